@@ -54,7 +54,10 @@ setup(name='SLUGPY',
                                 osp.join(bpc, 'kernel_density_neighbors.c'),
                                 osp.join(bpc, 'kernel_density_rep.c'),
                                 osp.join(bpc, 'kernel_density_util.c'),
-                                osp.join(bpc, 'kernel_density_draw.c')
+                                osp.join(bpc, 'kernel_density_draw.c'),
+                                osp.join(bpc, 'kernel_density_io.c'),
+                                osp.join(bpc, 'kernel_density_binned.c'),
+                                osp.join(bpc, 'kernel_density_mcmc.c')
                             ],
                                libraries=['gsl', 'gslcblas'])]
   )
@@ -8,7 +8,7 @@ __all__ = ["combine_cluster", "combine_integrated",
            "read_integrated", "read_integrated_phot", 
            "read_integrated_prop", "read_integrated_spec",
            "read_integrated_yield", "read_integrated_sn",
-           "read_summary", "slug_open", "slug_pdf",
+           "read_stats", "read_summary", "slug_open", "slug_pdf",
            "write_cluster", "write_integrated"]
 
 from .combine_cluster import combine_cluster
@@ -29,6 +29,7 @@ from .read_integrated_prop import read_integrated_prop
 from .read_integrated_spec import read_integrated_spec
 from .read_integrated_sn import read_integrated_sn
 from .read_integrated_yield import read_integrated_yield
+from .read_stats import read_stats
 from .read_summary import read_summary
 from .slug_open import slug_open
 from .slug_pdf import slug_pdf
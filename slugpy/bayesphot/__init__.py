@@ -1,4 +1,4 @@
 __version__ = '1.0'
-__all__ = ["bp"]
+__all__ = ["bp", "bp_rep"]
 
-from .bp import bp
+from .bp import bp, bp_rep
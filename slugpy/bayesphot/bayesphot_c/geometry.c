@@ -411,6 +411,40 @@ double box_min_dist2(const double *x1, const double *xbox2[2],
 
 
 
+double box_box_max_dist2(const double *xbox1[2], const double *xbox2[2],
+			 const double *scale, const unsigned long ndim) {
+  /* In each dimension, the most distant pair of points is the low
+     edge of one box and the high edge of the other */
+  unsigned long i;
+  double tmp, dist2 = 0.0;
+  for (i=0; i<ndim; i++) {
+    tmp = fmax(xbox1[1][i] - xbox2[0][i], xbox2[1][i] - xbox1[0][i]);
+    if (scale != NULL) tmp /= scale[i];
+    dist2 += tmp*tmp;
+  }
+  return(dist2);
+}
+
+
+
+double box_box_min_dist2(const double *xbox1[2], const double *xbox2[2],
+			 const double *scale, const unsigned long ndim) {
+  /* In each dimension, the closest pair of points is separated by
+     the gap between the boxes, or zero if they overlap */
+  unsigned long i;
+  double tmp, dist2 = 0.0;
+  for (i=0; i<ndim; i++) {
+    if (xbox1[1][i] < xbox2[0][i]) tmp = xbox2[0][i] - xbox1[1][i];
+    else if (xbox2[1][i] < xbox1[0][i]) tmp = xbox1[0][i] - xbox2[1][i];
+    else continue;
+    if (scale != NULL) tmp /= scale[i];
+    dist2 += tmp*tmp;
+  }
+  return(dist2);
+}
+
+
+
 double dist2(const double *x1, const double *x2, 
 	     const unsigned long ndim1, const unsigned long ndim2,
 	     const unsigned long *dim1, const unsigned long *dim2, 
@@ -302,6 +302,62 @@ double box_min_dist2(const double *x1, const double *xbox2[2],
 */
 
 
+double box_box_max_dist2(const double *xbox1[2], const double *xbox2[2],
+			 const double *scale, const unsigned long ndim);
+/* Returns the squared distance between the two most distant points
+   in a pair of closed boxes, using a scaled Euclidean metric. Unlike
+   the other routines in this module, both boxes must be closed and
+   span all ndim dimensions of the space.
+
+   Parameters:
+      INPUT xbox1
+         2D array of 2 x ndim elements giving positions of the corners
+         of box 1
+      INPUT xbox2
+         2D array of 2 x ndim elements giving positions of the corners
+         of box 2
+      INPUT scale
+         Array of ndim elements giving scale factors to describe
+         relative sizes of dimensions; if left as NULL, scale[i] = 1
+         for all dimensions
+      INPUT ndim
+         Number of dimensions in the space
+
+   Returns:
+      OUTPUT dist2
+         the squared distance between the farthest pair of points, one
+         in each box
+*/
+
+
+double box_box_min_dist2(const double *xbox1[2], const double *xbox2[2],
+			 const double *scale, const unsigned long ndim);
+/* Returns the squared distance between the two closest points in a
+   pair of closed boxes, using a scaled Euclidean metric; the distance
+   is zero if the boxes overlap. As for box_box_max_dist2, both boxes
+   must be closed and span all ndim dimensions of the space.
+
+   Parameters:
+      INPUT xbox1
+         2D array of 2 x ndim elements giving positions of the corners
+         of box 1
+      INPUT xbox2
+         2D array of 2 x ndim elements giving positions of the corners
+         of box 2
+      INPUT scale
+         Array of ndim elements giving scale factors to describe
+         relative sizes of dimensions; if left as NULL, scale[i] = 1
+         for all dimensions
+      INPUT ndim
+         Number of dimensions in the space
+
+   Returns:
+      OUTPUT dist2
+         the squared distance between the closest pair of points, one
+         in each box
+*/
+
+
 double dist2(const double *x1, const double *x2, 
 	     const unsigned long ndim1, const unsigned long ndim2,
 	     const unsigned long *dim1, const unsigned long *dim2, 
@@ -193,6 +193,54 @@ void xdata_alloc(unsigned long nnew, unsigned long *ncur, double **x,
 
 
 
+#ifdef KD_SOA
+/*********************************************************************/
+/* Routine to build the SoA copy of the leaf data                    */
+/*********************************************************************/
+void build_tree_soa(KDtree *tree) {
+
+  unsigned long nsoa = 0;
+  char *mem;
+
+  /* Assign each leaf its offset in the SoA array */
+  for (unsigned long i=1; i<=tree->nodes; i++) {
+    if (tree->tree[i].splitdim != -1 || tree->tree[i].npt == 0)
+      continue;
+    tree->tree[i].soaoff = nsoa;
+    nsoa += tree->ndim * KD_SOA_PAD(tree->tree[i].npt);
+  }
+
+  /* Allocate memory, and align it */
+  if (!(tree->xsoa_mem = malloc(nsoa*sizeof(kd_soa_real) + KD_SOA_ALIGN))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in build_tree\n");
+    exit(1);
+  }
+  mem = (char *) tree->xsoa_mem;
+  mem += (KD_SOA_ALIGN - ((size_t) mem) % KD_SOA_ALIGN) % KD_SOA_ALIGN;
+  tree->xsoa = (kd_soa_real *) mem;
+
+  /* Transpose the data in each leaf; padding elements are set to
+     zero, and are never used */
+#pragma omp parallel for
+  for (unsigned long i=1; i<=tree->nodes; i++) {
+    if (tree->tree[i].splitdim != -1 || tree->tree[i].npt == 0)
+      continue;
+    unsigned long npt = tree->tree[i].npt;
+    unsigned long npad = KD_SOA_PAD(npt);
+    kd_soa_real *xs = tree->xsoa + tree->tree[i].soaoff;
+    for (unsigned long j=0; j<tree->ndim; j++) {
+      for (unsigned long k=0; k<npt; k++)
+	xs[j*npad+k] = tree->tree[i].x[k*tree->ndim+j];
+      for (unsigned long k=npt; k<npad; k++) xs[j*npad+k] = 0.0;
+    }
+  }
+
+  /* From here on the positions are read from the SoA copy only */
+  for (unsigned long i=1; i<=tree->nodes; i++) tree->tree[i].x = NULL;
+}
+#endif
+
+
 /*********************************************************************/
 /* Routine to build the tree                                         */
 /*********************************************************************/
@@ -262,9 +310,12 @@ KDtree* build_tree(double *x, unsigned long ndim, unsigned long npt,
     for (unsigned long i=0; i<npt; i++) sortmap[i] = i;
   }
 
-  /* Initialize data in the root node */
+  /* Initialize data in the root node; it is a leaf unless it is
+     split below, which does not happen if the tree has one level */
   curnode = ROOT;
+  tree->tree[curnode].splitdim = -1;
   tree->tree[curnode].npt = npt;
+  tree->tree[curnode].off = 0;
   tree->tree[curnode].x = x;
   tree->tree[curnode].dptr = dptr;
 
@@ -319,8 +370,7 @@ KDtree* build_tree(double *x, unsigned long ndim, unsigned long npt,
 	   swap space if needed */
 	if (dsize > 0) dswap = malloc(dsize); else dswap = NULL;
 	partition_node(&(tree->tree[i]), tree->ndim, dswap, dsize,
-		       sortmap +
-		       (tree->tree[i].x - tree->tree[ROOT].x)/ndim);
+		       sortmap == NULL ? NULL : sortmap + tree->tree[i].off);
 	if (dsize > 0) free(dswap);	  
 	  
 	/* Set the bounding box on the child nodes */
@@ -344,6 +394,9 @@ KDtree* build_tree(double *x, unsigned long ndim, unsigned long npt,
 	/* Set counters and pointers for child nodes */
 	tree->tree[LEFT(i)].npt = (tree->tree[i].npt+1) / 2;
 	tree->tree[RIGHT(i)].npt = tree->tree[i].npt / 2;
+	tree->tree[LEFT(i)].off = tree->tree[i].off;
+	tree->tree[RIGHT(i)].off = tree->tree[i].off +
+	  tree->tree[LEFT(i)].npt;
 	tree->tree[LEFT(i)].x = tree->tree[i].x;
 	tree->tree[RIGHT(i)].x = tree->tree[i].x + 
 	  tree->tree[LEFT(i)].npt*tree->ndim;
@@ -395,6 +448,11 @@ KDtree* build_tree(double *x, unsigned long ndim, unsigned long npt,
       }
     }
   }
+
+#ifdef KD_SOA
+  /* Build the SoA copy of the leaves */
+  build_tree_soa(tree);
+#endif
   
   /* Return */
   return tree;
@@ -488,9 +546,12 @@ KDtree* build_tree_sortdims(double *x, unsigned long ndim,
   /* Initialize the sort map */
   if (sortmap) for (i=0; i<npt; i++) sortmap[i] = i;
 
-  /* Initialize data in the root node */
+  /* Initialize data in the root node; it is a leaf unless it is
+     split below, which does not happen if the tree has one level */
   curnode = ROOT;
+  tree->tree[curnode].splitdim = -1;
   tree->tree[curnode].npt = npt;
+  tree->tree[curnode].off = 0;
   tree->tree[curnode].x = x;
   tree->tree[curnode].dptr = dptr;
 
@@ -527,7 +588,7 @@ KDtree* build_tree_sortdims(double *x, unsigned long ndim,
       /* Figure out which dimension to split along */
       if (curnode != ROOT)
 	tree->tree[curnode].splitdim 
-	  = tree->tree[PARENT(curnode)].splitdim + 1;
+	  = (tree->tree[PARENT(curnode)].splitdim + 1) % ndim;
       else
 	tree->tree[curnode].splitdim = 0;
       while (nosort[tree->tree[curnode].splitdim])
@@ -536,7 +597,8 @@ KDtree* build_tree_sortdims(double *x, unsigned long ndim,
 
       /* Partition the points along the split dimension */
       partition_node(&(tree->tree[curnode]), tree->ndim, dswap, dsize,
-		     sortmap);
+		     sortmap == NULL ? NULL : sortmap +
+		     tree->tree[curnode].off);
 
       /* Set the bounding box on the child nodes */
       for (i=0; i<tree->ndim; i++) {
@@ -568,6 +630,9 @@ KDtree* build_tree_sortdims(double *x, unsigned long ndim,
       /* Set counters and pointers for child nodes */
       tree->tree[LEFT(curnode)].npt = (tree->tree[curnode].npt+1) / 2;
       tree->tree[RIGHT(curnode)].npt = tree->tree[curnode].npt / 2;
+      tree->tree[LEFT(curnode)].off = tree->tree[curnode].off;
+      tree->tree[RIGHT(curnode)].off = tree->tree[curnode].off +
+	tree->tree[LEFT(curnode)].npt;
       tree->tree[LEFT(curnode)].x = tree->tree[curnode].x;
       tree->tree[RIGHT(curnode)].x = tree->tree[curnode].x + 
 	tree->tree[LEFT(curnode)].npt*tree->ndim;
@@ -621,11 +686,210 @@ KDtree* build_tree_sortdims(double *x, unsigned long ndim,
   /* Free memory */
   if (dswap != NULL) free(dswap);
 
+#ifdef KD_SOA
+  /* Build the SoA copy of the leaves */
+  build_tree_soa(tree);
+#endif
+
   /* Return */
   return tree;
 }
 
 
+/*********************************************************************/
+/* Routine to insert points into an existing tree                    */
+/*********************************************************************/
+void insert_tree(KDtree *tree, double *xbuf, void *dbuf,
+		 const double *xnew, const void *dnew,
+		 const unsigned long nnew, unsigned long *perm,
+		 unsigned long *leaf) {
+
+  unsigned long i, j, k, curnode, nold, ndim, maxleaf;
+  unsigned long *leafnew, *count, *start, *order, *xoff;
+  void **dold;
+#ifdef KD_SOA
+  unsigned long *soaold;
+  const kd_soa_real *xsold;
+  void *xsold_mem;
+#else
+  const double *x0;
+#endif
+  size_t dsize;
+
+  /* Get some basic information */
+  ndim = tree->ndim;
+  nold = tree->tree[ROOT].npt;
+#ifdef KD_SOA
+  xsold = tree->xsoa;
+  xsold_mem = tree->xsoa_mem;
+#else
+  x0 = tree->tree[ROOT].x;
+#endif
+  dsize = dbuf == NULL ? 0 : tree->dsize;
+
+  /* Allocate memory; all per-node arrays are 1-offset */
+  if (leaf) leafnew = leaf;
+  else if (!(leafnew = (unsigned long *)
+	     calloc(nnew, sizeof(unsigned long)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in insert_tree\n");
+    exit(1);
+  }
+  if (!(count = (unsigned long *)
+	calloc(tree->nodes+1, sizeof(unsigned long))) ||
+      !(start = (unsigned long *)
+	calloc(tree->nodes+1, sizeof(unsigned long))) ||
+      !(xoff = (unsigned long *)
+	calloc(tree->nodes+1, sizeof(unsigned long))) ||
+      !(dold = (void **) calloc(tree->nodes+1, sizeof(void *))) ||
+#ifdef KD_SOA
+      !(soaold = (unsigned long *)
+	calloc(tree->nodes+1, sizeof(unsigned long))) ||
+#endif
+      !(order = (unsigned long *)
+	calloc(nnew > 0 ? nnew : 1, sizeof(unsigned long)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in insert_tree\n");
+    exit(1);
+  }
+
+  /* Send each new point down the tree to the leaf that contains it;
+     at each node we go left if the point is at or below the upper
+     edge of the left child's region along the split dimension */
+#pragma omp parallel for private(curnode)
+  for (unsigned long n=0; n<nnew; n++) {
+    curnode = ROOT;
+    while (tree->tree[curnode].splitdim != -1) {
+      int d = tree->tree[curnode].splitdim;
+      if (xnew[n*ndim+d] <= tree->tree[LEFT(curnode)].xlim[1][d])
+	curnode = LEFT(curnode);
+      else
+	curnode = RIGHT(curnode);
+    }
+    leafnew[n] = curnode;
+  }
+
+  /* Record where the points of each leaf currently are, before we
+     change anything */
+  for (i=1; i<=tree->nodes; i++) {
+    if (tree->tree[i].splitdim != -1 || tree->tree[i].npt == 0)
+      continue;
+    xoff[i] = tree->tree[i].off;
+    dold[i] = tree->tree[i].dptr;
+#ifdef KD_SOA
+    soaold[i] = tree->tree[i].soaoff;
+#endif
+  }
+
+  /* Walk back up from each leaf to the root, updating the number of
+     points and the bounding boxes of the nodes along the way; the
+     region limits are also enlarged if needed, so that later
+     insertions are still sent to the right place */
+  for (i=0; i<nnew; i++) {
+    const double *xpt = xnew + i*ndim;
+    count[leafnew[i]]++;
+    for (curnode=leafnew[i]; curnode != 0; curnode=PARENT(curnode)) {
+      KDnode *node = &(tree->tree[curnode]);
+      if (node->npt == 0) {
+	for (j=0; j<ndim; j++)
+	  node->xbnd[0][j] = node->xbnd[1][j] = xpt[j];
+      } else {
+	for (j=0; j<ndim; j++) {
+	  node->xbnd[0][j] = fmin(node->xbnd[0][j], xpt[j]);
+	  node->xbnd[1][j] = fmax(node->xbnd[1][j], xpt[j]);
+	}
+      }
+      for (j=0; j<ndim; j++) {
+	node->xlim[0][j] = fmin(node->xlim[0][j], xpt[j]);
+	node->xlim[1][j] = fmax(node->xlim[1][j], xpt[j]);
+      }
+      node->npt++;
+    }
+  }
+
+  /* Sort the new points by leaf; start[i] is the position in order
+     of the first new point that goes in leaf i */
+  for (i=1, k=0; i<=tree->nodes; i++) {
+    start[i] = k;
+    k += count[i];
+  }
+  for (i=0; i<nnew; i++) order[start[leafnew[i]]++] = i;
+  for (i=1; i<=tree->nodes; i++) start[i] -= count[i];
+
+  /* Assign the new data pointers; since every node's points are
+     contiguous, and the left child's points come before the right
+     child's, we can do this top-down from the root, with the index
+     order of the nodes guaranteeing that parents come before
+     children */
+  tree->tree[ROOT].off = 0;
+  tree->tree[ROOT].x = xbuf;
+  for (i=1; i<=tree->nodes; i++) {
+    if (tree->tree[i].npt == 0) continue;
+    if (dsize > 0)
+      tree->tree[i].dptr = ((char *) dbuf) + dsize * tree->tree[i].off;
+    else
+      tree->tree[i].dptr = NULL;
+    if (tree->tree[i].splitdim != -1) {
+      tree->tree[LEFT(i)].off = tree->tree[i].off;
+      tree->tree[RIGHT(i)].off = tree->tree[i].off +
+	tree->tree[LEFT(i)].npt;
+      tree->tree[LEFT(i)].x = tree->tree[i].x;
+      tree->tree[RIGHT(i)].x = tree->tree[i].x +
+	tree->tree[LEFT(i)].npt*ndim;
+    }
+  }
+
+  /* Copy data into the new buffers, one leaf at a time; each leaf
+     gets its old points followed by its new ones */
+  maxleaf = 0;
+#pragma omp parallel for reduction(max:maxleaf)
+  for (unsigned long n=1; n<=tree->nodes; n++) {
+    if (tree->tree[n].splitdim != -1 || tree->tree[n].npt == 0)
+      continue;
+    unsigned long off = tree->tree[n].off;
+    unsigned long nleafold = tree->tree[n].npt - count[n];
+#ifdef KD_SOA
+    /* Old points come from the old SoA copy, since the tree holds no
+       other copy of them */
+    unsigned long npadold = KD_SOA_PAD(nleafold);
+    for (unsigned long m=0; m<nleafold; m++)
+      for (unsigned long d=0; d<ndim; d++)
+	tree->tree[n].x[m*ndim+d] = xsold[soaold[n] + d*npadold + m];
+#else
+    memcpy(tree->tree[n].x, x0 + xoff[n]*ndim,
+	   nleafold*ndim*sizeof(double));
+#endif
+    if (dsize > 0)
+      memcpy(tree->tree[n].dptr, dold[n], nleafold*dsize);
+    for (unsigned long m=0; m<nleafold; m++) perm[off+m] = xoff[n]+m;
+    for (unsigned long m=0; m<count[n]; m++) {
+      unsigned long idx = order[start[n]+m];
+      memcpy(tree->tree[n].x + (nleafold+m)*ndim, xnew + idx*ndim,
+	     ndim*sizeof(double));
+      if (dsize > 0)
+	memcpy(((char *) tree->tree[n].dptr) + (nleafold+m)*dsize,
+	       ((const char *) dnew) + idx*dsize, dsize);
+      perm[off+nleafold+m] = nold + idx;
+    }
+    if (tree->tree[n].npt > maxleaf) maxleaf = tree->tree[n].npt;
+  }
+  if (maxleaf > tree->leafsize) tree->leafsize = maxleaf;
+
+#ifdef KD_SOA
+  /* Rebuild the SoA copy of the leaves, then free the old one */
+  build_tree_soa(tree);
+  free(xsold_mem);
+  free(soaold);
+#endif
+
+  /* Free memory */
+  if (!leaf) free(leafnew);
+  free(count);
+  free(start);
+  free(xoff);
+  free(dold);
+  free(order);
+}
+
+
 /*********************************************************************/
 /* Routine to free a tree                                            */
 /*********************************************************************/
@@ -639,266 +903,362 @@ void free_tree(KDtree *tree) {
   }
   tree->tree++; /* Undo offset by 1 */
   free(tree->tree);
+#ifdef KD_SOA
+  free(tree->xsoa_mem);
+#endif
   free(tree);
 }
 
 
 /*********************************************************************/
-/* Neighbor search routine                                           */
+/* Helper routines for neighbor searches. Searches keep the current  */
+/* list of candidate neighbors in a fixed-size max-heap ordered by   */
+/* squared distance, so the most distant candidate, which sets the   */
+/* pruning radius, is always at the top. The heap lives in the       */
+/* output arrays supplied by the caller, and the traversal stack     */
+/* holds at most one node per level of the tree, so a search needs    */
+/* no memory beyond a small fixed-size block on the stack.           */
 /*********************************************************************/
-void neighbors(const KDtree *tree, const double *xpt, 
-	       const unsigned long *dims, const unsigned long ndim, 
-	       const unsigned long nneighbor,
-	       const double *scale, double *pos,
-	       void *dptr, double *d2) {
-  unsigned long i, j, k;
-  unsigned long curnode, ptr;
-  double r2;
-
-  /* Initialize all distances to something big */
-  for (i=0; i<nneighbor; i++) d2[i] = DBL_MAX;
-
-  /* Now begin to search the tree */
-  curnode = ROOT;
-  while (1) {
-
-    /* See if any part of this node is within a distance less than the
-       current maximum distance from the search point; if not, got to
-       next node; side CS subtlety: the typecast in the next line is
-       needed to avoid compiler warnings; see 
-       http://c-faq.com/ansi/constmismatch.html */
-    r2 = box_min_dist2(xpt, (const double **) tree->tree[curnode].xbnd, 
-		       ndim, tree->ndim, dims, NULL, scale, ndim);
-
-    if (r2 > d2[nneighbor-1]) {
-      SETNEXT(curnode);
-      if (curnode==ROOT) break;
-      continue;
-    }
 
-    /* If we're here, we need to investigate this node. If this node
-       is not a leaf, just go to its left child. */
-    if (tree->tree[curnode].splitdim != -1) {
-      curnode = LEFT(curnode);
-      continue;
-    }
+/* Maximum depth of a KD tree; node indices are unsigned longs, so no
+   tree can be deeper than this */
+#define KD_MAXDEPTH (8*sizeof(unsigned long))
 
-    /* If we're here, we have found a leaf that we need to
-       investigate, so check each of the points it contains */
-    for (i=0; i<tree->tree[curnode].npt; i++) {
+/* Number of neighbors for which neighbors() can keep its index list
+   on the stack rather than allocating it */
+#define KD_NEIGHBOR_STACKBUF 256
 
-      /* Is this point more distant than the most distant of the
-	 current neighbors? If so, continue to next point. */
-      r2 = dist2(xpt, &(tree->tree[curnode].x[tree->ndim*i]), ndim,
-		 tree->ndim, dims, NULL, scale, tree->ndim);
-      if (r2  > d2[nneighbor-1]) continue;
-
-      /* If we're here, we've found a point in this leaf that is
-	 closer than them most distant of our current
-	 neighbors. Figure out where in the current neighbor list to
-	 insert it. */
-      ptr = 0;
-      while (d2[ptr] < r2) ptr++;
-
-      /* Move the rest of the current neighbor list back one space */
-      for (j=nneighbor-1; j>ptr; j--) {
-	for (k=0; k<tree->ndim; k++)
-	  pos[tree->ndim*j+k] = pos[tree->ndim*(j-1)+k];
-	d2[j] = d2[j-1];
-	if (tree->dsize > 0) {
-	  memcpy(((char *) dptr) + tree->dsize*j,
-		 ((char *) dptr) + tree->dsize*(j-1),
-		 tree->dsize);
-	}
-      }
+/* Number of dimensions for which neighbors_point() can keep the
+   coordinates of its search point on the stack */
+#define KD_POINT_STACKBUF 32
 
-      /* Insert the point we just found into the neighbor list */
-      for (k=0; k<tree->ndim; k++)
-	pos[tree->ndim*ptr+k] = tree->tree[curnode].x[tree->ndim*i+k];
-      d2[ptr] = r2;
-      if (tree->dsize > 0) {
-	memcpy(((char *) dptr) + tree->dsize*ptr,
-	       ((char *) tree->tree[curnode].dptr) + tree->dsize*i,
-	       tree->dsize);
-      }
-    }
+static inline
+void knn_sift_down(double *hd2, unsigned long *hidx,
+		   const unsigned long n, unsigned long i) {
+  unsigned long c, id = hidx[i];
+  double d = hd2[i];
+  while ((c = 2*i+1) < n) {
+    if (c+1 < n && hd2[c+1] > hd2[c]) c++;
+    if (hd2[c] <= d) break;
+    hd2[i] = hd2[c];
+    hidx[i] = hidx[c];
+    i = c;
+  }
+  hd2[i] = d;
+  hidx[i] = id;
+}
 
-    /* We're done with this leaf, so go on to next one */
-    SETNEXT(curnode);
-    if (curnode==ROOT) break;
+static inline
+void knn_sift_up(double *hd2, unsigned long *hidx, unsigned long i) {
+  unsigned long p, id = hidx[i];
+  double d = hd2[i];
+  while (i > 0) {
+    p = (i-1)/2;
+    if (hd2[p] >= d) break;
+    hd2[i] = hd2[p];
+    hidx[i] = hidx[p];
+    i = p;
   }
+  hd2[i] = d;
+  hidx[i] = id;
 }
 
+/* Offer a point to a heap holding nfound of at most nneighbor
+   candidates; returns the new pruning radius, which is the distance
+   to the farthest candidate once the heap is full */
+static inline
+double knn_add(double *hd2, unsigned long *hidx,
+	       const unsigned long nneighbor, unsigned long *nfound,
+	       const double r2, const unsigned long id) {
+  if (*nfound < nneighbor) {
+    /* Heap not yet full, so add this point */
+    hd2[*nfound] = r2;
+    hidx[*nfound] = id;
+    knn_sift_up(hd2, hidx, *nfound);
+    (*nfound)++;
+  } else if (r2 < hd2[0]) {
+    /* Closer than the farthest candidate, so replace it */
+    hd2[0] = r2;
+    hidx[0] = id;
+    knn_sift_down(hd2, hidx, nneighbor, 0);
+  }
+  return *nfound < nneighbor ? DBL_MAX : hd2[0];
+}
 
-/*********************************************************************/
-/* Neighbor search routine for all points in the tree                */
-/*********************************************************************/
-void neighbors_all(const KDtree *tree, const unsigned long nneighbor,
-		   const double *scale, unsigned long *idx, 
-		   double *d2) {
-  /* This routine is much like neighbors_point, but takes advantage of
-     some efficiencies that arise when we know we need to find the
-     nearest neighbors of every point. */
-  unsigned long curnode = ROOT;
-  unsigned long npt = tree->tree[ROOT].npt;
-  unsigned long i, k;
-  unsigned long j, offset, idxtmp, ptr;
-  unsigned long *homenode;
-  double r2, *xpt;
-
-  /* Allocate temporary storage */
-  if (!(homenode = calloc(npt, sizeof(unsigned long)))) {
-    fprintf(stderr, "bayesphot error: unable to allocate memory in neighbors_all\n");
-    exit(1);
+/* Squared distance from the search point to a tree point, computed
+   in the same way as dist2, but abandoning the sum once it exceeds
+   dmax, since the point cannot then be a neighbor */
+static inline
+double knn_dist2(const double *xpt, const double *x,
+		 const unsigned long *dims, const unsigned long ndim,
+		 const double *scale, const double dmax) {
+  unsigned long j, k;
+  double tmp, d = 0.0;
+  for (k=0; k<ndim; k++) {
+    j = dims ? dims[k] : k;
+    tmp = scale ? (xpt[k] - x[j]) / scale[j] : xpt[k] - x[j];
+    d += tmp*tmp;
+    if (d > dmax) break;
   }
+  return d;
+}
 
-  /* Initialize the distance list */
-  for (i=0; i<npt*nneighbor; i++) d2[i] = DBL_MAX;
+/* As knn_dist2, for point i of a leaf */
+static inline
+double knn_leaf_dist2(const KDtree *tree, const unsigned long leaf,
+		      const unsigned long i, const double *xpt,
+		      const unsigned long *dims, const unsigned long ndim,
+		      const double *scale, const double dmax) {
+#ifdef KD_SOA
+  const unsigned long npad = KD_SOA_PAD(tree->tree[leaf].npt);
+  const kd_soa_real *xs = tree->xsoa + tree->tree[leaf].soaoff + i;
+  unsigned long j, k;
+  double tmp, d = 0.0;
+  for (k=0; k<ndim; k++) {
+    j = dims ? dims[k] : k;
+    tmp = scale ? (xpt[k] - xs[j*npad]) / scale[j] : xpt[k] - xs[j*npad];
+    d += tmp*tmp;
+    if (d > dmax) break;
+  }
+  return d;
+#else
+  return knn_dist2(xpt, tree->tree[leaf].x + i*tree->ndim, dims, ndim,
+		   scale, dmax);
+#endif
+}
 
-  /* Traverse the entire tree down to its leaves */
-  while (1) {
+/* Squared distance from the search point to the nearest point of a
+   node's bounding box, computed in the same way as box_min_dist2,
+   and likewise abandoned once it exceeds dmax */
+static inline
+double knn_box_dist2(const double *xpt, double *const xbnd[2],
+		     const unsigned long *dims, const unsigned long ndim,
+		     const double *scale, const double dmax) {
+  unsigned long j, k;
+  double tmp, d = 0.0;
+  for (k=0; k<ndim; k++) {
+    j = dims ? dims[k] : k;
+    if (xpt[k] < xbnd[0][j]) tmp = xpt[k] - xbnd[0][j];
+    else if (xpt[k] > xbnd[1][j]) tmp = xpt[k] - xbnd[1][j];
+    else continue;
+    if (scale) tmp /= scale[j];
+    d += tmp*tmp;
+    if (d > dmax) break;
+  }
+  return d;
+}
 
-    /* If we're not a leaf, just go left */
-    if (tree->tree[curnode].splitdim != -1) {
-      curnode = LEFT(curnode);
-      continue;
+/* Core search routine: finds the nneighbor points closest to xpt. On
+   entry idx
+   and d2 hold a heap of nfound candidates, which may be empty. If
+   home is 0 the search starts from the root. Otherwise home is a leaf
+   whose points have already been offered to the heap, and the search
+   works upward from it, visiting the sibling of each of its ancestors
+   in turn; since these are ordered from nearest to farthest from a
+   point in the home leaf, the heap tightens as quickly as possible.
+   On return idx and d2 hold the indices (positions in the tree) and
+   squared distances of the neighbors found, sorted from nearest to
+   farthest, and unused entries of d2 are set to DBL_MAX. The return
+   value is the number of neighbors found. */
+static
+unsigned long knn_search(const KDtree *tree, const double *xpt,
+			 const unsigned long *dims,
+			 const unsigned long ndim,
+			 const unsigned long nneighbor,
+			 const double *scale,
+			 const unsigned long home,
+			 unsigned long nfound,
+			 unsigned long *idx, double *d2) {
+  unsigned long stack[KD_MAXDEPTH];
+  double stackd2[KD_MAXDEPTH];
+  unsigned long i, k, nstack, curnode, near, far, tmp;
+  double dmax, dnear, dfar, r2;
+
+  /* Start from the heap we were given, and either the root or the
+     siblings of the home leaf's ancestors; the latter are stacked so
+     that the deepest is taken first */
+  dmax = nfound < nneighbor ? DBL_MAX : d2[0];
+  if (home == 0) {
+    stack[0] = ROOT;
+    stackd2[0] = 0.0;
+    nstack = 1;
+  } else {
+    nstack = 0;
+    for (curnode=home; curnode!=ROOT; curnode=PARENT(curnode)) {
+      near = SIBLING(curnode);
+      if (tree->tree[near].npt == 0) continue;
+      dnear = knn_box_dist2(xpt, tree->tree[near].xbnd, dims, ndim,
+			    scale, dmax);
+      if (dnear > dmax) continue;
+      stack[nstack] = near;
+      stackd2[nstack] = dnear;
+      nstack++;
     }
+    for (i=0; i<nstack/2; i++) {
+      tmp = stack[i];
+      stack[i] = stack[nstack-1-i];
+      stack[nstack-1-i] = tmp;
+      r2 = stackd2[i];
+      stackd2[i] = stackd2[nstack-1-i];
+      stackd2[nstack-1-i] = r2;
+    }
+  }
 
-    /* We are a leaf, so get the pairwise distance between each pair
-       of points in this leaf */
-    offset = nneighbor * (tree->tree[curnode].x - tree->tree[ROOT].x) / 
-      tree->ndim;
-    for (i=0; i<tree->tree[curnode].npt; i++) {
-      homenode[offset/nneighbor+i] = curnode;
-      for (j=i+1; j<tree->tree[curnode].npt; j++) {
-
-	/* Get distance between point pair */
-	r2 = dist2(&(tree->tree[curnode].x[tree->ndim*i]),
-		   &(tree->tree[curnode].x[tree->ndim*j]), 
-		   tree->ndim, tree->ndim, NULL, NULL, scale, 
-		   tree->ndim);
-
-	/* If distance is smaller than largest distance for first
-	   point, store this point */
-	if (r2  < d2[offset+i*nneighbor + nneighbor-1]) {	
-
-	  /* Figure out where to insert this point */
-	  ptr = 0;
-	  while (d2[offset+i*nneighbor+ptr] < r2) ptr++;
-
-	  /* Move the rest of the current neighbor list back one space */
-	  for (k=nneighbor-1; k>ptr; k--) {
-	    idx[offset+i*nneighbor+k] = idx[offset+i*nneighbor+k-1];
-	    d2[offset+i*nneighbor+k] = d2[offset+i*nneighbor+k-1];
-	  }
-
-	  /* Insert the point we just found into the neighbor list */
-	  idx[offset+i*nneighbor+ptr] = offset / nneighbor + j;
-	  d2[offset+i*nneighbor+ptr] = r2;
-	}
-
-	/* Same as previous block, but for the second point; this
-	   just amounts to swapping the i's and j's */
-	if (r2  < d2[offset+j*nneighbor + nneighbor-1]) {	
-	  ptr = 0;
-	  while (d2[offset+j*nneighbor+ptr] < r2) ptr++;
-	  for (k=nneighbor-1; k>ptr; k--) {
-	    idx[offset+j*nneighbor+k] = idx[offset+j*nneighbor+k-1];
-	    d2[offset+j*nneighbor+k] = d2[offset+j*nneighbor+k-1];
-	  }
-	  idx[offset+j*nneighbor+ptr] = offset / nneighbor + i;
-	  d2[offset+j*nneighbor+ptr] = r2;
-	}
+  while (nstack > 0) {
+
+    /* Pop the next node; skip it if the heap has filled with points
+       closer than any part of it since it was pushed */
+    nstack--;
+    curnode = stack[nstack];
+    if (stackd2[nstack] > dmax) continue;
+
+    /* Descend to a leaf, always taking the nearer child first and
+       saving the farther one for later if it could hold a neighbor */
+    while (curnode != 0 && tree->tree[curnode].splitdim != -1) {
+      near = LEFT(curnode);
+      far = RIGHT(curnode);
+      dnear = tree->tree[near].npt == 0 ? DBL_MAX :
+	knn_box_dist2(xpt, tree->tree[near].xbnd, dims, ndim, scale,
+		      dmax);
+      dfar = tree->tree[far].npt == 0 ? DBL_MAX :
+	knn_box_dist2(xpt, tree->tree[far].xbnd, dims, ndim, scale,
+		      dmax);
+      if (dfar < dnear) {
+	tmp = near; near = far; far = tmp;
+	r2 = dnear; dnear = dfar; dfar = r2;
+      }
+      if (dfar <= dmax && tree->tree[far].npt > 0) {
+	stack[nstack] = far;
+	stackd2[nstack] = dfar;
+	nstack++;
       }
+      if (dnear > dmax || tree->tree[near].npt == 0) curnode = 0;
+      else curnode = near;
     }
+    if (curnode == 0) continue;
 
-    /* We're done with this leaf, so move to next node */
-    SETNEXT(curnode);
-    if (curnode==ROOT) break;
+    /* Check each of the points in this leaf */
+    for (i=0; i<tree->tree[curnode].npt; i++) {
+      r2 = knn_leaf_dist2(tree, curnode, i, xpt, dims, ndim, scale, dmax);
+      if (r2 < dmax)
+	dmax = knn_add(d2, idx, nneighbor, &nfound, r2,
+		       tree->tree[curnode].off + i);
+    }
   }
 
-  /* Now loop over all points, doing a depth-wise search of the tree
-     for each. */
-  for (k=0; k<npt; k++) {
-
-    /* Initialize for this point */
-    xpt = tree->tree[ROOT].x + k*tree->ndim;
-    offset = k*nneighbor;
-    curnode = ROOT;
+  /* Sort the heap in place from nearest to farthest, and flag any
+     entries we could not fill */
+  for (k=nfound; k>1; k--) {
+    r2 = d2[0]; d2[0] = d2[k-1]; d2[k-1] = r2;
+    tmp = idx[0]; idx[0] = idx[k-1]; idx[k-1] = tmp;
+    knn_sift_down(d2, idx, k-1, 0);
+  }
+  for (k=nfound; k<nneighbor; k++) d2[k] = DBL_MAX;
+  return nfound;
+}
 
-    while (1) {
 
-      /* See if any part of this node is within a distance less than the
-	 current maximum distance from the search point */
-      r2 = box_min_dist2(xpt, (const double **) tree->tree[curnode].xbnd, 
-			 tree->ndim, tree->ndim, NULL, NULL, scale, 
-			 tree->ndim);
+/*********************************************************************/
+/* Neighbor search routine                                           */
+/*********************************************************************/
+void neighbors(const KDtree *tree, const double *xpt, 
+	       const unsigned long *dims, const unsigned long ndim, 
+	       const unsigned long nneighbor,
+	       const double *scale, double *pos,
+	       void *dptr, double *d2) {
+  unsigned long i, j, nfound;
+  unsigned long idxbuf[KD_NEIGHBOR_STACKBUF], *idx;
+
+  /* Use the index buffer on the stack if it is big enough */
+  if (nneighbor <= KD_NEIGHBOR_STACKBUF) {
+    idx = idxbuf;
+  } else if (!(idx = (unsigned long *)
+	       calloc(nneighbor, sizeof(unsigned long)))) {
+    fprintf(stderr, "bayesphot error: unable to allocate memory in neighbors\n");
+    exit(1);
+  }
 
-      if (r2 > d2[offset+nneighbor-1]) {
-	SETNEXT(curnode);
-	if (curnode==ROOT) break;
-	continue;
-      }
+  /* Do the search */
+  nfound = knn_search(tree, xpt, dims, ndim, nneighbor, scale,
+		      0, 0, idx, d2);
+
+  /* Copy out the positions and extra data of the points found */
+  for (i=0; i<nfound; i++) {
+    for (j=0; j<tree->ndim; j++)
+      pos[tree->ndim*i+j] = kd_coord(tree, ROOT, idx[i], j);
+    if (tree->dsize > 0)
+      memcpy(((char *) dptr) + tree->dsize*i,
+	     ((char *) tree->tree[ROOT].dptr) + tree->dsize*idx[i],
+	     tree->dsize);
+  }
 
-      /* If we're here, we need to investigate this node. If this node
-	 is not a leaf, just go to its left child. */
-      if (tree->tree[curnode].splitdim != -1) {
-	curnode = LEFT(curnode);
-	continue;
-      }
+  /* Free memory if we allocated it */
+  if (idx != idxbuf) free(idx);
+}
 
-      /* Is this leaf the home leaf? If so, we've already checked it, so
-	 move on. */
-      if (curnode == homenode[k]) {
-	SETNEXT(curnode);
-	if (curnode==ROOT) break;
-	continue;
-      }
 
-      /* If we're here, we have found a leaf that we need to
-	 investigate, so check each of the points it contains */
-      for (i=0; i<tree->tree[curnode].npt; i++) {
+/*********************************************************************/
+/* Neighbor search routine for all points in the tree                */
+/*********************************************************************/
+void neighbors_all(const KDtree *tree, const unsigned long nneighbor,
+		   const double *scale, unsigned long *idx, 
+		   double *d2) {
+  unsigned long curnode;
+  for (curnode=ROOT; curnode<=tree->nodes; curnode++) {
+    if (tree->tree[curnode].splitdim != -1) continue;
+    neighbors_leaf(tree, curnode, nneighbor, scale, idx, d2);
+  }
+}
 
-	/* Skip the input point itself */
-	if (xpt == &(tree->tree[curnode].x[tree->ndim*i])) continue;
-
-	/* Is this point more distant than the most distant of the
-	   current neighbors? If so, continue to next point. */
-	r2 = dist2(xpt, &(tree->tree[curnode].x[tree->ndim*i]), tree->ndim,
-		   tree->ndim, NULL, NULL, scale, tree->ndim);
-	if (r2  > d2[offset+nneighbor-1]) continue;
-
-	/* If we're here, we've found a point in this leaf that is
-	   closer than the most distant of our current neighbors. Figure
-	   out where in the current neighbor list to insert it. */
-	ptr = 0;
-	while (d2[offset+ptr] < r2) ptr++;
-
-	/* Is this point already in the list? If so, skip it. */
-	idxtmp = (&(tree->tree[curnode].x[tree->ndim*i]) -
-		  &(tree->tree[ROOT].x[0])) / tree->ndim;
-	if (idx[offset+ptr] == idxtmp) continue;
-
-	/* If we're here, we found a new point, so move the list back to
-	   accomodate it */
-	for (j=nneighbor-1; j>ptr; j--) {
-	  idx[offset+j] = idx[offset+j-1];
-	  d2[offset+j] = d2[offset+j-1];
-	}
 
-	/* Insert the point we just found into the neighbor list */
-	idx[offset+ptr] = idxtmp;
-	d2[offset+ptr] = r2;
-      }
+/*********************************************************************/
+/* Neighbor search routine for all points in a leaf                  */
+/*********************************************************************/
+void neighbors_leaf(const KDtree *tree, const unsigned long leaf,
+		    const unsigned long nneighbor,
+		    const double *scale, unsigned long *idx, 
+		    double *d2) {
+  unsigned long i, j, npt, offset, *nfound;
+  const double *xi;
+  double r2, *xbuf;
+
+  /* Nothing to do for empty nodes */
+  npt = tree->tree[leaf].npt;
+  if (npt == 0) return;
+  offset = tree->tree[leaf].off;
+
+  /* Allocate the heap counters, and space for one point */
+  if (!(nfound = (unsigned long *) calloc(npt, sizeof(unsigned long))) ||
+      !(xbuf = (double *) calloc(tree->ndim, sizeof(double)))) {
+    fprintf(stderr, "bayesphot error: unable to allocate memory in neighbors_leaf\n");
+    exit(1);
+  }
 
-      /* We're done with this leaf, so go on to next one */
-      SETNEXT(curnode);
-      if (curnode==ROOT) break;
+  /* Seed the heap of every point in the leaf with the other points in
+     the leaf; each pairwise distance is computed once and offered to
+     both points */
+  for (i=0; i<npt; i++) {
+    xi = kd_point(tree, leaf, i, xbuf);
+    for (j=i+1; j<npt; j++) {
+      r2 = knn_leaf_dist2(tree, leaf, j, xi, NULL, tree->ndim, scale,
+			  DBL_MAX);
+      knn_add(d2+(offset+i)*nneighbor, idx+(offset+i)*nneighbor,
+	      nneighbor, nfound+i, r2, offset+j);
+      knn_add(d2+(offset+j)*nneighbor, idx+(offset+j)*nneighbor,
+	      nneighbor, nfound+j, r2, offset+i);
     }
   }
 
+  /* Now search the rest of the tree for each point, starting from the
+     seeded heaps and working outward from this leaf */
+  for (i=0; i<npt; i++)
+    knn_search(tree, kd_point(tree, leaf, i, xbuf), NULL, tree->ndim,
+	       nneighbor, scale, leaf, nfound[i],
+	       idx+(offset+i)*nneighbor, d2+(offset+i)*nneighbor);
+
   /* Free memory */
-  free(homenode);
+  free(nfound);
+  free(xbuf);
 }
 
 
@@ -909,151 +1269,49 @@ void neighbors_point(const KDtree *tree, const unsigned long idxpt,
 		     const unsigned long nneighbor,
 		     const double *scale, unsigned long *idx, 
 		     double *d2) {
-
-  /* This routine does essentially the same thing as neighbors, but
-     with the added step that we initialize the distances using the
-     points in the same leaf as the input point. This significantly
-     reduces worst-case search time. */
-  unsigned long curnode = ROOT;
-  unsigned long spdim = tree->tree[ROOT].splitdim;
-  unsigned long i, j, idxtmp, homenode, ptr;
-  double *xpt = &(tree->tree[ROOT].x[tree->ndim*idxpt]);
-  double r2;
-
-  /* Initialize the distance list */
-  for (i=0; i<nneighbor; i++) d2[i] = DBL_MAX;
-
-  /* Traverse the tree down to the leaf of this point */
-  while (spdim != -1) {
-    if (tree->tree[LEFT(curnode)].xbnd[1][spdim] >= xpt[spdim])
-      curnode = LEFT(curnode);
-    else
-      curnode = RIGHT(curnode);
-    spdim = tree->tree[curnode].splitdim;
+  unsigned long i, ipt, home, nfound = 0;
+  const double *xpt;
+  double r2, dmax = DBL_MAX;
+  double xstack[KD_POINT_STACKBUF], *xbuf;
+
+  /* Use the point buffer on the stack if it is big enough */
+  if (tree->ndim <= KD_POINT_STACKBUF) {
+    xbuf = xstack;
+  } else if (!(xbuf = (double *) calloc(tree->ndim, sizeof(double)))) {
+    fprintf(stderr, "bayesphot error: unable to allocate memory in neighbors_point\n");
+    exit(1);
   }
-  homenode = curnode;
-
-  /* Now traverse the tree breadth-wise, starting at the home node and
-     moving left, stopping once we have good initial guesses for every
-     one of the requested neighbors */
-  while (d2[nneighbor-1] == DBL_MAX) {
-
-    /* Search this leaf */
-    for (i=0; i<tree->tree[curnode].npt; i++) {
-
-      /* Skip the input point itself */
-      if (xpt == &(tree->tree[curnode].x[tree->ndim*i])) continue;
-
-      /* Is this point more distant than the most distant of the
-	 current neighbors? If so, continue to next point. */
-      r2 = dist2(xpt, &(tree->tree[curnode].x[tree->ndim*i]), tree->ndim, 
-		 tree->ndim, NULL, NULL, scale, tree->ndim);
-      if (r2  > d2[nneighbor-1]) continue;
-
-      /* If we're here, we've found a point in this leaf that is
-	 closer than the most distant of our current neighbors. Figure
-	 out where in the current neighbor list to insert it. */
-      ptr = 0;
-      while (d2[ptr] < r2) ptr++;
-
-      /* Move the rest of the current neighbor list back one space */
-      for (j=nneighbor-1; j>ptr; j--) {
-	idx[j] = idx[j-1];
-	d2[j] = d2[j-1];
-      }
-
-      /* Insert the point we just found into the neighbor list; note
-	 that we construct the index offset in the original data set by
-	 taking the memory offset and dividing by the number of
-	 dimensions. */
-      idx[ptr] = (&(tree->tree[curnode].x[tree->ndim*i]) -
-		  &(tree->tree[ROOT].x[0])) / tree->ndim;
-      d2[ptr] = r2;
-    }
-
-    /* If curnode is a power of 2, it's a leftmost node at its level,
-       so stop searching and break; otherwise move left. */
-    if ((curnode & (curnode-1)) == 0) break;
-    curnode--;
 
+  /* Find the leaf that holds the point, and its position there;
+     every node owns a contiguous range of points, so this needs only
+     the point counts */
+  ipt = idxpt;
+  home = kd_leaf_of(tree, ROOT, &ipt);
+  xpt = kd_point(tree, home, ipt, xbuf);
+
+  /* Seed the heap with the other points in that leaf, so that the
+     search of the rest of the tree starts with a tight radius */
+  for (i=0; i<tree->tree[home].npt; i++) {
+    if (i == ipt) continue;
+    r2 = knn_leaf_dist2(tree, home, i, xpt, NULL, tree->ndim, scale,
+			dmax);
+    if (r2 < dmax)
+      dmax = knn_add(d2, idx, nneighbor, &nfound, r2,
+		     tree->tree[home].off + i);
   }
 
-  /* Now do a depth-wise search of the tree, starting at ROOT */
-  curnode = ROOT;
-  while (1) {
+  /* Search the rest of the tree, working outward from the leaf */
+  knn_search(tree, xpt, NULL, tree->ndim, nneighbor, scale,
+	     home, nfound, idx, d2);
 
-    /* See if any part of this node is within a distance less than the
-       current maximum distance from the search point; if not, got to
-       next node; side CS subtlety: the typecast in the next line is
-       needed to avoid compiler warnings; see 
-       http://c-faq.com/ansi/constmismatch.html */
-    r2 = box_min_dist2(xpt, (const double **) tree->tree[curnode].xbnd, 
-		       tree->ndim, tree->ndim, NULL, NULL, scale, 
-		       tree->ndim);
-
-    if (r2 > d2[nneighbor-1]) {
-      SETNEXT(curnode);
-      if (curnode==ROOT) break;
-      continue;
-    }
-
-    /* If we're here, we need to investigate this node. If this node
-       is not a leaf, just go to its left child. */
-    if (tree->tree[curnode].splitdim != -1) {
-      curnode = LEFT(curnode);
-      continue;
-    }
-
-    /* Is this leaf the home leaf? If so, we've already checked it, so
-       move on. */
-    if (curnode == homenode) {
-      SETNEXT(curnode);
-      if (curnode==ROOT) break;
-      continue;
-    }
-
-    /* If we're here, we have found a leaf that we need to
-       investigate, so check each of the points it contains */
-    for (i=0; i<tree->tree[curnode].npt; i++) {
-
-      /* Skip the input point itself */
-      if (xpt == &(tree->tree[curnode].x[tree->ndim*i])) continue;
-
-      /* Is this point more distant than the most distant of the
-	 current neighbors? If so, continue to next point. */
-      r2 = dist2(xpt, &(tree->tree[curnode].x[tree->ndim*i]), tree->ndim,
-		 tree->ndim, NULL, NULL, scale, tree->ndim);
-      if (r2  > d2[nneighbor-1]) continue;
-
-      /* If we're here, we've found a point in this leaf that is
-	 closer than the most distant of our current neighbors. Figure
-	 out where in the current neighbor list to insert it. */
-      ptr = 0;
-      while (d2[ptr] < r2) ptr++;
-
-      /* Is this point already in the list? If so, skip it. */
-      idxtmp = (&(tree->tree[curnode].x[tree->ndim*i]) -
-		&(tree->tree[ROOT].x[0])) / tree->ndim;
-      if (idx[ptr] == idxtmp) continue;
-
-      /* If we're here, we found a new point, so move the list back to
-	 accomodate it */
-      for (j=nneighbor-1; j>ptr; j--) {
-	idx[j] = idx[j-1];
-	d2[j] = d2[j-1];
-      }
-
-      /* Insert the point we just found into the neighbor list */
-      idx[ptr] = idxtmp;
-      d2[ptr] = r2;
-    }
-
-    /* We're done with this leaf, so go on to next one */
-    SETNEXT(curnode);
-    if (curnode==ROOT) break;
-  }
+  /* Free memory if we allocated it */
+  if (xbuf != xstack) free(xbuf);
 }
 
+#undef KD_MAXDEPTH
+#undef KD_NEIGHBOR_STACKBUF
+#undef KD_POINT_STACKBUF
+
 
 
 
@@ -1068,11 +1326,13 @@ unsigned long query_box(const KDtree *tree, const double *xbox[2],
   unsigned long npt = 0, nalloc = 0;
   unsigned long curnode = ROOT;
   char *dptr1, *dptr2;
-  double *xcen;
+  double *xcen, *xbuf;
+  const double *xi;
   bool contained;
 
   /* Allocate temporary space and store box center in it */
-  if (!(xcen = (double *) calloc(tree->ndim, sizeof(double)))) {
+  if (!(xcen = (double *) calloc(tree->ndim, sizeof(double))) ||
+      !(xbuf = (double *) calloc(tree->ndim, sizeof(double)))) {
     fprintf(stderr, "bayesphot: error: unable to allocate memory in query_box\n");
     exit(1);
   }
@@ -1106,12 +1366,9 @@ unsigned long query_box(const KDtree *tree, const double *xbox[2],
 
       /* Store data */
       for (i=0; i<tree->tree[curnode].npt; i++) {
-	for (j=0; j<tree->ndim; j++) {
-	  (*x)[(ptr+i)*tree->ndim + j] = 
-	    tree->tree[curnode].x[tree->ndim*i+j];
-	}
-	(*d2)[ptr+1] = dist2(&(tree->tree[curnode].x[tree->ndim*i+j]),
-			     xcen, tree->ndim, ndim, NULL, dim,
+	xi = kd_point(tree, curnode, i, xbuf);
+	memcpy(*x + (ptr+i)*tree->ndim, xi, tree->ndim*sizeof(double));
+	(*d2)[ptr+i] = dist2(xi, xcen, tree->ndim, ndim, NULL, dim,
 			     scale, tree->ndim);
 	if (tree->dsize > 0) {
 	  dptr1 = (char *) (*dptr) + tree->dsize*(ptr+i);
@@ -1142,12 +1399,11 @@ unsigned long query_box(const KDtree *tree, const double *xbox[2],
       for (i=0; i<tree->tree[curnode].npt; i++) {
 
 	/* Is this point in the search region? */
+	xi = kd_point(tree, curnode, i, xbuf);
 	contained = true;
 	for (j=0; j<ndim; j++) {
-	  contained = contained &&
-	    (tree->tree[curnode].x[tree->ndim*i + dim[j]] > xbox[0][j]);
-	  contained = contained &&
-	    (tree->tree[curnode].x[tree->ndim*i + dim[j]] < xbox[1][j]);
+	  contained = contained && (xi[dim[j]] > xbox[0][j]);
+	  contained = contained && (xi[dim[j]] < xbox[1][j]);
 	}
 	if (!contained) continue;
 
@@ -1156,12 +1412,8 @@ unsigned long query_box(const KDtree *tree, const double *xbox[2],
 	npt++;
 	xdata_alloc(npt, &nalloc, x, dptr, d2, tree->ndim, 
 		    tree->dsize, false);
-	for (j=0; j<tree->ndim; j++) {
-	  (*x)[ptr*tree->ndim + j] = 
-	    tree->tree[curnode].x[tree->ndim*i+j];
-	}
-	(*d2)[ptr] = dist2(&(tree->tree[curnode].x[tree->ndim*i+j]),
-			   xcen, tree->ndim, ndim, NULL, dim,
+	memcpy(*x + ptr*tree->ndim, xi, tree->ndim*sizeof(double));
+	(*d2)[ptr] = dist2(xi, xcen, tree->ndim, ndim, NULL, dim,
 			   scale, tree->ndim);
 	if (tree->dsize > 0) {
 	  dptr1 = (char *) (*dptr) + tree->dsize*ptr;
@@ -1182,8 +1434,9 @@ unsigned long query_box(const KDtree *tree, const double *xbox[2],
   xdata_alloc(npt, &nalloc, x, dptr, d2, tree->ndim, tree->dsize, 
 	      true);
 
-  /* Free temporary */
+  /* Free temporaries */
   free(xcen);
+  free(xbuf);
 
   /* Return */
   return npt;		   
@@ -1196,12 +1449,13 @@ unsigned long query_sphere(const KDtree *tree, const double *xcen,
 			  unsigned long ndim, const unsigned long *dim, 
 			  const double radius, const double *scale,
 			  double **x, void **dptr, double **d2) {
-  unsigned long i, j, ptr;
+  unsigned long i, ptr;
   unsigned long npt = 0, nalloc = 0;
   unsigned long curnode=ROOT;
   char *dptr1, *dptr2;
   double r2;
-  double *xbox[2];
+  double *xbox[2], *xbuf;
+  const double *xi;
   double rad2 = radius*radius;
 
   /* For convenience, define a box that encloses the search search
@@ -1215,6 +1469,10 @@ unsigned long query_sphere(const KDtree *tree, const double *xcen,
     fprintf(stderr, "bayesphot: error: unable to allocate memory in query_sphere\n");
     exit(1);
   }
+  if (!(xbuf = calloc(tree->ndim, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in query_sphere\n");
+    exit(1);
+  }
   if (scale == NULL) {
     /* Case with no dimensional scaling */
     for (i=0; i<ndim; i++) {
@@ -1268,13 +1526,10 @@ unsigned long query_sphere(const KDtree *tree, const double *xcen,
 
       /* Store data */
       for (i=0; i<tree->tree[curnode].npt; i++) {
-	for (j=0; j<tree->ndim; j++) {
-	  (*x)[(ptr+i)*tree->ndim + j] = 
-	    tree->tree[curnode].x[tree->ndim*i+j];
-	}
-	(*d2)[ptr+i] = 
-	  dist2(&(tree->tree[curnode].x[tree->ndim*i]), xcen,
-		tree->ndim, ndim, NULL, dim, scale, tree->ndim);
+	xi = kd_point(tree, curnode, i, xbuf);
+	memcpy(*x + (ptr+i)*tree->ndim, xi, tree->ndim*sizeof(double));
+	(*d2)[ptr+i] = dist2(xi, xcen, tree->ndim, ndim, NULL, dim,
+			     scale, tree->ndim);
 	if (tree->dsize > 0) {
 	  dptr1 = (char *) (*dptr) + tree->dsize*(ptr+i);
 	  dptr2 = (char *) tree->tree[curnode].dptr + tree->dsize*i;
@@ -1304,8 +1559,9 @@ unsigned long query_sphere(const KDtree *tree, const double *xcen,
       for (i=0; i<tree->tree[curnode].npt; i++) {
 
 	/* Is this point in the search region? */
-	r2 = dist2(&(tree->tree[curnode].x[tree->ndim*i]), xcen,
-		   tree->ndim, ndim, NULL, dim, scale, tree->ndim);
+	xi = kd_point(tree, curnode, i, xbuf);
+	r2 = dist2(xi, xcen, tree->ndim, ndim, NULL, dim, scale,
+		   tree->ndim);
 	if (r2 < rad2) {
 
 	  /* This point is in the search region, so we need to add it */
@@ -1313,10 +1569,7 @@ unsigned long query_sphere(const KDtree *tree, const double *xcen,
 	  npt++;
 	  xdata_alloc(npt, &nalloc, x, dptr, d2, tree->ndim,
 		      tree->dsize, false);
-	  for (j=0; j<tree->ndim; j++) {
-	    (*x)[ptr*tree->ndim + j] = 
-	      tree->tree[curnode].x[tree->ndim*i+j];
-	  }
+	  memcpy(*x + ptr*tree->ndim, xi, tree->ndim*sizeof(double));
 	  (*d2)[ptr] = r2;
 	  if (tree->dsize > 0) {
 	    dptr1 = (char *) (*dptr) + tree->dsize*ptr;
@@ -1338,9 +1591,10 @@ unsigned long query_sphere(const KDtree *tree, const double *xcen,
   xdata_alloc(npt, &nalloc, x, dptr, d2, tree->ndim, tree->dsize,
 	      true);
 
-  /* Free the inscribing box */
+  /* Free the inscribing box and the point buffer */
   free(xbox[0]);
   free(xbox[1]);
+  free(xbuf);
 
   /* Return */
   return npt;
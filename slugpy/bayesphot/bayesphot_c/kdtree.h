@@ -34,6 +34,38 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define SIBLING(i) ((i&1)?i-1:i+1)
 #define SETNEXT(i) { while (i&1) i=i>>1; ++i; }
 
+/*********************************************************************/
+/* Optional structure-of-arrays storage of the leaf data. If         */
+/* compiled with KD_SOA defined, the tree copies the points in each  */
+/* leaf into an array it owns, stored dimension by dimension:        */
+/* coordinate j of point i of a leaf is at                           */
+/* xsoa[soaoff + j*KD_SOA_PAD(npt) + i]. The rows are padded to a    */
+/* multiple of KD_SOA_WIDTH elements and the array is aligned to     */
+/* KD_SOA_ALIGN bytes, so that every row starts on a vector boundary */
+/* and leaf kernels can be evaluated with aligned SIMD loads. Once   */
+/* this copy is built the tree no longer refers to the array of      */
+/* positions from which it was built, and the caller may free it;    */
+/* positions must then be read with kd_coord and kd_point. If        */
+/* KD_SOA_FLOAT is also defined, the copy is stored in single        */
+/* precision, halving its size; distances and kernel sums are still  */
+/* accumulated in double precision.                                  */
+/*********************************************************************/
+#ifdef KD_SOA
+#  ifdef KD_SOA_FLOAT
+typedef float kd_soa_real;
+#  else
+typedef double kd_soa_real;
+#  endif
+#  define KD_SOA_ALIGN 64
+#  define KD_SOA_WIDTH (KD_SOA_ALIGN / sizeof(kd_soa_real))
+#  define KD_SOA_PAD(n) \
+  ((((n) + KD_SOA_WIDTH - 1) / KD_SOA_WIDTH) * KD_SOA_WIDTH)
+/* Leaves are processed in blocks of this many points, so that the    */
+/* scratch space for distances has a fixed size however large a leaf */
+/* grows; a multiple of KD_SOA_WIDTH keeps every block aligned        */
+#  define KD_SOA_BLOCK (8*KD_SOA_WIDTH)
+#endif
+
 /*********************************************************************/
 /* Structures for a node and a tree                                  */
 /*********************************************************************/
@@ -46,10 +78,17 @@ typedef struct {
   double *xbnd[2];
   /* Dimension along which this node splits. -1 for a leaf. */
   int splitdim;
-  /* Pointer to the positions for this node */
+  /* Index of the first point of this node in tree order */
+  unsigned long off;
+  /* Pointer to the positions for this node; if compiled with KD_SOA,
+     this is NULL except while the tree is being built */
   double *x;
   /* Extra data associated to the positions */
   void *dptr;
+#ifdef KD_SOA
+  /* Offset of this node's data in the SoA copy; leaves only */
+  unsigned long soaoff;
+#endif
 } KDnode;
 
 typedef struct {
@@ -67,8 +106,122 @@ typedef struct {
   size_t dsize;
   /* Pointer to tree root */
   KDnode *tree;
+#ifdef KD_SOA
+  /* SoA copy of the leaf data, and the block of memory holding it */
+  kd_soa_real *xsoa;
+  void *xsoa_mem;
+#endif
 } KDtree;
 
+#ifdef KD_SOA
+/*********************************************************************/
+/* Routine to compute the squared distances, in units of a scale     */
+/* length, between a point and a block of points in a leaf, using    */
+/* the SoA copy of the leaf data. x holds ndim coordinates; if dims is not   */
+/* NULL, x[k] is the coordinate along tree dimension dims[k],        */
+/* otherwise x[k] is along dimension k. On return, d2[i] holds the   */
+/* squared distance to point first+i of the leaf, for i = 0 ... n-1. */
+/*********************************************************************/
+static inline
+void leaf_dist2_soa(const KDtree *tree, const unsigned long curnode,
+		    const unsigned long first, const unsigned long n,
+		    const double *x, const unsigned long *dims,
+		    const unsigned long ndim, const double *scale,
+		    double *d2) {
+  const unsigned long npad = KD_SOA_PAD(tree->tree[curnode].npt);
+  const kd_soa_real *xs = tree->xsoa + tree->tree[curnode].soaoff + first;
+  for (unsigned long i=0; i<n; i++) d2[i] = 0.0;
+  for (unsigned long k=0; k<ndim; k++) {
+    const unsigned long j = dims ? dims[k] : k;
+    const kd_soa_real *xj = xs + j*npad;
+    const double xk = x[k];
+    const double hj = scale[j];
+#pragma omp simd
+    for (unsigned long i=0; i<n; i++) {
+      double tmp = (xj[i] - xk) / hj;
+      d2[i] += tmp*tmp;
+    }
+  }
+}
+#endif
+
+/*********************************************************************/
+/* Routines to read the positions of points. Point i of a node is    */
+/* the point at position tree->tree[node].off + i in tree order.     */
+/* kd_leaf_of returns the leaf below a node that holds its point i,  */
+/* and changes i to the index of the point within that leaf.         */
+/* kd_coord returns coordinate j of point i of a node. kd_point      */
+/* returns a pointer to the tree->ndim coordinates of point i of a   */
+/* node; if compiled with KD_SOA these are gathered into buf, which  */
+/* must hold tree->ndim elements, and otherwise buf is not used.     */
+/* kd_leaf_dist2 returns the same result as calling dist2 with point */
+/* i of a leaf as x1 and with x, ndim, dims, and scale as x2, ndim2, */
+/* dim2, and scale, without gathering the point first.               */
+/*********************************************************************/
+static inline
+unsigned long kd_leaf_of(const KDtree *tree, unsigned long node,
+			 unsigned long *i) {
+  while (tree->tree[node].splitdim != -1) {
+    if (*i < tree->tree[LEFT(node)].npt) {
+      node = LEFT(node);
+    } else {
+      *i -= tree->tree[LEFT(node)].npt;
+      node = RIGHT(node);
+    }
+  }
+  return node;
+}
+
+static inline
+double kd_coord(const KDtree *tree, unsigned long node,
+		unsigned long i, const unsigned long j) {
+#ifdef KD_SOA
+  node = kd_leaf_of(tree, node, &i);
+  return tree->xsoa[tree->tree[node].soaoff +
+		    j*KD_SOA_PAD(tree->tree[node].npt) + i];
+#else
+  return tree->tree[node].x[i*tree->ndim + j];
+#endif
+}
+
+static inline
+const double *kd_point(const KDtree *tree, unsigned long node,
+		       unsigned long i, double *buf) {
+#ifdef KD_SOA
+  node = kd_leaf_of(tree, node, &i);
+  const unsigned long npad = KD_SOA_PAD(tree->tree[node].npt);
+  const kd_soa_real *xs = tree->xsoa + tree->tree[node].soaoff + i;
+  for (unsigned long j=0; j<tree->ndim; j++) buf[j] = xs[j*npad];
+  return buf;
+#else
+  (void) buf;
+  return tree->tree[node].x + i*tree->ndim;
+#endif
+}
+
+static inline
+double kd_leaf_dist2(const KDtree *tree, const unsigned long leaf,
+		     const unsigned long i, const double *x,
+		     const unsigned long *dims, const unsigned long ndim,
+		     const double *scale) {
+#ifdef KD_SOA
+  const unsigned long npad = KD_SOA_PAD(tree->tree[leaf].npt);
+  const kd_soa_real *xs = tree->xsoa + tree->tree[leaf].soaoff + i;
+  const unsigned long n = ndim < tree->ndim ? ndim : tree->ndim;
+  double tmp, d = 0.0;
+  for (unsigned long k=0; k<n; k++) {
+    const unsigned long j = dims ? dims[k] : k;
+    tmp = xs[j*npad] - x[k];
+    if (scale) tmp /= scale[j];
+    d += tmp*tmp;
+  }
+  return d;
+#else
+  return dist2(tree->tree[leaf].x + i*tree->ndim, x, tree->ndim, ndim,
+	       NULL, dims, scale, tree->ndim);
+#endif
+}
+
 
 /*********************************************************************/
 /* Function definitions                                              */
@@ -83,7 +236,9 @@ KDtree* build_tree(double *x, unsigned long ndim, unsigned long npt,
       INPUT/OUTPUT x
          array of npt * ndim elements containing the positions,
          ordered so that element x[j + i*ndim] is the jth coordinate
-         of point i; on return, this will be sorted into a tree
+         of point i; on return, this will be sorted into a tree,
+         and the tree will point to it, unless compiled with KD_SOA,
+         in which case the tree keeps its own copy and x may be freed
       INPUT ndim
          number of dimensions in the data set
       INPUT npt
@@ -122,7 +277,9 @@ KDtree* build_tree_sortdims(double *x, unsigned long ndim,
       INPUT/OUTPUT x
          array of npt * ndim elements containing the positions,
          ordered so that element x[j + i*ndim] is the jth coordinate
-         of point i; on return, this will be sorted into a tree
+         of point i; on return, this will be sorted into a tree,
+         and the tree will point to it, unless compiled with KD_SOA,
+         in which case the tree keeps its own copy and x may be freed
       INPUT ndim
          number of dimensions in the data set
       INPUT npt
@@ -148,6 +305,79 @@ KDtree* build_tree_sortdims(double *x, unsigned long ndim,
          a pointer to a KD tree decomposition of the data
 */
 
+#ifdef KD_SOA
+void build_tree_soa(KDtree *tree);
+/* Builds the SoA copy of the leaf data for a tree from the positions
+   the nodes point to, and then sets those pointers to NULL; this is
+   done automatically by build_tree, build_tree_sortdims, and
+   insert_tree, and only needs to be called directly for trees
+   constructed by other means.
+
+   Parameters
+      INPUT/OUTPUT tree
+         The KDtree whose leaves are to be copied
+
+   Returns
+      Nothing
+*/
+#endif
+
+void insert_tree(KDtree *tree, double *xbuf, void *dbuf,
+		 const double *xnew, const void *dnew,
+		 const unsigned long nnew, unsigned long *perm,
+		 unsigned long *leaf);
+/* This routine inserts points into an existing KD tree, without
+   changing its structure. Each new point is sent down the tree to
+   the leaf whose region contains it, and the bounding boxes and
+   point counts of the nodes along the way are updated. The points of
+   the enlarged tree are then written, in tree order, to a new
+   buffer, with each leaf holding its old points followed by its new
+   ones. Because the structure is unchanged, leaves that receive new
+   points can end up holding more than the leaf size with which the
+   tree was built; on return tree->leafsize is raised if necessary so
+   that it is still the largest number of points in any leaf. Callers
+   that want to keep the tree balanced should rebuild it once this
+   becomes too large compared to the original leaf size.
+
+   Parameters
+      INPUT/OUTPUT tree
+         The KDtree into which points are to be inserted
+      OUTPUT xbuf
+         array of (npt + nnew) * ndim elements, where npt is the
+         number of points in the tree before insertion; on return it
+         holds the positions of all points, in tree order, and the
+         tree points to it, unless compiled with KD_SOA, in which case
+         the tree keeps its own copy and xbuf may be freed; it must
+         not overlap the array holding the positions before insertion
+      OUTPUT dbuf
+         array of (npt + nnew) elements of size tree->dsize; on return
+         it holds the extra data associated to the points, in tree
+         order; if NULL, or if tree->dsize is 0, the extra data
+         pointers of all nodes are set to NULL
+      INPUT xnew
+         array of nnew * ndim elements giving the positions of the
+         points to be inserted
+      INPUT dnew
+         array of nnew elements of size tree->dsize giving the extra
+         data for the new points; ignored if dbuf is NULL
+      INPUT nnew
+         number of points to insert
+      OUTPUT perm
+         array of npt + nnew elements; on return, perm[i] is the
+         position of the point now at position i in the tree in the
+         concatenation of the old tree order and the list of new
+         points, i.e., perm[i] < npt means that the point was at
+         position perm[i] in the tree before insertion, and perm[i]
+         >= npt means that it is new point number perm[i] - npt
+      OUTPUT leaf
+         array of nnew elements; on return, leaf[i] is the index of
+         the leaf node into which new point i was inserted; if this is
+         not needed, set to NULL when calling
+
+   Returns
+      Nothing
+*/
+
 void free_tree(KDtree *tree);
 /* Frees the memory associated with a KD tree.
 
@@ -167,7 +397,11 @@ void neighbors(const KDtree *tree, const double *xpt,
 /* Routine to find the N nearest neighbors to an input point; input
    points can have fewer dimensions than the search space, in which
    case the routine searches for the nearest neighbors to a line,
-   plane, or higher-dimensional object.
+   plane, or higher-dimensional object. The search visits the nearer
+   child of each node first, keeps the candidate neighbors in a
+   bounded max-heap, and skips any node whose bounding box lies
+   farther away than the most distant candidate; it allocates no
+   memory unless nneighbor is very large.
 
    Parameters:
       INPUT tree
@@ -206,7 +440,8 @@ void neighbors(const KDtree *tree, const double *xpt,
          squared distances of all particles found from xpt; on entry,
          this pointer mut point to a block of nneighbor elements, and
          on return dist2[i] gives the distance from the ith point
-         found to xpt
+         found to xpt; if the tree contains fewer than nneighbor
+         points, the unused elements are set to DBL_MAX
 
    Returns
       Nothing
@@ -216,7 +451,8 @@ void neighbors_all(const KDtree *tree, const unsigned long nneighbor,
 		   const double *scale, unsigned long *idx, 
 		   double *d2);
 /* Routine to find the N nearest neighbors of every point in the KD
-   tree. Points are not considered their own neighbors.
+   tree, by calling neighbors_leaf for each leaf. Points are not
+   considered their own neighbors.
 
    Parameters:
       INPUT tree
@@ -242,6 +478,36 @@ void neighbors_all(const KDtree *tree, const unsigned long nneighbor,
       Nothing
 */
 
+void neighbors_leaf(const KDtree *tree, const unsigned long leaf,
+		    const unsigned long nneighbor,
+		    const double *scale, unsigned long *idx, 
+		    double *d2);
+/* Routine to find the N nearest neighbors of every point in a single
+   leaf of the KD tree. The neighbor lists of the points are first
+   seeded with the other points in the same leaf, using each pairwise
+   distance for both points, and the rest of the tree is then
+   searched starting from these lists. Calling this routine for every
+   leaf gives the same result as neighbors_all; because each call
+   writes only the entries of idx and d2 for its own points, calls
+   for different leaves may be made in parallel. Points are not
+   considered their own neighbors.
+
+   Parameters:
+      INPUT tree
+         the KD tree to be searched
+      INPUT leaf
+         index of the leaf node; nodes that are not leaves, or that
+         contain no points, are ignored
+      INPUT nneighbor, scale
+         same as for neighbors_all
+      OUTPUT idx, d2
+         same as for neighbors_all; only the entries for the points
+         in the leaf are set
+
+   Returns
+      Nothing
+*/
+
 void neighbors_point(const KDtree *tree, const unsigned long idxpt,
 		     const unsigned long nneighbor,
 		     const double *scale, unsigned long *idx, 
@@ -36,6 +36,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 /* Static functions                                                  */
 /*********************************************************************/
 
+/* Function to sum the kernel contributions of all points in a leaf,
+   using the SoA copy of the leaf data */
+#ifdef KD_SOA
+static inline
+double kd_leaf_sum_soa(const kernel_density *kd, const double *x,
+		       const unsigned long *dims, const unsigned long ndim,
+		       const unsigned long ndim_int, const bool integrated,
+		       const unsigned long curnode);
+#endif
+
 /* Functions to compute PDFs and integrals thereof on single tree nodes */
 static inline
 void kd_pdf_node(const kernel_density *kd, const double *x, 
@@ -107,159 +117,173 @@ double kd_pdf_node_reggrid(const kernel_density *kd,
 			   const unsigned long curnode,
 			   double *pdf);
 
-/**********************************************************************/
-/* Function to evaluate the PDF approximately using a kernel_density */
-/* object                                                            */
 /*********************************************************************/
-double kd_pdf(const kernel_density *kd, const double *x,
-	      const double reltol, const double abstol
-#ifdef DIAGNOSTIC
-	      , unsigned long *nodecheck, unsigned long *leafcheck,
-	      unsigned long *termcheck
-#endif
-	      ) {
-  unsigned long i, nnode, nalloc, ptr, lchild, rchild;
-  unsigned long *nodelist;
-  double *nodepdf, *nodeerr;
-  double pdf, maxerr, relerr, abserr;
-  double leafpdf, lpdf, lerr, rpdf, rerr;
+/* Node frontier management                                          */
+/*********************************************************************/
 
-  /* Initialize for diagnostic mode */
-#ifdef DIAGNOSTIC
-  *nodecheck = *leafcheck = *termcheck = 0;
+/* The routines that evaluate the PDF work by maintaining a frontier
+   of tree nodes that have been examined but not opened, and
+   repeatedly opening the node that contributes the most to the error
+   until the error is within tolerance. The frontier is stored as a
+   binary max-heap ordered by each node's error contribution, so that
+   finding and removing the worst node costs O(log n) rather than
+   O(n). The memory for the heap is held in a per-thread pool that
+   persists between calls, so that repeated evaluations do not
+   allocate memory. The pool is thread-local storage rather than
+   OpenMP threadprivate data, so that it is private to each thread
+   whether or not the library is compiled with OpenMP; this matters
+   because callers such as python (via ctypes, which releases the
+   GIL) may call into the library from several threads at once. */
+typedef struct {
+  double key;           /* Error contribution; the heap is ordered by this */
+  double pdf;           /* Central estimate of PDF contribution */
+  unsigned long node;   /* Index of node in tree */
+} kd_frontier_node;
+
+typedef struct {
+  kd_frontier_node *heap;
+  unsigned long n, nalloc;
+} kd_frontier;
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && \
+  !defined(__STDC_NO_THREADS__)
+#  define KD_THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#  define KD_THREAD_LOCAL __declspec(thread)
+#else
+#  define KD_THREAD_LOCAL __thread
 #endif
+static KD_THREAD_LOCAL kd_frontier frontier_pool = { NULL, 0, 0 };
 
-  /* Analyze root node */
-  kd_pdf_node(kd, x, ROOT, &pdf, &abserr);
-
-  /* Record diagnostic data */
-#ifdef DIAGNOSTIC
-  (*nodecheck)++;
-  if (kd->tree->tree[ROOT].splitdim == -1) (*leafcheck)++;
-  (*termcheck)++;
-#endif
+/* Get this thread's frontier, emptied */
+static inline
+kd_frontier *kd_frontier_get(void) {
+  frontier_pool.n = 0;
+  return &frontier_pool;
+}
 
-  /* Initialize from root node */
-  if (kd->tree->tree[ROOT].splitdim == -1) {
+/* Push a node onto the frontier */
+static inline
+void kd_frontier_push(kd_frontier *f, const unsigned long node,
+		      const double key, const double pdf) {
+  unsigned long i, parent;
+  if (f->n == f->nalloc) {
+    f->nalloc = f->nalloc == 0 ? NODEBLOCKSIZE : 2*f->nalloc;
+    if (!(f->heap = (kd_frontier_node *)
+	  realloc(f->heap, f->nalloc*sizeof(kd_frontier_node)))) {
+      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_frontier_push\n");
+      exit(1);
+    }
+  }
+  /* Sift up from the end */
+  i = f->n++;
+  while (i > 0) {
+    parent = (i-1)/2;
+    if (f->heap[parent].key >= key) break;
+    f->heap[i] = f->heap[parent];
+    i = parent;
+  }
+  f->heap[i].key = key;
+  f->heap[i].pdf = pdf;
+  f->heap[i].node = node;
+}
 
-    /* Special case: if root node is a leaf, we just got the exact
-       value, so return it and exit. */
-    return(pdf);
+/* Remove the node with the largest key from the frontier and return it */
+static inline
+kd_frontier_node kd_frontier_pop(kd_frontier *f) {
+  unsigned long i, child;
+  kd_frontier_node top = f->heap[0];
+  kd_frontier_node last = f->heap[--f->n];
+  /* Sift the last element down from the root */
+  i = 0;
+  while ((child = 2*i+1) < f->n) {
+    if (child+1 < f->n && f->heap[child+1].key > f->heap[child].key)
+      child++;
+    if (last.key >= f->heap[child].key) break;
+    f->heap[i] = f->heap[child];
+    i = child;
+  }
+  if (f->n > 0) f->heap[i] = last;
+  return top;
+}
 
-  } else {
+/* Running sums of the PDF and error over the frontier. Nodes are
+   added to and removed from these sums as the frontier changes, which
+   involves a lot of cancelling additions and subtractions when the
+   tolerance is tight; to keep roundoff error under control, the sums
+   are compensated (Kahan-Babuska summation). */
+typedef struct {
+  double sum, c;
+} kd_tally;
 
-    /* The usual case: root node is not a leaf */
+static inline
+void kd_tally_add(kd_tally *t, const double x) {
+  double s = t->sum + x;
+  if (fabs(t->sum) >= fabs(x)) t->c += (t->sum - s) + x;
+  else t->c += (x - s) + t->sum;
+  t->sum = s;
+}
 
-    /* Allocate memory for node list */
-    if (!(nodelist = (unsigned long *) 
-	  calloc(NODEBLOCKSIZE, sizeof(unsigned long)))) {
-      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf\n");
-      exit(1);
-    }
-    if (!(nodepdf = (double *) 
-	  calloc(NODEBLOCKSIZE, sizeof(double)))) {
-      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf\n");
-      exit(1);
-    }
-    if (!(nodeerr = (double *) 
-	  calloc(NODEBLOCKSIZE, sizeof(double)))) {
-      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf\n");
-      exit(1);
-    }
-    nalloc = NODEBLOCKSIZE;  
+static inline
+double kd_tally_val(const kd_tally *t) {
+  return t->sum + t->c;
+}
 
-    /* Push root node onto the node list */
-    nodelist[0] = ROOT;
-    nodepdf[0] = pdf;
-    nodeerr[0] = abserr;
-    nnode = 1;
-    leafpdf = 0.0;
-  }
+/*********************************************************************/
+/* Function to refine a PDF estimate by repeatedly opening the node  */
+/* on the frontier that contributes the most error, until the error */
+/* is within tolerance. On entry, the frontier holds the non-leaf    */
+/* nodes whose contributions have been estimated but not computed    */
+/* exactly, and the running sums pdfsum and errsum hold the total of */
+/* the estimates from leaves that have been evaluated exactly plus   */
+/* those from nodes on the frontier.                                 */
+/*********************************************************************/
+static inline
+double kd_pdf_refine(const kernel_density *kd, const double *x,
+		     kd_frontier *frontier, kd_tally *pdfsum,
+		     kd_tally *errsum, const double reltol,
+		     const double abstol
+#ifdef DIAGNOSTIC
+		     , unsigned long *nodecheck, unsigned long *leafcheck,
+		     unsigned long *termcheck
+#endif
+		     ) {
+  unsigned long lchild, rchild;
+  kd_frontier_node cur;
+  double pdf, relerr, abserr;
+  double lpdf, lerr, rpdf, rerr;
 
-  /* Now work recursively through the tree, identifying the node in
-     the tree that contributes most to the error and opening it until
-     the error estimate is within our tolerance */
   while (1) {
 
-    /* Compute the current estimate and total error, and find the node
-       that is contributing the most to the error budget. Note that in
-       principle we could do fewer arithmetic operations by keeping a
-       running tally of abserr and pdf, and updating these each time
-       we go through the loop, rather than recomputing them from
-       scratch each time. However, in practice this involves a lot of
-       cancelling additions and subtractions that can create problems
-       with roundoff when the error tolerance is tight and a lot of
-       node evaluations are needed to achieve it. Doing the
-       calculation fresh each time through the loop avoids this
-       problem, which is worth the small amount of extra work required. */
-    abserr = maxerr = nodeerr[0];
-    pdf = leafpdf + nodepdf[0];
-    ptr = 0;
-    for (i=1; i<nnode; i++) {
-      pdf += nodepdf[i];
-      abserr += nodeerr[i];
-      if (nodeerr[i] > maxerr) {
-	ptr = i;
-	maxerr = nodeerr[i];
-      }
-    }
-
     /* Check for convergence */
+    pdf = kd_tally_val(pdfsum);
+    abserr = kd_tally_val(errsum);
     relerr = abserr / pdf;
     if ((abserr <= abstol) || (relerr <= reltol)) break;
+
+    /* Safety check: bail out if no nodes left */
+    if (frontier->n == 0) break;
+
+    /* Remove the node contributing the most error from the frontier,
+       and take its contribution out of the running sums */
+    cur = kd_frontier_pop(frontier);
+    kd_tally_add(pdfsum, -cur.pdf);
+    kd_tally_add(errsum, -cur.key);
     
-    /* Compute estimates for that node's children */
-    lchild = LEFT(nodelist[ptr]);
-    rchild = RIGHT(nodelist[ptr]);
+    /* Compute estimates for that node's children, and add them to
+       the running sums */
+    lchild = LEFT(cur.node);
+    rchild = RIGHT(cur.node);
     kd_pdf_node(kd, x, lchild, &lpdf, &lerr);
     kd_pdf_node(kd, x, rchild, &rpdf, &rerr);
+    kd_tally_add(pdfsum, lpdf + rpdf);
+    kd_tally_add(errsum, lerr + rerr);
 
-    /* If children are leaves, add their contribution to the PDF from
-       leaves */
-    if (kd->tree->tree[lchild].splitdim == -1) leafpdf += lpdf;
-    if (kd->tree->tree[rchild].splitdim == -1) leafpdf += rpdf;
-
-    /* Remove the node we just analyzed from the list */
-    for (i=ptr; i<nnode-1; i++) {
-      nodelist[i] = nodelist[i+1];
-      nodepdf[i] = nodepdf[i+1];
-      nodeerr[i] = nodeerr[i+1];
-    }
-    nnode--;
-
-    /* Allocate more memory to hold child nodes if necessary */
-    if (nnode+2 >= nalloc) {
-      if (!(nodelist = (unsigned long *) 
-	    realloc(nodelist, 2*nalloc*sizeof(unsigned long)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf\n");
-	exit(1);
-      }
-      if (!(nodepdf = (double *) 
-	    realloc(nodepdf, 2*nalloc*sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf\n");
-	exit(1);
-      }
-      if (!(nodeerr = (double *) 
-	    realloc(nodeerr, 2*nalloc*sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf\n");
-	exit(1);
-      }
-      nalloc *= 2;
-    }
-
-    /* If children are not leaves, push them onto the node list */
-    if (kd->tree->tree[lchild].splitdim != -1) {
-      nodelist[nnode] = lchild;
-      nodepdf[nnode] = lpdf;
-      nodeerr[nnode] = lerr;
-      nnode++;
-    }
-    if (kd->tree->tree[rchild].splitdim != -1) {
-      nodelist[nnode] = rchild;
-      nodepdf[nnode] = rpdf;
-      nodeerr[nnode] = rerr;
-      nnode++;
-    }
+    /* If children are not leaves, push them onto the frontier */
+    if (kd->tree->tree[lchild].splitdim != -1)
+      kd_frontier_push(frontier, lchild, lerr, lpdf);
+    if (kd->tree->tree[rchild].splitdim != -1)
+      kd_frontier_push(frontier, rchild, rerr, rpdf);
 
     /* Record diagnostic data */
 #ifdef DIAGNOSTIC
@@ -268,21 +292,64 @@ double kd_pdf(const kernel_density *kd, const double *x,
     if (kd->tree->tree[rchild].splitdim != -1) (*leafcheck)++;
     (*termcheck)++;
 #endif
-
-    /* Safety check: bail out if no nodes left */
-    if (nnode == 0) break;
   }
 
-  /* Free memory */
-  free(nodelist);
-  free(nodepdf);
-  free(nodeerr);
-
   /* Return */
   return(pdf);
 }
 
 
+/**********************************************************************/
+/* Function to evaluate the PDF approximately using a kernel_density */
+/* object                                                            */
+/*********************************************************************/
+double kd_pdf(const kernel_density *kd, const double *x,
+	      const double reltol, const double abstol
+#ifdef DIAGNOSTIC
+	      , unsigned long *nodecheck, unsigned long *leafcheck,
+	      unsigned long *termcheck
+#endif
+	      ) {
+  kd_frontier *frontier;
+  kd_tally pdfsum = { 0.0, 0.0 }, errsum = { 0.0, 0.0 };
+  double pdf, abserr;
+
+  /* Initialize for diagnostic mode */
+#ifdef DIAGNOSTIC
+  *nodecheck = *leafcheck = *termcheck = 0;
+#endif
+
+  /* Analyze root node */
+  kd_pdf_node(kd, x, ROOT, &pdf, &abserr);
+
+  /* Record diagnostic data */
+#ifdef DIAGNOSTIC
+  (*nodecheck)++;
+  if (kd->tree->tree[ROOT].splitdim == -1) (*leafcheck)++;
+  (*termcheck)++;
+#endif
+
+  /* Special case: if root node is a leaf, we just got the exact
+     value, so return it and exit. */
+  if (kd->tree->tree[ROOT].splitdim == -1) return(pdf);
+
+  /* The usual case: root node is not a leaf, so push it onto the
+     frontier, and initialize the running sums */
+  frontier = kd_frontier_get();
+  kd_frontier_push(frontier, ROOT, abserr, pdf);
+  kd_tally_add(&pdfsum, pdf);
+  kd_tally_add(&errsum, abserr);
+
+  /* Now work recursively through the tree, opening nodes until the
+     error estimate is within our tolerance */
+  return(kd_pdf_refine(kd, x, frontier, &pdfsum, &errsum, reltol, abstol
+#ifdef DIAGNOSTIC
+		       , nodecheck, leafcheck, termcheck
+#endif
+		       ));
+}
+
+
 /*********************************************************************/
 /* Function to evaluate the PDF on a grid where some dimensions are  */
 /* fixed and others are varying                                      */
@@ -300,11 +367,12 @@ void kd_pdf_grid(const kernel_density *kd, const double *xfixed,
 		 double *pdf) {
 
   unsigned long i, j;
-  unsigned long nalloc=0, nnode, ptr, lchild, rchild;
+  unsigned long lchild, rchild;
   unsigned long fixedptr, outptr;
-  unsigned long *nodelist = NULL;
-  double *nodepdf = NULL;
-  double relerr = 0.0, maxerr;
+  kd_frontier *frontier;
+  kd_frontier_node cur;
+  kd_tally pdfmaxsum;
+  double relerr = 0.0;
   double pdfmax, leftpdf, rightpdf;
 
   /* Loop over the input fixed points */
@@ -325,51 +393,28 @@ void kd_pdf_grid(const kernel_density *kd, const double *xfixed,
     /* If root node is a leaf, we're done. Go to next fixed point. */
     if (kd->tree->tree[ROOT].splitdim == -1) continue;
 
-    /* More common case where root node is not a leaf */
-
-    /* Allocate memory for node list if necessary */
-    if (nalloc == 0) {
-      if (!(nodelist = (unsigned long *) 
-	    calloc(NODEBLOCKSIZE, sizeof(unsigned long)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	exit(1);
-      }
-      if (!(nodepdf = (double *) 
-	    calloc(NODEBLOCKSIZE, sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	exit(1);
-      }
-      nalloc = NODEBLOCKSIZE;  
-    }
-
-    /* Push root node onto the node list */
-    nodelist[0] = ROOT;
-    nodepdf[0] = pdfmax;
-    nnode = 1;
+    /* More common case where root node is not a leaf: push the root
+       onto the frontier, keyed by its maximum possible contribution
+       to the PDF, and initialize the running sum of the maximum
+       possible contribution from unopened nodes */
+    frontier = kd_frontier_get();
+    kd_frontier_push(frontier, ROOT, pdfmax, pdfmax);
+    pdfmaxsum.sum = pdfmax;
+    pdfmaxsum.c = 0.0;
 
     /* Now proceed through the tree, identifying the nodes that are
        contributing the most error and recursively opening them. */
     while (1) {
 
-      /* Find the node that is contributing the most error. */
-      maxerr = nodepdf[0];
-      ptr = 0;
-      for (j=1; j<nnode; j++) {
-	if (nodepdf[j] > maxerr) {
-	  ptr = j;
-	  maxerr = nodepdf[j];
-	}
-      }
-
-      /* Subtract this node's contribution to the maximum possible PDF
-	 contribution from unopened nodes. Enforce positivity to avoid
-	 spurious negative results coming from roundoff error. */
-      pdfmax -= nodepdf[ptr];
-      if (pdfmax < 0) pdfmax = 0.0;
+      /* Remove the node that is contributing the most error from the
+	 frontier, and subtract its contribution to the maximum
+	 possible PDF contribution from unopened nodes */
+      cur = kd_frontier_pop(frontier);
+      kd_tally_add(&pdfmaxsum, -cur.key);
 
       /* Compute estimates for this node's children */
-      lchild = LEFT(nodelist[ptr]);
-      rchild = RIGHT(nodelist[ptr]);
+      lchild = LEFT(cur.node);
+      rchild = RIGHT(cur.node);
       leftpdf = kd_pdf_node_grid(kd, xfixed+fixedptr, dimfixed, ndimfixed,
 				 xgrid, dimgrid, ndimgrid, ngrid, lchild,
 				 pdf+outptr);
@@ -377,8 +422,12 @@ void kd_pdf_grid(const kernel_density *kd, const double *xfixed,
 				  xgrid, dimgrid, ndimgrid, ngrid, rchild,
 				  pdf+outptr);
 
-      /* Get new maximum contribution to PDF from unopened nodes */
-      pdfmax += leftpdf + rightpdf;
+      /* Get new maximum contribution to PDF from unopened
+	 nodes. Enforce positivity to avoid spurious negative results
+	 coming from roundoff error. */
+      kd_tally_add(&pdfmaxsum, leftpdf + rightpdf);
+      pdfmax = kd_tally_val(&pdfmaxsum);
+      if (pdfmax < 0) pdfmax = 0.0;
 
       /* Check for termination on absolute error. Note that we can
 	 save a factor of 2 by adding half the upper limit on the
@@ -399,42 +448,13 @@ void kd_pdf_grid(const kernel_density *kd, const double *xfixed,
 	break;
       }
 
-      /* If we're here, we haven't converged yet. Remove the node we
-	 just analyzed from the list. */
-      for (j=ptr; j<nnode-1; j++) {
-	nodelist[j] = nodelist[j+1];
-	nodepdf[j] = nodepdf[j+1];
-      }
-      nnode--;
-
-      /* Allocate more memory to hold child nodes if necessary */
-      if (nnode+2 >= nalloc) {
-	if (!(nodelist = (unsigned long *) 
-	      realloc(nodelist, 2*nalloc*sizeof(unsigned long)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	if (!(nodepdf = (double *) 
-	      realloc(nodepdf, 2*nalloc*sizeof(double)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	nalloc *= 2;
-      }
-
       /* If children are not leaves, and their maximum contribution to
 	 the PDF is not 0 (possible due to roundoff, or if the kernel
-	 is compact), push them onto the node list */
-      if (leftpdf > 0.0) {
-	nodelist[nnode] = lchild;
-	nodepdf[nnode] = leftpdf;
-	nnode++;
-      }
-      if (rightpdf > 0.0) {
-	nodelist[nnode] = rchild;
-	nodepdf[nnode] = rightpdf;
-	nnode++;
-      }
+	 is compact), push them onto the frontier */
+      if (leftpdf > 0.0)
+	kd_frontier_push(frontier, lchild, leftpdf, leftpdf);
+      if (rightpdf > 0.0)
+	kd_frontier_push(frontier, rchild, rightpdf, rightpdf);
 
       /* Bail out if there are no non-leaf nodes left to be
 	 analyzed. This should also give abserr = 0, and thus
@@ -442,13 +462,9 @@ void kd_pdf_grid(const kernel_density *kd, const double *xfixed,
 	 condition. However, this can sometimes fail due to roundoff
 	 error if abstol and reltol are both very small, so this is a
 	 backstop. */
-      if (nnode == 0) break;
+      if (frontier->n == 0) break;
     }
   }
-
-  /* Free memory */
-  if (nodelist != NULL) free(nodelist);
-  if (nodepdf != NULL) free(nodepdf);
 }
 
 
@@ -464,12 +480,13 @@ double kd_pdf_int(const kernel_density *kd, const double *x,
 		  unsigned long *termcheck
 #endif
 		  ) {
-  unsigned long i, ndim_int, nnode, nalloc, ptr, lchild, rchild;
-  unsigned long *nodelist = NULL;
+  unsigned long i, ndim_int, lchild, rchild;
+  kd_frontier *frontier;
+  kd_frontier_node cur;
+  kd_tally pdfsum = { 0.0, 0.0 }, errsum = { 0.0, 0.0 };
   double hprod, ds_n, fac;
-  double *nodepdf = NULL, *nodeerr = NULL;
-  double maxerr, relerr, abserr;
-  double pdf, leafpdf, lpdf, rpdf, lerr, rerr;
+  double relerr, abserr;
+  double pdf, lpdf, rpdf, lerr, rerr;
   
   /* Pre-compute constant factor in the integrals we're evaluating;
      this is the part that depends only on h and the number of
@@ -504,42 +521,6 @@ double kd_pdf_int(const kernel_density *kd, const double *x,
   kd_pdf_node_int(kd, x, dims, ndim, ndim_int, fac, ROOT,
 		  &pdf, &abserr);
 
-  /* Initialize node list */
-  if (kd->tree->tree[ROOT].splitdim == -1) {
-
-    /* Special case: root node is a leaf, so just return the exact value */
-    return(pdf);
-
-  } else {
-
-    /* The usual case: root node is not a leaf */
-
-    /* Allocate memory for node list */
-    if (!(nodelist = (unsigned long *) 
-	  calloc(NODEBLOCKSIZE, sizeof(unsigned long)))) {
-      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int\n");
-      exit(1);
-    }
-    if (!(nodepdf = (double *) 
-	  calloc(NODEBLOCKSIZE, sizeof(double)))) {
-      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int\n");
-      exit(1);
-    }
-    if (!(nodeerr = (double *) 
-	  calloc(NODEBLOCKSIZE, sizeof(double)))) {
-      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int\n");
-      exit(1);
-    }
-    nalloc = NODEBLOCKSIZE;  
-
-    /* Push root node onto the node list */
-    nodelist[0] = ROOT;
-    nodepdf[0] = pdf;
-    nodeerr[0] = abserr;
-    nnode = 1;
-    leafpdf = 0.0;
-  }
-
   /* Record diagnostic data */
 #ifdef DIAGNOSTIC
   (*nodecheck)++;
@@ -547,81 +528,49 @@ double kd_pdf_int(const kernel_density *kd, const double *x,
   (*termcheck)++;
 #endif
 
+  /* Special case: root node is a leaf, so just return the exact value */
+  if (kd->tree->tree[ROOT].splitdim == -1) return(pdf);
+
+  /* The usual case: root node is not a leaf, so push it onto the
+     frontier, and initialize the running sums */
+  frontier = kd_frontier_get();
+  kd_frontier_push(frontier, ROOT, abserr, pdf);
+  kd_tally_add(&pdfsum, pdf);
+  kd_tally_add(&errsum, abserr);
+
   /* Now work recursively through the tree, identifying the node in
      the tree that contributes most to the error and opening it until
      the error estimate is within our tolerance */
   while (1) {
 
-    /* Compute the current estimate and total error, and find the node
-       that makes the largest contribution to the total error */
-    abserr = maxerr = nodeerr[0];
-    pdf = leafpdf + nodepdf[0];
-    ptr = 0;
-    for (i=1; i<nnode; i++) {
-      pdf += nodepdf[i];
-      abserr += nodeerr[i];
-      if (nodeerr[i] > maxerr) {
-	ptr = i;
-	maxerr = nodeerr[i];
-      }
-    }
-
     /* Check termination condition */
+    pdf = kd_tally_val(&pdfsum);
+    abserr = kd_tally_val(&errsum);
     relerr = abserr / pdf;
     if ((abserr <= abstol) || (relerr <= reltol)) break;
 
-    /* Analyze the children of the node contributing the most error */
-    lchild = LEFT(nodelist[ptr]);
-    rchild = RIGHT(nodelist[ptr]);
+    /* Safety check: bail out if no nodes left */
+    if (frontier->n == 0) break;
+
+    /* Remove the node contributing the most error from the frontier,
+       and take its contribution out of the running sums */
+    cur = kd_frontier_pop(frontier);
+    kd_tally_add(&pdfsum, -cur.pdf);
+    kd_tally_add(&errsum, -cur.key);
+
+    /* Analyze its children, and add them to the running sums */
+    lchild = LEFT(cur.node);
+    rchild = RIGHT(cur.node);
     kd_pdf_node_int(kd, x, dims, ndim, ndim_int, fac, lchild, &lpdf, &lerr);
     kd_pdf_node_int(kd, x, dims, ndim, ndim_int, fac, rchild, &rpdf, &rerr);
+    kd_tally_add(&pdfsum, lpdf + rpdf);
+    kd_tally_add(&errsum, lerr + rerr);
 
-    /* If children are leaves, add their contribution to the PDF from
-       leaves */
-    if (kd->tree->tree[lchild].splitdim == -1) leafpdf += lpdf;
-    if (kd->tree->tree[rchild].splitdim == -1) leafpdf += rpdf;
-    
-    /* Remove the node we just analyzed from the list */
-    for (i=ptr; i<nnode-1; i++) {
-      nodelist[i] = nodelist[i+1];
-      nodepdf[i] = nodepdf[i+1];
-      nodeerr[i] = nodeerr[i+1];
-    }
-    nnode--;
-
-    /* Allocate more memory to hold child nodes if necessary */
-    if (nnode+2 >= nalloc) {
-      if (!(nodelist = (unsigned long *) 
-	    realloc(nodelist, 2*nalloc*sizeof(unsigned long)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int\n");
-	exit(1);
-      }
-      if (!(nodepdf = (double *) 
-	    realloc(nodepdf, 2*nalloc*sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int\n");
-	exit(1);
-      }
-      if (!(nodeerr = (double *) 
-	    realloc(nodeerr, 2*nalloc*sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int\n");
-	exit(1);
-      }
-      nalloc *= 2;
-    }
-
-    /* If children are not leaves, push them onto the node list */
-    if (kd->tree->tree[lchild].splitdim != -1) {
-      nodelist[nnode] = lchild;
-      nodepdf[nnode] = lpdf;
-      nodeerr[nnode] = lerr;
-      nnode++;
-    }
-    if (kd->tree->tree[rchild].splitdim != -1) {
-      nodelist[nnode] = rchild;
-      nodepdf[nnode] = rpdf;
-      nodeerr[nnode] = rerr;
-      nnode++;
-    }
+    /* If children are not leaves, push them onto the frontier */
+    if (kd->tree->tree[lchild].splitdim != -1)
+      kd_frontier_push(frontier, lchild, lerr, lpdf);
+    if (kd->tree->tree[rchild].splitdim != -1)
+      kd_frontier_push(frontier, rchild, rerr, rpdf);
 
     /* Record diagnostic data */
 #ifdef DIAGNOSTIC
@@ -630,16 +579,8 @@ double kd_pdf_int(const kernel_density *kd, const double *x,
     if (kd->tree->tree[rchild].splitdim != -1) (*leafcheck)++;
     (*termcheck)++;
 #endif
-    
-    /* Safety check: bail out if no nodes left */
-    if (nnode == 0) break;
   }
 
-  /* Free memory */
-  free(nodelist);
-  free(nodepdf);
-  free(nodeerr);
-
   /* Return */
   return(pdf);
 }
@@ -663,12 +604,13 @@ void kd_pdf_int_grid(const kernel_density *kd, const double *xfixed,
 		     double *pdf) {
 
   unsigned long i, j;
-  unsigned long nalloc=0, nnode, ptr, lchild, rchild, ndim_int;
+  unsigned long lchild, rchild, ndim_int;
   unsigned long fixedptr, outptr;
-  unsigned long *nodelist = NULL;
-  double *nodepdf = NULL;
+  kd_frontier *frontier;
+  kd_frontier_node cur;
+  kd_tally pdfmaxsum;
   double hprod, ds_n, fac;
-  double maxerr, relerr = 0.0, pdfmax, leftpdf, rightpdf;
+  double relerr = 0.0, pdfmax, leftpdf, rightpdf;
 
   /* Pre-compute constant factor in the integrals we're evaluating;
      this is the part that depends only on h and the number of
@@ -713,51 +655,28 @@ void kd_pdf_int_grid(const kernel_density *kd, const double *xfixed,
     /* If root node is a leaf, we're done. Go to next fixed point. */
     if (kd->tree->tree[ROOT].splitdim == -1) continue;
 
-    /* More common case where root node is not a leaf */
-
-    /* Allocate memory for node list if necessary */
-    if (nalloc == 0) {
-      if (!(nodelist = (unsigned long *) 
-	    calloc(NODEBLOCKSIZE, sizeof(unsigned long)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int_grid\n");
-	exit(1);
-      }
-      if (!(nodepdf = (double *) 
-	    malloc(NODEBLOCKSIZE*sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int_grid\n");
-	exit(1);
-      }
-      nalloc = NODEBLOCKSIZE;  
-    }
-
-    /* Push root node onto the node list */
-    nodelist[0] = ROOT;
-    nodepdf[0] = pdfmax;
-    nnode = 1;
+    /* More common case where root node is not a leaf: push the root
+       onto the frontier, keyed by its maximum possible contribution
+       to the PDF, and initialize the running sum of the maximum
+       possible contribution from unopened nodes */
+    frontier = kd_frontier_get();
+    kd_frontier_push(frontier, ROOT, pdfmax, pdfmax);
+    pdfmaxsum.sum = pdfmax;
+    pdfmaxsum.c = 0.0;
 
     /* Now proceed through the tree, identifying the nodes that are
        contributing the most error and recursively opening them. */
     while (1) {
 
-      /* Find the node that is contributing the most error. */
-      maxerr = nodepdf[0];
-      ptr = 0;
-      for (j=1; j<nnode; j++) {
-	if (nodepdf[j] > maxerr) {
-	  ptr = j;
-	  maxerr = nodepdf[j];
-	}
-      }
-
-      /* Subtract this node's contribution to the maximum possible PDF
-	 contribution from unopened nodes. Enforce positivity to avoid
-	 spurious negative results coming from roundoff error. */
-      pdfmax -= nodepdf[ptr];
-      if (pdfmax < 0) pdfmax = 0.0;
+      /* Remove the node that is contributing the most error from the
+	 frontier, and subtract its contribution to the maximum
+	 possible PDF contribution from unopened nodes */
+      cur = kd_frontier_pop(frontier);
+      kd_tally_add(&pdfmaxsum, -cur.key);
 
       /* Compute estimates for this node's children */
-      lchild = LEFT(nodelist[ptr]);
-      rchild = RIGHT(nodelist[ptr]);
+      lchild = LEFT(cur.node);
+      rchild = RIGHT(cur.node);
       leftpdf = kd_pdf_node_int_grid(kd, xfixed+fixedptr, dimfixed, 
 				     ndimfixed, xgrid, dimgrid, ndimgrid, 
 				     ngrid, ndim_int, fac, lchild, 
@@ -767,8 +686,12 @@ void kd_pdf_int_grid(const kernel_density *kd, const double *xfixed,
 				      ngrid, ndim_int, fac, rchild, 
 				      pdf+outptr);
 
-      /* Get new maximum contribution to PDF from unopened nodes */
-      pdfmax += leftpdf + rightpdf;
+      /* Get new maximum contribution to PDF from unopened
+	 nodes. Enforce positivity to avoid spurious negative results
+	 coming from roundoff error. */
+      kd_tally_add(&pdfmaxsum, leftpdf + rightpdf);
+      pdfmax = kd_tally_val(&pdfmaxsum);
+      if (pdfmax < 0) pdfmax = 0.0;
 
       /* Check for termination on absolute error. Note that we can
 	 save a factor of 2 by adding half the upper limit on the
@@ -789,42 +712,13 @@ void kd_pdf_int_grid(const kernel_density *kd, const double *xfixed,
 	break;
       }
 
-      /* If we're here, we haven't converged yet. Remove the node we
-	 just analyzed from the list. */
-      for (j=ptr; j<nnode-1; j++) {
-	nodelist[j] = nodelist[j+1];
-	nodepdf[j] = nodepdf[j+1];
-      }
-      nnode--;
-
-      /* Allocate more memory to hold child nodes if necessary */
-      if (nnode+2 >= nalloc) {
-	if (!(nodelist = (unsigned long *) 
-	      realloc(nodelist, 2*nalloc*sizeof(unsigned long)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	if (!(nodepdf = (double *) 
-	      realloc(nodepdf, 2*nalloc*sizeof(double)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	nalloc *= 2;
-      }
-
       /* If children are not leaves, and their maximum contribution to
 	 the PDF is not 0 (possible due to roundoff, or if the kernel
-	 is compact), push them onto the node list */
-      if (leftpdf > 0.0) {
-	nodelist[nnode] = lchild;
-	nodepdf[nnode] = leftpdf;
-	nnode++;
-      }
-      if (rightpdf > 0.0) {
-	nodelist[nnode] = rchild;
-	nodepdf[nnode] = rightpdf;
-	nnode++;
-      }
+	 is compact), push them onto the frontier */
+      if (leftpdf > 0.0)
+	kd_frontier_push(frontier, lchild, leftpdf, leftpdf);
+      if (rightpdf > 0.0)
+	kd_frontier_push(frontier, rchild, rightpdf, rightpdf);
 
       /* Bail out if there are no non-leaf nodes left to be
 	 analyzed. This should also give abserr = 0, and thus
@@ -832,13 +726,9 @@ void kd_pdf_int_grid(const kernel_density *kd, const double *xfixed,
 	 condition. However, this can sometimes fail due to roundoff
 	 error if abstol and reltol are both very small, so this is a
 	 backstop. */
-      if (nnode == 0) break;
+      if (frontier->n == 0) break;
     }
   }
-
-  /* Free memory */
-  if (nodelist != NULL) free(nodelist);
-  if (nodepdf != NULL) free(nodepdf);
 }
 
 
@@ -858,13 +748,15 @@ void kd_pdf_int_reggrid(const kernel_density *kd, const double *xfixed,
 			double *pdf)
 {
   unsigned long i, j;
-  unsigned long nalloc=0, nnode, ptr, lchild, rchild, ndim_int;
+  unsigned long lchild, rchild, ndim_int;
   unsigned long ngridtot, nstenciltot, fixedptr, outptr;
-  unsigned long *nodelist = NULL, *nstencil;
+  unsigned long *nstencil;
+  kd_frontier *frontier;
+  kd_frontier_node cur;
+  kd_tally pdfmaxsum;
   double *dxgrid;
-  double *nodepdf = NULL;
   double hprod, ds_n, fac;
-  double maxerr, relerr = 0.0, pdfmax, leftpdf, rightpdf;
+  double relerr = 0.0, pdfmax, leftpdf, rightpdf;
 
   /* Pre-compute constant factor in the integrals we're evaluating;
      this is the part that depends only on h and the number of
@@ -966,51 +858,28 @@ void kd_pdf_int_reggrid(const kernel_density *kd, const double *xfixed,
     /* If root node is a leaf, we're done. Go to next fixed point. */
     if (kd->tree->tree[ROOT].splitdim == -1) continue;
 
-    /* More common case where root node is not a leaf */
-
-    /* Allocate memory for node list if necessary */
-    if (nalloc == 0) {
-      if (!(nodelist = (unsigned long *) 
-	    calloc(NODEBLOCKSIZE, sizeof(unsigned long)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int_grid\n");
-	exit(1);
-      }
-      if (!(nodepdf = (double *) 
-	    malloc(NODEBLOCKSIZE*sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int_grid\n");
-	exit(1);
-      }
-      nalloc = NODEBLOCKSIZE;  
-    }
-
-    /* Push root node onto the node list */
-    nodelist[0] = ROOT;
-    nodepdf[0] = pdfmax;
-    nnode = 1;
+    /* More common case where root node is not a leaf: push the root
+       onto the frontier, keyed by its maximum possible contribution
+       to the PDF, and initialize the running sum of the maximum
+       possible contribution from unopened nodes */
+    frontier = kd_frontier_get();
+    kd_frontier_push(frontier, ROOT, pdfmax, pdfmax);
+    pdfmaxsum.sum = pdfmax;
+    pdfmaxsum.c = 0.0;
 
     /* Now proceed through the tree, identifying the nodes that are
        contributing the most error and recursively opening them. */
     while (1) {
 
-      /* Find the node that is contributing the most error. */
-      maxerr = nodepdf[0];
-      ptr = 0;
-      for (j=1; j<nnode; j++) {
-	if (nodepdf[j] > maxerr) {
-	  ptr = j;
-	  maxerr = nodepdf[j];
-	}
-      }
-
-      /* Subtract this node's contribution to the maximum possible PDF
-	 contribution from unopened nodes. Enforce positivity to avoid
-	 spurious negative results coming from roundoff error. */
-      pdfmax -= nodepdf[ptr];
-      if (pdfmax < 0) pdfmax = 0.0;
+      /* Remove the node that is contributing the most error from the
+	 frontier, and subtract its contribution to the maximum
+	 possible PDF contribution from unopened nodes */
+      cur = kd_frontier_pop(frontier);
+      kd_tally_add(&pdfmaxsum, -cur.key);
 
       /* Compute estimates for this node's children */
-      lchild = LEFT(nodelist[ptr]);
-      rchild = RIGHT(nodelist[ptr]);
+      lchild = LEFT(cur.node);
+      rchild = RIGHT(cur.node);
       leftpdf = 
 	kd_pdf_node_int_reggrid(kd, xfixed+fixedptr, dimfixed, ndimfixed, 
 				xgridlo, dxgrid, ngrid, nstencil,
@@ -1024,8 +893,12 @@ void kd_pdf_int_reggrid(const kernel_density *kd, const double *xfixed,
 				ndimgrid, ndim_int, fac, rchild, 
 				pdf+outptr);
 
-      /* Get new maximum contribution to PDF from unopened nodes */
-      pdfmax += leftpdf + rightpdf;
+      /* Get new maximum contribution to PDF from unopened
+	 nodes. Enforce positivity to avoid spurious negative results
+	 coming from roundoff error. */
+      kd_tally_add(&pdfmaxsum, leftpdf + rightpdf);
+      pdfmax = kd_tally_val(&pdfmaxsum);
+      if (pdfmax < 0) pdfmax = 0.0;
 
       /* Check for termination on absolute error. Note that we can
 	 save a factor of 2 by adding half the upper limit on the
@@ -1046,42 +919,13 @@ void kd_pdf_int_reggrid(const kernel_density *kd, const double *xfixed,
 	break;
       }
 
-      /* If we're here, we haven't converged yet. Remove the node we
-	 just analyzed from the list. */
-      for (j=ptr; j<nnode-1; j++) {
-	nodelist[j] = nodelist[j+1];
-	nodepdf[j] = nodepdf[j+1];
-      }
-      nnode--;
-
-      /* Allocate more memory to hold child nodes if necessary */
-      if (nnode+2 >= nalloc) {
-	if (!(nodelist = (unsigned long *) 
-	      realloc(nodelist, 2*nalloc*sizeof(unsigned long)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	if (!(nodepdf = (double *) 
-	      realloc(nodepdf, 2*nalloc*sizeof(double)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	nalloc *= 2;
-      }
-
       /* If children are not leaves, and their maximum contribution to
 	 the PDF is not 0 (possible due to roundoff, or if the kernel
-	 is compact), push them onto the node list */
-      if (leftpdf > 0.0) {
-	nodelist[nnode] = lchild;
-	nodepdf[nnode] = leftpdf;
-	nnode++;
-      }
-      if (rightpdf > 0.0) {
-	nodelist[nnode] = rchild;
-	nodepdf[nnode] = rightpdf;
-	nnode++;
-      }
+	 is compact), push them onto the frontier */
+      if (leftpdf > 0.0)
+	kd_frontier_push(frontier, lchild, leftpdf, leftpdf);
+      if (rightpdf > 0.0)
+	kd_frontier_push(frontier, rchild, rightpdf, rightpdf);
 
       /* Bail out if there are no non-leaf nodes left to be
 	 analyzed. This should also give abserr = 0, and thus
@@ -1089,13 +933,11 @@ void kd_pdf_int_reggrid(const kernel_density *kd, const double *xfixed,
 	 condition. However, this can sometimes fail due to roundoff
 	 error if abstol and reltol are both very small, so this is a
 	 backstop. */
-      if (nnode == 0) break;
+      if (frontier->n == 0) break;
     }
   }
 
   /* Free memory */
-  if (nodelist != NULL) free(nodelist);
-  if (nodepdf != NULL) free(nodepdf);
   free(dxgrid);
   free(nstencil);
 }
@@ -1118,12 +960,14 @@ void kd_pdf_reggrid(const kernel_density *kd, const double *xfixed,
 		    double *pdf)
 {
   unsigned long i, j;
-  unsigned long nalloc=0, nnode, ptr, lchild, rchild;
+  unsigned long lchild, rchild;
   unsigned long ngridtot, nstenciltot, fixedptr, outptr;
-  unsigned long *nodelist = NULL, *nstencil;
+  unsigned long *nstencil;
+  kd_frontier *frontier;
+  kd_frontier_node cur;
+  kd_tally pdfmaxsum;
   double *dxgrid;
-  double *nodepdf = NULL;
-  double relerr = 0.0, maxerr;
+  double relerr = 0.0;
   double pdfmax, leftpdf, rightpdf;
 
   /* Figure out the total number of points in the grid */
@@ -1199,51 +1043,28 @@ void kd_pdf_reggrid(const kernel_density *kd, const double *xfixed,
     /* If root node is a leaf, we're done. Go to next fixed point. */
     if (kd->tree->tree[ROOT].splitdim == -1) continue;
 
-    /* More common case where root node is not a leaf */
-
-    /* Allocate memory for node list if necessary */
-    if (nalloc == 0) {
-      if (!(nodelist = (unsigned long *) 
-	    calloc(NODEBLOCKSIZE, sizeof(unsigned long)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	exit(1);
-      }
-      if (!(nodepdf = (double *) 
-	    calloc(NODEBLOCKSIZE, sizeof(double)))) {
-	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	exit(1);
-      }
-      nalloc = NODEBLOCKSIZE;  
-    }
-
-    /* Push root node onto the node list */
-    nodelist[0] = ROOT;
-    nodepdf[0] = pdfmax;
-    nnode = 1;
+    /* More common case where root node is not a leaf: push the root
+       onto the frontier, keyed by its maximum possible contribution
+       to the PDF, and initialize the running sum of the maximum
+       possible contribution from unopened nodes */
+    frontier = kd_frontier_get();
+    kd_frontier_push(frontier, ROOT, pdfmax, pdfmax);
+    pdfmaxsum.sum = pdfmax;
+    pdfmaxsum.c = 0.0;
 
     /* Now proceed through the tree, identifying the nodes that are
        contributing the most error and recursively opening them. */
     while (1) {
 
-      /* Find the node that is contributing the most error. */
-      maxerr = nodepdf[0];
-      ptr = 0;
-      for (j=1; j<nnode; j++) {
-	if (nodepdf[j] > maxerr) {
-	  ptr = j;
-	  maxerr = nodepdf[j];
-	}
-      }
-
-      /* Subtract this node's contribution to the maximum possible PDF
-	 contribution from unopened nodes. Enforce positivity to avoid
-	 spurious negative results coming from roundoff error. */
-      pdfmax -= nodepdf[ptr];
-      if (pdfmax < 0) pdfmax = 0.0;
+      /* Remove the node that is contributing the most error from the
+	 frontier, and subtract its contribution to the maximum
+	 possible PDF contribution from unopened nodes */
+      cur = kd_frontier_pop(frontier);
+      kd_tally_add(&pdfmaxsum, -cur.key);
 
       /* Compute estimates for this node's children */
-      lchild = LEFT(nodelist[ptr]);
-      rchild = RIGHT(nodelist[ptr]);
+      lchild = LEFT(cur.node);
+      rchild = RIGHT(cur.node);
       leftpdf = kd_pdf_node_reggrid(kd, xfixed+fixedptr, dimfixed, 
 				    ndimfixed, xgridlo, dxgrid, ngrid,
 				    nstencil, ngridtot, nstenciltot, 
@@ -1253,8 +1074,12 @@ void kd_pdf_reggrid(const kernel_density *kd, const double *xfixed,
 				     nstencil, ngridtot, nstenciltot, 
 				     dimgrid, ndimgrid, rchild, pdf+outptr);
 
-      /* Get new maximum contribution to PDF from unopened nodes */
-      pdfmax += leftpdf + rightpdf;
+      /* Get new maximum contribution to PDF from unopened
+	 nodes. Enforce positivity to avoid spurious negative results
+	 coming from roundoff error. */
+      kd_tally_add(&pdfmaxsum, leftpdf + rightpdf);
+      pdfmax = kd_tally_val(&pdfmaxsum);
+      if (pdfmax < 0) pdfmax = 0.0;
 
       /* Check for termination on absolute error. Note that we can
 	 save a factor of 2 by adding half the upper limit on the
@@ -1275,42 +1100,13 @@ void kd_pdf_reggrid(const kernel_density *kd, const double *xfixed,
 	break;
       }
 
-      /* If we're here, we haven't converged yet. Remove the node we
-	 just analyzed from the list. */
-      for (j=ptr; j<nnode-1; j++) {
-	nodelist[j] = nodelist[j+1];
-	nodepdf[j] = nodepdf[j+1];
-      }
-      nnode--;
-
-      /* Allocate more memory to hold child nodes if necessary */
-      if (nnode+2 >= nalloc) {
-	if (!(nodelist = (unsigned long *) 
-	      realloc(nodelist, 2*nalloc*sizeof(unsigned long)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	if (!(nodepdf = (double *) 
-	      realloc(nodepdf, 2*nalloc*sizeof(double)))) {
-	  fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_grid\n");
-	  exit(1);
-	}
-	nalloc *= 2;
-      }
-
       /* If children are not leaves, and their maximum contribution to
 	 the PDF is not 0 (possible due to roundoff, or if the kernel
-	 is compact), push them onto the node list */
-      if (leftpdf > 0.0) {
-	nodelist[nnode] = lchild;
-	nodepdf[nnode] = leftpdf;
-	nnode++;
-      }
-      if (rightpdf > 0.0) {
-	nodelist[nnode] = rchild;
-	nodepdf[nnode] = rightpdf;
-	nnode++;
-      }
+	 is compact), push them onto the frontier */
+      if (leftpdf > 0.0)
+	kd_frontier_push(frontier, lchild, leftpdf, leftpdf);
+      if (rightpdf > 0.0)
+	kd_frontier_push(frontier, rchild, rightpdf, rightpdf);
 
       /* Bail out if there are no non-leaf nodes left to be
 	 analyzed. This should also give abserr = 0, and thus
@@ -1318,18 +1114,102 @@ void kd_pdf_reggrid(const kernel_density *kd, const double *xfixed,
 	 condition. However, this can sometimes fail due to roundoff
 	 error if abstol and reltol are both very small, so this is a
 	 backstop. */
-      if (nnode == 0) break;
+      if (frontier->n == 0) break;
     }
   }
 
   /* Free memory */
-  if (nodelist != NULL) free(nodelist);
-  if (nodepdf != NULL) free(nodepdf);
   free(dxgrid);
   free(nstencil);
 }
 
 
+#ifdef KD_SOA
+/*********************************************************************/
+/* Function to sum the contributions of the points in a leaf to the  */
+/* PDF, using the SoA copy of the leaf data. The distances to all    */
+/* points are computed first, and the kernel is then evaluated in a  */
+/* separate loop for each kernel type, so that both loops vectorize. */
+/* If integrated is true, the kernel is the one that results from    */
+/* integrating over ndim_int dimensions, as in kd_pdf_node_int. The  */
+/* return value is not normalized.                                   */
+/*********************************************************************/
+static inline
+double kd_leaf_sum_soa(const kernel_density *kd, const double *x,
+		       const unsigned long *dims, const unsigned long ndim,
+		       const unsigned long ndim_int, const bool integrated,
+		       const unsigned long curnode) {
+  const unsigned long npt = kd->tree->tree[curnode].npt;
+  const double *wgtleaf = (const double *) kd->tree->tree[curnode].dptr;
+  const double epow = integrated ? 1.0+0.5*ndim_int : 1.0;
+  const double tpow = 0.5*ndim_int;
+  double d2[KD_SOA_BLOCK];
+  double sum = 0.0;
+
+  /* Work through the leaf a block at a time */
+  for (unsigned long first=0; first<npt; first+=KD_SOA_BLOCK) {
+    const unsigned long n =
+      npt-first < KD_SOA_BLOCK ? npt-first : KD_SOA_BLOCK;
+    const double *wgt = wgtleaf ? wgtleaf+first : NULL;
+
+    /* Get distances in units of the kernel size */
+    leaf_dist2_soa(kd->tree, curnode, first, n, x, dims, ndim, kd->h, d2);
+
+    /* Sum contributions */
+    switch (kd->ktype) {
+    case epanechnikov: {
+      if (integrated) {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += d2[i] < 1 ?
+	    (wgt ? wgt[i] : 1.0) * pow(1.0-d2[i], epow) : 0.0;
+      } else if (wgt) {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += d2[i] < 1 ? wgt[i] * (1.0-d2[i]) : 0.0;
+      } else {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += d2[i] < 1 ? 1.0-d2[i] : 0.0;
+      }
+      break;
+    }
+    case tophat: {
+      if (integrated) {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += d2[i] < 1 ?
+	    (wgt ? wgt[i] : 1.0) * pow(1.0-d2[i], tpow) : 0.0;
+      } else if (wgt) {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += d2[i] < 1 ? wgt[i] : 0.0;
+      } else {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += d2[i] < 1 ? 1.0 : 0.0;
+      }
+      break;
+    }
+    case gaussian: {
+      if (wgt) {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += wgt[i] * exp(-d2[i]/2.0);
+      } else {
+#pragma omp simd reduction(+:sum)
+	for (unsigned long i=0; i<n; i++)
+	  sum += exp(-d2[i]/2.0);
+      }
+      break;
+    }
+    }
+  }
+  return sum;
+}
+#endif
+
+
 /*********************************************************************/
 /* Function to estimate the contribution to a PDF from a node, and   */
 /* the error on it; if the input node is a leaf, the routine         */
@@ -1343,13 +1223,20 @@ inline
 void kd_pdf_node(const kernel_density *kd, const double *x,
 		 const unsigned long curnode, double *pdf,
 		 double *pdferr) {
+#ifndef KD_SOA
   unsigned long i;
+#endif
   unsigned long ndim = kd->tree->ndim;
   double d2, pdfmin = 0.0, pdfmax = 0.0;
 
   /* Is this node a leaf? If so, just sum over it and return that */
   if (kd->tree->tree[curnode].splitdim == -1) {
 
+#ifdef KD_SOA
+    /* Get the distances to all points in the leaf from the SoA copy
+       of the data, then sum the contributions of the points */
+    *pdf = kd_leaf_sum_soa(kd, x, NULL, ndim, 0, false, curnode);
+#else
     /* Loop over points, summing their contribution */
     *pdf = 0.0;
     for (i=0; i<kd->tree->tree[curnode].npt; i++) {
@@ -1397,6 +1284,7 @@ void kd_pdf_node(const kernel_density *kd, const double *x,
       }
 
     }
+#endif
 
     /* Normalize pdf, set error to zero */
     *pdf *= kd->norm_tot;
@@ -1489,17 +1377,16 @@ double kd_pdf_node_grid(const kernel_density *kd, const double *xfixed,
     for (i=0; i<kd->tree->tree[curnode].npt; i++) {
 
       /* Get distance in the fixed dimensions */
-      d2fixed = dist2(&(kd->tree->tree[curnode].x[ndim_tot*i]),
-		      xfixed, ndim_tot, ndimfixed,
-		      NULL, dimfixed, kd->h, ndim_tot);
+      d2fixed = kd_leaf_dist2(kd->tree, curnode, i, xfixed,
+				dimfixed, ndimfixed, kd->h);
 
       /* Loop over the points in the grid */
       for (j=0; j<ngrid; j++) {
 
 	/* Get distance in the grid dimensions */
-	d2grid = dist2(&(kd->tree->tree[curnode].x[ndim_tot*i]),
-		       xgrid+j*ndimgrid, ndim_tot, ndimgrid,
-		       NULL, dimgrid, kd->h, ndim_tot);
+	d2grid = kd_leaf_dist2(kd->tree, curnode, i,
+			       xgrid+j*ndimgrid, dimgrid, ndimgrid,
+			       kd->h);
 
 	/* Sum distances and get contribution to the PDF of this
 	   point */
@@ -1586,13 +1473,19 @@ void kd_pdf_node_int(const kernel_density *kd, const double *x,
 		     const unsigned long ndim_int, const double fac,
 		     const unsigned long curnode, double *pdf,
 		     double *pdferr) {
+#ifndef KD_SOA
   unsigned long i;
+#endif
   unsigned long ndim_tot = kd->tree->ndim;
   double d2, pdfmin = 0.0, pdfmax = 0.0;
 
   /* Is this node a leaf? If so, just sum over it and return that */
   if (kd->tree->tree[curnode].splitdim == -1) {
 
+#ifdef KD_SOA
+    /* Sum using the SoA copy of the data, as in kd_pdf_node */
+    *pdf = kd_leaf_sum_soa(kd, x, dims, ndim, ndim_int, true, curnode);
+#else
     /* Loop over points, summing their contribution */
     *pdf = 0.0;
     for (i=0; i<kd->tree->tree[curnode].npt; i++) {
@@ -1640,6 +1533,7 @@ void kd_pdf_node_int(const kernel_density *kd, const double *x,
       }
 
     }
+#endif
 
     /* Normalize and return */
     *pdf *= fac * kd->norm_tot;
@@ -1738,17 +1632,16 @@ double kd_pdf_node_int_grid(const kernel_density *kd,
     for (i=0; i<kd->tree->tree[curnode].npt; i++) {
 
       /* Get distance in the fixed dimensions */
-      d2fixed = dist2(&(kd->tree->tree[curnode].x[ndim_tot*i]),
-		      xfixed, ndim_tot, ndimfixed,
-		      NULL, dimfixed, kd->h, ndim_tot);
+      d2fixed = kd_leaf_dist2(kd->tree, curnode, i, xfixed,
+				dimfixed, ndimfixed, kd->h);
 
       /* Loop over the points in the grid */
       for (j=0; j<ngrid; j++) {
 
 	/* Get distance in the grid dimensions */
-	d2grid = dist2(&(kd->tree->tree[curnode].x[ndim_tot*i]),
-		       xgrid+j*ndimgrid, ndim_tot, ndimgrid,
-		       NULL, dimgrid, kd->h, ndim_tot);
+	d2grid = kd_leaf_dist2(kd->tree, curnode, i,
+			       xgrid+j*ndimgrid, dimgrid, ndimgrid,
+			       kd->h);
 
 	/* Sum distances and get contribution to the PDF of this
 	   point */
@@ -1881,9 +1774,8 @@ double kd_pdf_node_int_reggrid(const kernel_density *kd,
     for (i=0; i<kd->tree->tree[curnode].npt; i++) {
 
       /* Get distance in the fixed dimensions */
-      d2fixed = dist2(&(kd->tree->tree[curnode].x[ndim_tot*i]),
-		      xfixed, ndim_tot, ndimfixed,
-		      NULL, dimfixed, kd->h, ndim_tot);
+      d2fixed = kd_leaf_dist2(kd->tree, curnode, i, xfixed,
+				dimfixed, ndimfixed, kd->h);
 
       /* Initialize the offset array */
       for (j=0; j<ndimgrid; j++) offset[j] = -nstencil[j];
@@ -1891,17 +1783,17 @@ double kd_pdf_node_int_reggrid(const kernel_density *kd,
       /* Figure out which grid cell this point lands in */
       for (j=0; j<ndimgrid; j++)
 	ctr[j] = (int) 
-	  round((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[j]] - 
+	  round((kd_coord(kd->tree, curnode, i, dimgrid[j]) - 
 		 xgridlo[j]) / dxgrid[j]);
 
       /* Initialize the d2grid array at the lower left corner of the
 	 stencil grid */
       for (j=0; j<ndimgrid; j++)
 	d2grid[j] = 
-	  ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[j]] -
+	  ((kd_coord(kd->tree, curnode, i, dimgrid[j]) -
 	    (xgridlo[j] + (ctr[j]+offset[j])*dxgrid[j]))
 	   / kd->h[dimgrid[j]]) *
-	  ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[j]] -
+	  ((kd_coord(kd->tree, curnode, i, dimgrid[j]) -
 	    (xgridlo[j] + (ctr[j]+offset[j])*dxgrid[j]))
 	   / kd->h[dimgrid[j]]);
 
@@ -1979,10 +1871,10 @@ double kd_pdf_node_int_reggrid(const kernel_density *kd,
 	  offset[k]++;
 	  if (offset[k] > (int) nstencil[k]) offset[k] = -(int) nstencil[k];
 	  d2grid[k] = 
-	    ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[k]] -
+	    ((kd_coord(kd->tree, curnode, i, dimgrid[k]) -
 	      (xgridlo[k] + (ctr[k]+offset[k])*dxgrid[k]))
 	     / kd->h[dimgrid[k]]) *
-	    ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[k]] -
+	    ((kd_coord(kd->tree, curnode, i, dimgrid[k]) -
 	      (xgridlo[k] + (ctr[k]+offset[k])*dxgrid[k]))
 	     / kd->h[dimgrid[k]]);
 	  if (offset[k] != -(int) nstencil[k]) break;
@@ -2083,9 +1975,8 @@ double kd_pdf_node_reggrid(const kernel_density *kd,
     for (i=0; i<kd->tree->tree[curnode].npt; i++) {
 
       /* Get distance in the fixed dimensions */
-      d2fixed = dist2(&(kd->tree->tree[curnode].x[ndim_tot*i]),
-		      xfixed, ndim_tot, ndimfixed,
-		      NULL, dimfixed, kd->h, ndim_tot);
+      d2fixed = kd_leaf_dist2(kd->tree, curnode, i, xfixed,
+				dimfixed, ndimfixed, kd->h);
 
       /* Initialize the offset array */
       for (j=0; j<ndimgrid; j++) offset[j] = -nstencil[j];
@@ -2093,17 +1984,17 @@ double kd_pdf_node_reggrid(const kernel_density *kd,
       /* Figure out which grid cell this point lands in */
       for (j=0; j<ndimgrid; j++)
 	ctr[j] = (int) 
-	  round((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[j]] - 
+	  round((kd_coord(kd->tree, curnode, i, dimgrid[j]) - 
 		 xgridlo[j]) / dxgrid[j]);
 
       /* Initialize the d2grid array at the lower left corner of the
 	 stencil grid */
       for (j=0; j<ndimgrid; j++)
 	d2grid[j] = 
-	  ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[j]] -
+	  ((kd_coord(kd->tree, curnode, i, dimgrid[j]) -
 	    (xgridlo[j] + (ctr[j]+offset[j])*dxgrid[j]))
 	   / kd->h[dimgrid[j]]) *
-	  ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[j]] -
+	  ((kd_coord(kd->tree, curnode, i, dimgrid[j]) -
 	    (xgridlo[j] + (ctr[j]+offset[j])*dxgrid[j]))
 	   / kd->h[dimgrid[j]]);
 
@@ -2176,10 +2067,10 @@ double kd_pdf_node_reggrid(const kernel_density *kd,
 	  offset[k]++;
 	  if (offset[k] > (int) nstencil[k]) offset[k] = -(int) nstencil[k];
 	  d2grid[k] = 
-	    ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[k]] -
+	    ((kd_coord(kd->tree, curnode, i, dimgrid[k]) -
 	      (xgridlo[k] + (ctr[k]+offset[k])*dxgrid[k]))
 	     / kd->h[dimgrid[k]]) *
-	    ((kd->tree->tree[curnode].x[ndim_tot*i+dimgrid[k]] -
+	    ((kd_coord(kd->tree, curnode, i, dimgrid[k]) -
 	      (xgridlo[k] + (ctr[k]+offset[k])*dxgrid[k]))
 	     / kd->h[dimgrid[k]]);
 	  if (offset[k] != -(int) nstencil[k]) break;
@@ -2235,6 +2126,7 @@ void kd_pdf_int_vec(const kernel_density *kd,
 		    const unsigned long npt,
 		    const double reltol, 
 		    const double abstol,
+		    const unsigned int nthread,
 		    double *pdf
 #ifdef DIAGNOSTIC
 		    , unsigned long *nodecheck,
@@ -2243,23 +2135,17 @@ void kd_pdf_int_vec(const kernel_density *kd,
 #endif
 		    ) {
 
-  unsigned long i, j;
-  kernel_density kd_tmp;
-  double *bw_tmp;
-  
   if (!bandwidth) {
 
     /* Case with constant bandwidth */
-#pragma omp parallel private(i)
-    {
-#pragma omp for
-      for (i=0; i<npt; i++) {
-	pdf[i] = kd_pdf_int(kd, x+i*ndim, dims, ndim, reltol, abstol
+#pragma omp parallel for schedule(dynamic, KD_VEC_CHUNK) \
+  num_threads(KD_NTHREAD(nthread))
+    for (unsigned long i=0; i<npt; i++) {
+      pdf[i] = kd_pdf_int(kd, x+i*ndim, dims, ndim, reltol, abstol
 #ifdef DIAGNOSTIC
-			    , nodecheck+i, leafcheck+i, termcheck+i
+			  , nodecheck+i, leafcheck+i, termcheck+i
 #endif
-			    );
-      }
+			  );
     }
 
   } else {
@@ -2268,34 +2154,44 @@ void kd_pdf_int_vec(const kernel_density *kd,
        is that, in parallel, each thread needs to have a version of
        the kernel_density object that is identical to the original
        except for the values of kd->h, kd->norm, and kd->norm_tot. To
-       accomplish this, we first copy kd to a temporary variable
-       kd_tmp outside the loop; we declare that this variable is
-       private inside the loop. Then each time we go through the loop
-       we point kd_tmp.h to a newly-allocated array, whose value we
-       are free to change without interfering with the other threads. */
-#pragma omp parallel for private(i, j, kd_tmp, bw_tmp)
-    for (i=0; i<npt; i++) {
-	
-      /* Make our private copy of kd, and allocate memory for its
-	 bandwidth array; also allocate memory for a temporary
-	 bandwidth array, and initialize it. */
-      kd_tmp = *kd;
-      kd_tmp.h = calloc(kd->tree->ndim, sizeof(double));
-      bw_tmp = calloc(kd->tree->ndim, sizeof(double));
-      for (j=0; j<ndim; j++) bw_tmp[j] = kd->h[j];
-
-      /* Change bandwidth in our private copy of kd; note that we
-	 have to properly map the input bandwidth, which is missing
-	 certain dimensions, to the dimensions that remain */
-      for (j=0; j<ndim; j++) bw_tmp[dims[j]] = bandwidth[i*ndim+j];
-      kd_change_bandwidth(bw_tmp, &kd_tmp);
-
-      /* Evauluate the PDF with the modified bandwidth */
-      pdf[i] = kd_pdf_int(&kd_tmp, x+i*ndim, dims, ndim, reltol, abstol
+       accomplish this, each thread makes its own copy kd_tmp of kd,
+       with its own bandwidth array, whose value it is free to change
+       without interfering with the other threads. The copy and the
+       scratch bandwidth array are allocated once per thread and
+       reused for every point that thread handles. */
+#pragma omp parallel num_threads(KD_NTHREAD(nthread))
+    {
+      kernel_density kd_tmp = *kd;
+      double *bw_tmp;
+      if (!(kd_tmp.h = calloc(kd->tree->ndim, sizeof(double))) ||
+	  !(bw_tmp = calloc(kd->tree->ndim, sizeof(double)))) {
+	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_int_vec\n");
+	exit(1);
+      }
+      for (unsigned long j=0; j<kd->tree->ndim; j++) bw_tmp[j] = kd->h[j];
+
+#pragma omp for schedule(dynamic, KD_VEC_CHUNK)
+      for (unsigned long i=0; i<npt; i++) {
+
+	/* Change bandwidth in our private copy of kd; note that we
+	   have to properly map the input bandwidth, which is missing
+	   certain dimensions, to the dimensions that remain. The
+	   normalizations are reset from the original first, since
+	   kd_change_bandwidth rescales them, and we want the result
+	   not to depend on which points this thread did before. */
+	for (unsigned long j=0; j<ndim; j++)
+	  bw_tmp[dims[j]] = bandwidth[i*ndim+j];
+	kd_tmp.norm = kd->norm;
+	kd_tmp.norm_tot = kd->norm_tot;
+	kd_change_bandwidth(bw_tmp, &kd_tmp);
+
+	/* Evauluate the PDF with the modified bandwidth */
+	pdf[i] = kd_pdf_int(&kd_tmp, x+i*ndim, dims, ndim, reltol, abstol
 #ifdef DIAGNOSTIC
-			  , nodecheck+i, leafcheck+i, termcheck+i
+			    , nodecheck+i, leafcheck+i, termcheck+i
 #endif
-			  );
+			    );
+      }
 
       /* Free the local storage we allocated */
       free(kd_tmp.h);
@@ -2315,6 +2211,7 @@ void kd_pdf_vec(const kernel_density *kd,
 		const unsigned long npt,
 		const double reltol,
 		const double abstol,
+		const unsigned int nthread,
 		double *pdf
 #ifdef DIAGNOSTIC
 		, unsigned long *nodecheck,
@@ -2323,59 +2220,323 @@ void kd_pdf_vec(const kernel_density *kd,
 #endif
 		) {
 
-  kernel_density kd_tmp;
-
   if (!bandwidth) {
 
     /* Case with constant bandwidth */
-    /*#pragma omp parallel private(i)*/
+#pragma omp parallel for schedule(dynamic, KD_VEC_CHUNK) \
+  num_threads(KD_NTHREAD(nthread))
+    for (unsigned long i=0; i<npt; i++) {
+      pdf[i] = kd_pdf(kd, x+i*kd->tree->ndim, reltol, abstol
+#ifdef DIAGNOSTIC
+		      , nodecheck+i, leafcheck+i, termcheck+i
+#endif
+		      );
+    }
+
+  } else {
+
+    /* Case with varying bandwidth. As in kd_pdf_int_vec, each thread
+       keeps a private copy kd_tmp of kd with its own bandwidth array,
+       allocated once per thread, which it changes to whatever
+       bandwidth each point requires. */
+#pragma omp parallel num_threads(KD_NTHREAD(nthread))
     {
-#pragma omp parallel for
+      kernel_density kd_tmp = *kd;
+      if (!(kd_tmp.h = calloc(kd->tree->ndim, sizeof(double)))) {
+	fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_vec\n");
+	exit(1);
+      }
+
+#pragma omp for schedule(dynamic, KD_VEC_CHUNK)
       for (unsigned long i=0; i<npt; i++) {
-	pdf[i] = kd_pdf(kd, x+i*kd->tree->ndim, reltol, abstol
+
+	/* Change bandwidth in our private copy of kd, starting from
+	   the original normalizations */
+	kd_tmp.norm = kd->norm;
+	kd_tmp.norm_tot = kd->norm_tot;
+	kd_change_bandwidth(bandwidth+i*kd->tree->ndim, &kd_tmp);
+
+	/* Evauluate the PDF with the modified bandwidth */
+	pdf[i] = kd_pdf(&kd_tmp, x+i*kd->tree->ndim, reltol, abstol
 #ifdef DIAGNOSTIC
 			, nodecheck+i, leafcheck+i, termcheck+i
 #endif
 			);
       }
+
+      /* Free the local storage we allocated */
+      free(kd_tmp.h);
     }
+  }
+}
 
-  } else {
 
-    /* Case with varying bandwidth. The only part that is tricky here
-       is that, in parallel, each thread needs to have a version of
-       the kernel_density object that is identical to the original
-       except for the values of kd->h, kd->norm, and kd->norm_tot. To
-       accomplish this, we maintain a privde kd_tmp variable, which we
-       populate by copying from the global one, allocating memory for
-       a private bandwidth copy, and then changing that private copy
-       to have whatever bandwidth we need. */
-#pragma omp parallel for private(kd_tmp)
-    for (unsigned long i=0; i<npt; i++) {
-	
-      /* Make our private copy of kd, and allocate memory for its
-	 bandwidth array */
-      kd_tmp = *kd;
-      kd_tmp.h = calloc(kd->tree->ndim, sizeof(double));
+/*********************************************************************/
+/* Dual-tree evaluation of the PDF at many points                    */
+/*********************************************************************/
+
+/* The query points are divided into KD_DUAL_NBLOCK subtrees of the
+   query tree, which are evaluated independently and in parallel. The
+   number is fixed rather than tied to the number of threads, so that
+   the results do not depend on the number of threads. */
+#define KD_DUAL_NBLOCK 64
+
+/* Size of a node's bounding box, measured as its squared diagonal in
+   units of the kernel size */
+static inline
+double kd_box_size2(const KDnode *node, const double *h,
+		    const unsigned long ndim) {
+  unsigned long i;
+  double tmp, size2 = 0.0;
+  for (i=0; i<ndim; i++) {
+    tmp = (node->xbnd[1][i] - node->xbnd[0][i]) / h[i];
+    size2 += tmp*tmp;
+  }
+  return(size2);
+}
+
+/* Analog of kd_pdf_node for a box of query points rather than a
+   single point: returns the average of the minimum and maximum
+   possible contributions of a node to the PDF at any point in the
+   box, and half their difference as the error. This is done for
+   leaves as well as for interior nodes. */
+static inline
+void kd_pdf_node_box(const kernel_density *kd, const double *qbox[2],
+		     const unsigned long curnode, double *pdf,
+		     double *pdferr) {
+  unsigned long ndim = kd->tree->ndim;
+  double d2, pdfmin = 0.0, pdfmax = 0.0;
+  double wgt = kd->nodewgt[curnode] * kd->norm_tot;
+
+  /* Get minimum distance in units of the kernel size, and the PDF
+     evaluated at that distance */
+  d2 = box_box_min_dist2(qbox, 
+			 (const double **) kd->tree->tree[curnode].xbnd,
+			 kd->h, ndim);
+  switch (kd->ktype) {
+  case epanechnikov: {
+    pdfmax = d2 < 1.0 ? wgt * (1.0 - d2) : 0.0;
+    break;
+  }
+  case tophat: {
+    pdfmax = d2 < 1.0 ? wgt : 0.0;
+    break;
+  }
+  case gaussian: {
+    pdfmax = wgt * exp(-d2/2.0);
+    break;
+  }
+  }
+
+  /* Same for maximum distance */
+  d2 = box_box_max_dist2(qbox, 
+			 (const double **) kd->tree->tree[curnode].xbnd,
+			 kd->h, ndim);
+  switch (kd->ktype) {
+  case epanechnikov: {
+    pdfmin = d2 < 1.0 ? wgt * (1.0 - d2) : 0.0;
+    break;
+  }
+  case tophat: {
+    pdfmin = d2 < 1.0 ? wgt : 0.0;
+    break;
+  }
+  case gaussian: {
+    pdfmin = wgt * exp(-d2/2.0);
+    break;
+  }
+  }
 
-      /* Change bandwidth in our private copy of kd  */
-      kd_change_bandwidth(bandwidth+i*kd->tree->ndim, &kd_tmp);
+  /* Set estimate and error */
+  *pdf = (pdfmin + pdfmax) / 2.0;
+  *pdferr = (pdfmax - pdfmin) / 2.0;
+}
 
-      /* Evauluate the PDF with the modified bandwidth */
-      pdf[i] = kd_pdf(&kd_tmp, x+i*kd->tree->ndim, reltol, abstol
+/* Evaluate the PDF at all the points in a node of the query tree.
+   On entry, parent holds the frontier of reference nodes that was
+   reached for the parent query node; every point in the query node
+   receives the contribution of every reference node on it, and of no
+   other nodes. stack points to a list of frontiers, one for this
+   level of the query tree and one for each level below it. xq holds
+   the query points in query tree order; they are read from here
+   rather than through the query tree, which in KD_SOA builds may
+   hold them only in single precision. On return, pdf[i] holds the
+   PDF at query point i, where points are numbered in query tree
+   order. */
+static
+void kd_pdf_dual_node(const kernel_density *kd, const KDtree *qtree,
+		      const double *xq,
+		      const unsigned long qnode, const kd_frontier *parent,
+		      kd_frontier *stack, const double reltol,
+		      const double abstol, double *pdf) {
+
+  unsigned long i, j, lchild, rchild, ptr;
+  unsigned long ndim = kd->tree->ndim;
+  const KDnode *q = &(qtree->tree[qnode]);
+  const double *qbox[2] = { q->xbnd[0], q->xbnd[1] };
+  kd_frontier *f = stack, *frontier;
+  kd_frontier_node cur;
+  kd_tally pdfsum = { 0.0, 0.0 }, errsum = { 0.0, 0.0 };
+  double qsize, pdfest, abserr, lpdf, lerr, rpdf, rerr;
 #ifdef DIAGNOSTIC
-		      , nodecheck+i, leafcheck+i, termcheck+i
+  unsigned long nodecheck = 0, leafcheck = 0, termcheck = 0;
 #endif
-		      );
-      /*
-      printf("x =");
-      for (unsigned long j=0; j<kd->tree->ndim; j++)
-	printf(" %f", x[i*kd->tree->ndim+j]);
-      printf(", pdf = %f\n", pdf[i]);
-      */      
-      /* Free the local storage we allocated */
-      free(kd_tmp.h);
+
+  /* Index of the first point of this node in the query tree */
+  ptr = q->off;
+
+  /* Bound the contributions of the parent's reference nodes to the
+     points in this query node; this node's box lies inside that of
+     its parent, so these bounds are at least as tight as the ones
+     the parent had. Nodes that cannot contribute are dropped. */
+  f->n = 0;
+  for (i=0; i<parent->n; i++) {
+    kd_pdf_node_box(kd, qbox, parent->heap[i].node, &lpdf, &lerr);
+    if (lpdf == 0.0) continue;
+    kd_frontier_push(f, parent->heap[i].node, lerr, lpdf);
+    kd_tally_add(&pdfsum, lpdf);
+    kd_tally_add(&errsum, lerr);
+  }
+
+  /* Open reference nodes until either the estimate is good enough
+     for every point in the query node, or the node contributing the
+     most error is a leaf or is smaller than the query node, in which
+     case we gain more by dividing the query node than by dividing the
+     reference node further */
+  qsize = kd_box_size2(q, kd->h, ndim);
+  while (1) {
+
+    /* Check for convergence; if the estimate is good enough, assign
+       it to every point in this query node and we are done */
+    pdfest = kd_tally_val(&pdfsum);
+    abserr = kd_tally_val(&errsum);
+    if ((abserr <= abstol) || (abserr / pdfest <= reltol)) {
+      for (i=0; i<q->npt; i++) pdf[ptr+i] = pdfest;
+      return;
+    }
+
+    /* Decide whether to open the worst reference node */
+    if (f->n == 0) break;
+    cur = f->heap[0];
+    if (kd->tree->tree[cur.node].splitdim == -1) break;
+    if (kd_box_size2(&(kd->tree->tree[cur.node]), kd->h, ndim) < qsize)
+      break;
+
+    /* Replace the reference node with its children */
+    cur = kd_frontier_pop(f);
+    kd_tally_add(&pdfsum, -cur.pdf);
+    kd_tally_add(&errsum, -cur.key);
+    lchild = LEFT(cur.node);
+    rchild = RIGHT(cur.node);
+    kd_pdf_node_box(kd, qbox, lchild, &lpdf, &lerr);
+    kd_pdf_node_box(kd, qbox, rchild, &rpdf, &rerr);
+    if (lpdf != 0.0) {
+      kd_frontier_push(f, lchild, lerr, lpdf);
+      kd_tally_add(&pdfsum, lpdf);
+      kd_tally_add(&errsum, lerr);
+    }
+    if (rpdf != 0.0) {
+      kd_frontier_push(f, rchild, rerr, rpdf);
+      kd_tally_add(&pdfsum, rpdf);
+      kd_tally_add(&errsum, rerr);
     }
   }
+
+  /* If this query node is not a leaf, divide it */
+  if (q->splitdim != -1) {
+    kd_pdf_dual_node(kd, qtree, xq, LEFT(qnode), f, stack+1,
+		     reltol, abstol, pdf);
+    kd_pdf_dual_node(kd, qtree, xq, RIGHT(qnode), f, stack+1,
+		     reltol, abstol, pdf);
+    return;
+  }
+
+  /* This query node is a leaf, so finish each point individually,
+     exactly as kd_pdf does, but starting from the reference nodes on
+     our frontier rather than from the root */
+  for (i=0; i<q->npt; i++) {
+    frontier = kd_frontier_get();
+    pdfsum.sum = pdfsum.c = errsum.sum = errsum.c = 0.0;
+    for (j=0; j<f->n; j++) {
+      kd_pdf_node(kd, xq+(ptr+i)*ndim, f->heap[j].node, &lpdf, &lerr);
+      kd_tally_add(&pdfsum, lpdf);
+      kd_tally_add(&errsum, lerr);
+      if (kd->tree->tree[f->heap[j].node].splitdim != -1)
+	kd_frontier_push(frontier, f->heap[j].node, lerr, lpdf);
+    }
+    pdf[ptr+i] = kd_pdf_refine(kd, xq+(ptr+i)*ndim, frontier, &pdfsum,
+			       &errsum, reltol, abstol
+#ifdef DIAGNOSTIC
+			       , &nodecheck, &leafcheck, &termcheck
+#endif
+			       );
+  }
 }
 
+void kd_pdf_dualtree(const kernel_density *kd,
+		     const double *x,
+		     const unsigned long npt,
+		     const double reltol,
+		     const double abstol,
+		     const unsigned int nthread,
+		     double *pdf) {
+
+  unsigned long i, ndim = kd->tree->ndim;
+  unsigned long blocklev, nlev, block0, block1;
+  unsigned long *sortmap;
+  double *xq, *pdfq;
+  KDtree *qtree;
+  kd_frontier_node root = { 0.0, 0.0, ROOT };
+  kd_frontier rootfrontier = { &root, 1, 1 };
+
+  /* Safety check */
+  if (npt == 0) return;
+
+  /* Build a tree on a copy of the query points, using the same leaf
+     size as the reference tree */
+  if (!(xq = malloc(npt*ndim*sizeof(double))) ||
+      !(pdfq = malloc(npt*sizeof(double))) ||
+      !(sortmap = malloc(npt*sizeof(unsigned long)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_dualtree\n");
+    exit(1);
+  }
+  memcpy(xq, x, npt*ndim*sizeof(double));
+  qtree = build_tree(xq, ndim, npt, kd->tree->leafsize, NULL, 0, 0,
+		     sortmap);
+
+  /* Find the level of the query tree at which to divide it into
+     blocks, and the range of node indices at that level */
+  for (blocklev=0; (1UL << blocklev) < KD_DUAL_NBLOCK &&
+	 blocklev < qtree->levels-1; blocklev++);
+  block0 = 1UL << blocklev;
+  block1 = block0 << 1;
+  nlev = qtree->levels - blocklev;
+
+  /* Evaluate the blocks; each thread keeps one frontier per level of
+     the query tree below the block level */
+#pragma omp parallel num_threads(KD_NTHREAD(nthread))
+  {
+    kd_frontier *stack;
+    if (!(stack = calloc(nlev, sizeof(kd_frontier)))) {
+      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_dualtree\n");
+      exit(1);
+    }
+#pragma omp for schedule(dynamic, 1)
+    for (unsigned long b=block0; b<block1; b++) {
+      if (qtree->tree[b].npt == 0) continue;
+      kd_pdf_dual_node(kd, qtree, xq, b, &rootfrontier, stack,
+		       reltol, abstol, pdfq);
+    }
+    for (unsigned long j=0; j<nlev; j++) free(stack[j].heap);
+    free(stack);
+  }
+
+  /* Put the results back in the order of the input points */
+  for (i=0; i<npt; i++) pdf[sortmap[i]] = pdfq[i];
+
+  /* Free memory */
+  free_tree(qtree);
+  free(xq);
+  free(pdfq);
+  free(sortmap);
+}
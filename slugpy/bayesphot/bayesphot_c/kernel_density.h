@@ -24,6 +24,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdbool.h>
 #include "kdtree.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*********************************************************************/
+/* Threading control for the vectorized routines. These routines     */
+/* take an argument nthread giving the number of OpenMP threads to   */
+/* use; a value of 0 means use the OpenMP default. Points are handed */
+/* out to threads dynamically in chunks of KD_VEC_CHUNK, because the */
+/* cost of an evaluation varies greatly from point to point. If the  */
+/* library is compiled without OpenMP, nthread is ignored and all    */
+/* work is done on the calling thread.                               */
+/*********************************************************************/
+#define KD_VEC_CHUNK 8
+#ifdef _OPENMP
+#  define KD_NTHREAD(n) ((n) > 0 ? (int) (n) : omp_get_max_threads())
+#else
+#  define KD_NTHREAD(n) 1
+#endif
 
 /*********************************************************************/
 /* Types of kernels                                                  */
@@ -48,6 +67,10 @@ typedef struct {
   kernel_type ktype;
   /* Sums of weights in nodes of the tree */
   double *nodewgt;
+  /* If the tree was read from a file by kd_map, the mapped file and
+     its size; NULL and 0 otherwise */
+  void *map;
+  size_t mapsize;
 } kernel_density;
 
 /*********************************************************************/
@@ -383,6 +406,7 @@ void kd_pdf_int_vec(const kernel_density *kd,
 		    const unsigned long npt,
 		    const double reltol, 
 		    const double abstol,
+		    const unsigned int nthread,
 		    double *pdf
 #ifdef DIAGNOSTIC
 		    , unsigned long *nodecheck,
@@ -422,6 +446,8 @@ void kd_pdf_int_vec(const kernel_density *kd,
          Absolute error tolerance in the computation. An approximate
          value pdf_approx will be returned once the estimated error
 	 | pdf_approx - pdf_true | < abstol.
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
       OUT pdf
          an approximation to the output integral, accurate within the
          specified error tolerances
@@ -447,6 +473,10 @@ void kd_pdf_int_vec(const kernel_density *kd,
       npt times, then calling change bandwidth to set the bandwidth
       back to its original value. However, this routine executes this
       procedure in a manner that is thread-safe.
+
+      Points are evaluated in parallel, but each evaluation is
+      independent of the others, so the results do not depend on the
+      number of threads.
 */
 
 
@@ -545,6 +575,7 @@ void kd_pdf_vec(const kernel_density *kd,
 		const unsigned long npt,
 		const double reltol,
 		const double abstol,
+		const unsigned int nthread,
 		double *pdf
 #ifdef DIAGNOSTIC
 		, unsigned long *nodecheck,
@@ -578,6 +609,8 @@ void kd_pdf_vec(const kernel_density *kd,
          the relative tolerance for the computation; see kd_pdf_tol
       INPUT abstol
          the absolute tolerance for the computation; see kd_pdf_tol
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
       OUTPUT pdf
          the computed values of the PDF; array must point to npt
          elements of allocated, writeable memory on input
@@ -603,6 +636,58 @@ void kd_pdf_vec(const kernel_density *kd,
       npt times, then calling change bandwidth to set the bandwidth
       back to its original value. However, this routine executes this
       procedure in a manner that is thread-safe.
+
+      Points are evaluated in parallel, but each evaluation is
+      independent of the others, so the results do not depend on the
+      number of threads.
+*/
+
+void kd_pdf_dualtree(const kernel_density *kd,
+		     const double *x,
+		     const unsigned long npt,
+		     const double reltol,
+		     const double abstol,
+		     const unsigned int nthread,
+		     double *pdf);
+/* This routine returns the value of the probability distribution
+   function for a kernel_density object evaluated at a series of
+   specified positions, with a specified relative tolerance. The
+   result satisfies the same error bounds as that of kd_pdf_vec with
+   a NULL bandwidth, but the calculation is done by building a KD
+   tree on the input positions and traversing it together with the
+   tree in kd. Nearby input points then share the work of walking the
+   tree, and groups of them for which the estimate is already within
+   tolerance are assigned it all at once. This is much faster than
+   kd_pdf_vec when the number of points is large and they are
+   clustered, as is typical for a catalog.
+
+   Parameters:
+      INPUT kd
+         the kernel_density object to be used to evaluate the PDF
+      INPUT x
+         an ndim*npt element array giving the positions at which the
+         PDF is to be evaluated; element x[i*ndim+j] is the jth
+         coordinate of the ith input data point
+      INPUT npt
+         number of input positions
+      INPUT reltol
+         the relative tolerance for the computation; see kd_pdf_tol
+      INPUT abstol
+         the absolute tolerance for the computation; see kd_pdf_tol
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
+      OUTPUT pdf
+         the computed values of the PDF; array must point to npt
+         elements of allocated, writeable memory on input
+
+   Returns:
+      Nothing
+
+   Notes:
+      Unlike kd_pdf_vec, this routine does not accept a separate
+      bandwidth for each point, and does not record diagnostic
+      information. As for kd_pdf_vec, the results do not depend on
+      the number of threads.
 */
 
 
@@ -0,0 +1,435 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <gsl/gsl_sf_gamma.h>
+#include "geometry.h"
+#include "kernel_density_binned.h"
+
+/*********************************************************************/
+/* Useful macros                                                     */
+/*********************************************************************/
+
+/* Largest factor by which the binning grid may have more cells than
+   the output grid, before we give up and use the tree-based routines
+   instead */
+#define KD_BIN_MAXREFINE 64
+
+/* Largest error, as a fraction of the kernel peak, allowed per grid
+   dimension; larger tolerances gain nothing in speed, and the
+   truncation radius is only defined for tolerances below 1 */
+#define KD_BIN_MAXTOL 0.1
+
+/* Library points whose squared distance from the fixed point, in
+   units of the bandwidth, exceeds that of the closest point by more
+   than this are ignored; exp(-KD_BIN_D2SKIP/2) ~ 1e-16 */
+#define KD_BIN_D2SKIP 73.7
+
+/*********************************************************************/
+/* Geometry of the binning grid in one dimension                     */
+/*********************************************************************/
+typedef struct {
+  double lo;            /* Position of the first binning cell */
+  double dx;            /* Spacing of binning cells */
+  unsigned long m;      /* Number of binning cells per output cell */
+  unsigned long pad;    /* Half-width of the kernel, in binning cells */
+  unsigned long n;      /* Number of binning cells */
+} kd_bin_dim;
+
+/*********************************************************************/
+/* Static functions                                                  */
+/*********************************************************************/
+
+/* Deposit the weight carried by every library point onto the
+   binning grid */
+static
+void kd_bin_weights(const kernel_density *kd, const double *xfixed,
+		    const unsigned long *dimfixed,
+		    const unsigned long ndimfixed,
+		    const unsigned long *dimgrid,
+		    const unsigned long ndimgrid,
+		    const kd_bin_dim *bins, const unsigned long *stride,
+		    double *grid);
+
+/* Convolve the binning grid with the kernel, reducing it to the
+   output grid */
+static
+void kd_bin_convolve(const kd_bin_dim *bins, double *const *kern,
+		     const unsigned long *ngrid,
+		     const unsigned long ndimgrid,
+		     double **grid, double **work);
+
+/* Evaluate on the grid with the tree-based routines instead */
+static
+void kd_bin_use_tree(const kernel_density *kd, const double *xfixed,
+		     const unsigned long *dimfixed,
+		     const unsigned long ndimfixed,
+		     const unsigned long nfixed,
+		     const double *xgridlo, const double *xgridhi,
+		     const unsigned long *ngrid,
+		     const unsigned long *dimgrid,
+		     const unsigned long ndimgrid,
+		     const double reltol, const double abstol,
+		     double *pdf);
+
+
+/*********************************************************************/
+/* Binned evaluation of the PDF on a regular grid                    */
+/*********************************************************************/
+void kd_pdf_reggrid_binned(const kernel_density *kd,
+			   const double *xfixed,
+			   const unsigned long *dimfixed,
+			   const unsigned long ndimfixed,
+			   const unsigned long nfixed,
+			   const double *xgridlo,
+			   const double *xgridhi,
+			   const unsigned long *ngrid,
+			   const unsigned long *dimgrid,
+			   const unsigned long ndimgrid,
+			   const double reltol, const double abstol,
+			   const unsigned int nthread,
+			   double *pdf) {
+
+  unsigned long i, j, k, ndim_int, ngridtot, nbintot, refine;
+  unsigned long *stride;
+  kd_bin_dim *bins;
+  double **kern;
+  double hprod, fac, dxmax, nsig, tol;
+
+  /* Safety check */
+  if (kd->ktype != gaussian) {
+    fprintf(stderr, "bayesphot: error: kd_pdf_reggrid_binned requires a gaussian kernel\n");
+    exit(1);
+  }
+
+  /* Constant factor from the dimensions being integrated out; this
+     is the same as in kd_pdf_int_reggrid */
+  ndim_int = kd->tree->ndim - ndimfixed - ndimgrid;
+  fac = 1.0;
+  if (ndim_int > 0) {
+    hprod = 1.0;
+    for (i=0; i<kd->tree->ndim; i++) hprod *= kd->h[i];
+    for (i=0; i<ndimfixed; i++) hprod /= kd->h[dimfixed[i]];
+    for (i=0; i<ndimgrid; i++) hprod /= kd->h[dimgrid[i]];
+    fac = hprod * ds(ndim_int) * pow(2.0, ndim_int/2.0 - 1) *
+      gsl_sf_gamma(0.5*ndim_int);
+  }
+
+  /* Get the error budget as a fraction of the kernel peak; the peak
+     is at most fac * norm, so abstol corresponds to a fraction
+     abstol / (fac * norm), and we take the looser of this and
+     reltol. Divide the budget equally between binning and truncation
+     of the kernel, and equally between dimensions; binning at
+     spacing dx introduces an error of at most (dx/h)^2/8 of the
+     kernel peak, and truncating at nsig bandwidths drops at most
+     exp(-nsig^2/2) of it */
+  tol = reltol;
+  if (abstol > 0.0 && abstol / (fac * kd->norm) > tol)
+    tol = abstol / (fac * kd->norm);
+  tol /= 2.0*ndimgrid;
+  if (tol > KD_BIN_MAXTOL) tol = KD_BIN_MAXTOL;
+
+  /* If no error is allowed, binning cannot be used */
+  if (!(tol > 0.0)) {
+    kd_bin_use_tree(kd, xfixed, dimfixed, ndimfixed, nfixed,
+		    xgridlo, xgridhi, ngrid, dimgrid, ndimgrid,
+		    reltol, abstol, pdf);
+    return;
+  }
+  dxmax = sqrt(8.0*tol);
+  nsig = sqrt(-2.0*log(tol));
+
+  /* Set up the binning grid in each dimension; each binning grid is
+     aligned with the output grid, refined by an integer factor, and
+     padded by the width of the kernel on either side so that points
+     just outside the output grid still contribute */
+  if (!(bins = (kd_bin_dim *) calloc(ndimgrid, sizeof(kd_bin_dim))) ||
+      !(stride = (unsigned long *)
+	calloc(ndimgrid, sizeof(unsigned long))) ||
+      !(kern = (double **) calloc(ndimgrid, sizeof(double *)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_reggrid_binned\n");
+    exit(1);
+  }
+  refine = 1;
+  for (k=0; k<ndimgrid; k++) {
+    double h = kd->h[dimgrid[k]];
+    if (ngrid[k] > 1) {
+      double dxgrid = (xgridhi[k]-xgridlo[k]) / (ngrid[k]-1);
+      bins[k].m = (unsigned long) ceil(dxgrid / (h*dxmax));
+      if (bins[k].m < 1) bins[k].m = 1;
+      bins[k].dx = dxgrid / bins[k].m;
+    } else {
+      bins[k].m = 1;
+      bins[k].dx = h*dxmax;
+    }
+    bins[k].pad = (unsigned long) ceil(nsig*h/bins[k].dx);
+    bins[k].n = (ngrid[k]-1)*bins[k].m + 1 + 2*bins[k].pad;
+    bins[k].lo = xgridlo[k] - bins[k].pad*bins[k].dx;
+    refine *= bins[k].m;
+  }
+
+  /* If the output grid is too coarse compared to the bandwidth for
+     binning to be efficient, use the tree instead */
+  if (refine > KD_BIN_MAXREFINE) {
+    free(bins);
+    free(stride);
+    free(kern);
+    kd_bin_use_tree(kd, xfixed, dimfixed, ndimfixed, nfixed,
+		    xgridlo, xgridhi, ngrid, dimgrid, ndimgrid,
+		    reltol, abstol, pdf);
+    return;
+  }
+
+  /* Strides of the binning grid, and sizes of the grids */
+  nbintot = 1;
+  for (k=ndimgrid; k>0; k--) {
+    stride[k-1] = nbintot;
+    nbintot *= bins[k-1].n;
+  }
+  ngridtot = 1;
+  for (k=0; k<ndimgrid; k++) ngridtot *= ngrid[k];
+
+  /* Tabulate the kernel in each dimension */
+  for (k=0; k<ndimgrid; k++) {
+    if (!(kern[k] = (double *)
+	  calloc(2*bins[k].pad+1, sizeof(double)))) {
+      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_reggrid_binned\n");
+      exit(1);
+    }
+    for (j=0; j<2*bins[k].pad+1; j++) {
+      double u = ((double) j - (double) bins[k].pad) * bins[k].dx /
+	kd->h[dimgrid[k]];
+      kern[k][j] = exp(-u*u/2.0);
+    }
+  }
+
+  /* Evaluate for each fixed point; each thread holds its own
+     binning grid and work space */
+#pragma omp parallel num_threads(KD_NTHREAD(nthread))
+  {
+    double *grid, *work;
+    if (!(grid = (double *) malloc(nbintot*sizeof(double))) ||
+	!(work = (double *) malloc(nbintot*sizeof(double)))) {
+      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_reggrid_binned\n");
+      exit(1);
+    }
+
+#pragma omp for schedule(dynamic, 1)
+    for (unsigned long n=0; n<nfixed; n++) {
+      double *g = grid, *w = work;
+      for (unsigned long l=0; l<nbintot; l++) g[l] = 0.0;
+      kd_bin_weights(kd, xfixed+n*ndimfixed, dimfixed, ndimfixed,
+		     dimgrid, ndimgrid, bins, stride, g);
+      kd_bin_convolve(bins, kern, ngrid, ndimgrid, &g, &w);
+      for (unsigned long l=0; l<ngridtot; l++)
+	pdf[n*ngridtot+l] = g[l] * fac * kd->norm_tot;
+    }
+
+    free(grid);
+    free(work);
+  }
+
+  /* Free memory */
+  for (k=0; k<ndimgrid; k++) free(kern[k]);
+  free(kern);
+  free(bins);
+  free(stride);
+}
+
+
+/*********************************************************************/
+/* Routine to deposit weights on the binning grid                    */
+/*********************************************************************/
+static
+void kd_bin_weights(const kernel_density *kd, const double *xfixed,
+		    const unsigned long *dimfixed,
+		    const unsigned long ndimfixed,
+		    const unsigned long *dimgrid,
+		    const unsigned long ndimgrid,
+		    const kd_bin_dim *bins, const unsigned long *stride,
+		    double *grid) {
+
+  unsigned long i, k, c, ptr, curnode, ncorner;
+  unsigned long ndim = kd->tree->ndim;
+  long *cell;
+  double *frac, *xbuf;
+  double d2, d2best, wgt, cwgt, u;
+  const double *x;
+  bool on_grid;
+
+  /* Allocate memory */
+  if (!(cell = (long *) calloc(ndimgrid, sizeof(long))) ||
+      !(frac = (double *) calloc(ndimgrid, sizeof(double))) ||
+      !(xbuf = (double *) calloc(ndim, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_reggrid_binned\n");
+    exit(1);
+  }
+
+  /* Walk the tree, skipping nodes too far from the fixed point in
+     the fixed dimensions to contribute */
+  ncorner = 1UL << ndimgrid;
+  d2best = INFINITY;
+  curnode = ROOT;
+  while (1) {
+
+    /* Can this node contribute? */
+    d2 = box_min_dist2(xfixed,
+		       (const double **) kd->tree->tree[curnode].xbnd,
+		       ndimfixed, ndim, dimfixed, NULL, kd->h, ndim);
+    if (d2 > d2best + KD_BIN_D2SKIP) {
+      SETNEXT(curnode);
+      if (curnode == ROOT) break;
+      continue;
+    }
+
+    /* If this is not a leaf, go to its left child */
+    if (kd->tree->tree[curnode].splitdim != -1) {
+      curnode = LEFT(curnode);
+      continue;
+    }
+
+    /* This is a leaf, so deposit its points */
+    for (i=0; i<kd->tree->tree[curnode].npt; i++) {
+
+      /* Weight of this point given the fixed dimensions */
+      x = kd_point(kd->tree, curnode, i, xbuf);
+      d2 = dist2(x, xfixed, ndim, ndimfixed, NULL, dimfixed, kd->h, ndim);
+      if (d2 < d2best) d2best = d2;
+      if (d2 > d2best + KD_BIN_D2SKIP) continue;
+      wgt = exp(-d2/2.0);
+      if (kd->tree->tree[curnode].dptr != NULL)
+	wgt *= ((double *) kd->tree->tree[curnode].dptr)[i];
+
+      /* Find the binning cell containing the point; points outside
+	 the binning grid are more than the kernel width from every
+	 output grid point, so they are dropped */
+      on_grid = true;
+      for (k=0; k<ndimgrid; k++) {
+	u = (x[dimgrid[k]] - bins[k].lo) / bins[k].dx;
+	cell[k] = (long) floor(u);
+	frac[k] = u - cell[k];
+	if (cell[k] < 0 || cell[k]+1 >= (long) bins[k].n) on_grid = false;
+      }
+      if (!on_grid) continue;
+
+      /* Share the weight among the corners of the cell */
+      for (c=0; c<ncorner; c++) {
+	ptr = 0;
+	cwgt = wgt;
+	for (k=0; k<ndimgrid; k++) {
+	  if (c & (1UL << k)) {
+	    ptr += (cell[k]+1) * stride[k];
+	    cwgt *= frac[k];
+	  } else {
+	    ptr += cell[k] * stride[k];
+	    cwgt *= 1.0 - frac[k];
+	  }
+	}
+	grid[ptr] += cwgt;
+      }
+    }
+
+    /* Go to next node */
+    SETNEXT(curnode);
+    if (curnode == ROOT) break;
+  }
+
+  /* Free memory */
+  free(cell);
+  free(frac);
+  free(xbuf);
+}
+
+
+/*********************************************************************/
+/* Routine to convolve the binning grid with the kernel. The kernel  */
+/* is separable, so we convolve along one dimension at a time, and   */
+/* in each pass evaluate the result only at the binning cells that   */
+/* coincide with output grid points, so that each pass shrinks its   */
+/* dimension to the size of the output grid. On return, *grid holds  */
+/* the result, packed in the same order as the output grid.          */
+/*********************************************************************/
+static
+void kd_bin_convolve(const kd_bin_dim *bins, double *const *kern,
+		     const unsigned long *ngrid,
+		     const unsigned long ndimgrid,
+		     double **grid, double **work) {
+
+  unsigned long i, k, l, o, p, nouter, ninner, nin, pad, m;
+  const double *in, *kk;
+  double *out, *tmp;
+
+  for (k=0; k<ndimgrid; k++) {
+
+    /* Dimensions before k have already been reduced to the output
+       grid, those after k have not */
+    nouter = 1;
+    for (i=0; i<k; i++) nouter *= ngrid[i];
+    ninner = 1;
+    for (i=k+1; i<ndimgrid; i++) ninner *= bins[i].n;
+    nin = bins[k].n;
+    pad = bins[k].pad;
+    m = bins[k].m;
+    kk = kern[k];
+    in = *grid;
+    out = *work;
+
+    /* Convolve */
+    for (o=0; o<nouter; o++) {
+      for (i=0; i<ngrid[k]; i++) {
+	double *outrow = out + (o*ngrid[k] + i)*ninner;
+	for (p=0; p<ninner; p++) outrow[p] = 0.0;
+	for (l=0; l<2*pad+1; l++) {
+	  const double *inrow = in + (o*nin + i*m + l)*ninner;
+	  const double kl = kk[l];
+	  for (p=0; p<ninner; p++) outrow[p] += kl * inrow[p];
+	}
+      }
+    }
+
+    /* Swap buffers */
+    tmp = *grid;
+    *grid = *work;
+    *work = tmp;
+  }
+}
+
+
+/*********************************************************************/
+/* Routine to fall back on the tree-based grid evaluation            */
+/*********************************************************************/
+static
+void kd_bin_use_tree(const kernel_density *kd, const double *xfixed,
+		     const unsigned long *dimfixed,
+		     const unsigned long ndimfixed,
+		     const unsigned long nfixed,
+		     const double *xgridlo, const double *xgridhi,
+		     const unsigned long *ngrid,
+		     const unsigned long *dimgrid,
+		     const unsigned long ndimgrid,
+		     const double reltol, const double abstol,
+		     double *pdf) {
+  if (kd->tree->ndim > ndimfixed + ndimgrid)
+    kd_pdf_int_reggrid(kd, xfixed, dimfixed, ndimfixed, nfixed,
+		       xgridlo, xgridhi, ngrid, dimgrid, ndimgrid,
+		       reltol, abstol, pdf);
+  else
+    kd_pdf_reggrid(kd, xfixed, dimfixed, ndimfixed, nfixed,
+		   xgridlo, xgridhi, ngrid, dimgrid, ndimgrid,
+		   reltol, abstol, pdf);
+}
@@ -0,0 +1,125 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+/*********************************************************************/
+/* This module contains an approximate, grid-based method for        */
+/* computing marginal PDFs on regular grids from kernel density      */
+/* objects with Gaussian kernels. Rather than walking the tree       */
+/* separately for every grid point, the method computes the weight   */
+/* that each library point carries given the fixed dimensions,       */
+/* deposits these weights onto a grid with linear (cloud-in-cell)    */
+/* interpolation, and then convolves the grid with the kernel. The   */
+/* Gaussian kernel is separable, so the convolution is done one      */
+/* dimension at a time, and each pass reduces that dimension to the  */
+/* points of the output grid. The cost is therefore roughly linear   */
+/* in the number of library points that contribute plus the number   */
+/* of grid points, independent of the kernel bandwidth.              */
+/*********************************************************************/
+
+#ifndef _KERNEL_DENSITY_BINNED_H_
+#define _KERNEL_DENSITY_BINNED_H_
+
+#include "kernel_density.h"
+
+/*********************************************************************/
+/* Function definitions                                              */
+/*********************************************************************/
+
+void kd_pdf_reggrid_binned(const kernel_density *kd,
+			   const double *xfixed,
+			   const unsigned long *dimfixed,
+			   const unsigned long ndimfixed,
+			   const unsigned long nfixed,
+			   const double *xgridlo,
+			   const double *xgridhi,
+			   const unsigned long *ngrid,
+			   const unsigned long *dimgrid,
+			   const unsigned long ndimgrid,
+			   const double reltol, const double abstol,
+			   const unsigned int nthread,
+			   double *pdf);
+/* This routine computes the same quantity as kd_pdf_int_reggrid
+   (if some dimensions appear in neither dimfixed nor dimgrid, and
+   are therefore integrated out) or kd_pdf_reggrid (if every
+   dimension appears in one or the other), using the binned
+   approximation described above. It may only be used with Gaussian
+   kernels.
+
+   Parameters:
+      INPUT kd
+         the kernel_density object to be used to evaluate the PDF
+      INPUT xfixed
+         an ndimfixed * nfixed element array; each block of ndimfixed
+         elements gives a position in the dimensions specified by
+         dimfixed, and there are nfixed such blocks.
+      INPUT dimfixed
+         an ndimfixed element array specifying the dimensions in each
+         of the nfixed blocks in xfixed
+      INPUT ndimfixed
+         number of dimensions that are fixed; must be > 0
+      INPUT nfixed
+         number of fixed points; must be > 0
+      INPUT xgridlo
+         an ndimgrid element array, giving the coordinates of the
+         lower left corner of the grid
+      INPUT xgridhi
+         an ndimgrid element array, giving the coordinates of the
+         upper right corner of the grid
+      INPUT ngrid
+         an ndimgrid element array specifying the number of grid
+         points in each dimension of the grid; must be > 0
+      INPUT dimgrid
+         an ndimgrid element array specifying the dimensions of the
+         grid
+      INPUT reltol
+         Relative error tolerance. The binning resolution and the
+         extent of the kernel are chosen so that, at every grid
+         point, | pdf_approx - pdf_true | / pdf_peak < reltol, where
+         pdf_peak is the value the PDF would have at its maximum if
+         all the library points that contribute were coincident;
+         pdf_peak >= max(pdf_true), and the two are close when the
+         PDF is no wider than a few kernel bandwidths, so this is
+         close to the criterion used by kd_pdf_int_reggrid
+      INPUT abstol
+         Absolute error tolerance; the error bound is met if either
+         the reltol criterion above holds or | pdf_approx - pdf_true
+         | < abstol at every grid point. If reltol and abstol are
+         both 0, the PDF is evaluated exactly by kd_pdf_int_reggrid
+         or kd_pdf_reggrid
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
+      OUT pdf
+         an ngrid[0] * ngrid[1] * ... ngrid[ndimgrid-1] * nfixed
+         element array giving the PDF, packed in the same order as
+         for kd_pdf_int_reggrid
+
+   Returns:
+      Nothing
+
+   Notes:
+      The error bound follows from the maximum curvature of the
+      Gaussian kernel: linear binning at a spacing dx changes the
+      kernel evaluated at any point by at most (dx/h)^2 / 8 of its
+      peak value, so the binning grid is made fine enough that the
+      sum of this over the grid dimensions, plus the part of the
+      kernel lost by truncating its tails, stays below reltol. Where
+      the output grid is much coarser than the kernel bandwidth this
+      would require a very fine binning grid; in that case the
+      routine instead calls kd_pdf_int_reggrid or kd_pdf_reggrid.
+*/
+
+#endif
+/* _KERNEL_DENSITY_BINNED_H_ */
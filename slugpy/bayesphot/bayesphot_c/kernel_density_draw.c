@@ -177,8 +177,7 @@ void kd_pdf_draw_breadth(const kernel_density *kd,
 	} else {
 
 	  /* This leaf does have points, so get offset to them */
-	  offset = (kd->tree->tree[i].x - kd->tree->tree[ROOT].x) /
-	    kd->tree->ndim;
+	  offset = kd->tree->tree[i].off;
 
 	  /* Get differential weights of points and of entire node */
 	  nodewgt[i] = get_node_wgt(kd, x, dims, ndim, i,
@@ -221,8 +220,7 @@ void kd_pdf_draw_breadth(const kernel_density *kd,
 
 	  /* This is a leaf, so see which point in the leaf is the one
 	     we want */
-	  offset = (kd->tree->tree[curnode].x - kd->tree->tree[ROOT].x)
-	    / kd->tree->ndim;
+	  offset = kd->tree->tree[curnode].off;
 	  j = 0;
 	  while (rnd[rndsort[i]] >= pointwgt[offset+j]/nodewgt[ROOT]) j++;
 
@@ -512,7 +510,7 @@ void kd_pdf_draw(const kernel_density *kd, const double *x,
 	 each dimension, since the probabilities are nicely separable */
       for (j=0; j<ndim_out; j++)
 	out[i*ndim_out+j] = 
-	  kd->tree->tree[ROOT].x[idxmap[i]*kd->tree->ndim+dims_out[j]] +
+	  kd_coord(kd->tree, ROOT, idxmap[i], dims_out[j]) +
 	  gsl_ran_gaussian_ziggurat(r, kd->h[dims_out[j]]);
       break;
     }
@@ -536,7 +534,7 @@ void kd_pdf_draw(const kernel_density *kd, const double *x,
       norm = sqrt(norm);
       for (j=0; j<ndim_out; j++)
 	out[i*ndim_out+j] = 
-	  kd->tree->tree[ROOT].x[idxmap[i]*kd->tree->ndim+dims_out[j]] +
+	  kd_coord(kd->tree, ROOT, idxmap[i], dims_out[j]) +
 	  dist * kd->h[dims_out[j]] * rndgauss[j] / norm;
       break;
     }
@@ -590,8 +588,7 @@ double get_node_wgt(const kernel_density *kd, const double *x,
     for (i=0; i<kd->tree->tree[curnode].npt; i++) {
 
       /* Get distance in units of the kernel size */
-      d2 = dist2(&(kd->tree->tree[curnode].x[ndim_tree*i]), x,
-		 ndim_tree, ndim, NULL, dims, kd->h, ndim_tree);
+      d2 = kd_leaf_dist2(kd->tree, curnode, i, x, dims, ndim, kd->h);
 
       /* Compute the weight of this point */
       if (kd->tree->tree[curnode].dptr != NULL) {
@@ -719,9 +716,7 @@ int assign_idx(const kernel_density *kd,
 	}
 
 	/* Record the index */
-	idxmap[rndsort[i]] = k + (unsigned long)
-	  (kd->tree->tree[leaflist[j]].x -
-	   kd->tree->tree[ROOT].x)/kd->tree->ndim;
+	idxmap[rndsort[i]] = k + kd->tree->tree[leaflist[j]].off;
 	ksave = k+1;
 
 	/* Check if there are any more sample points that should also
@@ -731,9 +726,7 @@ int assign_idx(const kernel_density *kd,
 	  if (cumwgt1/leafwgt_sum <= rnd[rndsort[i+1]]) break;
 	  if (cumwgt1/leafwgt_sum_lim <= rnd[rndsort[i+1]])
 	    return 0;
-	  idxmap[rndsort[i+1]] = k + (unsigned long)
-	    (kd->tree->tree[leaflist[j]].x -
-	     kd->tree->tree[ROOT].x)/kd->tree->ndim;
+	  idxmap[rndsort[i+1]] = k + kd->tree->tree[leaflist[j]].off;
 	}
 
 	/* We found our point, so stop looping through the leaf */
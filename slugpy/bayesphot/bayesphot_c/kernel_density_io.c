@@ -0,0 +1,554 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kernel_density_io.h"
+#include "kernel_density_util.h"
+
+/*********************************************************************/
+/* File layout. The file starts with a header, followed by a series  */
+/* of sections; the header gives the byte offset of each section,    */
+/* and every section starts at a multiple of KD_FILE_ALIGN bytes.    */
+/* The sections are:                                                 */
+/*    KD_SEC_H        bandwidth, ndim doubles                        */
+/*    KD_SEC_NODE     one kd_file_node per node of the tree          */
+/*    KD_SEC_BND      bounding boxes of the nodes; for each node,    */
+/*                    xlim[0], xlim[1], xbnd[0], xbnd[1], each of    */
+/*                    ndim doubles                                   */
+/*    KD_SEC_X        positions of the points in tree order, npt *   */
+/*                    ndim doubles; in files written with KD_SOA,    */
+/*                    the SoA copy of the leaves instead, laid out   */
+/*                    as in memory, with each leaf at the offset     */
+/*                    given by its kd_file_node                      */
+/*    KD_SEC_WGT      weights of the points in tree order, npt       */
+/*                    doubles; empty if the points are unweighted    */
+/*    KD_SEC_NODEWGT  summed weights of the nodes, one double per    */
+/*                    node                                           */
+/*    KD_SEC_SORTMAP  sortmap, npt 64-bit unsigned integers          */
+/* The header also holds a hash of the points and weights, in their  */
+/* original order, so that readers can check that a file matches    */
+/* their data; a hash of the nosort flags the tree was built with,   */
+/* as computed by kd_hash_nosort; and the layout of KD_SEC_X, which  */
+/* must match the one this library was compiled with: 0 for points,  */
+/* or the size in bytes of each element of the SoA copy.             */
+/*********************************************************************/
+#define KD_FILE_MAGIC "BPKDTREE"
+#define KD_FILE_VERSION 4
+#define KD_FILE_BYTEORDER 0x0102030405060708ull
+#define KD_FILE_ALIGN 64
+#ifdef KD_SOA
+#  define KD_FILE_LAYOUT sizeof(kd_soa_real)
+#else
+#  define KD_FILE_LAYOUT 0
+#endif
+
+enum kd_file_section {
+  KD_SEC_H = 0, KD_SEC_NODE, KD_SEC_BND, KD_SEC_X, KD_SEC_WGT,
+  KD_SEC_NODEWGT, KD_SEC_SORTMAP,
+  KD_NSEC
+};
+
+typedef struct {
+  char magic[8];
+  uint64_t version;
+  uint64_t byteorder;
+  uint64_t ndim;
+  uint64_t npt;
+  uint64_t leafsize;
+  uint64_t levels;
+  uint64_t leaves;
+  uint64_t nodes;
+  uint64_t weighted;
+  uint64_t ktype;
+  double norm;
+  double norm_tot;
+  uint64_t hash;
+  uint64_t nosort;
+  uint64_t layout;
+  uint64_t offset[KD_NSEC];
+  uint64_t size;
+} kd_file_header;
+
+typedef struct {
+  uint64_t npt;       /* Number of points in node */
+  int64_t splitdim;   /* Splitting dimension, -1 for leaves */
+  uint64_t xoff;      /* Index of first point in node */
+  uint64_t soaoff;    /* Offset of leaf in SoA copy, if any */
+} kd_file_node;
+
+/*********************************************************************/
+/* Static functions                                                  */
+/*********************************************************************/
+
+/* Fold a 64-bit word into a running hash; the word is mixed with the
+   MurmurHash3 finalizer before being combined, so that nearby values
+   give unrelated results */
+static inline
+uint64_t kd_hash_word(uint64_t h, uint64_t w) {
+  w ^= w >> 33;
+  w *= 0xff51afd7ed558ccdull;
+  w ^= w >> 33;
+  w *= 0xc4ceb9fe1a85ec53ull;
+  w ^= w >> 33;
+  h ^= w;
+  h *= 0x100000001b3ull;
+  return h ^ (h >> 29);
+}
+
+static inline
+uint64_t kd_hash_double(uint64_t h, double d) {
+  uint64_t w;
+  memcpy(&w, &d, sizeof(w));
+  return kd_hash_word(h, w);
+}
+
+/* Hash a data set; point i of the original data is at position
+   pos[i] of x and wgt if pos is not NULL, and at position i
+   otherwise. If tree is not NULL, the positions are read from it,
+   and x is not used. Positions are hashed at the precision the tree
+   stores them, so that the hash of a data set matches that of a
+   tree built on it. */
+static
+uint64_t kd_hash_data(const double *x, const KDtree *tree,
+		      const double *wgt,
+		      const unsigned long ndim, const unsigned long npt,
+		      const uint64_t *pos) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  h = kd_hash_word(h, ndim);
+  h = kd_hash_word(h, npt);
+  h = kd_hash_word(h, wgt != NULL);
+  for (unsigned long i=0; i<npt; i++) {
+    const unsigned long n = pos ? pos[i] : i;
+    if (tree) {
+      unsigned long k = n;
+      unsigned long leaf = kd_leaf_of(tree, ROOT, &k);
+      for (unsigned long j=0; j<ndim; j++)
+	h = kd_hash_double(h, kd_coord(tree, leaf, k, j));
+    } else {
+      for (unsigned long j=0; j<ndim; j++)
+#ifdef KD_SOA
+	h = kd_hash_double(h, (kd_soa_real) x[n*ndim+j]);
+#else
+	h = kd_hash_double(h, x[n*ndim+j]);
+#endif
+    }
+    if (wgt) h = kd_hash_double(h, wgt[n]);
+  }
+  return h;
+}
+
+/* Round up to a multiple of the alignment */
+static inline
+uint64_t kd_file_pad(const uint64_t n) {
+  return (n + KD_FILE_ALIGN - 1) / KD_FILE_ALIGN * KD_FILE_ALIGN;
+}
+
+/* Write a block of data to a file, followed by zeros up to the next
+   alignment boundary */
+static
+bool kd_file_write_sec(FILE *fp, const void *data, const uint64_t nbyte,
+		       uint64_t *ptr) {
+  static const char zeros[KD_FILE_ALIGN] = { 0 };
+  uint64_t npad = kd_file_pad(*ptr + nbyte) - (*ptr + nbyte);
+  if (nbyte > 0)
+    if (fwrite(data, 1, nbyte, fp) != nbyte) return false;
+  if (npad > 0)
+    if (fwrite(zeros, 1, npad, fp) != npad) return false;
+  *ptr += nbyte + npad;
+  return true;
+}
+
+/* Read and check the header of a file */
+static
+bool kd_file_read_header(FILE *fp, const char *fname,
+			 kd_file_header *hdr) {
+  if (fread(hdr, sizeof(kd_file_header), 1, fp) != 1) {
+    fprintf(stderr, "bayesphot: error: unable to read header of %s\n",
+	    fname);
+    return false;
+  }
+  if (strncmp(hdr->magic, KD_FILE_MAGIC, 8)) {
+    fprintf(stderr, "bayesphot: error: %s is not a KD tree file\n",
+	    fname);
+    return false;
+  }
+  if (hdr->byteorder != KD_FILE_BYTEORDER) {
+    fprintf(stderr, "bayesphot: error: %s was written on a machine with a different byte order\n",
+	    fname);
+    return false;
+  }
+  if (hdr->version != KD_FILE_VERSION) {
+    fprintf(stderr, "bayesphot: error: %s has unsupported version %lu\n",
+	    fname, (unsigned long) hdr->version);
+    return false;
+  }
+  if (hdr->layout != KD_FILE_LAYOUT) {
+    fprintf(stderr, "bayesphot: error: %s was written by a build of bayesphot with a different KD_SOA setting\n",
+	    fname);
+    return false;
+  }
+  return true;
+}
+
+
+/*********************************************************************/
+/* Function to write a kernel_density object to a file               */
+/*********************************************************************/
+bool kd_write(const kernel_density *kd, const unsigned long *sortmap,
+	      const int *nosort, const char *fname) {
+
+  const KDtree *tree = kd->tree;
+  const unsigned long ndim = tree->ndim;
+  const unsigned long npt = tree->tree[ROOT].npt;
+  const double *wgt = (const double *) tree->tree[ROOT].dptr;
+#ifdef KD_SOA
+  const void *x = tree->xsoa;
+  uint64_t nxbyte = 0;
+#else
+  const void *x = tree->tree[ROOT].x;
+  const uint64_t nxbyte = npt*ndim*sizeof(double);
+#endif
+  kd_file_header hdr;
+  kd_file_node *nodes;
+  double *bnd;
+  uint64_t *smap, ptr;
+  FILE *fp;
+  bool ok;
+
+  /* Fill in the header */
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, KD_FILE_MAGIC, 8);
+  hdr.version = KD_FILE_VERSION;
+  hdr.byteorder = KD_FILE_BYTEORDER;
+  hdr.ndim = ndim;
+  hdr.npt = npt;
+  hdr.leafsize = tree->leafsize;
+  hdr.levels = tree->levels;
+  hdr.leaves = tree->leaves;
+  hdr.nodes = tree->nodes;
+  hdr.weighted = wgt != NULL;
+  hdr.ktype = kd->ktype;
+  hdr.norm = kd->norm;
+  hdr.norm_tot = kd->norm_tot;
+  hdr.nosort = kd_hash_nosort(nosort, ndim);
+  hdr.layout = KD_FILE_LAYOUT;
+#ifdef KD_SOA
+  for (unsigned long i=1; i<=tree->nodes; i++)
+    if (tree->tree[i].splitdim == -1 && tree->tree[i].npt > 0)
+      nxbyte += ndim * KD_SOA_PAD(tree->tree[i].npt) *
+	sizeof(kd_soa_real);
+#endif
+  ptr = kd_file_pad(sizeof(hdr));
+  hdr.offset[KD_SEC_H] = ptr;
+  ptr += kd_file_pad(ndim*sizeof(double));
+  hdr.offset[KD_SEC_NODE] = ptr;
+  ptr += kd_file_pad(tree->nodes*sizeof(kd_file_node));
+  hdr.offset[KD_SEC_BND] = ptr;
+  ptr += kd_file_pad(4*ndim*tree->nodes*sizeof(double));
+  hdr.offset[KD_SEC_X] = ptr;
+  ptr += kd_file_pad(nxbyte);
+  hdr.offset[KD_SEC_WGT] = ptr;
+  if (wgt) ptr += kd_file_pad(npt*sizeof(double));
+  hdr.offset[KD_SEC_NODEWGT] = ptr;
+  ptr += kd_file_pad(tree->nodes*sizeof(double));
+  hdr.offset[KD_SEC_SORTMAP] = ptr;
+  ptr += kd_file_pad(npt*sizeof(uint64_t));
+  hdr.size = ptr;
+
+  /* Pack the node structure, bounding boxes, and sort map */
+  if (!(nodes = (kd_file_node *)
+	calloc(tree->nodes, sizeof(kd_file_node)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_write\n");
+    exit(1);
+  }
+  if (!(bnd = (double *) calloc(4*ndim*tree->nodes, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_write\n");
+    exit(1);
+  }
+  if (!(smap = (uint64_t *) calloc(npt, sizeof(uint64_t)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_write\n");
+    exit(1);
+  }
+  for (unsigned long i=0; i<tree->nodes; i++) {
+    const KDnode *node = &(tree->tree[i+1]);
+    nodes[i].npt = node->npt;
+    nodes[i].splitdim = node->splitdim;
+    nodes[i].xoff = node->npt > 0 ? node->off : 0;
+#ifdef KD_SOA
+    if (node->splitdim == -1 && node->npt > 0)
+      nodes[i].soaoff = node->soaoff;
+#endif
+    for (unsigned long j=0; j<ndim; j++) {
+      bnd[(4*i)*ndim+j] = node->xlim[0][j];
+      bnd[(4*i+1)*ndim+j] = node->xlim[1][j];
+      bnd[(4*i+2)*ndim+j] = node->xbnd[0][j];
+      bnd[(4*i+3)*ndim+j] = node->xbnd[1][j];
+    }
+  }
+  /* Hash the data in their original order; smap is used as scratch
+     space for the inverse of the sort map, which gives the position
+     in the tree of each point in the original order */
+  for (unsigned long i=0; i<npt; i++)
+    smap[sortmap ? sortmap[i] : i] = i;
+  hdr.hash = kd_hash_data(NULL, tree, wgt, ndim, npt, smap);
+  for (unsigned long i=0; i<npt; i++)
+    smap[i] = sortmap ? sortmap[i] : i;
+
+  /* Write */
+  if (!(fp = fopen(fname, "wb"))) {
+    fprintf(stderr, "bayesphot: error: unable to open %s for writing\n",
+	    fname);
+    free(nodes);
+    free(bnd);
+    free(smap);
+    return false;
+  }
+  ptr = 0;
+  ok = kd_file_write_sec(fp, &hdr, sizeof(hdr), &ptr) &&
+    kd_file_write_sec(fp, kd->h, ndim*sizeof(double), &ptr) &&
+    kd_file_write_sec(fp, nodes, tree->nodes*sizeof(kd_file_node), &ptr) &&
+    kd_file_write_sec(fp, bnd, 4*ndim*tree->nodes*sizeof(double), &ptr) &&
+    kd_file_write_sec(fp, x, nxbyte, &ptr) &&
+    (wgt == NULL ||
+     kd_file_write_sec(fp, wgt, npt*sizeof(double), &ptr)) &&
+    kd_file_write_sec(fp, kd->nodewgt+1, tree->nodes*sizeof(double),
+		      &ptr) &&
+    kd_file_write_sec(fp, smap, npt*sizeof(uint64_t), &ptr);
+  if (fclose(fp)) ok = false;
+  if (!ok)
+    fprintf(stderr, "bayesphot: error: unable to write %s\n", fname);
+
+  /* Free temporaries and return */
+  free(nodes);
+  free(bnd);
+  free(smap);
+  return ok;
+}
+
+
+/*********************************************************************/
+/* Function to read the basic properties of a file                   */
+/*********************************************************************/
+bool kd_file_info(const char *fname, unsigned long *ndim,
+		  unsigned long *npt, unsigned long *leafsize,
+		  unsigned long *nosort, unsigned long *hash) {
+  kd_file_header hdr;
+  FILE *fp;
+  bool ok;
+  if (!(fp = fopen(fname, "rb"))) return false;
+  ok = kd_file_read_header(fp, fname, &hdr);
+  fclose(fp);
+  if (!ok) return false;
+  *ndim = hdr.ndim;
+  *npt = hdr.npt;
+  *leafsize = hdr.leafsize;
+  *nosort = hdr.nosort;
+  *hash = hdr.hash;
+  return true;
+}
+
+
+/*********************************************************************/
+/* Function to compute the hash of a data set                        */
+/*********************************************************************/
+unsigned long kd_hash(const double *x, const double *wgt,
+		      const unsigned long ndim, const unsigned long npt) {
+  return kd_hash_data(x, NULL, wgt, ndim, npt, NULL);
+}
+
+
+/*********************************************************************/
+/* Function to compute the hash of a set of nosort flags             */
+/*********************************************************************/
+unsigned long kd_hash_nosort(const int *nosort,
+			     const unsigned long ndim) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  bool any = false;
+  if (nosort) {
+    for (unsigned long j=0; j<ndim; j++) {
+      if (nosort[j]) {
+	h = kd_hash_word(h, j);
+	any = true;
+      }
+    }
+  }
+  return any ? h : 0;
+}
+
+
+/*********************************************************************/
+/* Function to map a file into a kernel_density object               */
+/*********************************************************************/
+kernel_density *kd_map(const char *fname, const kernel_type ktype,
+		       unsigned long *sortmap) {
+
+  kd_file_header hdr;
+  struct stat st;
+  FILE *fp;
+  int fd;
+  char *map;
+  const kd_file_node *nodes;
+  double *bnd, *wgt;
+  char *x;
+  const uint64_t *smap;
+  unsigned long ndim;
+  kernel_density *kd;
+  KDtree *tree;
+
+  /* Open the file and check the header */
+  if (!(fp = fopen(fname, "rb"))) {
+    fprintf(stderr, "bayesphot: error: unable to open %s\n", fname);
+    return NULL;
+  }
+  if (!kd_file_read_header(fp, fname, &hdr)) {
+    fclose(fp);
+    return NULL;
+  }
+  fd = fileno(fp);
+  if (fstat(fd, &st) || (uint64_t) st.st_size < hdr.size) {
+    fprintf(stderr, "bayesphot: error: %s is truncated\n", fname);
+    fclose(fp);
+    return NULL;
+  }
+
+  /* Map the file; the mapping is private, so that pages are shared
+     between processes until they are written to */
+  map = (char *) mmap(NULL, hdr.size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE, fd, 0);
+  fclose(fp);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "bayesphot: error: unable to map %s\n", fname);
+    return NULL;
+  }
+  ndim = hdr.ndim;
+  nodes = (const kd_file_node *) (map + hdr.offset[KD_SEC_NODE]);
+  bnd = (double *) (map + hdr.offset[KD_SEC_BND]);
+  x = map + hdr.offset[KD_SEC_X];
+  wgt = hdr.weighted ? (double *) (map + hdr.offset[KD_SEC_WGT]) : NULL;
+  smap = (const uint64_t *) (map + hdr.offset[KD_SEC_SORTMAP]);
+
+  /* Build the tree; the nodes are the only part of it that is
+     allocated, and their data pointers point into the mapped file */
+  if (!(tree = (KDtree *) malloc(sizeof(KDtree)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_map\n");
+    exit(1);
+  }
+  tree->ndim = ndim;
+  tree->levels = hdr.levels;
+  tree->leaves = hdr.leaves;
+  tree->nodes = hdr.nodes;
+  tree->leafsize = hdr.leafsize;
+  tree->dsize = wgt ? sizeof(double) : 0;
+  if (!(tree->tree = (KDnode *) calloc(tree->nodes, sizeof(KDnode)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_map\n");
+    exit(1);
+  }
+  tree->tree--; /* Offset by 1 so tree->tree[1] is the root node */
+  for (unsigned long i=0; i<tree->nodes; i++) {
+    KDnode *node = &(tree->tree[i+1]);
+    node->npt = nodes[i].npt;
+    node->splitdim = (int) nodes[i].splitdim;
+    node->off = nodes[i].xoff;
+#ifdef KD_SOA
+    node->x = NULL;
+    node->soaoff = nodes[i].soaoff;
+#else
+    node->x = ((double *) x) + nodes[i].xoff*ndim;
+#endif
+    node->dptr = wgt ? (void *) (wgt + nodes[i].xoff) : NULL;
+    node->xlim[0] = bnd + (4*i)*ndim;
+    node->xlim[1] = bnd + (4*i+1)*ndim;
+    node->xbnd[0] = bnd + (4*i+2)*ndim;
+    node->xbnd[1] = bnd + (4*i+3)*ndim;
+  }
+#ifdef KD_SOA
+  /* The SoA copy is read straight from the file; sections are
+     aligned to KD_FILE_ALIGN = KD_SOA_ALIGN bytes, so it is aligned
+     as the leaf kernels require */
+  tree->xsoa = (kd_soa_real *) x;
+  tree->xsoa_mem = NULL;
+#endif
+
+  /* Build the kernel_density object; the bandwidth is copied, since
+     it is changed often and is tiny */
+  if (!(kd = malloc(sizeof(kernel_density)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_map\n");
+    exit(1);
+  }
+  if (!(kd->h = calloc(ndim, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_map\n");
+    exit(1);
+  }
+  memcpy(kd->h, map + hdr.offset[KD_SEC_H], ndim*sizeof(double));
+  kd->tree = tree;
+  kd->norm = hdr.norm;
+  kd->norm_tot = hdr.norm_tot;
+  kd->ktype = (kernel_type) hdr.ktype;
+  kd->nodewgt = ((double *) (map + hdr.offset[KD_SEC_NODEWGT])) - 1;
+  kd->map = map;
+  kd->mapsize = hdr.size;
+
+  /* If the kernel type differs from that used when the file was
+     written, recompute the normalization */
+  if (kd->ktype != ktype) {
+    kd->ktype = ktype;
+    kd_change_bandwidth(kd->h, kd);
+  }
+
+  /* Return the sort map */
+  if (sortmap)
+    for (unsigned long i=0; i<hdr.npt; i++) sortmap[i] = smap[i];
+
+  /* Return */
+  return kd;
+}
+
+
+/*********************************************************************/
+/* Function to return the positions of the points                    */
+/*********************************************************************/
+double *kd_points(const kernel_density *kd) {
+#ifdef KD_SOA
+  (void) kd;
+  return NULL;
+#else
+  return kd->tree->tree[ROOT].x;
+#endif
+}
+
+
+/*********************************************************************/
+/* Function to free a mapped tree                                    */
+/*********************************************************************/
+void kd_unmap(kernel_density *kd) {
+  kd->tree->tree++; /* Undo offset by 1 */
+  free(kd->tree->tree);
+  free(kd->tree);
+  munmap(kd->map, kd->mapsize);
+  kd->tree = NULL;
+  kd->nodewgt = NULL;
+  kd->map = NULL;
+  kd->mapsize = 0;
+}
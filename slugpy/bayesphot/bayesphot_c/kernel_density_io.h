@@ -0,0 +1,204 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+/*********************************************************************/
+/* This module contains routines to write kernel_density objects to  */
+/* disk, and to map them back into memory. A file holds everything   */
+/* needed to reconstruct the object without re-partitioning the      */
+/* data: the bandwidth and normalization, the structure of the tree  */
+/* and the bounding boxes of its nodes, the points in tree order,    */
+/* their weights (if any), the summed weights of the nodes, and the  */
+/* map from the original order of the points to the tree order.      */
+/*                                                                   */
+/* Files are mapped privately, so many processes that map the same   */
+/* file share the same physical memory for it. Changes made through  */
+/* kd_change_bandwidth and kd_change_wgt are copy-on-write: they     */
+/* affect only the process that makes them, and are never written    */
+/* back to the file.                                                 */
+/*                                                                   */
+/* Data are stored in native byte order; files can only be read on   */
+/* machines with the same byte order and word size as the one that   */
+/* wrote them. Builds with KD_SOA store the points in the tree's SoA */
+/* layout, and can only read files written by builds with the same   */
+/* KD_SOA and KD_SOA_FLOAT settings.                                 */
+/*********************************************************************/
+
+#ifndef _KERNEL_DENSITY_IO_H_
+#define _KERNEL_DENSITY_IO_H_
+
+#include <stdbool.h>
+#include "kernel_density.h"
+
+/*********************************************************************/
+/* Function definitions                                              */
+/*********************************************************************/
+
+bool kd_write(const kernel_density *kd, const unsigned long *sortmap,
+	      const int *nosort, const char *fname);
+/* This routine writes a kernel_density object to a file.
+
+   Parameters:
+      INPUT kd
+         the kernel_density object to be written
+      INPUT sortmap
+         the sortmap returned by build_kd or build_kd_sortdims when kd
+         was constructed; may be NULL, in which case the identity map
+         is stored
+      INPUT nosort
+         the nosort flags passed to build_kd_sortdims when kd was
+         constructed, or NULL if it was constructed with build_kd; a
+         hash of them is stored so that readers can check that the
+         tree was built with the options they expect
+      INPUT fname
+         name of the file to write
+
+   Returns:
+      OUTPUT success
+         true if the file was written successfully, false otherwise
+*/
+
+bool kd_file_info(const char *fname, unsigned long *ndim,
+		  unsigned long *npt, unsigned long *leafsize,
+		  unsigned long *nosort, unsigned long *hash);
+/* This routine reads the header of a file written by kd_write.
+
+   Parameters:
+      INPUT fname
+         name of the file to read
+      OUTPUT ndim
+         number of dimensions in the data set
+      OUTPUT npt
+         number of points in the data set
+      OUTPUT leafsize
+         leaf size of the tree
+      OUTPUT nosort
+         hash of the nosort flags the tree was built with, as
+         computed by kd_hash_nosort
+      OUTPUT hash
+         hash of the data and weights the tree was written with, as
+         computed by kd_hash; comparing it to kd_hash of a data set
+         shows whether the file was written from that data set
+
+   Returns:
+      OUTPUT success
+         true if the file exists and is a valid kernel_density file,
+         false otherwise
+*/
+
+unsigned long kd_hash(const double *x, const double *wgt,
+		      const unsigned long ndim, const unsigned long npt);
+/* This routine computes a 64-bit hash of a data set and its weights,
+   matching the hash that kd_write stores for a tree built on them.
+
+   Parameters:
+      INPUT x
+         array of npt * ndim elements containing the positions of the
+         points, in their original order (i.e., before build_kd
+         sorted them); element x[j + i*ndim] is the jth coordinate of
+         point i
+      INPUT wgt
+         array of npt elements giving the weights of the points, or
+         NULL if the points are unweighted
+      INPUT ndim
+         number of dimensions in the data set
+      INPUT npt
+         number of points in the data set
+
+   Returns:
+      OUTPUT hash
+         the hash value
+*/
+
+unsigned long kd_hash_nosort(const int *nosort,
+			     const unsigned long ndim);
+/* This routine computes a 64-bit hash of the nosort flags passed to
+   build_kd_sortdims, matching the one that kd_write stores. Only
+   whether each flag is non-zero matters; NULL, or flags that are all
+   zero, give 0, the value stored for trees built with build_kd.
+
+   Parameters:
+      INPUT nosort
+         array of ndim elements, or NULL
+      INPUT ndim
+         number of dimensions in the data set
+
+   Returns:
+      OUTPUT hash
+         the hash value
+*/
+
+kernel_density *kd_map(const char *fname, const kernel_type ktype,
+		       unsigned long *sortmap);
+/* This routine maps a file written by kd_write into memory, and
+   returns a kernel_density object built on it.
+
+   Parameters:
+      INPUT fname
+         name of the file to map
+      INPUT ktype
+         functional form of the kernel; this may differ from the one
+         in use when the file was written
+      OUTPUT sortmap
+         if not NULL, must point to npt elements; on return it holds
+         the mapping from the original position of every point to
+         its position in the tree, as returned by build_kd
+
+   Returns:
+      OUTPUT kd
+         a kernel_density object, or NULL if the file could not be
+         mapped; the object must be freed with free_kd
+
+   Notes:
+      The positions of the points, in tree order, can be retrieved
+      with kd_points, or with kd_get_points if compiled with KD_SOA;
+      they live in the mapped file, and remain valid until the object
+      is freed.
+*/
+
+double *kd_points(const kernel_density *kd);
+/* This routine returns a pointer to the positions of the points
+   indexed by a kernel_density object, in tree order; element
+   [j + i*ndim] is the jth coordinate of point i. This is mainly
+   useful for objects created by kd_map, whose data live in the
+   mapped file.
+
+   Parameters:
+      INPUT kd
+         the kernel_density object
+
+   Returns:
+      OUTPUT x
+         pointer to the positions, or NULL if compiled with KD_SOA,
+         in which case the object holds no such array, and positions
+         must be read with kd_get_points
+*/
+
+void kd_unmap(kernel_density *kd);
+/* This routine frees the tree of a kernel_density object created by
+   kd_map and unmaps its file, leaving the rest of the object
+   untouched; it is called by free_kd, and should not normally be
+   called directly.
+
+   Parameters:
+      INPUT/OUTPUT kd
+         The kernel_density object whose file is to be unmapped
+
+   Returns:
+      Nothing
+*/
+
+#endif
+/* _KERNEL_DENSITY_IO_H_ */
@@ -0,0 +1,181 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernel_density_mcmc.h"
+
+/*********************************************************************/
+/* Ensemble MCMC sampler                                             */
+/*********************************************************************/
+void kd_pdf_mcmc(const kernel_density *kd, const double *xfixed,
+		 const unsigned long *dimfixed,
+		 const unsigned long ndimfixed,
+		 const unsigned long nwalker, const unsigned long nstep,
+		 const unsigned long nburn, const double *x0,
+		 const double a, const double reltol, const double abstol,
+		 const unsigned int nthread, const gsl_rng *r,
+		 double *chain, double *accept) {
+
+  unsigned long i, j, k, l, s, half, nhalf, nfree, nkeep, ndim;
+  unsigned long *dimfree, *nacc;
+  double *x, *xprop, *lnp, *pdfprop, *z;
+  double zscale, lnq;
+  bool *isfixed;
+#ifdef DIAGNOSTIC
+  unsigned long *nodecheck, *leafcheck, *termcheck;
+#endif
+
+  /* Safety checks */
+  ndim = kd->tree->ndim;
+  if (ndimfixed >= ndim) {
+    fprintf(stderr, "bayesphot: error: kd_pdf_mcmc requires at least one free dimension\n");
+    exit(1);
+  }
+  if ((nwalker < 4) || (nwalker % 2 != 0)) {
+    fprintf(stderr, "bayesphot: error: kd_pdf_mcmc requires an even number of walkers >= 4\n");
+    exit(1);
+  }
+  if (nburn >= nstep) {
+    fprintf(stderr, "bayesphot: error: kd_pdf_mcmc requires nburn < nstep\n");
+    exit(1);
+  }
+  nfree = ndim - ndimfixed;
+  nhalf = nwalker / 2;
+  nkeep = nstep - nburn;
+
+  /* Allocate memory */
+  if (!(isfixed = (bool *) calloc(ndim, sizeof(bool))) ||
+      !(dimfree = (unsigned long *)
+	calloc(nfree, sizeof(unsigned long))) ||
+      !(nacc = (unsigned long *) calloc(nwalker, sizeof(unsigned long))) ||
+      !(x = (double *) calloc(nwalker*ndim, sizeof(double))) ||
+      !(xprop = (double *) calloc(nhalf*ndim, sizeof(double))) ||
+      !(lnp = (double *) calloc(nwalker, sizeof(double))) ||
+      !(pdfprop = (double *) calloc(nhalf, sizeof(double))) ||
+      !(z = (double *) calloc(nhalf, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_mcmc\n");
+    exit(1);
+  }
+#ifdef DIAGNOSTIC
+  /* kd_pdf_vec records its diagnostics for every point, so it needs
+     somewhere to put them even though we do not report them */
+  if (!(nodecheck = (unsigned long *)
+	calloc(nwalker, sizeof(unsigned long))) ||
+      !(leafcheck = (unsigned long *)
+	calloc(nwalker, sizeof(unsigned long))) ||
+      !(termcheck = (unsigned long *)
+	calloc(nwalker, sizeof(unsigned long)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_pdf_mcmc\n");
+    exit(1);
+  }
+#endif
+
+  /* Figure out which dimensions are free */
+  for (i=0; i<ndimfixed; i++) isfixed[dimfixed[i]] = true;
+  for (i=0, j=0; i<ndim; i++) if (!isfixed[i]) dimfree[j++] = i;
+
+  /* Set up the full positions of the walkers, and evaluate the PDF
+     at their starting positions */
+  for (i=0; i<nwalker; i++) {
+    for (k=0; k<ndimfixed; k++) x[i*ndim+dimfixed[k]] = xfixed[k];
+    for (k=0; k<nfree; k++) x[i*ndim+dimfree[k]] = x0[i*nfree+k];
+  }
+  kd_pdf_vec(kd, x, NULL, nwalker, reltol, abstol, nthread, lnp
+#ifdef DIAGNOSTIC
+	     , nodecheck, leafcheck, termcheck
+#endif
+	     );
+  for (i=0; i<nwalker; i++) lnp[i] = log(lnp[i]);
+
+  /* Main loop */
+  zscale = sqrt(a);
+  for (s=0; s<nstep; s++) {
+
+    /* Move each half of the ensemble in turn */
+    for (half=0; half<2; half++) {
+
+      /* Generate proposals: walker i in this half moves along the
+	 line joining it to a randomly-chosen walker j in the other
+	 half, by a stretch factor z drawn from g(z) ~ 1/sqrt(z) on
+	 [1/a, a] */
+      for (l=0; l<nhalf; l++) {
+	i = half*nhalf + l;
+	j = (1-half)*nhalf + gsl_rng_uniform_int(r, nhalf);
+	z[l] = (1.0/zscale + (zscale - 1.0/zscale) *
+		gsl_rng_uniform(r));
+	z[l] = z[l]*z[l];
+	for (k=0; k<ndim; k++)
+	  xprop[l*ndim+k] = x[j*ndim+k] +
+	    z[l] * (x[i*ndim+k] - x[j*ndim+k]);
+      }
+
+      /* Evaluate the PDF at all the proposed positions at once */
+      kd_pdf_vec(kd, xprop, NULL, nhalf, reltol, abstol, nthread,
+		 pdfprop
+#ifdef DIAGNOSTIC
+		 , nodecheck, leafcheck, termcheck
+#endif
+		 );
+
+      /* Accept or reject each proposal; proposals where the PDF
+	 vanishes are always rejected, but we still draw a random
+	 number for them so that every step consumes the same number
+	 of random deviates */
+      for (l=0; l<nhalf; l++) {
+	i = half*nhalf + l;
+	if (pdfprop[l] <= 0.0) {
+	  gsl_rng_uniform(r);
+	  continue;
+	}
+	lnq = (nfree-1)*log(z[l]) + log(pdfprop[l]) - lnp[i];
+	if (log(gsl_rng_uniform_pos(r)) < lnq) {
+	  memcpy(x+i*ndim, xprop+l*ndim, ndim*sizeof(double));
+	  lnp[i] = log(pdfprop[l]);
+	  nacc[i]++;
+	}
+      }
+    }
+
+    /* Record positions after burn-in */
+    if (s >= nburn) {
+      for (i=0; i<nwalker; i++)
+	for (k=0; k<nfree; k++)
+	  chain[(i*nkeep + s-nburn)*nfree + k] = x[i*ndim+dimfree[k]];
+    }
+  }
+
+  /* Return acceptance fractions if requested */
+  if (accept)
+    for (i=0; i<nwalker; i++) accept[i] = ((double) nacc[i]) / nstep;
+
+  /* Free memory */
+  free(isfixed);
+  free(dimfree);
+  free(nacc);
+  free(x);
+  free(xprop);
+  free(lnp);
+  free(pdfprop);
+  free(z);
+#ifdef DIAGNOSTIC
+  free(nodecheck);
+  free(leafcheck);
+  free(termcheck);
+#endif
+}
@@ -0,0 +1,107 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+/*********************************************************************/
+/* This module contains an affine-invariant ensemble MCMC sampler    */
+/* (Goodman & Weare 2010, as implemented in emcee by Foreman-Mackey  */
+/* et al. 2013) for sampling a kernel density PDF with some          */
+/* dimensions held fixed. The walkers are divided into two halves,   */
+/* and each half is moved in turn using stretch moves based on the   */
+/* positions of the walkers in the other half; the PDF at all the    */
+/* proposed positions in a half is then evaluated with a single call */
+/* to kd_pdf_vec.                                                    */
+/*********************************************************************/
+
+#ifndef _KERNEL_DENSITY_MCMC_H_
+#define _KERNEL_DENSITY_MCMC_H_
+
+#include "kernel_density.h"
+#include "gsl/gsl_rng.h"
+
+/*********************************************************************/
+/* Function definitions                                              */
+/*********************************************************************/
+
+void kd_pdf_mcmc(const kernel_density *kd, const double *xfixed,
+		 const unsigned long *dimfixed,
+		 const unsigned long ndimfixed,
+		 const unsigned long nwalker, const unsigned long nstep,
+		 const unsigned long nburn, const double *x0,
+		 const double a, const double reltol, const double abstol,
+		 const unsigned int nthread, const gsl_rng *r,
+		 double *chain, double *accept);
+/* This routine runs an ensemble MCMC sampler on a kernel density
+   PDF, subject to the constraint that certain dimensions have fixed
+   values. For example, given a kernel density PDF of physical and
+   photometric properties, this can be used to sample the posterior
+   distribution of the physical properties at fixed photometry.
+
+   Parameters:
+      INPUT kd
+         The kernel density object to sample
+      INPUT xfixed
+         An ndimfixed element array giving the positions in the
+         dimensions that are fixed
+      INPUT dimfixed
+         An ndimfixed element array specifying which dimensions are
+         fixed; dimensions must not be repeated
+      INPUT ndimfixed
+         The number of fixed dimensions; must be < kd->tree->ndim
+      INPUT nwalker
+         Number of walkers; must be even and at least 4
+      INPUT nstep
+         Number of steps each walker takes
+      INPUT nburn
+         Number of initial steps to discard as burn-in; must be <
+         nstep
+      INPUT x0
+         An nwalker * nfree element array, where nfree = kd->tree->ndim
+         - ndimfixed, giving the starting positions of the walkers in
+         the dimensions that are not fixed, listed in increasing order
+      INPUT a
+         Scale parameter of the stretch move; must be > 1, and 2 is
+         the usual choice
+      INPUT reltol
+         Relative tolerance for PDF evaluations; see kd_pdf
+      INPUT abstol
+         Absolute tolerance for PDF evaluations; see kd_pdf
+      INPUT nthread
+         Number of OpenMP threads to use in evaluating the PDF; 0 means
+         use the default
+      INPUT/OUTPUT r
+         The random number generator to use
+      OUTPUT chain
+         An nwalker * (nstep - nburn) * nfree element array containing
+         the positions of the walkers after burn-in, in the same order
+         as the chain returned by emcee: element
+         chain[(i*(nstep-nburn) + j)*nfree + k] is dimension k of
+         walker i after step nburn + j. This array must be allocated
+         to the correct size before calling this routine.
+      OUTPUT accept
+         If not NULL, an nwalker element array that on return holds
+         the fraction of proposed steps each walker accepted
+
+   Returns:
+      Nothing
+
+   Notes:
+      Random numbers are drawn serially, and each PDF evaluation is
+      independent, so for a given random number generator state the
+      chain does not depend on the number of threads.
+*/
+
+#endif
+/* _KERNEL_DENSITY_MCMC_H_ */
@@ -37,13 +37,21 @@ void kd_neighbors(const kernel_density *kd, const double *xpt,
 /*********************************************************************/
 void kd_neighbors_all(const kernel_density *kd, 
 		      const unsigned long nneighbor, 
-		      const bool bandwidth_units, unsigned long *idx, 
-		      double *d2) {
-  /* Call the KDtree neighbor finding routine */
-  if (bandwidth_units) {
-    neighbors_all(kd->tree, nneighbor, kd->h, idx, d2);
-  } else {
-    neighbors_all(kd->tree, nneighbor, NULL, idx, d2);
+		      const bool bandwidth_units,
+		      const unsigned int nthread,
+		      unsigned long *idx, double *d2) {
+  const double *h = bandwidth_units ? kd->h : NULL;
+
+  /* Work leaf by leaf: the points in a leaf share their first
+     candidate neighbors and search the same part of the tree, and
+     neighboring leaves have neighboring node numbers, so handing
+     each thread a block of consecutive nodes keeps the part of the
+     tree it is searching in cache */
+#pragma omp parallel for schedule(dynamic, KD_NEIGHBOR_BLOCK) \
+  num_threads(KD_NTHREAD(nthread))
+  for (unsigned long i=ROOT; i<=kd->tree->nodes; i++) {
+    if (kd->tree->tree[i].splitdim == -1)
+      neighbors_leaf(kd->tree, i, nneighbor, h, idx, d2);
   }
 }
 
@@ -71,16 +79,17 @@ void kd_neighbors_point_vec(const kernel_density *kd,
 			    const unsigned long npt,
 			    const unsigned long nneighbor,
 			    const bool bandwidth_units,
+			    const unsigned int nthread,
 			    unsigned long *idx, double *d2) {
-  unsigned long i;
-  for (i=0; i<npt; i++) {
-    if (bandwidth_units) {
-      neighbors_point(kd->tree, idxpt[i], nneighbor, kd->h, 
-		      idx+i*nneighbor, d2+i*nneighbor);
-    } else {
-      neighbors_point(kd->tree, idxpt[i], nneighbor, NULL, 
-		      idx+i*nneighbor, d2+i*nneighbor);
-    }
+  const double *h = bandwidth_units ? kd->h : NULL;
+
+  /* Each point writes only its own part of the output arrays, so
+     points can be processed in any order */
+#pragma omp parallel for schedule(dynamic, KD_VEC_CHUNK) \
+  num_threads(KD_NTHREAD(nthread))
+  for (unsigned long i=0; i<npt; i++) {
+    neighbors_point(kd->tree, idxpt[i], nneighbor, h, 
+		    idx+i*nneighbor, d2+i*nneighbor);
   }
 }
 
@@ -90,26 +99,20 @@ void kd_neighbors_point_vec(const kernel_density *kd,
 void kd_neighbors_vec(const kernel_density *kd, const double *xpt, 
 		      const unsigned long *dims, const unsigned long ndim, 
 		      const unsigned long npt, const unsigned long nneighbor,
-		      const bool bandwidth_units, double *pos,
+		      const bool bandwidth_units,
+		      const unsigned int nthread, double *pos,
 		      void *dptr, double *d2) {
-  unsigned long i;
+  const double *h = bandwidth_units ? kd->h : NULL;
 
   /* Loop over input points, calling KDtree neighbor find routine on each */
-  for (i=0; i<npt; i++) {
-    if (bandwidth_units) {
-      neighbors(kd->tree, 
-		xpt + i*ndim, 
-		dims, ndim, nneighbor, kd->h, 
-		pos + i*kd->tree->ndim*nneighbor, 
-		(void *) (((double *) dptr) + i*nneighbor),
-		d2 + i*nneighbor);
-    } else {
-      neighbors(kd->tree, 
-		xpt + i*ndim, 
-		dims, ndim, nneighbor, NULL, 
-		pos + i*kd->tree->ndim*nneighbor, 
-		(void *) (((double *) dptr) + i*nneighbor),
-		d2 + i*nneighbor);
-    }
+#pragma omp parallel for schedule(dynamic, KD_VEC_CHUNK) \
+  num_threads(KD_NTHREAD(nthread))
+  for (unsigned long i=0; i<npt; i++) {
+    neighbors(kd->tree, 
+	      xpt + i*ndim, 
+	      dims, ndim, nneighbor, h, 
+	      pos + i*kd->tree->ndim*nneighbor, 
+	      (void *) (((double *) dptr) + i*nneighbor),
+	      d2 + i*nneighbor);
   }
 }
@@ -25,6 +25,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdbool.h>
 #include "kernel_density.h"
 
+/* Number of consecutive tree nodes handed to each thread at a time
+   by kd_neighbors_all */
+#define KD_NEIGHBOR_BLOCK 32
+
 void kd_neighbors(const kernel_density *kd, const double *xpt, 
 		  const unsigned long *dims, const unsigned long ndim, 
 		  const unsigned long nneighbor,
@@ -80,8 +84,9 @@ void kd_neighbors(const kernel_density *kd, const double *xpt,
 
 void kd_neighbors_all(const kernel_density *kd, 
 		      const unsigned long nneighbor, 
-		      const bool bandwidth_units, unsigned long *idx, 
-		      double *d2);
+		      const bool bandwidth_units,
+		      const unsigned int nthread,
+		      unsigned long *idx, double *d2);
 /* This routine returns the indices of the N nearest neighbors for
    every point in the data set indexed by the kernel density
    object. Points are not considered their own neighbors.
@@ -95,6 +100,8 @@ void kd_neighbors_all(const kernel_density *kd,
          if true, the metric used to determine relative distance is
          normalized to the dimension-dependent bandwidth; if false,
          the metric is a simple Euclidean one
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
       OUTPUT idx
          indices of the neighbors found element idx[i*nneighbor+j]
          gives the index of the jth nearest neighbor of the ith point,
@@ -147,6 +154,7 @@ void kd_neighbors_point_vec(const kernel_density *kd,
 			    const unsigned long npt,
 			    const unsigned long nneighbor,
 			    const bool bandwidth_units,
+			    const unsigned int nthread,
 			    unsigned long *idx, double *d2);
 /* This routine is identical to kd_neighbors_point, except that it
    operates on a vector of input points instead of a single point.
@@ -165,6 +173,8 @@ void kd_neighbors_point_vec(const kernel_density *kd,
          if true, the metric used to determine relative distance is
          normalized to the dimension-dependent bandwidth; if false,
          the metric is a simple Euclidean one
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
       OUTPUT idx
          indices of the neighbors found, where indices refer to the
          array x that is indexed by the kernel density object; element
@@ -183,7 +193,8 @@ void kd_neighbors_point_vec(const kernel_density *kd,
 void kd_neighbors_vec(const kernel_density *kd, const double *xpt, 
 		      const unsigned long *dims, const unsigned long ndim, 
 		      const unsigned long npt, const unsigned long nneighbor,
-		      const bool bandwidth_units, double *pos,
+		      const bool bandwidth_units,
+		      const unsigned int nthread, double *pos,
 		      void *dptr, double *d2);
 /* This routine is identical to kd_neighbors, except that it operates
    on a vector of input points instead of a single input point.
@@ -213,6 +224,8 @@ void kd_neighbors_vec(const kernel_density *kd, const double *xpt,
          if true, the metric used to determine relative distance is
          normalized to the dimension-dependent bandwidth; if false,
          the metric is a simple Euclidean one
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
       OUTPUT pos
          positions of the nearest neighbor points; on entry, this
          pointer must point to a block of at least
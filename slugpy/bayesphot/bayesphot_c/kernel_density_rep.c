@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <gsl/gsl_randist.h>
 #include <gsl/gsl_sort.h>
 #include "geometry.h"
 #include "kernel_density_util.h"
@@ -60,8 +61,8 @@ unsigned long kd_rep(const kernel_density *kd, const double *x,
 
   /* Set the number of dimensions we're returning to the default if
      dim_return is NULL */
-  if (dim_return) ndim_ret = kd->tree->ndim - ndim;
-  else ndim_ret = ndim_return;
+  if (dim_return) ndim_ret = ndim_return;
+  else ndim_ret = kd->tree->ndim - ndim;
 
   /* Initialize the outputs */
   npt = 0;
@@ -140,9 +141,7 @@ unsigned long kd_rep(const kernel_density *kd, const double *x,
       for (i=0; i<kd->tree->tree[curnode].npt; i++) {
 
 	/* Get distance */
-	d2 = dist2(&(kd->tree->tree[curnode].x[kd->tree->ndim*i]), x,
-		   kd->tree->ndim, ndim, NULL, dims, kd->h, 
-		   kd->tree->ndim);
+	d2 = kd_leaf_dist2(kd->tree, curnode, i, x, dims, ndim, kd->h);
       
 	/* Compute weight of point */
 	wgttmp[npt] = exp(-d2/2.0);
@@ -158,12 +157,11 @@ unsigned long kd_rep(const kernel_density *kd, const double *x,
 	  /* If this dimension is not in dim_return, and dim_return is
 	     set, skip it */
 	  if (dim_return) {
-	    for (k=0; i<ndim_return; k++) if (j == dim_return[k]) break;
-	    if (k == ndim) continue;
+	    for (k=0; k<ndim_return; k++) if (j == dim_return[k]) break;
+	    if (k == ndim_return) continue;
 	  }
 	  /* If we're here, copy the dimension */ 
-	  xtmp[npt*ndim_ret+dimptr] = 
-	    kd->tree->tree[curnode].x[kd->tree->ndim*i+j];
+	  xtmp[npt*ndim_ret+dimptr] = kd_coord(kd->tree, curnode, i, j);
 	  dimptr++;
 	}
 
@@ -265,6 +263,7 @@ unsigned long kd_rep(const kernel_density *kd, const double *x,
   /* Free memory */
   free(xtmp);
   free(wgttmp);
+  free(idx);
   *xpt = (double *) realloc(*xpt, ndim_ret*npt_final*sizeof(double));
   *wgts = (double *) realloc(*wgts, npt_final*sizeof(double));
 
@@ -288,7 +287,7 @@ unsigned long squeeze_rep(const unsigned long npt,
 			  double **wgts) {
   kernel_density *kd;
   unsigned long i, j, levptr, npt_final;
-  double d2, w, log_hmin, logdx, *node_err;
+  double d2, w, log_hmin, logdx, *node_err, *xi, *xr;
 
   /* Get minimum bandwidth */
   log_hmin = log10(h[0]);
@@ -296,15 +295,15 @@ unsigned long squeeze_rep(const unsigned long npt,
     log_hmin = log_hmin < log10(h[i]) ? log_hmin : log10(h[i]);
 
   /* Build a kernel density representation of the data, with leaves
-     consisting of two points */
+     consisting of two points; this sorts x into tree order, so the
+     points of each node are merged in place in x */
   kd = build_kd(*x, ndim, npt, *wgts, 2, h, gaussian, 0, NULL);
 
-  /* Allocate temporaries */
-  if (!(node_err = (double *) calloc(kd->tree->nodes, sizeof(double)))) {
+  /* Allocate temporaries; node indices run from 1 to nodes */
+  if (!(node_err = (double *) calloc(kd->tree->nodes+1, sizeof(double)))) {
     fprintf(stderr, "bayesphot: error: unable to allocate memory in squeeze_rep\n");
     exit(1);
   }
-  for (i=0; i<kd->tree->nodes; i++) node_err[i] = 0.0;
 
   /* Go to leftmost node of the tree */
   levptr = ROOT;
@@ -332,9 +331,8 @@ unsigned long squeeze_rep(const unsigned long npt,
 
 	/* Get log separation of node points in units of the minimum
 	   bandwidth */ 
-	d2 = dist2(&(kd->tree->tree[i].x[0]),
-		   &(kd->tree->tree[i].x[ndim]),
-		   ndim, ndim, NULL, NULL, NULL, ndim);
+	xi = *x + kd->tree->tree[i].off*ndim;
+	d2 = dist2(xi, xi+ndim, ndim, ndim, NULL, NULL, NULL, ndim);
 	logdx = 0.5 * log10(d2) - log_hmin;
 
 	/* Compute the error associated with merging the points in this
@@ -349,8 +347,7 @@ unsigned long squeeze_rep(const unsigned long npt,
 	/* Compute the location of the merged point, and store in first
 	   slot for this node */
 	for (j=0; j<ndim; j++)
-	  kd->tree->tree[i].x[j] = w * kd->tree->tree[i].x[j] +
-	    (1.0-w) * kd->tree->tree[i].x[ndim+j];
+	  xi[j] = w * xi[j] + (1.0-w) * xi[ndim+j];
 
 	/* Set the weight of the merged point to the weight of the
 	   entire node, and zero out the other point */
@@ -376,9 +373,9 @@ unsigned long squeeze_rep(const unsigned long npt,
 
 	/* Get log separation of node points in units of the minimum
 	   bandwidth */ 
-	d2 = dist2(kd->tree->tree[LEFT(i)].x,
-		   kd->tree->tree[RIGHT(i)].x,
-		   ndim, ndim, NULL, NULL, NULL, ndim);
+	xi = *x + kd->tree->tree[i].off*ndim;
+	xr = *x + kd->tree->tree[RIGHT(i)].off*ndim;
+	d2 = dist2(xi, xr, ndim, ndim, NULL, NULL, NULL, ndim);
 	logdx = 0.5 * log10(d2) - log_hmin;
 
 	/* Compute the error associated with merging the points in this
@@ -396,8 +393,7 @@ unsigned long squeeze_rep(const unsigned long npt,
 	/* Compute the location of the merged point, and store in first
 	   slot for this node */
 	for (j=0; j<ndim; j++)
-	  kd->tree->tree[i].x[j] = w * kd->tree->tree[LEFT(i)].x[j] +
-	    (1.0-w) * kd->tree->tree[RIGHT(i)].x[j];
+	  xi[j] = w * xi[j] + (1.0-w) * xr[j];
 
 	/* Set the weight of the merged point to the weight of the
 	   entire node, and zero out the other point */
@@ -407,6 +403,10 @@ unsigned long squeeze_rep(const unsigned long npt,
     }
   }
 
+  /* Free the tree; this leaves the data in x and wgts in place */
+  free(node_err);
+  free_kd(kd);
+
   /* Last step: compress the final arrays, resize them in memory, then
      return the new size */
   for (i=0, npt_final=0; i<npt; i++) {
@@ -437,6 +437,281 @@ void free_kd_rep(double **xpt, double **wgts) {
 }
 
 
+/*********************************************************************/
+/* Functions to create, query, and free persistent representations   */
+/*********************************************************************/
+
+kd_rep_handle *kd_rep_create(const kernel_density *kd,
+			     const double *x,
+			     const unsigned long *dims,
+			     const unsigned long ndim,
+			     const double reltol,
+			     const unsigned long *dim_return,
+			     const unsigned long ndim_return,
+			     const bool squeeze) {
+
+  unsigned long i, j, k, npt;
+  double *xpt, *wgts;
+  kd_rep_handle *rep;
+
+  /* Build the representation */
+  npt = kd_rep(kd, x, dims, ndim, reltol, dim_return, ndim_return,
+	       &xpt, &wgts);
+  if (npt == 0) {
+    free_kd_rep(&xpt, &wgts);
+    return NULL;
+  }
+
+  /* Allocate the handle */
+  if (!(rep = (kd_rep_handle *) malloc(sizeof(kd_rep_handle)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_rep_create\n");
+    exit(1);
+  }
+  rep->ndim = dim_return ? ndim_return : kd->tree->ndim - ndim;
+  if (!(rep->dims = (unsigned long *)
+	calloc(rep->ndim, sizeof(unsigned long))) ||
+      !(rep->h = (double *) calloc(rep->ndim, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_rep_create\n");
+    exit(1);
+  }
+
+  /* Record which dimensions of the parent were returned, and their
+     bandwidths; this uses the same selection rule as kd_rep */
+  for (j=0, i=0; j<kd->tree->ndim; j++) {
+    for (k=0; k<ndim; k++) if (j == dims[k]) break;
+    if (k != ndim) continue;
+    if (dim_return) {
+      for (k=0; k<ndim_return; k++) if (j == dim_return[k]) break;
+      if (k == ndim_return) continue;
+    }
+    rep->dims[i] = j;
+    rep->h[i] = kd->h[j];
+    i++;
+  }
+
+  /* Squeeze if requested */
+  if (squeeze)
+    npt = squeeze_rep(npt, rep->ndim, rep->h, reltol, &xpt, &wgts);
+
+  /* Store and return */
+  rep->npt = npt;
+  rep->xpt = xpt;
+  rep->wgts = wgts;
+  return rep;
+}
+
+void kd_rep_create_vec(const kernel_density *kd,
+		       const double *x,
+		       const unsigned long *dims,
+		       const unsigned long ndim,
+		       const unsigned long npt,
+		       const double reltol,
+		       const unsigned long *dim_return,
+		       const unsigned long ndim_return,
+		       const bool squeeze,
+		       const unsigned int nthread,
+		       kd_rep_handle **reps) {
+
+  /* Each representation is independent, and the time needed to build
+     one varies a great deal, so schedule dynamically */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(KD_NTHREAD(nthread))
+  for (unsigned long i=0; i<npt; i++)
+    reps[i] = kd_rep_create(kd, x+i*ndim, dims, ndim, reltol,
+			    dim_return, ndim_return, squeeze);
+}
+
+void kd_rep_free(kd_rep_handle *rep) {
+  if (rep == NULL) return;
+  free(rep->dims);
+  free(rep->h);
+  free(rep->xpt);
+  free(rep->wgts);
+  free(rep);
+}
+
+unsigned long kd_rep_npt(const kd_rep_handle *rep) { return rep->npt; }
+double *kd_rep_x(const kd_rep_handle *rep) { return rep->xpt; }
+double *kd_rep_wgts(const kd_rep_handle *rep) { return rep->wgts; }
+
+
+/*********************************************************************/
+/* Functions to evaluate quantities from persistent representations  */
+/*********************************************************************/
+
+void kd_rep_eval_grid(const kd_rep_handle *rep,
+		      const unsigned long *dimgrid,
+		      const unsigned long ndimgrid,
+		      const double *xgridlo,
+		      const double *xgridhi,
+		      const unsigned long *ngrid,
+		      double *pdf) {
+
+  unsigned long i, k, l, n, last, nlast, nouter, ngridtot, nfac;
+  unsigned long *col, *off, *idx;
+  double dx, t, p, *fac, *row;
+
+  /* Find the column of the representation corresponding to each grid
+     dimension, and the offset of its entries in the factor table */
+  if (!(col = (unsigned long *) calloc(ndimgrid, sizeof(unsigned long))) ||
+      !(off = (unsigned long *) calloc(ndimgrid, sizeof(unsigned long))) ||
+      !(idx = (unsigned long *) calloc(ndimgrid, sizeof(unsigned long)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_rep_eval_grid\n");
+    exit(1);
+  }
+  ngridtot = 1;
+  nfac = 0;
+  for (k=0; k<ndimgrid; k++) {
+    for (col[k]=0; col[k]<rep->ndim; col[k]++)
+      if (rep->dims[col[k]] == dimgrid[k]) break;
+    if (col[k] == rep->ndim) {
+      fprintf(stderr, "bayesphot: error: kd_rep_eval_grid: dimension %lu is not in the representation\n", dimgrid[k]);
+      exit(1);
+    }
+    off[k] = nfac;
+    nfac += ngrid[k];
+    ngridtot *= ngrid[k];
+  }
+  last = ndimgrid-1;
+  nlast = ngrid[last];
+  nouter = ngridtot / nlast;
+  if (!(fac = (double *) calloc(nfac, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_rep_eval_grid\n");
+    exit(1);
+  }
+
+  /* Zero the output */
+  for (n=0; n<ngridtot; n++) pdf[n] = 0.0;
+
+  /* Loop over points */
+  for (i=0; i<rep->npt; i++) {
+
+    /* Compute the one-dimensional kernel factors for this point along
+       each grid dimension */
+    for (k=0; k<ndimgrid; k++) {
+      dx = ngrid[k] > 1 ?
+	(xgridhi[k] - xgridlo[k]) / (ngrid[k] - 1) : 0.0;
+      for (l=0; l<ngrid[k]; l++) {
+	t = (xgridlo[k] + l*dx - rep->xpt[i*rep->ndim+col[k]]) /
+	  rep->h[col[k]];
+	fac[off[k]+l] = exp(-0.5*t*t);
+      }
+    }
+
+    /* Add the outer product of the factors to the grid, one row along
+       the last dimension at a time */
+    for (k=0; k<ndimgrid; k++) idx[k] = 0;
+    for (n=0; n<nouter; n++) {
+      p = rep->wgts[i];
+      for (k=0; k<last; k++) p *= fac[off[k]+idx[k]];
+      if (p != 0.0) {
+	row = pdf + n*nlast;
+	for (l=0; l<nlast; l++) row[l] += p * fac[off[last]+l];
+      }
+      for (k=last; k>0; k--) {
+	if (++idx[k-1] < ngrid[k-1]) break;
+	idx[k-1] = 0;
+      }
+    }
+  }
+
+  /* Free memory */
+  free(col);
+  free(off);
+  free(idx);
+  free(fac);
+}
+
+void kd_rep_eval_grid_vec(const kd_rep_handle **reps,
+			  const unsigned long nrep,
+			  const unsigned long *dimgrid,
+			  const unsigned long ndimgrid,
+			  const double *xgridlo,
+			  const double *xgridhi,
+			  const unsigned long *ngrid,
+			  const unsigned int nthread,
+			  double *pdf) {
+
+  unsigned long ngridtot = 1;
+  for (unsigned long k=0; k<ndimgrid; k++) ngridtot *= ngrid[k];
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(KD_NTHREAD(nthread))
+  for (unsigned long i=0; i<nrep; i++) {
+    if (reps[i] == NULL) {
+      for (unsigned long n=0; n<ngridtot; n++) pdf[i*ngridtot+n] = 0.0;
+    } else {
+      kd_rep_eval_grid(reps[i], dimgrid, ndimgrid,
+		       xgridlo+i*ndimgrid, xgridhi+i*ndimgrid, ngrid,
+		       pdf+i*ngridtot);
+    }
+  }
+}
+
+void kd_rep_moments(const kd_rep_handle *rep, double *mean,
+		    double *cov) {
+
+  unsigned long i, j, k, nd = rep->ndim;
+  double dj, dk;
+
+  /* Mean */
+  for (j=0; j<nd; j++) mean[j] = 0.0;
+  for (i=0; i<rep->npt; i++)
+    for (j=0; j<nd; j++) mean[j] += rep->wgts[i] * rep->xpt[i*nd+j];
+
+  /* Covariance: scatter of the points about the mean, plus the
+     covariance of the kernel itself */
+  if (cov == NULL) return;
+  for (j=0; j<nd*nd; j++) cov[j] = 0.0;
+  for (i=0; i<rep->npt; i++) {
+    for (j=0; j<nd; j++) {
+      dj = rep->xpt[i*nd+j] - mean[j];
+      for (k=0; k<=j; k++) {
+	dk = rep->xpt[i*nd+k] - mean[k];
+	cov[j*nd+k] += rep->wgts[i] * dj * dk;
+      }
+    }
+  }
+  for (j=0; j<nd; j++) {
+    cov[j*nd+j] += rep->h[j]*rep->h[j];
+    for (k=0; k<j; k++) cov[k*nd+j] = cov[j*nd+k];
+  }
+}
+
+void kd_rep_draw(const kd_rep_handle *rep, const unsigned long nsample,
+		 const gsl_rng *r, double *out) {
+
+  unsigned long i, j, lo, hi, mid, nd = rep->ndim;
+  double u, *cumwgt;
+
+  /* Build the cumulative weight table */
+  if (!(cumwgt = (double *) calloc(rep->npt, sizeof(double)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_rep_draw\n");
+    exit(1);
+  }
+  cumwgt[0] = rep->wgts[0];
+  for (i=1; i<rep->npt; i++) cumwgt[i] = cumwgt[i-1] + rep->wgts[i];
+
+  /* Draw samples: choose a point with probability proportional to its
+     weight by bisection on the cumulative weights, then add a
+     displacement drawn from its kernel */
+  for (i=0; i<nsample; i++) {
+    u = gsl_rng_uniform(r) * cumwgt[rep->npt-1];
+    lo = 0;
+    hi = rep->npt-1;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (cumwgt[mid] > u) hi = mid;
+      else lo = mid+1;
+    }
+    for (j=0; j<nd; j++)
+      out[i*nd+j] = rep->xpt[lo*nd+j] +
+	gsl_ran_gaussian_ziggurat(r, rep->h[j]);
+  }
+
+  /* Free memory */
+  free(cumwgt);
+}
+
+
 /*********************************************************************/
 /* Return the maximum error that results from merging the points in  */
 /* a node; the quantity returns is normalized to the maximum of the  */
@@ -22,7 +22,34 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef _KERNEL_DENSITY_REP_H_
 #define _KERNEL_DENSITY_REP_H_
 
+#include <stdbool.h>
 #include "kernel_density.h"
+#include "gsl/gsl_rng.h"
+
+/*********************************************************************/
+/* A kernel density representation kept in memory, together with the */
+/* information needed to evaluate it. Representations built by       */
+/* kd_rep_create are independent of the kernel_density object from   */
+/* which they were built, and can be used to evaluate any number of  */
+/* marginal PDFs, moments, and samples without searching the tree    */
+/* again.                                                            */
+/*********************************************************************/
+typedef struct {
+  /* Number of points in the representation */
+  unsigned long npt;
+  /* Number of dimensions in the representation */
+  unsigned long ndim;
+  /* Dimensions of the parent kernel_density object to which the
+     coordinates of the points correspond */
+  unsigned long *dims;
+  /* Kernel bandwidth in each dimension */
+  double *h;
+  /* Positions of the points; xpt[i*ndim+j] is coordinate j of point
+     i */
+  double *xpt;
+  /* Weights of the points, normalized to have a sum of unity */
+  double *wgts;
+} kd_rep_handle;
 
 /*********************************************************************/
 /* Function definitions                                              */
@@ -149,5 +176,205 @@ unsigned long squeeze_rep(const unsigned long npts,
       one (see kd_rep).
 */
 
+kd_rep_handle *kd_rep_create(const kernel_density *kd,
+			     const double *x,
+			     const unsigned long *dims,
+			     const unsigned long ndim,
+			     const double reltol,
+			     const unsigned long *dim_return,
+			     const unsigned long ndim_return,
+			     const bool squeeze);
+/* This routine builds a kernel density representation with kd_rep,
+   optionally squeezes it with squeeze_rep, and returns it as a
+   kd_rep_handle.
+
+   Parameters:
+      INPUT kd, x, dims, ndim, reltol, dim_return, ndim_return
+         same as for kd_rep
+      INPUT squeeze
+         if true, the representation is squeezed using reltol as the
+         tolerance
+
+   Returns:
+      OUTPUT rep
+         the representation, which must be freed with kd_rep_free, or
+         NULL if kd_rep could not reach the requested precision
+*/
+
+void kd_rep_create_vec(const kernel_density *kd,
+		       const double *x,
+		       const unsigned long *dims,
+		       const unsigned long ndim,
+		       const unsigned long npt,
+		       const double reltol,
+		       const unsigned long *dim_return,
+		       const unsigned long ndim_return,
+		       const bool squeeze,
+		       const unsigned int nthread,
+		       kd_rep_handle **reps);
+/* This routine is a vectorized version of kd_rep_create, which
+   builds representations for npt points at once, in parallel.
+
+   Parameters:
+      INPUT kd, dims, ndim, reltol, dim_return, ndim_return, squeeze
+         same as for kd_rep_create
+      INPUT x
+         array of npt * ndim elements giving the positions for which
+         representations are to be built; element x[i*ndim+j] is
+         coordinate j of point i
+      INPUT npt
+         number of points
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
+      OUTPUT reps
+         array of npt elements; on return, reps[i] is the
+         representation for point i, or NULL if it could not be built
+
+   Returns:
+      Nothing
+*/
+
+void kd_rep_free(kd_rep_handle *rep);
+/* This routine frees a representation created by kd_rep_create or
+   kd_rep_create_vec; passing NULL does nothing.
+
+   Parameters:
+      INPUT/OUTPUT rep
+         the representation to be freed
+
+   Returns:
+      Nothing
+*/
+
+unsigned long kd_rep_npt(const kd_rep_handle *rep);
+double *kd_rep_x(const kd_rep_handle *rep);
+double *kd_rep_wgts(const kd_rep_handle *rep);
+/* These routines return the number of points in a representation,
+   and pointers to their positions and weights; they are provided as
+   a convenience for python. The pointers remain valid until the
+   representation is freed.
+*/
+
+void kd_rep_eval_grid(const kd_rep_handle *rep,
+		      const unsigned long *dimgrid,
+		      const unsigned long ndimgrid,
+		      const double *xgridlo,
+		      const double *xgridhi,
+		      const unsigned long *ngrid,
+		      double *pdf);
+/* This routine evaluates the PDF described by a representation,
+   marginalized over all the dimensions of the representation except
+   those in dimgrid, on a regular grid. Because the representation
+   consists of Gaussians, the marginalization is exact, and the
+   kernel of each point is the product of one-dimensional factors,
+   which are computed once per point per grid dimension.
+
+   Parameters:
+      INPUT rep
+         the representation
+      INPUT dimgrid
+         array of ndimgrid elements giving the dimensions of the grid;
+         these are dimensions of the parent kernel_density object,
+         and each must be one of rep->dims
+      INPUT ndimgrid
+         number of dimensions in the grid; must be > 0
+      INPUT xgridlo
+         array of ndimgrid elements giving the coordinates of the
+         lower left corner of the grid
+      INPUT xgridhi
+         array of ndimgrid elements giving the coordinates of the
+         upper right corner of the grid
+      INPUT ngrid
+         array of ndimgrid elements giving the number of grid points
+         in each dimension; each must be > 0, and a dimension with a
+         single grid point is evaluated at xgridlo
+      OUTPUT pdf
+         array of ngrid[0] * ngrid[1] * ... ngrid[ndimgrid-1] elements;
+         on return, element pdf[((i0*ngrid[1] + i1)*ngrid[2] + i2)...]
+         holds the value of
+         sum_i wgts[i] * prod_k exp(-(g_k - xpt[i,k])^2 / (2 h_k^2)),
+         where g_k is coordinate i_k along dimension k of the grid;
+         this is the same unnormalized quantity described in kd_rep
+
+   Returns:
+      Nothing
+*/
+
+void kd_rep_eval_grid_vec(const kd_rep_handle **reps,
+			  const unsigned long nrep,
+			  const unsigned long *dimgrid,
+			  const unsigned long ndimgrid,
+			  const double *xgridlo,
+			  const double *xgridhi,
+			  const unsigned long *ngrid,
+			  const unsigned int nthread,
+			  double *pdf);
+/* This routine is a vectorized version of kd_rep_eval_grid, which
+   evaluates the PDFs of nrep representations at once, in parallel.
+
+   Parameters:
+      INPUT reps
+         array of nrep representations; NULL entries are allowed, and
+         give a PDF of zero
+      INPUT nrep
+         number of representations
+      INPUT dimgrid, ndimgrid, ngrid
+         same as for kd_rep_eval_grid; the same grid dimensions and
+         numbers of grid points are used for every representation
+      INPUT xgridlo, xgridhi
+         arrays of nrep * ndimgrid elements giving the grid corners
+         for each representation, so that each can have its own
+         grid
+      INPUT nthread
+         number of OpenMP threads to use; 0 means use the default
+      OUTPUT pdf
+         array of nrep * ngrid[0] * ... ngrid[ndimgrid-1] elements;
+         the PDF for representation i starts at element
+         i * ngrid[0] * ... ngrid[ndimgrid-1], and is packed as for
+         kd_rep_eval_grid
+
+   Returns:
+      Nothing
+*/
+
+void kd_rep_moments(const kd_rep_handle *rep, double *mean,
+		    double *cov);
+/* This routine computes the mean and covariance matrix of the PDF
+   described by a representation; the covariance includes the width
+   of the kernels as well as the scatter of the points.
+
+   Parameters:
+      INPUT rep
+         the representation
+      OUTPUT mean
+         array of rep->ndim elements; on return holds the mean
+      OUTPUT cov
+         array of rep->ndim * rep->ndim elements; on return holds the
+         covariance matrix; may be NULL if it is not needed
+
+   Returns:
+      Nothing
+*/
+
+void kd_rep_draw(const kd_rep_handle *rep, const unsigned long nsample,
+		 const gsl_rng *r, double *out);
+/* This routine draws samples from the PDF described by a
+   representation.
+
+   Parameters:
+      INPUT rep
+         the representation
+      INPUT nsample
+         number of samples to draw
+      INPUT/OUTPUT r
+         the random number generator to use
+      OUTPUT out
+         array of nsample * rep->ndim elements; on return, element
+         out[i*rep->ndim+j] is coordinate j of sample i
+
+   Returns:
+      Nothing
+*/
+
 #endif
 /* _KERNEL_DENSITY_REP_H_ */
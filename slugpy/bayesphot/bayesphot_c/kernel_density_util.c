@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <gsl/gsl_math.h>
 #include "geometry.h"
+#include "kernel_density_io.h"
 #include "kernel_density_util.h"
 
 /*********************************************************************/
@@ -48,6 +49,8 @@ kernel_density* build_kd(double *x, unsigned long ndim,
   /* Record data describing kernel */
   for (unsigned long i=0; i<ndim; i++) kd->h[i] = bandwidth[i];
   kd->ktype = ktype;
+  kd->map = NULL;
+  kd->mapsize = 0;
 
   /* Surface element factor for an n-sphere */
   ds_n = ds(ndim);
@@ -170,6 +173,8 @@ kernel_density* build_kd_sortdims(double *x, unsigned long ndim,
   /* Record data describing kernel */
   for (i=0; i<ndim; i++) kd->h[i] = bandwidth[i];
   kd->ktype = ktype;
+  kd->map = NULL;
+  kd->mapsize = 0;
 
   /* Surface element factor for an n-sphere */
   ds_n = ds(ndim);
@@ -286,6 +291,8 @@ kernel_density *copy_kd(kernel_density *kd) {
   kdcopy->norm_tot = kd->norm_tot;
   kdcopy->ktype = kd->ktype;
   kdcopy->nodewgt = kd->nodewgt;
+  kdcopy->map = NULL;
+  kdcopy->mapsize = 0;
   for (i=0; i<kd->tree->ndim; i++) kdcopy->h[i] = kd->h[i];
 
   /* Return */
@@ -297,9 +304,14 @@ kernel_density *copy_kd(kernel_density *kd) {
 /*********************************************************************/
 void free_kd(kernel_density *kd) {
   free(kd->h);
-  kd->nodewgt++;
-  free(kd->nodewgt);
-  free_tree(kd->tree);
+  if (kd->map != NULL) {
+    /* Tree and node weights live in a mapped file */
+    kd_unmap(kd);
+  } else {
+    kd->nodewgt++;
+    free(kd->nodewgt);
+    free_tree(kd->tree);
+  }
   free(kd);
 }
 
@@ -350,9 +362,7 @@ void kd_change_wgt(const double *wgt, kernel_density *kd) {
 
       /* Set pointer to weight for this node */
       if (kd->tree->tree[i].npt != 0)
-	kd->tree->tree[i].dptr = (void *) 
-	  (wgt + (kd->tree->tree[i].x - kd->tree->tree[ROOT].x) / 
-	   kd->tree->ndim);
+	kd->tree->tree[i].dptr = (void *) (wgt + kd->tree->tree[i].off);
 
       /* Get weight */
       kd->nodewgt[i] = 0.0;  
@@ -381,9 +391,7 @@ void kd_change_wgt(const double *wgt, kernel_density *kd) {
       /* Set pointer to weight for this node */
       if (wgt != NULL) {
 	if (kd->tree->tree[i].npt != 0)
-	  kd->tree->tree[i].dptr = (void *) 
-	    (wgt + (kd->tree->tree[i].x - kd->tree->tree[ROOT].x) / 
-	     kd->tree->ndim);
+	  kd->tree->tree[i].dptr = (void *) (wgt + kd->tree->tree[i].off);
       } else {
 	kd->tree->tree[i].dptr = NULL;
       }
@@ -441,6 +449,156 @@ void kd_change_bandwidth(const double *bandwidth, kernel_density *kd) {
 }
 
 
+/*********************************************************************/
+/* Function to add points to a kernel_density object                 */
+/*********************************************************************/
+
+/* Maximum ratio of the size of the largest leaf to the target leaf
+   size before kd_insert rebuilds the tree */
+#define KD_INSERT_MAXFILL 2
+
+void kd_insert(kernel_density *kd, double *xbuf, double *wgtbuf,
+	       const double *xnew, const double *wgtnew,
+	       const unsigned long nnew, const unsigned long leafsize,
+	       unsigned long *perm) {
+
+  unsigned long i, curnode, nold, ntot, ndim;
+  unsigned long *leaf, *sortmap;
+  const double *wgtold;
+  bool weighted;
+
+  /* Safety checks */
+  if (kd->map != NULL) {
+    fprintf(stderr, "bayesphot: error: cannot insert points into a kernel_density object read with kd_map\n");
+    exit(1);
+  }
+  wgtold = (const double *) kd->tree->tree[ROOT].dptr;
+  weighted = wgtold != NULL;
+  if (weighted && (wgtbuf == NULL || wgtnew == NULL)) {
+    fprintf(stderr, "bayesphot: error: kd_insert requires weights for a weighted kernel_density object\n");
+    exit(1);
+  }
+  ndim = kd->tree->ndim;
+  nold = kd->tree->tree[ROOT].npt;
+  ntot = nold + nnew;
+
+  /* Allocate memory */
+  if (!(leaf = (unsigned long *)
+	calloc(nnew > 0 ? nnew : 1, sizeof(unsigned long)))) {
+    fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_insert\n");
+    exit(1);
+  }
+
+  /* Insert the points into the tree; weights are handled separately
+     below, since they may have been attached by kd_change_wgt rather
+     than when the tree was built */
+  insert_tree(kd->tree, xbuf, NULL, xnew, NULL, nnew, perm, leaf);
+
+  /* Put the weights into tree order, and point the nodes at them */
+  if (weighted) {
+#pragma omp parallel for
+    for (unsigned long n=0; n<ntot; n++)
+      wgtbuf[n] = perm[n] < nold ? wgtold[perm[n]] :
+	wgtnew[perm[n]-nold];
+    for (i=1; i<=kd->tree->nodes; i++)
+      if (kd->tree->tree[i].npt != 0)
+	kd->tree->tree[i].dptr = (void *) (wgtbuf + kd->tree->tree[i].off);
+  }
+
+  /* Add the weights of the new points to the nodes that contain
+     them, and update the normalization */
+  for (i=0; i<nnew; i++)
+    for (curnode=leaf[i]; curnode != 0; curnode=PARENT(curnode))
+      kd->nodewgt[curnode] += weighted ? wgtnew[i] : 1.0;
+  if (weighted)
+    kd->norm_tot = kd->norm / kd->nodewgt[ROOT];
+  else
+    kd->norm_tot = kd->norm / ntot;
+  free(leaf);
+
+  /* If the tree has become too unbalanced, rebuild it */
+  if (kd->tree->leafsize > KD_INSERT_MAXFILL*leafsize) {
+
+    /* Build a new tree on the combined data, re-ordering the data
+       and weights in place */
+    if (!(sortmap = (unsigned long *)
+	  calloc(ntot, sizeof(unsigned long)))) {
+      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_insert\n");
+      exit(1);
+    }
+    free_tree(kd->tree);
+    if (weighted)
+      kd->tree = build_tree(xbuf, ndim, ntot, leafsize, wgtbuf,
+			    sizeof(double), 0, sortmap);
+    else
+      kd->tree = build_tree(xbuf, ndim, ntot, leafsize, NULL, 0, 0,
+			    sortmap);
+
+    /* Compose the permutation from the rebuild with that from the
+       insertion */
+    if (!(leaf = (unsigned long *)
+	  calloc(ntot, sizeof(unsigned long)))) {
+      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_insert\n");
+      exit(1);
+    }
+#pragma omp parallel for
+    for (unsigned long n=0; n<ntot; n++) leaf[n] = perm[sortmap[n]];
+    memcpy(perm, leaf, ntot*sizeof(unsigned long));
+    free(leaf);
+    free(sortmap);
+
+    /* Re-allocate the node weights, then recompute them and the
+       normalization */
+    kd->nodewgt++;
+    free(kd->nodewgt);
+    if (!(kd->nodewgt = calloc(kd->tree->nodes, sizeof(double)))) {
+      fprintf(stderr, "bayesphot: error: unable to allocate memory in kd_insert\n");
+      exit(1);
+    }
+    kd->nodewgt--;
+    kd_change_wgt(weighted ? wgtbuf : NULL, kd);
+  }
+}
+
+#undef KD_INSERT_MAXFILL
+
+
+/*********************************************************************/
+/* Function to read point positions from a kernel_density object     */
+/*********************************************************************/
+void kd_get_points(const kernel_density *kd, const unsigned long *idx,
+		   const unsigned long nidx, const unsigned long *dims,
+		   const unsigned long ndims, double *out) {
+
+  const KDtree *tree = kd->tree;
+
+  if (idx == NULL) {
+
+    /* Reading all points, so go through the leaves, each of which
+       holds a contiguous block of points */
+#pragma omp parallel for
+    for (unsigned long n=1; n<=tree->nodes; n++) {
+      if (tree->tree[n].splitdim != -1) continue;
+      for (unsigned long i=0; i<tree->tree[n].npt; i++)
+	for (unsigned long k=0; k<ndims; k++)
+	  out[(tree->tree[n].off+i)*ndims+k] =
+	    kd_coord(tree, n, i, dims ? dims[k] : k);
+    }
+
+  } else {
+
+    /* Reading selected points, so find the leaf holding each one */
+#pragma omp parallel for
+    for (unsigned long n=0; n<nidx; n++) {
+      unsigned long i = idx[n];
+      unsigned long leaf = kd_leaf_of(tree, ROOT, &i);
+      for (unsigned long k=0; k<ndims; k++)
+	out[n*ndims+k] = kd_coord(tree, leaf, i, dims ? dims[k] : k);
+    }
+  }
+}
+
+
 /*********************************************************************/
 /* Function to report if we were compiled in diagnotic mode          */
 /*********************************************************************/
@@ -451,3 +609,27 @@ bool diagnostic_mode() {
   return false;
 #endif
 }
+
+
+/*********************************************************************/
+/* Function to report if we were compiled with OpenMP                */
+/*********************************************************************/
+bool openmp_mode() {
+#ifdef _OPENMP
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+/*********************************************************************/
+/* Function to report if we were compiled with KD_SOA                */
+/*********************************************************************/
+bool soa_mode() {
+#ifdef KD_SOA
+  return true;
+#else
+  return false;
+#endif
+}
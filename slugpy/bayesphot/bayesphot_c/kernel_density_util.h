@@ -195,10 +195,116 @@ void kd_change_wgt(const double *wgt, kernel_density *kd);
       Nothing
 */
 
+void kd_insert(kernel_density *kd, double *xbuf, double *wgtbuf,
+	       const double *xnew, const double *wgtnew,
+	       const unsigned long nnew, const unsigned long leafsize,
+	       unsigned long *perm);
+/* This routine adds points to a kernel_density object. The points
+   are inserted into the existing tree with insert_tree, and the
+   summed weights of the nodes and the normalization are updated
+   incrementally, so the cost is dominated by copying the data into
+   the new buffers rather than by re-partitioning it. However, the
+   structure of the tree is not changed by insertion, so leaves that
+   receive many new points become large; once any leaf holds more
+   than twice the target leaf size (KD_INSERT_MAXFILL), the tree is
+   instead rebuilt from scratch on the combined data. If points are
+   added in batches of comparable size, this means that the tree is
+   rebuilt each time the library roughly doubles in size, so the
+   amortized cost per point of the rebuilds is the same as that of
+   building the tree once.
+
+   Parameters
+      INPUT/OUTPUT kd
+         The kernel density object to which points are to be added;
+         this must not be an object created by kd_map
+      OUTPUT xbuf
+         array of (npt + nnew) * ndim elements, where npt is the
+         number of points in kd before insertion; on return this
+         holds the positions of all the points, in tree order, and kd
+         refers to it, so it must not be freed while kd is in use,
+         unless compiled with KD_SOA, in which case kd keeps its own
+         copy of the positions and xbuf may be freed
+      OUTPUT wgtbuf
+         array of npt + nnew elements; on return this holds the
+         weights of all the points, in tree order, and kd refers to
+         it; may be NULL if kd is unweighted
+      INPUT xnew
+         array of nnew * ndim elements giving the positions of the
+         new points
+      INPUT wgtnew
+         array of nnew elements giving the weights of the new points;
+         must be NULL if kd is unweighted, and non-NULL if it is
+         weighted
+      INPUT nnew
+         number of points to add
+      INPUT leafsize
+         target leaf size of the tree, used to decide when to rebuild
+         it, and as the leaf size of the rebuilt tree
+      OUTPUT perm
+         array of npt + nnew elements; on return perm[i] gives the
+         original position of the point now at position i in the tree,
+         in the sense described for insert_tree; this can be used to
+         re-order any other data associated to the points
+
+   Returns
+      Nothing
+
+   Notes
+      If the tree is rebuilt, it is rebuilt with no restrictions on
+      the dimensions along which it is split, even if it was
+      originally constructed with build_kd_sortdims or with minsplit
+      > 0; this affects only the efficiency of the tree, not the
+      results of any calculation done with it.
+*/
+
+void kd_get_points(const kernel_density *kd, const unsigned long *idx,
+		   const unsigned long nidx, const unsigned long *dims,
+		   const unsigned long ndims, double *out);
+/* This routine copies the positions of points out of a
+   kernel_density object. This is the way to read the positions if
+   the code was compiled with KD_SOA, since the tree then holds them
+   only in its own structure-of-arrays copy, possibly in single
+   precision.
+
+   Parameters
+      INPUT kd
+         The kernel density object whose points are to be read
+      INPUT idx
+         array of nidx elements giving the indices, in tree order, of
+         the points to read; if NULL, all points are read, in tree
+         order, and nidx must be the number of points in kd
+      INPUT nidx
+         number of points to read
+      INPUT dims
+         array of ndims elements giving the dimensions to read; if
+         NULL, all dimensions are read, and ndims must be the number
+         of dimensions in kd
+      INPUT ndims
+         number of dimensions to read
+      OUTPUT out
+         array of nidx * ndims elements; on return, out[i*ndims+j] is
+         coordinate dims[j] of point idx[i]
+
+   Returns
+      Nothing
+*/
+
 bool diagnostic_mode(void);
 /* This routine just returns true if the code was compiled in
    diagnostic mode, false if it was not. */
 
+bool openmp_mode(void);
+/* This routine returns true if the code was compiled with OpenMP
+   support, false if it was not; without OpenMP, the nthread
+   arguments to the vectorized routines are ignored and all
+   calculations run on a single thread. */
+
+bool soa_mode(void);
+/* This routine returns true if the code was compiled with KD_SOA, in
+   which case the KD tree keeps its own copy of the point positions
+   and does not refer to the arrays from which it was built, false if
+   it was not. */
+
 #endif
 /* _KERNEL_DENSITY_UTIL_H_ */
 
@@ -37,6 +37,101 @@ array_1d_ulong = npct.ndpointer(dtype=c_ulong, ndim=1,
 array_1d_int = npct.ndpointer(dtype=c_int, ndim=1,
                               flags="CONTIGUOUS")
 
+##################################################################
+# Define a class to hold representations kept in c memory         #
+##################################################################
+
+class bp_rep(object):
+    """
+    A kernel density representation of a marginal PDF, of the type
+    returned by bp.make_approx_phys, held in memory by the bayesphot
+    c library. Objects of this class are created by
+    bp.make_rep_phys, and can be passed to bp.mpdf_approx in place of
+    x and wgts; they avoid rebuilding the representation or copying
+    it between python and c each time a marginal PDF, moment, or
+    sample is needed.
+
+    Attributes:
+       npt : int
+          number of points in the representation
+       dims : array of int
+          dimensions of the parent bp object covered by the
+          representation
+       bandwidth : array
+          kernel bandwidth in each dimension
+       x : array, shape (npt, ndim)
+          positions of the points
+       wgts : array, shape (npt)
+          weights of the points, normalized to have a sum of unity
+
+    Notes:
+       x and wgts are views of memory owned by the c library, which
+       is freed when the bp_rep is deleted; copy them if they are
+       needed after that
+    """
+
+    def __init__(self, clib, ptr, dims, bandwidth):
+        self._clib = clib
+        self._ptr = ptr
+        self._rng = None
+        self.dims = np.array(dims, dtype=int)
+        self.bandwidth = np.array(bandwidth, dtype=c_double)
+        self.npt = clib.kd_rep_npt(ptr)
+        self.x = npct.as_array(clib.kd_rep_x(ptr),
+                               shape=(self.npt, len(self.dims)))
+        self.wgts = npct.as_array(clib.kd_rep_wgts(ptr),
+                                  shape=(self.npt,))
+
+    def __del__(self):
+        if self._ptr is not None:
+            self._clib.kd_rep_free(self._ptr)
+            self._ptr = None
+        if self._rng is not None:
+            self._clib.rng_free(self._rng)
+            self._rng = None
+
+    def moments(self):
+        """
+        Returns the mean and covariance matrix of the PDF described by
+        the representation
+
+        Parameters:
+           None
+
+        Returns:
+           mean : array, shape (ndim)
+              mean of the PDF
+           cov : array, shape (ndim, ndim)
+              covariance matrix of the PDF, including the width of
+              the kernels
+        """
+        nd = len(self.dims)
+        mean = np.zeros(nd)
+        cov = np.zeros(nd*nd)
+        self._clib.kd_rep_moments(self._ptr, mean, cov)
+        return mean, cov.reshape((nd, nd))
+
+    def draw(self, nsample=1):
+        """
+        Returns a sample drawn from the PDF described by the
+        representation
+
+        Parameters:
+           nsample : int
+              number of samples to draw
+
+        Returns:
+           samples : array, shape (nsample, ndim)
+              the samples drawn
+        """
+        if self._rng is None:
+            self._rng = self._clib.rng_init(0)
+        nd = len(self.dims)
+        out = np.zeros(nsample*nd)
+        self._clib.kd_rep_draw(self._ptr, nsample, self._rng, out)
+        return out.reshape((nsample, nd))
+
+
 ##################################################################
 # Define the cluster_slug class                                  #
 ##################################################################
@@ -79,6 +174,10 @@ class bp(object):
           number of photometric properties in the library
        ndim : int
           nphys + nphot
+       nthreads : int
+          number of OpenMP threads used by the c library when
+          evaluating many points at once; 0 means use the OpenMP
+          default
     """
 
     ##################################################################
@@ -88,7 +187,7 @@ class bp(object):
                  ktype='gaussian', priors=None, pobs=None,
                  sample_density=None, reltol=1.0e-2, abstol=1.0e-10,
                  leafsize=16, nosort=None, thread_safe=True,
-                 caching='none'):
+                 caching='none', nthreads=0, kdfile=None):
         """
         Initialize a bp object.
 
@@ -194,12 +293,36 @@ class bp(object):
                     no caching is performed automatically; the user
                     may still manually cache data by calling
                     the make_cache method
+           nthreads : int
+              number of OpenMP threads the c library should use to
+              evaluate PDFs and find neighbors for many points at
+              once; 0 means use the OpenMP default, which is
+              normally set by the OMP_NUM_THREADS environment
+              variable; results do not depend on the number of
+              threads
+           kdfile : string | None
+              name of a file in which to keep the KD tree built from
+              dataset; if the file does not exist, the tree is built
+              as usual and then written to it; if it does exist, the
+              tree is mapped directly from it rather than being
+              rebuilt; the data in a mapped file are shared between
+              all processes that map it, which reduces both memory
+              use and start-up time when many processes use the same
+              library; the file records a hash of the data it was
+              built from, and the leafsize and nosort it was built
+              with, and an existing file for which any of these
+              differ from the arguments passed is rejected rather
+              than used; a library whose tree was mapped from a file
+              cannot be extended with add_data
 
         Returns
            Nothing
 
         Raises
-           IOError, if the bayesphot c library cannot be found
+           IOError, if the bayesphot c library cannot be found, or if
+           kdfile exists but cannot be mapped
+           ValueError, if kdfile exists but was not written from
+           dataset with the same leafsize and nosort
 
         Notes
            Because the data sets passed in may be large, this class
@@ -215,15 +338,27 @@ class bp(object):
            memory overhead.
         """
 
-        # Load the c library
+        # Load the c library; the random number generator it uses for
+        # sampling is allocated and seeded the first time it is needed
         self.__clib = npct.load_library("bayesphot", 
                                         osp.realpath(__file__))
+        self._rng = None
 
         # Check for diagnostic mode
         self.__clib.diagnostic_mode.restype = c_bool
         self.__clib.diagnostic_mode.argtypes = None
         self.__diag_mode = bool(self.__clib.diagnostic_mode())
 
+        # Check whether the library can use more than one thread
+        self.__clib.openmp_mode.restype = c_bool
+        self.__clib.openmp_mode.argtypes = None
+        self.__openmp = bool(self.__clib.openmp_mode())
+
+        # Check whether the KD tree keeps its own copy of the points
+        self.__clib.soa_mode.restype = c_bool
+        self.__clib.soa_mode.argtypes = None
+        self.__soa = bool(self.__clib.soa_mode())
+
         # Define interfaces to all the c library functions
         self.__clib.build_kd.restype = c_void_p
         self.__clib.build_kd.argtypes \
@@ -260,11 +395,68 @@ class bp(object):
         self.__clib.free_kd_copy.restype = None
         self.__clib.free_kd_copy.argtypes = [ c_void_p ]
 
+        self.__clib.kd_write.restype = c_bool
+        self.__clib.kd_write.argtypes \
+            = [ c_void_p,          # kd
+                POINTER(c_ulong),  # sortmap
+                POINTER(c_int),    # nosort
+                ctypes.c_char_p ]  # fname
+
+        self.__clib.kd_file_info.restype = c_bool
+        self.__clib.kd_file_info.argtypes \
+            = [ ctypes.c_char_p,   # fname
+                POINTER(c_ulong),  # ndim
+                POINTER(c_ulong),  # npt
+                POINTER(c_ulong),  # leafsize
+                POINTER(c_ulong),  # nosort
+                POINTER(c_ulong) ] # hash
+
+        self.__clib.kd_hash.restype = c_ulong
+        self.__clib.kd_hash.argtypes \
+            = [ array_1d_double,   # x
+                c_void_p,          # wgt
+                c_ulong,           # ndim
+                c_ulong ]          # npt
+
+        self.__clib.kd_hash_nosort.restype = c_ulong
+        self.__clib.kd_hash_nosort.argtypes \
+            = [ POINTER(c_int),    # nosort
+                c_ulong ]          # ndim
+
+        self.__clib.kd_map.restype = c_void_p
+        self.__clib.kd_map.argtypes \
+            = [ ctypes.c_char_p,   # fname
+                c_int,             # ktype
+                POINTER(c_ulong) ] # sortmap
+
+        self.__clib.kd_points.restype = POINTER(c_double)
+        self.__clib.kd_points.argtypes = [ c_void_p ] # kd
+
         self.__clib.kd_change_wgt.restype = None
         self.__clib.kd_change_wgt.argtypes \
             = [ POINTER(c_double), # wgt
                 c_void_p ]         # kd
 
+        self.__clib.kd_insert.restype = None
+        self.__clib.kd_insert.argtypes \
+            = [ c_void_p,          # kd
+                array_1d_double,   # xbuf
+                POINTER(c_double), # wgtbuf
+                array_1d_double,   # xnew
+                POINTER(c_double), # wgtnew
+                c_ulong,           # nnew
+                c_ulong,           # leafsize
+                array_1d_ulong ]   # perm
+
+        self.__clib.kd_get_points.restype = None
+        self.__clib.kd_get_points.argtypes \
+            = [ c_void_p,          # kd
+                POINTER(c_ulong),  # idx
+                c_ulong,           # nidx
+                array_1d_ulong,    # dims
+                c_ulong,           # ndims
+                array_1d_double ]  # out
+
         self.__clib.kd_change_bandwidth.restype = None
         self.__clib.kd_change_bandwidth.argtypes \
             = [ array_1d_double,   # bandwidth
@@ -290,6 +482,7 @@ class bp(object):
                 c_ulong,           # npt
                 c_ulong,           # nneighbor
                 c_bool,            # bandwidth_units
+                c_uint,            # nthread
                 array_1d_double,   # pos
                 POINTER(c_double), # dptr
                 array_1d_double ]  # d2
@@ -309,6 +502,7 @@ class bp(object):
                 c_ulong,           # npt
                 c_ulong,           # nneighbor
                 c_bool,            # bandwidth_units
+                c_uint,            # nthread
                 array_1d_ulong,     # idx
                 array_1d_double ]  # d2
 
@@ -317,7 +511,8 @@ class bp(object):
             = [ c_void_p,          # kd
                 c_ulong,           # nneighbor
                 c_bool,            # bandwidth_units
-                array_1d_ulong,     # idx
+                c_uint,            # nthread
+                array_1d_ulong,    # idx
                 array_1d_double ]  # d2
 
         self.__clib.kd_pdf.restype = c_double
@@ -376,6 +571,7 @@ class bp(object):
                     c_ulong,           # npt
                     c_double,          # reltol
                     c_double,          # abstol
+                    c_uint,            # nthread
                     array_1d_double,   # pdf
                     array_1d_ulong,     # nodecheck
                     array_1d_ulong,     # leafcheck
@@ -388,7 +584,17 @@ class bp(object):
                     c_ulong,           # npt
                     c_double,          # reltol
                     c_double,          # abstol
+                    c_uint,            # nthread
                     array_1d_double ]  # pdf
+        self.__clib.kd_pdf_dualtree.restype = None
+        self.__clib.kd_pdf_dualtree.argtypes \
+            = [ c_void_p,          # kd
+                array_1d_double,   # x
+                c_ulong,           # npt
+                c_double,          # reltol
+                c_double,          # abstol
+                c_uint,            # nthread
+                array_1d_double ]  # pdf
         self.__clib.kd_pdf_int.restype = c_double
         if self.__diag_mode:
             self.__clib.kd_pdf_int.argtypes \
@@ -420,6 +626,7 @@ class bp(object):
                     c_ulong,           # npt
                     c_double,          # reltol
                     c_double,          # abstol
+                    c_uint,            # nthread
                     array_1d_double,   # pdf
                     array_1d_ulong,    # nodecheck
                     array_1d_ulong,    # leafcheck
@@ -434,6 +641,7 @@ class bp(object):
                     c_ulong,           # npt
                     c_double,          # reltol
                     c_double,          # abstol
+                    c_uint,            # nthread
                     array_1d_double ]  # pdf
         self.__clib.kd_pdf_int_grid.restype = None
         self.__clib.kd_pdf_int_grid.argtypes \
@@ -464,6 +672,22 @@ class bp(object):
                 c_double,              # reltol
                 c_double,              # abstol
                 array_1d_double ]      # pdf                
+        self.__clib.kd_pdf_reggrid_binned.restype = None
+        self.__clib.kd_pdf_reggrid_binned.argtypes \
+            = [ c_void_p,              # kd
+                array_1d_double,       # xfixed
+                array_1d_ulong,        # dimfixed
+                c_ulong,               # ndimfixed
+                c_ulong,               # nfixed
+                array_1d_double,       # xgridlo
+                array_1d_double,       # xgridhi
+                array_1d_ulong,        # ngrid
+                array_1d_ulong,        # dimgrid
+                c_ulong,               # ndimgrid
+                c_double,              # reltol
+                c_double,              # abstol
+                c_uint,                # nthread
+                array_1d_double ]      # pdf
 
         self.__clib.kd_rep.restype = c_ulong
         self.__clib.kd_rep.argtypes \
@@ -495,6 +719,60 @@ class bp(object):
                 POINTER(POINTER(
                     c_double)) ]       # wgts
 
+        self.__clib.kd_rep_create.restype = c_void_p
+        self.__clib.kd_rep_create.argtypes \
+            = [ c_void_p,              # kd
+                array_1d_double,       # x
+                array_1d_ulong,        # dims
+                c_ulong,               # ndim
+                c_double,              # reltol
+                array_1d_ulong,        # dim_return
+                c_ulong,               # ndim_return
+                c_bool ]               # squeeze
+        self.__clib.kd_rep_create_vec.restype = None
+        self.__clib.kd_rep_create_vec.argtypes \
+            = [ c_void_p,              # kd
+                array_1d_double,       # x
+                array_1d_ulong,        # dims
+                c_ulong,               # ndim
+                c_ulong,               # npt
+                c_double,              # reltol
+                array_1d_ulong,        # dim_return
+                c_ulong,               # ndim_return
+                c_bool,                # squeeze
+                c_uint,                # nthread
+                POINTER(c_void_p) ]    # reps
+        self.__clib.kd_rep_free.restype = None
+        self.__clib.kd_rep_free.argtypes = [ c_void_p ] # rep
+        self.__clib.kd_rep_npt.restype = c_ulong
+        self.__clib.kd_rep_npt.argtypes = [ c_void_p ] # rep
+        self.__clib.kd_rep_x.restype = POINTER(c_double)
+        self.__clib.kd_rep_x.argtypes = [ c_void_p ] # rep
+        self.__clib.kd_rep_wgts.restype = POINTER(c_double)
+        self.__clib.kd_rep_wgts.argtypes = [ c_void_p ] # rep
+        self.__clib.kd_rep_eval_grid_vec.restype = None
+        self.__clib.kd_rep_eval_grid_vec.argtypes \
+            = [ POINTER(c_void_p),     # reps
+                c_ulong,               # nrep
+                array_1d_ulong,        # dimgrid
+                c_ulong,               # ndimgrid
+                array_1d_double,       # xgridlo
+                array_1d_double,       # xgridhi
+                array_1d_ulong,        # ngrid
+                c_uint,                # nthread
+                array_1d_double ]      # pdf
+        self.__clib.kd_rep_moments.restype = None
+        self.__clib.kd_rep_moments.argtypes \
+            = [ c_void_p,              # rep
+                array_1d_double,       # mean
+                array_1d_double ]      # cov
+        self.__clib.kd_rep_draw.restype = None
+        self.__clib.kd_rep_draw.argtypes \
+            = [ c_void_p,              # rep
+                c_ulong,               # nsample
+                c_void_p,              # rng
+                array_1d_double ]      # out
+
         self.__clib.kd_pdf_draw.restype = None
         self.__clib.kd_pdf_draw.argtypes \
             = [ c_void_p,              # kd
@@ -505,6 +783,23 @@ class bp(object):
                 c_int,                 # draw_method
                 c_void_p,              # rng
                 array_1d_double ]      # out
+        self.__clib.kd_pdf_mcmc.restype = None
+        self.__clib.kd_pdf_mcmc.argtypes \
+            = [ c_void_p,              # kd
+                array_1d_double,       # xfixed
+                array_1d_ulong,        # dimfixed
+                c_ulong,               # ndimfixed
+                c_ulong,               # nwalker
+                c_ulong,               # nstep
+                c_ulong,               # nburn
+                array_1d_double,       # x0
+                c_double,              # a
+                c_double,              # reltol
+                c_double,              # abstol
+                c_uint,                # nthread
+                c_void_p,              # rng
+                array_1d_double,       # chain
+                c_void_p ]             # accept
         self.__clib.rng_init.restype = c_void_p
         self.__clib.rng_init.argtypes \
             = [ c_ulong ]              # seed
@@ -542,6 +837,7 @@ class bp(object):
         self.__pobs_data = None
         self.__kd_phys = None
         self.__cache = []
+        self.nthreads = nthreads
 
         # Build the initial kernel density estimation object, using a
         # dummy bandwidth; record mapping from indices of input data
@@ -549,21 +845,78 @@ class bp(object):
         # sample density, observation probability, or prior
         self.__bandwidth = np.ones(self.__nphys + self.__nphot)
         self.__idxmap = np.zeros(self.__ndata, dtype=c_ulong)
-        self.__idxmap_inv = np.argsort(self.__idxmap)
+        self.__kdmapped = False
         if nosort is None:
+            nosort_ptr = None
+        else:
+            nosort_c = np.zeros(nosort.shape, dtype=np.intc)
+            nosort_c[:] = nosort == True
+            nosort_ptr = nosort_c.ctypes.data_as(POINTER(c_int))
+        if kdfile is not None and osp.isfile(kdfile):
+            fname = kdfile.encode()
+            ndim = c_ulong(0)
+            npt = c_ulong(0)
+            leafsize = c_ulong(0)
+            filenosort = c_ulong(0)
+            filehash = c_ulong(0)
+            if not self.__clib.kd_file_info(fname, ndim, npt,
+                                            leafsize, filenosort,
+                                            filehash):
+                raise IOError("bp: unable to read KD tree file " +
+                              kdfile)
+            if ndim.value != self.__dataset.shape[1] or \
+               npt.value != self.__ndata or \
+               filehash.value != self.__clib.kd_hash(
+                   np.ravel(self.__dataset), None,
+                   self.__dataset.shape[1], self.__ndata):
+                raise ValueError("bp: KD tree file " + kdfile +
+                                 " does not match dataset")
+            if leafsize.value != self.leafsize or \
+               filenosort.value != self.__clib.kd_hash_nosort(
+                   nosort_ptr, self.__dataset.shape[1]):
+                raise ValueError("bp: KD tree file " + kdfile +
+                                 " was built with different leafsize"
+                                 " or nosort")
+            self.__kd = self.__clib.kd_map(
+                fname, self.__ktype,
+                self.__idxmap.ctypes.data_as(POINTER(c_ulong)))
+            if self.__kd is None:
+                raise IOError("bp: unable to map KD tree file " +
+                              kdfile)
+            self.__kdmapped = True
+            # Point the data set at the copy held in the mapped file,
+            # which is already in tree order; with KD_SOA the file
+            # holds only the tree's own copy, which we read through
+            # __points
+            if self.__soa:
+                self.__dataset = None
+            else:
+                self.__dataset = npct.as_array(
+                    self.__clib.kd_points(self.__kd),
+                    shape=self.__dataset.shape)
+        elif nosort is None:
             self.__kd = self.__clib.build_kd(
                 np.ravel(self.__dataset), self.__dataset.shape[1],
                 self.__ndata, None, self.leafsize, self.__bandwidth,
                 self.__ktype, 0,
                 self.__idxmap.ctypes.data_as(POINTER(c_ulong)))
         else:
-            nosort_c = np.zeros(nosort.shape, dtype=np.intc)
-            nosort_c[:] = nosort == True
             self.__kd = self.__clib.build_kd_sortdims(
                 np.ravel(self.__dataset), self.__dataset.shape[1],
                 self.__ndata, None, self.leafsize, self.__bandwidth,
                 self.__ktype, nosort_c,
                 self.__idxmap.ctypes.data_as(POINTER(c_ulong)))
+        if kdfile is not None and not osp.isfile(kdfile):
+            if not self.__clib.kd_write(
+                    self.__kd,
+                    self.__idxmap.ctypes.data_as(POINTER(c_ulong)),
+                    nosort_ptr, kdfile.encode()):
+                warn("bp: unable to write KD tree file " + kdfile)
+        self.__idxmap_inv = np.argsort(self.__idxmap)
+
+        # With KD_SOA the tree has copied the points, so drop our copy
+        if self.__soa:
+            self.__dataset = None
 
         # Store sample density
         if hasattr(sample_density, '__iter__'):
@@ -615,8 +968,9 @@ class bp(object):
         if hasattr(self, '__kd_phys'):
             if self.__kd_phys is not None:
                 self.__clib.free_kd(self.__kd_phys)
-        if hasattr(self, '__rng'):
-            self.__clib.rng_free(self.__rng)
+        if getattr(self, '_rng', None) is not None:
+            self.__clib.rng_free(self._rng)
+            self._rng = None
 
 
     ##################################################################
@@ -644,7 +998,7 @@ class bp(object):
                 # Callable, so pass the physical data to the
                 # callable and store the result
                 self.__sample_density \
-                    = self.__sden(self.__dataset[:,:self.__nphys])
+                    = self.__sden(self.__points(slice(self.__nphys)))
 
             elif type(self.__sden) is np.ndarray or self.__sden is None:
 
@@ -661,7 +1015,7 @@ class bp(object):
                 # already
                 if self.__kd_phys is None:
                     self.__dataset_phys \
-                        = np.copy(self.__dataset[:,:self.__nphys])
+                        = np.copy(self.__points(slice(self.__nphys)))
                     self.__kd_phys \
                         = self.__clib.build_kd(
                             np.ravel(self.__dataset_phys), 
@@ -680,11 +1034,12 @@ class bp(object):
                         # that we cannot pass self.__dataset_phys,
                         # because it is not in the same order as
                         # the full data set anymore
-                        pts = np.ravel(self.__dataset[:,:self.__nphys])
+                        pts = np.ravel(self.__points(slice(self.__nphys)))
                         if not self.__diag_mode:
                             self.__clib.kd_pdf_vec(
                                 self.__kd_phys, pts, None,
                                 self.__ndata, self.reltol, self.abstol,
+                                self.nthreads,
                                 self.__sample_density)
                         else:
                             nodecheck = np.zeros(self.__ndata, dtype=c_ulong)
@@ -693,6 +1048,7 @@ class bp(object):
                             self.__clib.kd_pdf_vec(
                                 self.__kd_phys, pts, None,
                                 self.__ndata, self.reltol, self.abstol,
+                                self.nthreads,
                                 self.__sample_density_sorted, nodecheck, 
                                 leafcheck, termcheck)
                     else:
@@ -715,6 +1071,7 @@ class bp(object):
                             self.__clib.kd_pdf_vec(
                                 self.__kd_phys, np.ravel(pos), None,
                                 nsamp+2, self.reltol, self.abstol,
+                                self.nthreads,
                                 sample_density)
                         else:
                             nodecheck = np.zeros(nsamp+2, dtype=c_ulong)
@@ -723,11 +1080,12 @@ class bp(object):
                             self.__clib.kd_pdf_vec(
                                 self.__kd_phys, np.ravel(pos), None,
                                 nsamp+2, self.reltol, self.abstol,
+                                self.nthreads,
                                 sample_density, nodecheck, 
                                 leafcheck, termcheck)
                         # Now interpolate the sample points to all
                         # points in the data set
-                        pts = np.ravel(self.__dataset[:,:self.__nphys])
+                        pts = np.ravel(self.__points(slice(self.__nphys)))
                         self.__sample_density \
                             = np.exp(
                                 interp.griddata(pos, 
@@ -853,7 +1211,7 @@ class bp(object):
             self.__priors = pr
             if hasattr(self.__priors, '__call__'):
                 self.__prior_data \
-                    = self.__priors(self.__dataset[:,:self.__nphys]) \
+                    = self.__priors(self.__points(slice(self.__nphys))) \
                           .flatten()
             else:
                 self.__prior_data = self.__priors
@@ -950,7 +1308,7 @@ class bp(object):
             self.__pobs = po
             if hasattr(self.__pobs, '__call__'):
                 self.__pobs_data \
-                    = self.__pobs(self.__dataset[:,self.__nphys:]).\
+                    = self.__pobs(self.__points(slice(self.__nphys, None))).\
                     flatten()
             else:
                 self.__pobs_data = self.__pobs
@@ -1026,7 +1384,7 @@ class bp(object):
                     d2 = np.zeros(nneighbor*5000)
                     self.__clib.kd_neighbors_point_vec(
                         self.__kd, idxpt, 5000, nneighbor, False,
-                        neighbors, d2)
+                        self.nthreads, neighbors, d2)
 
                 else:
                     # For smaller data sets, use it all
@@ -1035,13 +1393,14 @@ class bp(object):
                     d2 = np.zeros(nneighbor*self.__ndata)
                     idxpt = np.arange(self.__ndata, dtype=c_ulong)
                     self.__clib.kd_neighbors_all(self.__kd, nneighbor, 
-                                                 False, neighbors, d2)
+                                                 False, self.nthreads,
+                                                 neighbors, d2)
 
                 # Take the bandwidth in each dimension to be the 90th
                 # percentile of the 10th nearest neighbor distance
-                offset = np.abs(self.__dataset[idxpt,:] -
-                                self.__dataset[
-                                    neighbors[nneighbor-1::nneighbor],:])
+                offset = np.abs(self.__points(idx=idxpt) -
+                                self.__points(
+                                    idx=neighbors[nneighbor-1::nneighbor]))
                 self.__auto_bw = np.zeros(self.__nphys+self.__nphot)
                 for i in range(self.__nphys+self.__nphot):
                     self.__auto_bw[i] = np.percentile(offset[:,i], 95)
@@ -1097,6 +1456,28 @@ class bp(object):
         for c in self.__cache:
             c['bp'].reltol = self.__reltol
 
+    ##################################################################
+    # Utility method to change the number of threads used by the c
+    # library; as with the tolerances, this is passed on to any
+    # cached data sets
+    ##################################################################
+    @property
+    def nthreads(self):
+        return self.__nthreads
+
+    @nthreads.setter
+    def nthreads(self, nthreads):
+        if nthreads < 0:
+            raise ValueError("bp: nthreads must be >= 0")
+        if nthreads > 1 and not self.__openmp:
+            warn("bp: nthreads = " + str(nthreads) +
+                 " requested, but the bayesphot c library was " +
+                 "compiled without OpenMP; calculations will run " +
+                 "on a single thread")
+        self.__nthreads = nthreads
+        for c in self.__cache:
+            c['bp'].nthreads = self.__nthreads
+
     ##################################################################
     # Utitlity methods to return the number of physical and
     # photometric quantities, and the total number of dimensions,
@@ -1182,6 +1563,42 @@ class bp(object):
         else:
             self.__clib.free_kd_copy(kd_tmp)
 
+    ##################################################################
+    # Utility method to read the positions of the library points, in
+    # tree order. If the c library was compiled with KD_SOA, the tree
+    # holds the only copy of the positions, so they are copied out of
+    # it; otherwise they are read from the data set we hold. This is
+    # intended for internal use.
+    ##################################################################
+    def __points(self, dims=None, idx=None):
+        if self.__dataset is not None:
+            if idx is None:
+                idx = slice(None)
+            if dims is None:
+                dims = slice(None)
+            return self.__dataset[idx, dims]
+        if dims is None:
+            dims_c = np.arange(self.ndim, dtype=c_ulong)
+        elif isinstance(dims, slice):
+            dims_c = np.arange(self.ndim, dtype=c_ulong)[dims]
+        else:
+            dims_c = np.array(np.atleast_1d(dims), dtype=c_ulong)
+        if idx is None:
+            nidx = self.__ndata
+            idx_ptr = None
+        else:
+            idx_c = np.array(np.atleast_1d(idx), dtype=c_ulong)
+            nidx = idx_c.size
+            idx_ptr = idx_c.ctypes.data_as(POINTER(c_ulong))
+        out = np.zeros((nidx, dims_c.size))
+        self.__clib.kd_get_points(self.__kd, idx_ptr, nidx,
+                                  dims_c, dims_c.size, np.ravel(out))
+        if np.isscalar(dims):
+            out = out[:,0]
+        if np.isscalar(idx):
+            out = out[0]
+        return out
+
     ##################################################################
     # Methods to create and destroy caches
     ##################################################################
@@ -1222,7 +1639,7 @@ class bp(object):
         nphys = np.sum(keepdims < self.nphys)
 
         # Extract the dimensions we're keeping from the data set
-        data_cache = np.copy(self.__dataset[:,keepdims])
+        data_cache = np.copy(self.__points(keepdims))
         bw = self.bandwidth[keepdims]
         if self.__prior_data is not None:
             prior_cache = np.copy(self.__prior_data)
@@ -1246,7 +1663,7 @@ class bp(object):
                       reltol=self.reltol,
                       abstol=self.abstol, leafsize=self.leafsize,
                       thread_safe=self.thread_safe,
-                      caching='none')
+                      caching='none', nthreads=self.nthreads)
 
         # Store the new object
         self.__cache.append(
@@ -1255,6 +1672,7 @@ class bp(object):
               'data'       : data_cache,
               'prior'      : prior_cache,
               'pobs'       : pobs_cache,
+              'origidx'    : np.copy(self.__idxmap),
               'bp'         : bp_cache } )
 
     def clear_cache(self, margindims=None):
@@ -1282,6 +1700,198 @@ class bp(object):
                 repr(margindims))
         
 
+    ##################################################################
+    # Method to add simulations to the library
+    ##################################################################
+    def add_data(self, dataset, sample_density=None, priors=None,
+                 pobs=None):
+        """
+        This method adds new simulations to the library. The new
+        points are inserted into the existing KD tree rather than
+        rebuilding it from scratch, and any cached data sets created
+        by make_cache are extended in the same way, so they remain
+        valid.
+
+        Parameters
+           dataset : array, shape (N, M)
+              positions of the new simulations, in the same format
+              as the dataset used to construct the bp object
+           sample_density : array, shape (N) | None
+              sample density at each of the new points; this is
+              required if the sample density of the library was set
+              as an array, and is ignored otherwise; if the sample
+              density was set as a callable, it is evaluated at the
+              new points, and if it was set to 'auto', it is
+              recomputed for the whole library
+           priors : array, shape (N) | None
+              prior probability of each of the new points; this is
+              required if the priors were set as an array, and is
+              ignored otherwise; if the priors were set as a
+              callable, it is evaluated at the new points
+           pobs : array, shape (N) | None
+              observation probability of each of the new points;
+              this is required if pobs was set as an array, and is
+              ignored otherwise; if pobs was set as a callable, it is
+              evaluated at the new points
+
+        Returns
+           Nothing
+
+        Raises
+           ValueError, if dataset does not have the same number of
+           dimensions as the library, if sample_density, priors, or
+           pobs is required but not given, or if the KD tree was
+           mapped from a file
+
+        Notes
+           The new simulations are numbered after the existing ones,
+           in the order given, so arrays returned by the
+           sample_density, priors, and pobs properties, and arrays
+           passed to set them, list the original simulations first
+           and the new ones after them. The bandwidth is not
+           changed, even if it was originally chosen automatically.
+        """
+
+        # Safety checks
+        data_new = np.ascontiguousarray(
+            np.atleast_2d(dataset), dtype=c_double)
+        if data_new.ndim != 2 or data_new.shape[1] != self.ndim:
+            raise ValueError("bp.add_data: dataset must have " +
+                             str(self.ndim) + " dimensions")
+        if self.__kdmapped:
+            raise ValueError("bp.add_data: cannot add data to a "
+                             "library whose KD tree was mapped from "
+                             "a file")
+        nnew = data_new.shape[0]
+        if nnew == 0:
+            return
+        nold = self.__ndata
+        ntot = nold + nnew
+
+        # Get the sample density, priors, and observation
+        # probabilities of the new points
+        sden_auto = not hasattr(self.__sden, '__iter__') and \
+                    self.__sden == 'auto'
+        if hasattr(self.__sden, '__call__'):
+            sden_new = self.__sden(data_new[:,:self.__nphys])
+        elif self.__sden is None or sden_auto:
+            sden_new = None
+        elif sample_density is None:
+            raise ValueError("bp.add_data: must give sample_density "
+                             "for the new data")
+        else:
+            sden_new = np.asarray(sample_density, dtype=c_double)
+        if hasattr(self.__priors, '__call__'):
+            prior_new = self.__priors(data_new[:,:self.__nphys]) \
+                            .flatten()
+        elif self.__priors is None:
+            prior_new = None
+        elif priors is None:
+            raise ValueError("bp.add_data: must give priors for the "
+                             "new data")
+        else:
+            prior_new = np.asarray(priors, dtype=c_double)
+        if hasattr(self.__pobs, '__call__'):
+            pobs_new = self.__pobs(data_new[:,self.__nphys:]).flatten()
+        elif self.__pobs is None:
+            pobs_new = None
+        elif pobs is None:
+            raise ValueError("bp.add_data: must give pobs for the "
+                             "new data")
+        else:
+            pobs_new = np.asarray(pobs, dtype=c_double)
+
+        # Compute weights for the new points in the same way as the
+        # priors and pobs setters; if the sample density is computed
+        # automatically, these are placeholders that will be replaced
+        # once it has been recomputed below
+        weighted = self.__priors is not None or self.__pobs is not None
+        if weighted:
+            wgt_new = np.ones(nnew)
+            if sden_new is not None:
+                wgt_new *= 1.0 / sden_new
+            if prior_new is not None:
+                wgt_new *= prior_new
+            if pobs_new is not None:
+                wgt_new *= pobs_new
+            wgt = np.zeros(ntot)
+            wgt_ptr = wgt.ctypes.data_as(POINTER(c_double))
+            wgt_new_ptr = wgt_new.ctypes.data_as(POINTER(c_double))
+        else:
+            wgt_ptr = None
+            wgt_new_ptr = None
+
+        # Insert the points into the tree
+        dataset_all = np.zeros((ntot, self.ndim))
+        perm = np.zeros(ntot, dtype=c_ulong)
+        self.__clib.kd_insert(self.__kd, np.ravel(dataset_all), wgt_ptr,
+                              np.ravel(data_new), wgt_new_ptr, nnew,
+                              self.leafsize, perm)
+
+        # Bring all the per-point data we hold in tree order into the
+        # new tree order
+        def reorder(old, new):
+            return np.concatenate((old, new))[perm]
+        if self.__soa:
+            self.__dataset = None
+        else:
+            self.__dataset = dataset_all
+        self.__ndata = ntot
+        self.__idxmap = reorder(self.__idxmap,
+                                np.arange(nold, ntot, dtype=c_ulong))
+        self.__idxmap_inv = np.argsort(self.__idxmap)
+        if hasattr(self.__sden, '__iter__'):
+            self.__sden = reorder(self.__sden, sden_new)
+        if sden_auto:
+            self.__sample_density = None
+            if self.__kd_phys is not None:
+                self.__clib.free_kd(self.__kd_phys)
+                self.__kd_phys = None
+        elif self.__sample_density is not None:
+            self.__sample_density = reorder(self.__sample_density,
+                                            sden_new)
+        if self.__prior_data is not None:
+            self.__prior_data = reorder(self.__prior_data, prior_new)
+            if not hasattr(self.__priors, '__call__'):
+                self.__priors = self.__prior_data
+        if self.__pobs_data is not None:
+            self.__pobs_data = reorder(self.__pobs_data, pobs_new)
+            if not hasattr(self.__pobs, '__call__'):
+                self.__pobs = self.__pobs_data
+        if weighted:
+            self.__wgt = wgt
+
+        # If the sample density is computed automatically, recompute
+        # it, and with it the weights of all the points
+        dummy = self.sample_density
+        if sden_auto and weighted:
+            wgt = np.ones(self.__ndata)
+            if self.__sample_density is not None:
+                wgt *= 1.0 / self.__sample_density
+            if self.__prior_data is not None:
+                wgt *= self.__prior_data
+            if self.__pobs_data is not None:
+                wgt *= self.__pobs_data
+            self.__wgt = wgt
+            self.__clib.kd_change_wgt(self.__wgt.ctypes.data_as(
+                POINTER(c_double)), self.__kd)
+
+        # Extend the cached data sets; these were built with the
+        # sample density, priors, and pobs as arrays, in the tree
+        # order at the time the cache was made, which we record in
+        # origidx
+        for c in self.__cache:
+            c_sden = None
+            if dummy is not None:
+                c_sden = dummy[nold:]
+            c['bp'].add_data(data_new[:,c['keepdims']],
+                             sample_density=c_sden,
+                             priors=prior_new, pobs=pobs_new)
+            c['origidx'] = np.concatenate(
+                (c['origidx'], np.arange(nold, ntot, dtype=c_ulong)))
+            if sden_auto:
+                c['bp'].sample_density = dummy[c['origidx']]
+
     ##################################################################
     # Method to compute the log likelihood function for a particular
     # set of physical properties given a particular set of photometric
@@ -1473,16 +2083,26 @@ class bp(object):
             
         # Call the PDF computation routine
         if margindim is None:
-            # No marginalization, so call kd_pdf
-
-            if not self.__diag_mode:
+            # No marginalization, so call kd_pdf; for many points
+            # sharing a single bandwidth, evaluate them all together
+            # with the dual tree method, which is faster
+
+            if not self.__diag_mode and cbw_ptr is None and \
+               pdf.size >= 1000:
+                self.__clib.kd_pdf_dualtree(
+                    self.__kd, np.ravel(cdata), pdf.size,
+                    self.reltol, self.abstol, self.nthreads,
+                    np.ravel(pdf))
+            elif not self.__diag_mode:
                 self.__clib.kd_pdf_vec(
                     self.__kd, np.ravel(cdata), cbw_ptr, pdf.size, 
-                    self.reltol, self.abstol, np.ravel(pdf))
+                    self.reltol, self.abstol, self.nthreads,
+                    np.ravel(pdf))
             else:
                 self.__clib.kd_pdf_vec(
                     self.__kd, np.ravel(cdata), cbw_ptr, pdf.size, 
-                    self.reltol, self.abstol, np.ravel(pdf),
+                    self.reltol, self.abstol, self.nthreads,
+                    np.ravel(pdf),
                     np.ravel(nodecheck), np.ravel(leafcheck),
                     np.ravel(termcheck))
         else:
@@ -1491,12 +2111,12 @@ class bp(object):
                 self.__clib.kd_pdf_int_vec(
                     self.__kd, np.ravel(cdata), cbw_ptr, keepdims,
                     keepdims.size, pdf.size, self.reltol,
-                    self.abstol, np.ravel(pdf))
+                    self.abstol, self.nthreads, np.ravel(pdf))
             else:
                 self.__clib.kd_pdf_int_vec(
                     self.__kd, np.ravel(cdata), cbw_ptr, keepdims,
                     keepdims.size, pdf.size, self.reltol,
-                    self.abstol, np.ravel(pdf),
+                    self.abstol, self.nthreads, np.ravel(pdf),
                     np.ravel(nodecheck), np.ravel(leafcheck),
                     np.ravel(termcheck))
 
@@ -1512,7 +2132,8 @@ class bp(object):
     # properties
     ##################################################################
     def mpdf(self, idx, photprop, photerr=None, ngrid=128,
-             qmin=None, qmax=None, grid=None, norm=True):
+             qmin=None, qmax=None, grid=None, norm=True,
+             method='tree'):
         """
         Returns the marginal probability for one or mode physical
         quantities for one or more input sets of photometric
@@ -1552,6 +2173,13 @@ class bp(object):
            norm : bool
               if True, returned pdf's will be normalized to integrate
               to 1
+           method : 'tree' | 'binned'
+              method used to evaluate the PDF; 'tree' evaluates it at
+              each grid point by walking the KD tree; 'binned' bins
+              the library onto a grid and convolves it with the
+              kernel, which is much faster for fine grids, and is
+              accurate to reltol relative to the peak of the PDF;
+              'binned' is only available for gaussian kernels
 
         Returns:
            grid_out : array
@@ -1590,7 +2218,8 @@ class bp(object):
                                         photerr=photerr,
                                         ngrid=ngrid,
                                         qmin=qmin, qmax=qmax,
-                                        grid=grid, norm=norm)
+                                        grid=grid, norm=norm,
+                                        method=method)
                 
         # Safety check
         if (np.array(photprop).shape[-1] != self.__nphot) and \
@@ -1602,6 +2231,11 @@ class bp(object):
                (self.__nphot > 1):
                 raise ValueError("need " + str(self.__nphot) +
                                  " photometric errors!")
+        if method not in ['tree', 'binned']:
+            raise ValueError("method must be 'tree' or 'binned'")
+        if method == 'binned' and self.__ktype != 2:
+            raise ValueError("method 'binned' requires a gaussian "
+                             "kernel")
         if (np.amax(idx) > self.nphys) or (np.amin(idx) < 0) or \
            (not np.array_equal(np.squeeze(np.unique(np.array(idx))), 
                                np.squeeze(np.array([idx])))):
@@ -1633,9 +2267,9 @@ class bp(object):
             ngrid_tmp = np.array(grid_out.shape[1:], dtype=c_ulong)
         else:
             if qmin is None:
-                qmin = np.amin(self.__dataset[:,idx], axis=0)
+                qmin = np.amin(self.__points(idx), axis=0)
             if qmax is None:
-                qmax = np.amax(self.__dataset[:,idx], axis=0)
+                qmax = np.amax(self.__points(idx), axis=0)
             griddims = []
             if hasattr(idx, '__len__'):
                 nidx = len(idx)
@@ -1712,8 +2346,16 @@ class bp(object):
             # physical properties (which is the case if len(idx) <
             # nphys), but we invoke kd_pdf_vec if we're not actually
             # marginalizing (len(idx)==nphys) because then we don't
-            # need to do any integration
-            if nidx < self.__nphys:
+            # need to do any integration; the binned method handles
+            # both cases
+            if method == 'binned':
+                self.__clib.kd_pdf_reggrid_binned(
+                    kd_tmp, np.ravel(phottmp),
+                    dims[nidx:], self.__nphot, nphot,
+                    qmin_tmp, qmax_tmp, ngrid_tmp, dims[:nidx], nidx,
+                    self.reltol, self.abstol, self.nthreads,
+                    np.ravel(pdf))
+            elif nidx < self.__nphys:
                 self.__clib.kd_pdf_int_reggrid(
                     kd_tmp, np.ravel(phottmp),
                     dims[nidx:], self.__nphot, nphot,
@@ -1747,7 +2389,16 @@ class bp(object):
                 pdf_sub = np.zeros(np.array(pdf[i]).shape)
 
                 # Call kernel density estimate with this bandwidth
-                if nidx < self.__nphys:
+                if method == 'binned':
+                    self.__clib.kd_pdf_reggrid_binned(
+                        kd_tmp, phot_sub,
+                        dims[nidx:], self.__nphot, 
+                        phot_sub.size//self.__nphot,
+                        qmin_tmp, qmax_tmp, ngrid_tmp, 
+                        dims[:nidx], nidx,
+                        self.reltol, self.abstol, self.nthreads,
+                        np.ravel(pdf_sub))
+                elif nidx < self.__nphys:
                     self.__clib.kd_pdf_int_reggrid(
                         kd_tmp, phot_sub,
                         dims[nidx:], self.__nphot, 
@@ -1925,9 +2576,9 @@ class bp(object):
             ngrid_tmp = np.array(grid_out.shape[1:], dtype=c_ulong)
         else:
             if qmin is None:
-                qmin = np.amin(self.__dataset[:,idx+self.__nphys], axis=0)
+                qmin = np.amin(self.__points(idx+self.__nphys), axis=0)
             if qmax is None:
-                qmax = np.amax(self.__dataset[:,idx+self.__nphys], axis=0)
+                qmax = np.amax(self.__points(idx+self.__nphys), axis=0)
             griddims = []
             if hasattr(idx, '__len__'):
                 nidx = len(idx)
@@ -2217,7 +2868,7 @@ class bp(object):
                 self.__clib.kd_pdf_vec(
                     self.__kd, np.ravel(grid_out_c), None,
                     grid_out_c.size//self.ndim,
-                    self.reltol, self.abstol,
+                    self.reltol, self.abstol, self.nthreads,
                     np.ravel(pdf))
 
             else:
@@ -2227,7 +2878,8 @@ class bp(object):
                 self.__clib.kd_pdf_int_vec(
                     self.__kd, np.ravel(grid_out_c), None,
                     idx, len(idx), grid_out_c.size//len(idx),
-                    self.reltol, self.abstol, np.ravel(pdf))
+                    self.reltol, self.abstol, self.nthreads,
+                    np.ravel(pdf))
 
         else:
 
@@ -2289,15 +2941,15 @@ class bp(object):
             # from the library. For photometric dimensions, exclude
             # values of 99, which indicate bad data.
             if qmin is None:
-                qmin = np.amin(self.__dataset[:,idx], axis=0)
+                qmin = np.amin(self.__points(idx), axis=0)
             if qmax is None:
                 qmax = np.zeros(len(idx))
                 for i in range(len(idx)):
+                    xi = self.__points(i)
                     if i < self.__nphys:
-                        qmax[i] = np.amax(self.__dataset[:,i])
+                        qmax[i] = np.amax(xi)
                     else:
-                        qmax[i] = np.amax(self.__dataset[:,i][
-                            self.__dataset[:,i] < 99.0])
+                        qmax[i] = np.amax(xi[xi < 99.0])
             griddims = []
 
             # Figure out how many dimensions the output has
@@ -2402,7 +3054,7 @@ class bp(object):
     # photometric values
     ##################################################################
     def mcmc(self, photprop, photerr=None, mc_walkers=100,
-             mc_steps=500, mc_burn_in=50):
+             mc_steps=500, mc_burn_in=50, sampler='native'):
         """
         This function returns a sample of MCMC walkers sampling the
         physical parameters at a specified set of photometric values.
@@ -2422,6 +3074,15 @@ class bp(object):
               number of steps in the MCMC
            mc_burn_in : int
               number of steps to consider "burn-in" and discard
+           sampler : 'native' | 'emcee'
+              if 'native', the MCMC is run by the affine-invariant
+              ensemble sampler in the bayesphot c library, which
+              evaluates the likelihood for all walkers at each step
+              in a single multithreaded call; if 'emcee', the MCMC is
+              run by emcee, with the likelihood evaluated through a
+              python callback for each walker. The two use the same
+              algorithm, but 'native' is much faster; it requires
+              that mc_walkers be even and at least 4.
 
         Returns
            samples : array
@@ -2429,8 +3090,17 @@ class bp(object):
         """
 
         # See if we have emcee
-        if not mc_avail:
-            raise ImportError("unable to import emcee")
+        if sampler == 'emcee':
+            if not mc_avail:
+                raise ImportError("unable to import emcee")
+        elif sampler == 'native':
+            if mc_walkers < 4 or mc_walkers % 2 != 0:
+                raise ValueError("native sampler requires mc_walkers "
+                                 "to be even and >= 4")
+            if self._rng is None:
+                self._rng = self.__clib.rng_init(0)
+        else:
+            raise ValueError("unknown sampler "+str(sampler))
 
         # Safety check
         if (np.array(photprop).shape[-1] != self.__nphot) and \
@@ -2502,15 +3172,27 @@ class bp(object):
                        np.random.randn(self.__nphys) 
                        for i in range(mc_walkers)]
 
-                # Run the MCMC
-                sampler=emcee.EnsembleSampler(mc_walkers, self.__nphys, 
-                                              self.__logL, 
-                                              args=[ph_tmp, kd_tmp])
-                sampler.run_mcmc(pos, mc_steps)
-
-                # Store the result
-                samples.append(sampler.chain[:,mc_burn_in:,:].
-                               reshape((-1,self.__nphys)))
+                # Run the MCMC and store the result
+                if sampler == 'emcee':
+                    mc = emcee.EnsembleSampler(mc_walkers, self.__nphys,
+                                               self.__logL,
+                                               args=[ph_tmp, kd_tmp])
+                    mc.run_mcmc(pos, mc_steps)
+                    samples.append(mc.chain[:,mc_burn_in:,:].
+                                   reshape((-1,self.__nphys)))
+                else:
+                    chain = np.zeros(mc_walkers *
+                                     (mc_steps-mc_burn_in) *
+                                     self.__nphys)
+                    self.__clib.kd_pdf_mcmc(
+                        kd_tmp,
+                        np.ascontiguousarray(ph_tmp, dtype=c_double),
+                        dims.astype(c_ulong), self.__nphot,
+                        mc_walkers, mc_steps, mc_burn_in,
+                        np.array(pos, dtype=c_double).flatten(),
+                        2.0, self.reltol, self.abstol, self.nthreads,
+                        self._rng, chain, None)
+                    samples.append(chain.reshape((-1,self.__nphys)))
 
 
         # Set bandwidth back to default if necessary
@@ -2627,7 +3309,8 @@ class bp(object):
                 self.__kd, np.ravel(phot), 
                 dims.ctypes.data_as(POINTER(c_ulong)),
                 self.__nphot, np.array(phot).size // self.__nphot,
-                nmatch, bandwidth_units, np.ravel(matches),
+                nmatch, bandwidth_units, self.nthreads,
+                np.ravel(matches),
                 wgts.ctypes.data_as(POINTER(c_double)), 
                 np.ravel(d2))
 
@@ -2647,7 +3330,7 @@ class bp(object):
                 kd_tmp, np.ravel(phot), 
                 dims.ctypes.data_as(POINTER(c_ulong)),
                 self.__nphot, np.array(phot).size//self.__nphot,
-                nmatch, True, np.ravel(matches),
+                nmatch, True, self.nthreads, np.ravel(matches),
                 wgts.ctypes.data_as(POINTER(c_double)), 
                 np.ravel(d2))
 
@@ -2676,7 +3359,8 @@ class bp(object):
                     kd_tmp, np.ravel(phot[i]), 
                     dims.ctypes.data_as(POINTER(c_ulong)),
                     self.__nphot, np.array(phot[i]).size//self.__nphot,
-                    nmatch, True, np.ravel(matches)[offset2:],
+                    nmatch, True, self.nthreads,
+                    np.ravel(matches)[offset2:],
                     wgts.ctypes.data_as(POINTER(c_double)), 
                     np.ravel(d2)[offset1:])
                 ptr = ptr+1
@@ -2751,7 +3435,7 @@ class bp(object):
             self.__kd, np.ravel(phys_tmp), 
             dims.ctypes.data_as(POINTER(c_ulong)),
             self.__nphys, npt, nmatch, bandwidth_units, 
-            np.ravel(matches),
+            self.nthreads, np.ravel(matches),
             wgts.ctypes.data_as(POINTER(c_double)), 
             d2)
 
@@ -2986,7 +3670,8 @@ class bp(object):
                 xout = POINTER(c_double)()
                 wgtsout = POINTER(c_double)()
                 npts = self.__clib.kd_rep(
-                    kd_tmp, np.array(ph), 
+                    kd_tmp if kd_tmp is not None else self.__kd,
+                    np.array(ph), 
                     np.arange(self.__nphot, dtype=c_ulong)+self.__nphys,
                     self.__nphot, tol, 
                     dim_return_ptr, ndim_return,
@@ -3039,6 +3724,113 @@ class bp(object):
         # Return
         return x, wgts
             
+    ##################################################################
+    # Method to build representations that persist in c memory
+    ##################################################################
+    def make_rep_phys(self, phot, photerr=None, squeeze=True,
+                      phys_ignore=None, tol=None):
+        """
+        Returns representations of the PDF of physical properties
+        that corresponds to a set of photometric properties, of the
+        same type as those returned by make_approx_phys, but held in
+        memory by the c library rather than copied into python
+        arrays. The representations can be passed to mpdf_approx
+        to compute any number of marginal PDFs, and provide methods
+        to compute moments and draw samples, without being rebuilt.
+        When many sets of photometric properties are given, the
+        representations are built in parallel.
+
+        Parameters:
+           phot : arraylike, shape (nfilter) or (N, nfilter)
+              the set or sets of photometric properties for which the
+              representations are to be generated
+           photerr : arraylike, shape (nfilter) or (N, nfilter)
+              array giving photometric errors; as for
+              make_approx_phys, a representation is generated for
+              every combination of photometric properties and errors
+           squeeze : bool
+              if True, the representations will be squeezed to
+              minimize the number of points included
+           phys_ignore : None or listlike of bool
+              if None, the representations cover all physical
+              properties; otherwise this must be a listlike of bool,
+              one entry per physical dimension, with a value of False
+              indicating that dimension should be excluded
+           tol : float
+              if set, this tolerance overrides the value of reltol
+
+        Returns:
+           reps : bp_rep or list of bp_rep
+              the representations, in the same order as the outputs
+              of make_approx_phys; entries for which the requested
+              precision cannot be reached are None, and a warning is
+              issued
+        """
+
+        # Put the inputs into arrays we can pass to c
+        phottmp = np.array(phot, dtype=c_double)
+        if phottmp.shape[-1] != self.__nphot:
+            raise ValueError("need " + str(self.__nphot) + 
+                             " photometric properties!")
+        phottmp = phottmp.reshape((-1, self.__nphot))
+        nphot_set = phottmp.shape[0]
+        if photerr is not None:
+            photerrtmp = np.array(photerr, dtype=c_double)
+            if photerrtmp.shape[-1] != self.__nphot:
+                raise ValueError("need " + str(self.__nphot) + 
+                                 " photometric errors!")
+            photerrtmp = photerrtmp.reshape((-1, self.__nphot))
+        else:
+            photerrtmp = [None]
+
+        # Specify dimensions to return
+        if phys_ignore is None:
+            dim_return = np.arange(self.__nphys, dtype=c_ulong)
+        else:
+            dim_return = np.array(
+                np.where(np.logical_not(np.array(phys_ignore)))[0],
+                dtype=c_ulong)
+        bw = self.__bandwidth[dim_return]
+
+        # Set tolerance
+        if tol is None:
+            tol = self.reltol
+
+        # Build the representations for all photometric properties at
+        # once for each set of photometric errors
+        dims = np.arange(self.__nphot, dtype=c_ulong)+self.__nphys
+        reps = [None] * (nphot_set * len(photerrtmp))
+        kd_tmp = None
+        for j, pherr in enumerate(photerrtmp):
+            if pherr is not None:
+                kd_tmp = self.__change_bw_err(pherr, kd_cur=kd_tmp)
+            ptrs = (c_void_p * nphot_set)()
+            self.__clib.kd_rep_create_vec(
+                kd_tmp if kd_tmp is not None else self.__kd,
+                np.ravel(phottmp), dims, self.__nphot, nphot_set,
+                tol, dim_return, len(dim_return), squeeze,
+                self.nthreads, ptrs)
+            for i in range(nphot_set):
+                if ptrs[i] is not None:
+                    reps[i*len(photerrtmp)+j] \
+                        = bp_rep(self.__clib, ptrs[i], dim_return, bw)
+
+        # Reset the bandwidth
+        if kd_tmp is not None:
+            self.__restore_bw_err(kd_tmp)
+
+        # Warn about failures
+        if None in reps:
+            warn("bp.make_rep_phys: requested precision cannot be "
+                 "reached for some inputs")
+
+        # If we were given a single object, return a single
+        # representation
+        if np.ndim(phot) == 1 and \
+           (photerr is None or np.ndim(photerr) == 1):
+            return reps[0]
+        return reps
+
     ##################################################################
     # Method to squeeze a representation that has already been created
     ##################################################################
@@ -3106,10 +3898,14 @@ class bp(object):
         the same style as meshgrid.
 
         Parameters:
-           x : array, shape (M, ndim), or a list of such arrays
+           x : array, shape (M, ndim), or bp_rep, or list of bp_rep
               array of points retured by make_approx_phot or
-              make_approx_phys
-           wgts : array, shape (M) or a list of such arrays
+              make_approx_phys, or representation(s) returned by
+              make_rep_phys; in the latter case, the PDF is evaluated
+              by the c library, wgts and dims are ignored, and a list
+              of representations is evaluated in parallel on a single
+              grid that covers all of them
+           wgts : array, shape (M)
               array of weights returned by make_approx_phot or
               make_approx_phys
            dims : 'phys' | 'phot' | arraylike of ints
@@ -3159,9 +3955,32 @@ class bp(object):
               dimensions match the leading dimensions produced by
               broadcasting the leading dimensions of photprop and
               photerr together, while the trailing dimensions match
-              the dimensions of the output grid
+              the dimensions of the output grid; if x is a list of
+              bp_rep, the leading dimension is the index in the list,
+              and entries that are None give a PDF of zero
         """
 
+        # If we were given representations held in c memory, get the
+        # dimensions they cover and the points from them
+        if isinstance(x, bp_rep):
+            reps = [x]
+        elif isinstance(x, (list, tuple)) and \
+             any([isinstance(r, bp_rep) for r in x]):
+            reps = x
+        else:
+            reps = None
+        if reps is not None:
+            reps_valid = [r for r in reps if r is not None]
+            dims = list(reps_valid[0].dims)
+            for r in reps_valid[1:]:
+                if list(r.dims) != dims:
+                    raise ValueError("bp.mpdf_approx: all "
+                                     "representations must cover "
+                                     "the same dimensions")
+            pts = [(r.x, r.wgts) for r in reps_valid]
+        else:
+            pts = [(x, wgts)]
+
         # Set up input and output dimensions
         if dims == 'phys':
             dim_in = np.arange(self.__nphys)
@@ -3180,6 +3999,7 @@ class bp(object):
         else:
             raise ValueError("dims_return must be a subset of dims!")
         nidx = len(dim_out)
+        cols = [list(dim_in).index(d) for d in dim_out]
 
         # Set up the output grid
         if grid is not None:
@@ -3209,24 +4029,32 @@ class bp(object):
                     get_qmax = True
                 else:
                     get_qmax = False
-                for d in dim_out:
-                    xtmp = np.copy(x[:,d])
-                    wgttmp = np.copy(wgts)
-                    idx = np.argsort(xtmp)
-                    xtmp = xtmp[idx]
-                    wgttmp = wgttmp[idx]
-                    wgtsum = np.cumsum(wgttmp)
+                for c in cols:
+                    qlo = []
+                    qhi = []
+                    for xpt, wpt in pts:
+                        xtmp = np.copy(xpt[:,c])
+                        wgttmp = np.copy(wpt)
+                        idx = np.argsort(xtmp)
+                        xtmp = xtmp[idx]
+                        wgttmp = wgttmp[idx]
+                        wgtsum = np.cumsum(wgttmp)
+                        if get_qmin:
+                            if qmin == 'all':
+                                qlo.append(xtmp[0])
+                            else:
+                                qlo.append(
+                                    xtmp[np.argmax(wgtsum > 0.001)])
+                        if get_qmax:
+                            if wgtsum[-1] > 0.999 and qmax is not 'all':
+                                qhi.append(xtmp[np.argmax(wgtsum >
+                                                          0.999)])
+                            else:
+                                qhi.append(xtmp[-1])
                     if get_qmin:
-                        if qmin == 'all':
-                            qmin.append(xtmp[0])
-                        else:
-                            qmin.append(xtmp[np.argmax(wgtsum > 0.001)])
+                        qmin.append(min(qlo))
                     if get_qmax:
-                        if wgtsum[-1] > 0.999 and qmax is not 'all':
-                            qmax.append(xtmp[np.argmax(wgtsum >
-                                                       0.999)])
-                        else:
-                            qmax.append(xtmp[-1])
+                        qmax.append(max(qhi))
                 if get_qmin:
                     qmin = np.array(qmin)
                 if get_qmax:
@@ -3251,20 +4079,37 @@ class bp(object):
                            float(qmax-qmin)/(ngrid-1)
                 griddims = [grid_out]
 
-        # Compute result; in the multi-dimensional case this involves
-        # some tricky array indexing
-        if nidx == 1:
+        # Compute result; for representations held in c memory, the c
+        # library does this for all of them at once; otherwise, in
+        # the multi-dimensional case this involves some tricky array
+        # indexing
+        if reps is not None:
+            ngrid_c = np.array([g.size for g in griddims], dtype=c_ulong)
+            xlo = np.tile(np.array([g[0] for g in griddims],
+                                   dtype=c_double), len(reps))
+            xhi = np.tile(np.array([g[-1] for g in griddims],
+                                   dtype=c_double), len(reps))
+            pdf = np.zeros(len(reps)*np.prod(ngrid_c))
+            ptrs = (c_void_p * len(reps))(
+                *[r._ptr if r is not None else None for r in reps])
+            self.__clib.kd_rep_eval_grid_vec(
+                ptrs, len(reps), np.array(dim_out, dtype=c_ulong),
+                nidx, xlo, xhi, ngrid_c, self.nthreads, pdf)
+            pdf = pdf.reshape((len(reps),)+tuple(ngrid_c))
+            if isinstance(x, bp_rep):
+                pdf = pdf[0]
+        elif nidx == 1:
             pdf = np.einsum('i,ij', wgts, 
                            np.exp(-np.subtract.outer(
-                               x[:,dim_out[0]], grid_out)**2 / 
+                               x[:,cols[0]], grid_out)**2 / 
                                   (2*self.__bandwidth[dim_out[0]]**2)))
                          
         else:
             compsum = np.exp(
-                -np.subtract.outer(x[:,dim_out[0]], griddims[0])**2 /
+                -np.subtract.outer(x[:,cols[0]], griddims[0])**2 /
                 (2.0*self.__bandwidth[dim_out[0]]**2))
-            for d, grd in zip(dim_out[1:], griddims[1:]):
-                comp = np.exp(-np.subtract.outer(x[:,d], grd)**2 / \
+            for c, d, grd in zip(cols[1:], dim_out[1:], griddims[1:]):
+                comp = np.exp(-np.subtract.outer(x[:,c], grd)**2 / \
                               (2.0*self.__bandwidth[d]**2))
                 compsum = np.einsum('...j,...k->...jk', compsum, comp)
             pdf = np.einsum('i,i...', wgts, compsum)
@@ -3293,11 +4138,16 @@ class bp(object):
                 for i in range(2, nidx):
                     cellsize = np.multiply.outer(cellsize, csize[i])
 
-            # Compute integral
-            normfac = np.sum(pdf*cellsize)
-
-            # Normalize
-            pdf = pdf/normfac
+            # Compute integral and normalize; for a list of
+            # representations, do so separately for each one
+            if reps is not None and not isinstance(x, bp_rep):
+                normfac = np.sum(pdf*cellsize,
+                                 axis=tuple(range(1, pdf.ndim)))
+                normfac[normfac == 0.0] = 1.0
+                pdf = pdf/normfac.reshape((-1,)+(1,)*(pdf.ndim-1))
+            else:
+                normfac = np.sum(pdf*cellsize)
+                pdf = pdf/normfac
 
         # Return
         return grid_out, pdf
@@ -3335,8 +4185,8 @@ class bp(object):
         
         # Allocate a random number generator from gsl if we do not
         # already have one
-        if not hasattr(self, '__rng'):
-            self.__rng = self.__clib.rng_init(0)
+        if self._rng is None:
+            self._rng = self.__clib.rng_init(0)
 
         # Allocate array to hold outputs
         samples = np.zeros((nsample, self.__nphys+self.__nphot),
@@ -3350,7 +4200,7 @@ class bp(object):
 
         # Call library function
         self.__clib.kd_pdf_draw(kd_tmp, None, None, 0,
-                                nsample, 1, self.__rng,
+                                nsample, 1, self._rng,
                                 np.ravel(samples))
 
         # Restore kernel density bandwidth
@@ -3432,8 +4282,8 @@ class bp(object):
 
         # Allocate a random number generator from gsl if we do not
         # already have one
-        if not hasattr(self, '__rng'):
-            self.__rng = self.__clib.rng_init(0)
+        if self._rng is None:
+            self._rng = self.__clib.rng_init(0)
 
         # Loop over leading dimensions of input physical properties
         for i in np.ndindex(*physprop_.shape[:-1]):
@@ -3445,7 +4295,7 @@ class bp(object):
                 physidx_.ctypes.data_as(ctypes.POINTER(c_ulong)),
                 physidx_.size,
                 nsample, 0,
-                self.__rng,
+                self._rng,
                 np.ravel(samples[i]))
 
         # Restore kernel density bandwidth
@@ -61,6 +61,9 @@ class cluster_slug(object):
           if True, the computation routines will run in thread-safe
           mode, allowing use with multiprocessing; this incurs a small
           performance penalty
+       nthreads : int
+          number of OpenMP threads used by the kernel density
+          evaluation routines; 0 means use the OpenMP default
 
     Methods
        filters() : 
@@ -107,7 +110,8 @@ class cluster_slug(object):
                  priors=None, sample_density=None, pobs=None, reltol=1.0e-2,
                  abstol=1.0e-8, leafsize=16, use_nebular=True,
                  use_extinction=True, thread_safe=True,
-                 pruning=False, caching='none', vp_list=[]):
+                 pruning=False, caching='none', vp_list=[],
+                 nthreads=0, kdfile=None):
         """
         Initialize a cluster_slug object.
 
@@ -247,6 +251,17 @@ class cluster_slug(object):
               A list with an element for each of the variable parameters
               in the data. An element is set to True if we wish to use
               that parameter here, or False if we do not.
+           nthreads : int
+              number of OpenMP threads to be used by the underlying
+              bayesphot objects when evaluating many points at once;
+              0 means use the OpenMP default
+           kdfile : string | None
+              if not None, the KD tree built for each set of filters
+              is kept in a file, so that later runs, and other
+              processes using the same library, can map it rather
+              than rebuilding it; the file for a set of filters is
+              named kdfile followed by a period and the filter
+              names joined by periods; see bp for details
 
         Returns
            Nothing
@@ -415,6 +430,8 @@ class cluster_slug(object):
         self.__abstol = abstol
         self.__bw_phot_default = bw_phot
         self.__thread_safe = thread_safe
+        self.__nthreads = nthreads
+        self.__kdfile = kdfile
         self.__pruning = pruning
 
         # If we are pruning, use the priors object to figure out which
@@ -941,6 +958,13 @@ class cluster_slug(object):
                 for i in range(len(filters)):
                     bw[self.__nphys+i] = self.__photbw[f]
 
+        # Get the name of the file holding the KD tree, if any
+        if self.__kdfile is not None:
+            kdfile = self.__kdfile + '.' + \
+                     '.'.join([f.replace(osp.sep, '_') for f in filters])
+        else:
+            kdfile = None
+
         # Build the bp object
         newfilter['bp'] \
             = bp(newfilter['dataset'],
@@ -954,7 +978,9 @@ class cluster_slug(object):
                  reltol = self.__reltol,
                  abstol = self.__abstol,
                  thread_safe = self.__thread_safe,
-                 caching = self.__caching)
+                 caching = self.__caching,
+                 nthreads = self.__nthreads,
+                 kdfile = kdfile)
 
         # Save to the master filter list
         self.__filtersets.append(newfilter)
@@ -1092,6 +1118,16 @@ class cluster_slug(object):
         for f in self.__filtersets:
             f['bp'].thread_safe = self.__thread_safe
 
+    @property
+    def nthreads(self):
+        return self.__nthreads
+
+    @nthreads.setter
+    def nthreads(self, nthreads):
+        self.__nthreads = nthreads
+        for f in self.__filtersets:
+            f['bp'].nthreads = self.__nthreads
+
     ##################################################################
     # Methods to make and destroy caches
     ##################################################################
@@ -1267,7 +1303,7 @@ class cluster_slug(object):
 
     def mpdf(self, idx, photprop, photerr=None, ngrid=128,
              qmin=None, qmax=None, grid=None, norm=True,
-             filters=None):
+             filters=None, method='tree'):
         """
         Returns the marginal probability for one or mode physical
         quantities for one or more input sets of photometric
@@ -1313,6 +1349,10 @@ class cluster_slug(object):
               only 1 set of photometric filters has been defined for
               the cluster_slug object, that set will be used by
               default
+           method : 'tree' | 'binned'
+              method used to evaluate the PDF; 'binned' is faster for
+              fine grids, but is only available for gaussian kernels;
+              see bp.mpdf for details
 
         Returns:
            grid_out : array
@@ -1336,7 +1376,7 @@ class cluster_slug(object):
                 return self.__filtersets[0]['bp']. \
                     mpdf(idx, photprop, photerr=photerr, 
                          ngrid=ngrid, qmin=qmin, qmax=qmax, 
-                         grid=grid, norm=norm)
+                         grid=grid, norm=norm, method=method)
             else:
                 raise ValueError("must specify a filter set")
 
@@ -1354,7 +1394,7 @@ class cluster_slug(object):
             # Call the logL method
             return bp.mpdf(idx, photprop, photerr=photerr,
                            ngrid=ngrid, qmin=qmin, qmax=qmax,
-                           grid=grid, norm=norm)
+                           grid=grid, norm=norm, method=method)
 
 
     def mpdf_phot(self, idx, physprop, ngrid=128,
@@ -1545,7 +1585,8 @@ class cluster_slug(object):
         
         
     def mcmc(self, photprop, photerr=None, mc_walkers=100,
-             mc_steps=500, mc_burn_in=50, filters=None):
+             mc_steps=500, mc_burn_in=50, filters=None,
+             sampler='native'):
         """
         This function returns a sample of MCMC walkers for cluster
         mass, age, and extinction 
@@ -1570,6 +1611,8 @@ class cluster_slug(object):
               only 1 set of photometric filters has been defined for
               the cluster_slug object, that set will be used by
               default
+           sampler : 'native' | 'emcee'
+              MCMC sampler to use; see bp.mcmc
 
         Returns
            samples : array
@@ -1584,7 +1627,7 @@ class cluster_slug(object):
             if len(self.__filtersets) == 1:
                 return self.__filtersets[0]['bp']. \
                     mcmc(photprop, photerr, mc_walkers, mc_steps, 
-                         mc_burn_in)
+                         mc_burn_in, sampler=sampler)
             else:
                 raise ValueError("must specify a filter set")
 
@@ -1601,7 +1644,7 @@ class cluster_slug(object):
 
             # Call the mcmc method
             return bp.mcmc(photprop, photerr, mc_walkers, mc_steps, 
-                           mc_burn_in)
+                           mc_burn_in, sampler=sampler)
 
 
     def bestmatch(self, phot, photerr=None, nmatch=1, 
@@ -1893,6 +1936,78 @@ class cluster_slug(object):
                                        tol=tol)
 
 
+    def make_rep_phys(self, phot, photerr=None, squeeze=True,
+                      phys_ignore=None, filters=None, tol=None):
+        """
+        Returns representations of the PDF of physical properties
+        that corresponds to a set of photometric properties, of the
+        same type as those returned by make_approx_phys, but held in
+        memory by the c library so that they can be used to compute
+        many marginal PDFs, moments, and samples without being
+        rebuilt; representations for many sets of photometric
+        properties are built in parallel.
+
+        Parameters:
+           phot : arraylike, shape (nfilter) or (N, nfilter)
+              the set or sets of photometric properties for which the
+              representations are to be generated
+           photerr : arraylike, shape (nfilter) or (N, nfilter)
+              array giving photometric errors
+           squeeze : bool
+              if True, the representations will be squeezed to
+              minimize the number of points included
+           phys_ignore : None or listlike of bool
+              if None, the representations cover all physical
+              properties; otherwise this must be a listlike of bool,
+              one entry per physical dimension, with a value of False
+              indicating that dimension should be excluded
+           filters : listlike of strings
+              list of photometric filters to use; if left as None, and
+              only 1 set of photometric filters has been defined for
+              the cluster_slug object, that set will be used by
+              default
+           tol : float
+              if set, this tolerance overrides the value of reltol
+
+        Returns:
+           reps : bp_rep or list of bp_rep
+              the representations; these can be passed to mpdf_approx
+              in place of x and wgts; entries for which the requested
+              precision cannot be reached are None
+        """
+
+        # Were we given a set of filters?
+        if filters is None:
+
+            # No filters given; if we have only a single filter set
+            # stored, just use it
+            if len(self.__filtersets) == 1:
+                return self.__filtersets[0]['bp']. \
+                    make_rep_phys(phot, photerr=photerr,
+                                  squeeze=squeeze,
+                                  phys_ignore=phys_ignore,
+                                  tol=tol)
+            else:
+                raise ValueError("must specify a filter set")
+
+        else:
+
+            # We were given a filter set; add it if it doesn't exist
+            self.add_filters(filters)
+
+            # Find the bp object we should use
+            for f in self.__filtersets:
+                if f['filters'] == filters:
+                    bp = f['bp']
+                    break
+
+            # Call the method
+            return bp.make_rep_phys(phot, photerr=photerr,
+                                    squeeze=squeeze,
+                                    phys_ignore=phys_ignore,
+                                    tol=tol)
+
+
     def squeeze_rep(self, x, wgts, dims=None, filters=None):
         """
         Takes an input array of positions and weights that form a
@@ -1960,10 +2075,13 @@ class cluster_slug(object):
         the same style as meshgrid.
 
         Parameters:
-           x : array, shape (M, ndim), or a list of such arrays
+           x : array, shape (M, ndim), or bp_rep, or list of bp_rep
               array of points retured by make_approx_phot or
-              make_approx_phys
-           wgts : array, shape (M) or a list of such arrays
+              make_approx_phys, or representation(s) returned by
+              make_rep_phys; in the latter case, wgts and dims are
+              ignored, and a list of representations is evaluated in
+              parallel on a single grid that covers all of them
+           wgts : array, shape (M)
               array of weights returned by make_approx_phot or
               make_approx_phys
            dims : 'phys' | 'phot' | arraylike of ints
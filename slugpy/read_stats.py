@@ -0,0 +1,129 @@
+"""
+Routine to read in a SLUG summary statistics file.
+"""
+
+import os
+import os.path as osp
+import numpy as np
+from collections import namedtuple
+
+def read_stats(model_name, output_dir=None):
+    """
+    Function to read a SLUG summary statistics file.
+
+    Parameters
+       model_name : string
+          The name of the model to be read
+       output_dir : string
+          The directory where the SLUG2 output is located; if set to None,
+          the current directory is searched, followed by the SLUG_DIR
+          directory if that environment variable is set
+
+    Returns
+       A namedtuple containing the following fields:
+
+       quantity : list of string, length N_quantity
+          names of the quantities
+       n : array, shape (N_times, N_quantity)
+          number of trials included for each output time and quantity
+       mean : array, shape (N_times, N_quantity)
+          mean value
+       sd : array, shape (N_times, N_quantity)
+          standard deviation
+       min : array, shape (N_times, N_quantity)
+          minimum value
+       max : array, shape (N_times, N_quantity)
+          maximum value
+       quantile_p : array, shape (N_quantile)
+          quantiles reported
+       quantile : array, shape (N_times, N_quantity, N_quantile)
+          estimated value of each quantile
+       hist_edges : array, shape (N_times, N_quantity, N_bin+1)
+          edges of the histogram bins
+       hist : array, shape (N_times, N_quantity, N_bin)
+          number of trials in each histogram bin
+
+    Raises
+       IOError, if a stats file for the specified model cannot be found
+    """
+
+    # Did we get a specific directory in which to look? If not, try
+    # current directory
+    if output_dir is None:
+        outdir = "."
+    else:
+        outdir = output_dir
+
+    # Try to open in cwd
+    fname = osp.join(outdir, model_name+'_stats.txt')
+    try:
+        fp = open(fname, 'r')
+    except IOError:
+        fp = None
+
+    # If that failed, and we didn't get an explicit directory
+    # specification, try looking in SLUG_DIR/output
+    if (fp is None) and (output_dir is None) and \
+       ('SLUG_DIR' in os.environ):
+        outdir = osp.join(os.environ['SLUG_DIR'], 'output')
+        fname = osp.join(outdir, model_name+'_stats.txt')
+        fp = open(fname, 'r')
+
+    # Read the header of the moments table to get the quantiles, and
+    # burn the line of dashes
+    hdr = fp.readline().split()
+    quantile_p = np.array([float(h[1:]) for h in hdr[7:]])
+    fp.readline()
+
+    # Read the moments table, which ends with a blank line
+    quantity = []
+    outidx = []
+    mom = []
+    for line in fp:
+        linesplit = line.split()
+        if len(linesplit) == 0:
+            break
+        if linesplit[0] not in quantity:
+            quantity.append(linesplit[0])
+        outidx.append(int(linesplit[1]))
+        mom.append([float(l) for l in linesplit[2:]])
+    nq = len(quantity)
+    ntime = max(outidx)+1
+    mom = np.array(mom).reshape((ntime, nq, -1))
+
+    # Burn the histogram table header, then read the histograms
+    fp.readline()
+    fp.readline()
+    scale = []
+    lohi = []
+    hist = []
+    for line in fp:
+        linesplit = line.split()
+        if len(linesplit) == 0:
+            break
+        scale.append(linesplit[2])
+        lohi.append([float(l) for l in linesplit[3:5]])
+        hist.append([int(l) for l in linesplit[5:]])
+    fp.close()
+    hist = np.array(hist).reshape((ntime, nq, -1))
+    nbin = hist.shape[2]
+
+    # Construct histogram bin edges
+    hist_edges = np.zeros((ntime*nq, nbin+1))
+    for i, (s, (lo, hi)) in enumerate(zip(scale, lohi)):
+        if s == 'log':
+            hist_edges[i] = np.logspace(np.log10(lo), np.log10(hi),
+                                        nbin+1)
+        else:
+            hist_edges[i] = np.linspace(lo, hi, nbin+1)
+    hist_edges = hist_edges.reshape((ntime, nq, nbin+1))
+
+    # Build namedtuple and return
+    out_type = namedtuple('stats_data',
+                          ['quantity', 'n', 'mean', 'sd', 'min', 'max',
+                           'quantile_p', 'quantile', 'hist_edges',
+                           'hist'])
+    out = out_type(quantity, mom[:,:,0].astype(int), mom[:,:,1],
+                   mom[:,:,2], mom[:,:,3], mom[:,:,4], quantile_p,
+                   mom[:,:,5:], hist_edges, hist)
+    return out
@@ -25,8 +25,12 @@ namespace std
 #include "../constants.H"
 #include "../slug_MPI.H"
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
@@ -51,36 +55,12 @@ slug_filter_set(const std::vector<std::string>& filter_names_,
   phot_mode(phot_mode_)
 {
 
-  // Try to open the FILTER_LIST file
-  string fname = "FILTER_LIST";
-  std::ifstream filter_file;
-  path dirname(filter_dir);
-  path filter_path = dirname / path(fname.c_str());
-  filter_file.open(filter_path.c_str());
-  if (!filter_file.is_open()) {
-    // Couldn't open file, so bail out
-    ostreams.slug_err_one << "unable to open filter file " 
-			  << filter_path.string() << endl;
-    bailout(1);
-  }
-
-  // Read the list of available filters
-  vector<string> avail_filters;
-  vector<string> tokens;
-  vector<double> beta, lambda_c;
-  string line;
-  while (getline(filter_file, line)) {
-    // Split line into tokens; first token is index, second is filter
-    // name, third is filter beta, fourth is central wavelength (if
-    // beta != 0)
-    trim(line);
-    split(tokens, line, is_any_of("\t "), token_compress_on);
-    avail_filters.push_back(tokens[1]);
-    beta.push_back(lexical_cast<double>(tokens[2]));
-    if (beta.back() == 0.0) lambda_c.push_back(0.0);
-    else lambda_c.push_back(lexical_cast<double>(tokens[3]));
-  }
-  filter_file.close();
+  // Get the index of available filters
+  vector<index_entry> index;
+  get_index(filter_dir, index);
+  vector<string> avail_filters(index.size());
+  for (vector<index_entry>::size_type i=0; i<index.size(); i++)
+    avail_filters[i] = index[i].name;
 
   // Find indices for all the filters we've been requested to read
   vector<int> filter_idx;
@@ -141,13 +121,13 @@ slug_filter_set(const std::vector<std::string>& filter_names_,
   }
 
   // Now try to open the filter data file
-  fname = "allfilters.dat";
-  filter_path = dirname / path(fname.c_str());
-  filter_file.open(filter_path.c_str());
+  path dirname(filter_dir);
+  path dat_path = dirname / path("allfilters.dat");
+  std::ifstream filter_file(dat_path.c_str(), ios::in | ios::binary);
   if (!filter_file.is_open()) {
     // Couldn't open file, so bail out
     ostreams.slug_err_one << "unable to open filter file " 
-			  << filter_path.string() << endl;
+			  << dat_path.string() << endl;
     bailout(1);
   }
 
@@ -185,68 +165,14 @@ slug_filter_set(const std::vector<std::string>& filter_names_,
     }
   }
 
-  // Read through the filter data file
-  int filterptr = -1;
-  int recordptr = -1;
-  while (getline(filter_file, line)) {
-    trim(line);
-
-    // Does this line start with #? If so, it marks the beginning of
-    // the data for a new filter.
-    if (line.compare(0, 1, "#") == 0) {
-
-      // Did we just finish a filter we needed to record? If so, build
-      // a new slug_filter object and put it into the filter list in
-      // the appropriate spot.
-      if (recordptr >= 0) {
-	filters[recordptr] = 
-	  new slug_filter(lambda, response, beta[filterptr], 
-			  lambda_c[filterptr]);
-	// Break if we have now read all filters
-	nrecorded++;
-	if (nrecorded == filters.size()) break;
-      }
-
-      // Increment the filter pointer and reset the accumulators
-      filterptr++;
-      lambda.resize(0);
-      response.resize(0);
-
-      // See if we need to record the next filter
-      recordptr = -1;
-      for (unsigned int i=0; i<filter_idx.size(); i++) {
-	if (filterptr == filter_idx[i]) {
-	  recordptr = i;
-	  break;
-	}
-      }
-
-    } else if (recordptr >= 0) {
-
-      // This is a filter we're interested in, so tokenize the line
-      // and record the data; skip repeated entries
-      split(tokens, line, is_any_of("\t "), token_compress_on);
-      if (lambda.size() == 0) {
-	  lambda.push_back(lexical_cast<double>(tokens[0]));
-	  response.push_back(lexical_cast<double>(tokens[1]));
-      } else if (lambda.back() != lexical_cast<double>(tokens[0])) {
-	lambda.push_back(lexical_cast<double>(tokens[0]));
-	response.push_back(lexical_cast<double>(tokens[1]));
-      }
-    }
-
-  }
-
-  // Close file
-  filter_file.close();
-
-  // If we were in the process of recording a filter when we reached
-  // EOF, store the last filter
-  if (nrecorded < filters.size()) {
-    assert(recordptr >= 0);   // Safety check
-    filters[recordptr] = 
-      new slug_filter(lambda, response, beta[filterptr], 
-		      lambda_c[filterptr]);
+  // Read the records for the requested filters
+  for (unsigned int i=0; i<filter_idx.size(); i++) {
+    if (filter_idx[i] < 0) continue;
+    load_filter(filter_file, filter_dir, index, filter_idx[i],
+		lambda, response);
+    const index_entry &entry = index[filter_idx[i]];
+    filters[i] = new slug_filter(lambda, response, entry.beta,
+				 entry.lambda_c);
     nrecorded++;
   }
 
@@ -321,39 +247,9 @@ slug_filter_set(const std::vector<std::string>& filter_names_,
       bailout(1);
     }
 
-    // Re-open the filter file
-    filter_file.open(filter_path.c_str());
-    if (!filter_file.is_open()) {
-      // Couldn't open file, so bail out
-      ostreams.slug_err_one
-	<< "slug: error: unable to open filter file " 
-	<< filter_path.string() << endl;
-      bailout(1);
-    }
-
     // Now read the V filter
-    int filterptr = -1;
-    lambda.resize(0);
-    response.resize(0);
-    while (getline(filter_file, line)) {
-      trim(line);
-      // Does this line start with #? If so, it marks the beginning of
-      // the data for a new filter.
-      if (line.compare(0, 1, "#") == 0) {
-	// Incremenet filter pointer, and if we've passed the filter
-	// we want, stop reading.
-	filterptr++;
-	if (filterptr > V_index) break;
-      } else if (filterptr == V_index) {
-	// If this is the filter we want, record its values
-	split(tokens, line, is_any_of("\t "), token_compress_on);
-	lambda.push_back(lexical_cast<double>(tokens[0]));
-	response.push_back(lexical_cast<double>(tokens[1]));
-      }
-    }
-
-    // Close the filter file
-    filter_file.close();
+    load_filter(filter_file, filter_dir, index, V_index,
+		lambda, response);
 
     // Make a V filter object
     slug_filter V_filter(lambda, response);
@@ -373,6 +269,330 @@ slug_filter_set(const std::vector<std::string>& filter_names_,
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Helpers for the filter index
+////////////////////////////////////////////////////////////////////////
+namespace filter_index {
+
+  // Magic string and version number identifying an index file; the
+  // marker is used to reject index files written on a machine with
+  // different byte order
+  static const char magic[8] = { 'S', 'L', 'U', 'G', 'F', 'I', 'D', 'X' };
+  static const unsigned int version = 1;
+  static const unsigned int marker = 0x01020304;
+
+  // 64-bit FNV-1a checksum
+  static unsigned long long
+  checksum(const char *data, const std::string::size_type len) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (std::string::size_type i=0; i<len; i++) {
+      h ^= static_cast<unsigned char>(data[i]);
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  // Routines to read and write binary values
+  template <typename T>
+  static void put(std::ofstream &f, const T &x) {
+    f.write(reinterpret_cast<const char *>(&x), sizeof(T));
+  }
+  template <typename T>
+  static bool get(std::ifstream &f, T &x) {
+    f.read(reinterpret_cast<char *>(&x), sizeof(T));
+    return f.good();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Routine to get the filter index
+////////////////////////////////////////////////////////////////////////
+void
+slug_filter_set::get_index(const string &filter_dir,
+			   vector<index_entry> &index,
+			   const bool rebuild) const {
+
+  // Read the FILTER_LIST file into memory, and checksum it
+  path dirname(filter_dir);
+  path list_path = dirname / path("FILTER_LIST");
+  std::ifstream list_file(list_path.c_str(), ios::in | ios::binary);
+  if (!list_file.is_open()) {
+    // Couldn't open file, so bail out
+    ostreams.slug_err_one << "unable to open filter file " 
+			  << list_path.string() << endl;
+    bailout(1);
+  }
+  stringstream ss;
+  ss << list_file.rdbuf();
+  list_file.close();
+  string list_data = ss.str();
+  unsigned long long list_hash =
+    filter_index::checksum(list_data.data(), list_data.size());
+
+  // Get the size of the data file
+  path dat_path = dirname / path("allfilters.dat");
+  boost::system::error_code ec;
+  unsigned long long dat_size = file_size(dat_path, ec);
+  if (ec) {
+    ostreams.slug_err_one << "unable to open filter file " 
+			  << dat_path.string() << endl;
+    bailout(1);
+  }
+
+  // Try to read the index unless we have been told to rebuild it; if
+  // that fails, build it and try to save it
+  path idx_path = dirname / path("allfilters.idx");
+  if (rebuild ||
+      !read_index(idx_path.string(), list_hash, dat_size, index)) {
+    build_index(list_data, dat_path.string(), index);
+    write_index(idx_path.string(), list_hash, dat_size, index);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Routine to read the index from disk; returns false if the index is
+// missing or does not match the filter files
+////////////////////////////////////////////////////////////////////////
+bool
+slug_filter_set::read_index(const string &idx_name,
+			    const unsigned long long list_hash,
+			    const unsigned long long dat_size,
+			    vector<index_entry> &index) const {
+
+  // Open file
+  std::ifstream idx_file(idx_name.c_str(), ios::in | ios::binary);
+  if (!idx_file.is_open()) return false;
+
+  // Check header
+  char magic[8];
+  unsigned int version, marker, nfilter;
+  unsigned long long hash, size;
+  idx_file.read(magic, 8);
+  if (!idx_file.good() ||
+      string(magic, 8).compare(string(filter_index::magic, 8)))
+    return false;
+  if (!filter_index::get(idx_file, version) ||
+      version != filter_index::version) return false;
+  if (!filter_index::get(idx_file, marker) ||
+      marker != filter_index::marker) return false;
+  if (!filter_index::get(idx_file, hash) || hash != list_hash)
+    return false;
+  if (!filter_index::get(idx_file, size) || size != dat_size)
+    return false;
+  if (!filter_index::get(idx_file, nfilter)) return false;
+
+  // Read entries
+  index.resize(nfilter);
+  for (unsigned int i=0; i<nfilter; i++) {
+    unsigned int len;
+    if (!filter_index::get(idx_file, len)) return false;
+    index[i].name.resize(len);
+    if (len > 0) idx_file.read(&index[i].name[0], len);
+    if (!filter_index::get(idx_file, index[i].beta) ||
+	!filter_index::get(idx_file, index[i].lambda_c) ||
+	!filter_index::get(idx_file, index[i].offset) ||
+	!filter_index::get(idx_file, index[i].length) ||
+	!filter_index::get(idx_file, index[i].hash)) return false;
+    if (index[i].offset + index[i].length > dat_size) return false;
+  }
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Routine to build the index from the ASCII files
+////////////////////////////////////////////////////////////////////////
+void
+slug_filter_set::build_index(const string &list_data,
+			     const string &dat_name,
+			     vector<index_entry> &index) const {
+
+  // Parse the list of available filters
+  index.resize(0);
+  vector<string> tokens;
+  string line;
+  stringstream list_stream(list_data);
+  while (getline(list_stream, line)) {
+    // Split line into tokens; first token is index, second is filter
+    // name, third is filter beta, fourth is central wavelength (if
+    // beta != 0)
+    trim(line);
+    split(tokens, line, is_any_of("\t "), token_compress_on);
+    index_entry entry;
+    entry.name = tokens[1];
+    entry.beta = lexical_cast<double>(tokens[2]);
+    if (entry.beta == 0.0) entry.lambda_c = 0.0;
+    else entry.lambda_c = lexical_cast<double>(tokens[3]);
+    entry.offset = entry.length = entry.hash = 0;
+    index.push_back(entry);
+  }
+
+  // Read through the data file, recording where the record for each
+  // filter starts; records start with a line beginning with #, and
+  // appear in the same order as in FILTER_LIST
+  std::ifstream dat_file(dat_name.c_str(), ios::in | ios::binary);
+  if (!dat_file.is_open()) {
+    ostreams.slug_err_one << "unable to open filter file " 
+			  << dat_name << endl;
+    bailout(1);
+  }
+  stringstream ss;
+  ss << dat_file.rdbuf();
+  dat_file.close();
+  const string dat = ss.str();
+  vector<string::size_type> starts;
+  string::size_type pos = 0;
+  while (pos < dat.size()) {
+    string::size_type first = dat.find_first_not_of(" \t", pos);
+    if (first != string::npos && dat[first] == '#')
+      starts.push_back(pos);
+    pos = dat.find('\n', pos);
+    if (pos == string::npos) break;
+    pos++;
+  }
+  if (starts.size() < index.size()) {
+    ostreams.slug_err_one << "filter file " << dat_name
+			  << " contains " << starts.size()
+			  << " filters, but FILTER_LIST lists "
+			  << index.size() << endl;
+    bailout(1);
+  }
+  for (vector<index_entry>::size_type i=0; i<index.size(); i++) {
+    index[i].offset = starts[i];
+    index[i].length =
+      (i+1 < starts.size() ? starts[i+1] : dat.size()) - starts[i];
+    index[i].hash = filter_index::checksum(dat.data() + index[i].offset,
+					   index[i].length);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Routine to save the index. We write to a temporary file and then
+// rename it, so that processes that start at the same time never see
+// a partially-written index. Failure to write is not an error, since
+// the filter directory may not be writable; we simply rebuild the
+// index next time.
+////////////////////////////////////////////////////////////////////////
+void
+slug_filter_set::write_index(const string &idx_name,
+			     const unsigned long long list_hash,
+			     const unsigned long long dat_size,
+			     const vector<index_entry> &index) const {
+
+  // Create a temporary file with a unique name; the process ID alone
+  // is not enough, since processes on different nodes of a cluster
+  // may share the filter directory. mkstemp creates the file readable
+  // only by its owner, so open it up to match a normally created file.
+  string tmp_name = idx_name + ".tmp.XXXXXX";
+  int fd = mkstemp(&tmp_name[0]);
+  if (fd < 0) return;
+  fchmod(fd, 0644);
+  close(fd);
+  std::ofstream idx_file(tmp_name.c_str(), ios::out | ios::binary);
+  if (!idx_file.is_open()) {
+    boost::system::error_code ec;
+    remove(path(tmp_name), ec);
+    return;
+  }
+
+  // Write header and entries
+  idx_file.write(filter_index::magic, 8);
+  filter_index::put(idx_file, filter_index::version);
+  filter_index::put(idx_file, filter_index::marker);
+  filter_index::put(idx_file, list_hash);
+  filter_index::put(idx_file, dat_size);
+  filter_index::put(idx_file, static_cast<unsigned int>(index.size()));
+  for (vector<index_entry>::size_type i=0; i<index.size(); i++) {
+    filter_index::put(idx_file,
+		      static_cast<unsigned int>(index[i].name.size()));
+    idx_file.write(index[i].name.data(), index[i].name.size());
+    filter_index::put(idx_file, index[i].beta);
+    filter_index::put(idx_file, index[i].lambda_c);
+    filter_index::put(idx_file, index[i].offset);
+    filter_index::put(idx_file, index[i].length);
+    filter_index::put(idx_file, index[i].hash);
+  }
+  idx_file.close();
+
+  // Move into place
+  boost::system::error_code ec;
+  if (idx_file.fail()) {
+    remove(path(tmp_name), ec);
+    return;
+  }
+  rename(path(tmp_name), path(idx_name), ec);
+  if (ec) remove(path(tmp_name), ec);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Routine to read the response curve of a single filter, rebuilding
+// the index if the record does not match it. This happens if
+// allfilters.dat is edited after the index is written, without
+// changing its size.
+////////////////////////////////////////////////////////////////////////
+void
+slug_filter_set::load_filter(std::ifstream &dat_file,
+			     const string &filter_dir,
+			     vector<index_entry> &index,
+			     const vector<index_entry>::size_type idx,
+			     vector<double> &lambda,
+			     vector<double> &response) const {
+  if (read_filter(dat_file, index[idx], lambda, response)) return;
+  get_index(filter_dir, index, true);
+  if (read_filter(dat_file, index[idx], lambda, response)) return;
+  path dat_path = path(filter_dir) / path("allfilters.dat");
+  ostreams.slug_err_one << "filter file " << dat_path.string()
+			<< " does not match its index, even after "
+			<< "rebuilding the index" << endl;
+  bailout(1);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Routine to read the response curve of a single filter through the
+// index; returns false if the record does not match the index
+////////////////////////////////////////////////////////////////////////
+bool
+slug_filter_set::read_filter(std::ifstream &dat_file,
+			     const index_entry &entry,
+			     vector<double> &lambda,
+			     vector<double> &response) const {
+
+  // Read the record and check it against the index
+  string rec(entry.length, '\0');
+  dat_file.clear();
+  dat_file.seekg(entry.offset);
+  if (entry.length > 0) dat_file.read(&rec[0], entry.length);
+  if (!dat_file.good() ||
+      filter_index::checksum(rec.data(), rec.size()) != entry.hash)
+    return false;
+
+  // Parse the record; the first line is the header, and each
+  // following line contains a wavelength and a response. Skip
+  // repeated wavelengths.
+  lambda.resize(0);
+  response.resize(0);
+  string::size_type pos = rec.find('\n');
+  while (pos != string::npos && pos < rec.size()) {
+    const char *ptr = rec.c_str() + pos + 1;
+    char *end1, *end2;
+    double l = strtod(ptr, &end1);
+    double r = strtod(end1, &end2);
+    if (end1 != ptr && end2 != end1) {
+      if (lambda.size() == 0 || lambda.back() != l) {
+	lambda.push_back(l);
+	response.push_back(r);
+      }
+    }
+    pos = rec.find('\n', pos+1);
+  }
+  return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // The destructor
 ////////////////////////////////////////////////////////////////////////
@@ -27,14 +27,23 @@ namespace std
 #endif
 #include "slug_parmParser.H"
 #include "slug_sim.H"
+#include "slug_sweep.H"
 #include "slug_MPI.H"
 #include "slug_IO.H"
+#include "utils/slug_task_group.H"
 
 int main(int argc, char *argv[]) {
 
 #ifdef ENABLE_MPI
-  // If we are running an MPI simulation, start MPI here
-  MPI_Init(&argc, &argv);
+  // If we are running an MPI simulation, start MPI here; data files
+  // may be loaded by several threads at startup, but only the main
+  // thread makes MPI calls. If the MPI library does not allow other
+  // threads to exist even on those terms, the data files are loaded
+  // serially.
+  int thread_support;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
+  if (thread_support < MPI_THREAD_FUNNELED)
+    slug_task_group::allow_threads(false);
 #endif
 
   // Set up our output handlers; note that we create these with new so
@@ -46,6 +55,24 @@ int main(int argc, char *argv[]) {
   slug_ostreams ostreams;
 #endif
   
+  // If we were asked to run a sweep over many configurations, hand
+  // off to the sweep driver
+  if (argc == 3 &&
+      (!std::string(argv[1]).compare("-s") ||
+       !std::string(argv[1]).compare("--sweep"))) {
+    slug_sweep sweep(argv[2], ostreams
+#ifdef ENABLE_MPI
+		     , MPI_COMM_WORLD
+#endif
+		     );
+    sweep.run();
+#ifdef ENABLE_MPI
+    ostreams.flush_communication();
+    MPI_Finalize();
+#endif
+    return 0;
+  }
+
   // Parse the parameter file
   slug_parmParser pp(argc, argv, ostreams
 #ifdef ENABLE_MPI
@@ -49,7 +49,8 @@ using namespace boost::random;
 ////////////////////////////////////////////////////////////////////////
 slug_PDF::slug_PDF(slug_PDF_segment *new_seg, rng_type *my_rng,
 		   slug_ostreams &ostreams_, double normalization) :
-  ostreams(ostreams_), disc(nullptr), disc_restricted(nullptr) {
+  ostreams(ostreams_), disc(nullptr), disc_restricted(nullptr),
+  range_set(false), disc_range(nullptr) {
 
   // Set pointer to the rng
   rng = my_rng;
@@ -89,7 +90,8 @@ slug_PDF::slug_PDF(slug_PDF_segment *new_seg, rng_type *my_rng,
 ////////////////////////////////////////////////////////////////////////
 slug_PDF::slug_PDF(const char *PDF, rng_type *my_rng,
 		   slug_ostreams &ostreams_, bool is_normalized) :
-  ostreams(ostreams_), disc(nullptr), disc_restricted(nullptr) {
+  ostreams(ostreams_), disc(nullptr), disc_restricted(nullptr),
+  range_set(false), disc_range(nullptr) {
 
   // Set pointer to the rng
   rng = my_rng;
@@ -202,6 +204,8 @@ slug_PDF::~slug_PDF() {
     delete disc_restricted;
   if (disc != nullptr)
     delete disc;
+  if (disc_range != nullptr)
+    delete disc_range;
   if (coin != nullptr)
     delete coin;
 }
@@ -221,6 +225,9 @@ slug_PDF::setNorm(double new_norm) {
   for (unsigned int i=0; i<weights_restricted.size(); i++)
     weights_restricted[i] *= new_norm / PDFintegral;
 
+  // Clear cached range data
+  clear_range();
+
   // Record new normalization
   PDFintegral = new_norm;
   if (new_norm == 1.0) normalized = true;
@@ -286,6 +293,7 @@ slug_PDF::add_segment(double x_min, double x_max, double wgt,
   // Push this segment onto the segment vector
   segments.push_back(seg);
   weights.push_back(wgt);
+  clear_range();
 
   // If the weight of the new segment is non-zero, renormalize
   if (wgt != 0.0) {
@@ -514,40 +522,21 @@ slug_PDF::draw(double a, double b) const {
     return segments[0]->draw(a, b);
   }
 
-  // If we're here, we need to construct temporary list of segments
-  // and weights with the restricted range we've been given
-  vector<slug_PDF_segment *> seg_temp;
-  vector<double> wgt_temp;
-  for (unsigned int i=0; i<segments.size(); i++) {
-    if (a >= segments[i]->sMax()) continue; // Segment is out of range
-    if (b <= segments[i]->sMin()) continue; // Segment is out of range
-    if (a <= segments[i]->sMin() && b >= segments[i]->sMax()) {
-      // Segment entirely in range, just copy weight
-      seg_temp.push_back(segments[i]);
-      wgt_temp.push_back(weights[i]);
-    } else {
-      // Segment partly in range; store segment and compute new weight
-      seg_temp.push_back(segments[i]);
-      wgt_temp.push_back(weights[i] * segments[i]->integral(a, b));
-    }
-  }
-
-  // Create a new discrete distribution generator from the new weights
-  boost::random::discrete_distribution<> 
-    dist(wgt_temp.begin(), wgt_temp.end());
-  variate_generator<rng_type&,
-    boost::random::discrete_distribution <> > disc_temp(*rng, dist);
+  // If we're here, get the list of segments and the segment picker
+  // for the restricted range we've been given, unless we have them
+  // cached from the last call
+  if (!range_set || (a != range_a) || (b != range_b)) set_range(a, b);
 
   // Draw from discrete generator
   unsigned int segNum;
-  if (seg_temp.size() > 1) {
-    segNum = (unsigned int) disc_temp();
+  if (seg_range.size() > 1) {
+    segNum = (unsigned int) (*disc_range)();
   } else {
     segNum = 0;
   }
 
   // Draw from that segment and return
-  return seg_temp[segNum]->draw(a, b);
+  return seg_range[segNum]->draw(a, b);
 }
 
 
@@ -566,29 +555,10 @@ slug_PDF::draw(double a, double b, unsigned long n) const {
     return samples;
   }
 
-  // If we're here, we need to construct temporary list of segments
-  // and weights with the restricted range we've been given
-  vector<slug_PDF_segment *> seg_temp;
-  vector<double> wgt_temp;
-  for (unsigned int i=0; i<segments.size(); i++) {
-    if (a >= segments[i]->sMax()) continue; // Segment is out of range
-    if (b <= segments[i]->sMin()) continue; // Segment is out of range
-    if (a <= segments[i]->sMin() && b >= segments[i]->sMax()) {
-      // Segment entirely in range, just copy weight
-      seg_temp.push_back(segments[i]);
-      wgt_temp.push_back(weights[i]);
-    } else {
-      // Segment partly in range; store segment and compute new weight
-      seg_temp.push_back(segments[i]);
-      wgt_temp.push_back(weights[i] * segments[i]->integral(a, b));
-    }
-  }
-
-  // Create a new discrete distribution generator from the new weights
-  boost::random::discrete_distribution<> 
-    dist(wgt_temp.begin(), wgt_temp.end());
-  variate_generator<rng_type&,
-    boost::random::discrete_distribution <> > disc_temp(*rng, dist);
+  // If we're here, get the list of segments and the segment picker
+  // for the restricted range we've been given, unless we have them
+  // cached from the last call
+  if (!range_set || (a != range_a) || (b != range_b)) set_range(a, b);
 
   // Draw n samples
   vector<double> samples(n);
@@ -596,20 +566,76 @@ slug_PDF::draw(double a, double b, unsigned long n) const {
 
     // Draw from discrete generator
     unsigned int segNum;
-    if (seg_temp.size() > 1) {
-      segNum = (unsigned int) disc_temp();
+    if (seg_range.size() > 1) {
+      segNum = (unsigned int) (*disc_range)();
     } else {
       segNum = 0;
     }
 
     // Draw from that segment and return
-    samples[i] = seg_temp[segNum]->draw(a, b);
+    samples[i] = seg_range[segNum]->draw(a, b);
   }
 
   // Return
   return samples;
 }
 
+////////////////////////////////////////////////////////////////////////
+// Set up the list of segments and the segment picker for draws over a
+// restricted range
+////////////////////////////////////////////////////////////////////////
+void
+slug_PDF::set_range(double a, double b) const {
+
+  // Construct list of segments and weights with the restricted range
+  // we've been given
+  seg_range.resize(0);
+  vector<double> wgt_range;
+  for (unsigned int i=0; i<segments.size(); i++) {
+    if (a >= segments[i]->sMax()) continue; // Segment is out of range
+    if (b <= segments[i]->sMin()) continue; // Segment is out of range
+    if (a <= segments[i]->sMin() && b >= segments[i]->sMax()) {
+      // Segment entirely in range, just copy weight
+      seg_range.push_back(segments[i]);
+      wgt_range.push_back(weights[i]);
+    } else {
+      // Segment partly in range; store segment and compute new weight
+      seg_range.push_back(segments[i]);
+      wgt_range.push_back(weights[i] * segments[i]->integral(a, b));
+    }
+  }
+
+  // Create a new discrete distribution generator from the new weights
+  if (disc_range != nullptr) delete disc_range;
+  if (seg_range.size() > 1) {
+    boost::random::discrete_distribution<> 
+      dist(wgt_range.begin(), wgt_range.end());
+    disc_range = new variate_generator<rng_type&,
+      boost::random::discrete_distribution <> >(*rng, dist);
+  } else {
+    disc_range = nullptr;
+  }
+
+  // Record range
+  range_a = a;
+  range_b = b;
+  range_set = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Clear the cached data for draws over a restricted range; this must
+// be called whenever the segments or their weights change
+////////////////////////////////////////////////////////////////////////
+void
+slug_PDF::clear_range() {
+  if (disc_range != nullptr) delete disc_range;
+  disc_range = nullptr;
+  seg_range.resize(0);
+  range_set = false;
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Draw population function
 ////////////////////////////////////////////////////////////////////////
@@ -1268,7 +1294,9 @@ vector<double> slug_PDF::vseg_draw()
 
   }
 
-  //Update the weights
+  //Update the weights, and clear the cached range data since the
+  //segments have changed
+  clear_range();
 
   //Reset all the weights for each segment to 1.0
   std::fill(weights.begin(), weights.end(), 1.0);
@@ -1326,6 +1354,9 @@ vector<double> slug_PDF::vseg_draw()
   expectVal_restrict = expectVal;
   PDFintegral_restrict = PDFintegral;
 
+  //Record the parameters, so callers can use them to key caches
+  vparams = all_newvals;
+
   //The PDF is now ready to have its range restricted if required.
   return all_newvals;         //Return the drawn values for testing
 }
@@ -117,9 +117,16 @@ slug_PDF_exponential::draw(double a, double b) {
   // Draw a uniform deviate
   udev = (*unidist)();
 
-  // Transform to exponential distribution
-  val = -segScale * 
-    log(udev*exp(-b1/segScale) + (1.0-udev)*exp(-a1/segScale));
+  // Transform to exponential distribution; we measure from whichever
+  // end of the range the PDF is largest at, so that the exponentials
+  // cannot underflow or overflow however far the range is from the
+  // origin or how many scale lengths it spans
+  if (segScale > 0.0)
+    val = a1 - segScale * log1p(udev*expm1(-(b1-a1)/segScale));
+  else
+    val = b1 - segScale * log1p(udev*expm1((b1-a1)/segScale));
+  if (val < a1) val = a1;
+  if (val > b1) val = b1;
   return(val);
 }
 
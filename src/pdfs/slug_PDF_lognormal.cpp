@@ -63,6 +63,9 @@ slug_PDF_lognormal::initialize(const std::vector<double>& tokenVal) {
   // Get dispersion in base e
   disp = segDisp*log(10.0);
 
+  // Clear the stored draw range
+  win_set = false;
+
   // Build a lognormal distribution object with the specified parameters
   boost::random::lognormal_distribution<> lndist1(log(segMean), disp);
   lndist = new 
@@ -125,9 +128,30 @@ slug_PDF_lognormal::draw(double a, double b) {
   double a1 = a < segMin ? segMin : a;
   double b1 = b > segMax ? segMax : b;
   double val;
-  while (1) {
-    val = (*lndist)();
-    if ((val >= a1) && (val <= b1)) break;
+
+  // Get the fraction of the PDF in the range, unless we have it
+  // already
+  if (!win_set || (a1 != win_a) || (b1 != win_b)) {
+    win_a = a1;
+    win_b = b1;
+    win_za = log(a1/segMean)/disp;
+    win_zb = log(b1/segMean)/disp;
+    win_frac = 0.5*(erf(win_zb/sqrt(2.0)) - erf(win_za/sqrt(2.0)));
+    win_set = true;
+  }
+
+  // If most of the PDF is in range, rejection sampling from the full
+  // distribution is fastest; if not, draw from the truncated normal
+  // in log space directly
+  if (win_frac >= 0.5) {
+    while (1) {
+      val = (*lndist)();
+      if ((val >= a1) && (val <= b1)) break;
+    }
+  } else {
+    val = segMean * exp(disp * draw_trunc_normal(win_za, win_zb));
+    if (val < a1) val = a1;
+    if (val > b1) val = b1;
   }
   return(val);
 }
@@ -63,6 +63,9 @@ slug_PDF_normal::initialize(const std::vector<double>& tokenVals) {
   segMean = tokenVals[0];
   segDisp = tokenVals[1];
 
+  // Clear the stored draw range
+  win_set = false;
+
   // Build a normal distribution object with the specified parameters
   boost::normal_distribution<> ndist1(segMean, segDisp);
   ndist = new 
@@ -129,9 +132,28 @@ slug_PDF_normal::draw(double a, double b) {
   double a1 = a < segMin ? segMin : a;
   double b1 = b > segMax ? segMax : b;
   double val;
-  while (1) {
-    val = (*ndist)();
-    if ((val >= a1) && (val <= b1)) break;
+
+  // Get the fraction of the PDF in the range, unless we have it
+  // already
+  if (!win_set || (a1 != win_a) || (b1 != win_b)) {
+    win_a = a1;
+    win_b = b1;
+    win_za = (a1-segMean)/segDisp;
+    win_zb = (b1-segMean)/segDisp;
+    win_frac = 0.5*(erf(win_zb/sqrt(2.0)) - erf(win_za/sqrt(2.0)));
+    win_set = true;
+  }
+
+  // If most of the PDF is in range, rejection sampling from the full
+  // distribution is fastest; if not, draw from the truncated normal
+  // directly
+  if (win_frac >= 0.5) {
+    while (1) {
+      val = (*ndist)();
+      if ((val >= a1) && (val <= b1)) break;
+    }
+  } else {
+    val = segMean + segDisp * draw_trunc_normal(win_za, win_zb);
   }
   return(val);
 }
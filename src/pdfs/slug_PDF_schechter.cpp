@@ -22,6 +22,7 @@ namespace std
 }
 #endif
 #include "slug_PDF_schechter.H"
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <boost/math/special_functions/expint.hpp>
@@ -68,6 +69,27 @@ static inline double gamma_upper_inc(double a, double x) {
   }
 }
 
+////////////////////////////////////////////////////////////////////////
+// Helpers for the drawing envelope
+////////////////////////////////////////////////////////////////////////
+namespace schechter {
+
+  // Maximum number of pieces in the envelope; beyond this many
+  // scale lengths the last piece covers the rest of the range, but
+  // this is never a problem in practice because the probability of
+  // drawing from it is < e^-256
+  static const std::vector<double>::size_type max_pieces = 256;
+
+  // Integral of x^p from a to b
+  static inline double powerlaw_int(double p, double a, double b) {
+    if (p != -1.0)
+      return (pow(b, p+1.0) - pow(a, p+1.0)) / (p+1.0);
+    else
+      return log(b/a);
+  }
+}
+
+
 
 ////////////////////////////////////////////////////////////////////////
 // Constructor
@@ -122,6 +144,9 @@ slug_PDF_schechter::initialize(const std::vector<double>& tokenVal) {
   segMinVal = norm * pow( segMin/segStar, segSlope ) * exp(-segMin/segSlope);
   segMaxVal = norm * pow( segMax/segStar, segSlope ) * exp(-segMax/segSlope);
   expectVal = expectationVal(segMin, segMax);
+
+  // Clear the envelope
+  env_set = false;
 }
 
 
@@ -160,41 +185,84 @@ slug_PDF_schechter::integral(double a, double b) {
 			   gamma_upper_inc(1.0+segSlope, b1/segStar));
 }
 
-// Draw a mass from a schechter with minimum and maximum. Note that
-// this is implemented as drawing from a powerlaw with rejection
-// sampling, so the user is strongly advised to choose limits and
-// slope such that the rejection probability isn't too large, or this
-// will be VERY slow. Unfortunately doing this with a transformation
-// method requires numerical inversion of the Gamma function, would
-// probably also be obnoxiously slow. There may be a more clever way
-// to do it, but I don't know of one.
+////////////////////////////////////////////////////////////////////////
+// Build the envelope function for drawing from the range [a, b]
+////////////////////////////////////////////////////////////////////////
+void
+slug_PDF_schechter::build_envelope(double a, double b) {
+  env_a = a;
+  env_b = b;
+  env_x.assign(1, a);
+  env_cum.assign(1, 0.0);
+  double x = a;
+  while (x < b) {
+    double xnext = x + segStar;
+    if ((xnext >= b) || (env_x.size() == schechter::max_pieces))
+      xnext = b;
+    // Weight of piece; we normalize the exponential factor to its
+    // value at a so that it does not underflow when a >> segStar
+    double wgt = exp(-(x-a)/segStar) *
+      schechter::powerlaw_int(segSlope, x, xnext);
+    env_x.push_back(xnext);
+    env_cum.push_back(env_cum.back() + wgt);
+    x = xnext;
+  }
+  env_set = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Draw a mass from a schechter with minimum and maximum. This is
+// implemented as rejection sampling from the piecewise envelope built
+// by build_envelope: we pick a piece with probability proportional to
+// its weight, draw from the power law within that piece, and accept
+// with probability exp(-(x - x_lo)/segStar), where x_lo is the lower
+// edge of the piece. The result is exact, and the acceptance rate is
+// better than 1/e regardless of the limits and slope.
+////////////////////////////////////////////////////////////////////////
 double
 slug_PDF_schechter::draw(double a, double b) {
   double a1 = a < segMin ? segMin : a;
   double b1 = b > segMax ? segMax : b;
   double val, udev;
 
+  // Handle degenerate range
+  if (b1 <= a1) return a1;
+
+  // Build envelope if needed
+  if (!env_set || (a1 != env_a) || (b1 != env_b))
+    build_envelope(a1, b1);
+
   // Loop for rejection sampling
   while (1) {
 
+    // Pick a piece
+    udev = (*unidist)() * env_cum.back();
+    std::vector<double>::size_type i =
+      std::upper_bound(env_cum.begin(), env_cum.end(), udev)
+      - env_cum.begin();
+    if (i > 0) i--;
+    if (i >= env_x.size()-1) i = env_x.size()-2;
+    double xlo = env_x[i], xhi = env_x[i+1];
+
     // Draw a uniform deviate
     udev = (*unidist)();
 
     // Transform to power distribution
     if (segSlope != -1.0) {
-      val = pow(udev*pow(b1, segSlope+1.0) + 
-		(1.0-udev)*pow(a1, segSlope+1.0), 
+      val = pow(udev*pow(xhi, segSlope+1.0) + 
+		(1.0-udev)*pow(xlo, segSlope+1.0), 
 		1.0/(segSlope+1.0));
     } else {
-      val = pow(b1, udev) / pow(a1, udev-1.0);
+      val = pow(xhi, udev) / pow(xlo, udev-1.0);
     }
 
-    // Accept or reject? Acceptance probability = exp(-val/segStar).
+    // Accept or reject? Acceptance probability =
+    // exp(-(val-xlo)/segStar).
     double acceptval;
     acceptval = (*unidist)();
-    if (exp(-val/segStar) > acceptval) break;
+    if (exp(-(val-xlo)/segStar) > acceptval) break;
   }
 
   return val;
 }
-
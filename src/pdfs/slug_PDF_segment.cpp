@@ -24,8 +24,11 @@ namespace std
 #include "slug_PDF_segment.H"
 #include "slug_PDF.H"
 #include "../slug_MPI.H"
+#include <cmath>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/math/special_functions/erf.hpp>
+#include <boost/random/uniform_01.hpp>
 
 using namespace std;
 using namespace boost;
@@ -257,3 +260,69 @@ void slug_PDF_segment::delete_v_pdfs()
 
 }
 
+
+////////////////////////////////////////////////////////////////////////
+// Draw from a truncated standard normal distribution. If the interval
+// contains the peak, or lies in the tail at a point where the
+// complementary error function is still representable, we invert the
+// CDF directly. Further out in the tail we use the exponential
+// envelope of Robert (1995, Stat. Comp., 5, 121), or a uniform
+// envelope if the interval is narrower than the exponential scale;
+// both accept at least ~1/e of the time.
+////////////////////////////////////////////////////////////////////////
+double
+slug_PDF_segment::draw_trunc_normal(double za, double zb) {
+
+  // Reflect so that the interval is either centered or on the upper side
+  if (zb <= 0.0) return -draw_trunc_normal(-zb, -za);
+
+  boost::random::uniform_01<> uni;
+  double z;
+
+  if (za <= 0.0) {
+
+    // Interval contains the peak, so invert using the lower tail
+    // probability Phi(z) = erfc(-z/sqrt(2))/2
+    double pa = erfc(-za/sqrt(2.0));
+    double pb = erfc(-zb/sqrt(2.0));
+    double p;
+    do {
+      p = pa + uni(*rng)*(pb-pa);
+    } while ((p <= 0.0) || (p >= 2.0));
+    z = -sqrt(2.0) * math::erfc_inv(p);
+
+  } else if (za < 35.0) {
+
+    // Interval is in the upper tail, but erfc is still representable,
+    // so invert using the upper tail probability
+    double qa = erfc(za/sqrt(2.0));
+    double qb = erfc(zb/sqrt(2.0));
+    double q;
+    do {
+      q = qa - uni(*rng)*(qa-qb);
+    } while (q <= 0.0);
+    z = sqrt(2.0) * math::erfc_inv(q);
+
+  } else {
+
+    // Far tail; use rejection sampling
+    double lambda = 0.5*(za + sqrt(za*za+4.0));
+    if (zb - za > 1.0/lambda) {
+      while (1) {
+	z = za - log(1.0-uni(*rng))/lambda;
+	if (z > zb) continue;
+	if (uni(*rng) <= exp(-0.5*(z-lambda)*(z-lambda))) break;
+      }
+    } else {
+      while (1) {
+	z = za + uni(*rng)*(zb-za);
+	if (uni(*rng) <= exp(-0.5*(z-za)*(z+za))) break;
+      }
+    }
+  }
+
+  // Guard against roundoff taking us outside the interval
+  if (z < za) z = za;
+  if (z > zb) z = zb;
+  return z;
+}
@@ -23,13 +23,60 @@ namespace std
 #endif
 
 #include "slug_IO.H"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 
 ////////////////////////////////////////////////////////////////////////
 // slug_prefixbuf class
 ////////////////////////////////////////////////////////////////////////
-int slug_prefixbuf::sync() { return this->sbuf->pubsync(); }
+int slug_prefixbuf::sync() {
+  if (std::this_thread::get_id() != owner) return 0;
+  return this->sbuf->pubsync();
+}
 
 int slug_prefixbuf::overflow(int c) {
+  if (defer(c)) return c;
+  return put(c);
+}
+
+// Hold a character written by a thread other than the owner,
+// returning true if we did so; complete lines are moved to the held
+// output, so that lines from different threads are not interleaved
+bool slug_prefixbuf::defer(int c) {
+  std::thread::id id = std::this_thread::get_id();
+  if (id == owner) return false;
+  if (c == std::char_traits<char>::eof()) return true;
+  std::lock_guard<std::mutex> lock(mtx);
+  std::string &line = partial[id];
+  line += std::char_traits<char>::to_char_type(c);
+  if (c == '\n') {
+    held += line;
+    partial.erase(id);
+  }
+  return true;
+}
+
+// Write out held output, together with any incomplete lines, through
+// overflow, so that derived classes handle it exactly as they do
+// output from the owner
+void slug_prefixbuf::release() {
+  std::string out;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    out.swap(held);
+    for (std::map<std::thread::id, std::string>::iterator
+	   it = partial.begin(); it != partial.end(); ++it)
+      out += it->second + '\n';
+    partial.clear();
+  }
+  for (std::string::size_type i=0; i<out.size(); i++)
+    overflow(std::char_traits<char>::to_int_type(out[i]));
+  if (out.size() > 0) pubsync();
+}
+
+int slug_prefixbuf::put(int c) {
   if (c != std::char_traits<char>::eof()) {
     if (this->need_prefix
 	&& !this->prefix.empty()
@@ -162,6 +209,10 @@ void slug_oprefixstream::flush_communication() {
 // writing its own next line of output
 int slug_oprefixstream::overflow(int c) {
 
+  // Output from threads other than the owner is held until it is
+  // released by the owner, so that only the owner makes MPI calls
+  if (defer(c)) return c;
+
   if (comm == MPI_COMM_NULL) {
 
     // If we were given a null communicator, just act like the serial
@@ -298,3 +349,444 @@ int slug_oprefixstream::overflow(int c) {
 }
 #endif	
 
+
+
+#ifdef ENABLE_MPI
+////////////////////////////////////////////////////////////////////////
+// slug_mpiio_buf class
+////////////////////////////////////////////////////////////////////////
+
+// Maximum number of bytes to write per collective write call; this
+// keeps the byte counts passed to MPI within the range of an int
+#define SLUG_MPIIO_CHUNK_SIZE 1073741824
+
+// Constructor
+slug_mpiio_buf::slug_mpiio_buf(const std::string& fname, MPI_Comm comm_)
+  : comm(comm_), open_flag(false), os(nullptr), os_buf(nullptr),
+    rec_start(0), next_trial(0), file_off(0) {
+  int err = MPI_File_open(comm, const_cast<char *>(fname.c_str()),
+			  MPI_MODE_CREATE | MPI_MODE_WRONLY,
+			  MPI_INFO_NULL, &fh);
+  open_flag = (err == MPI_SUCCESS);
+
+  // Truncate the file in case it existed before; data are written
+  // in order from the start, so the file never has stale contents
+  // past the end of what we have written
+  if (open_flag) MPI_File_set_size(fh, 0);
+}
+
+// Destructor
+slug_mpiio_buf::~slug_mpiio_buf() {
+  if (os != nullptr) os->rdbuf(os_buf);
+}
+
+// Attach to a stream
+void slug_mpiio_buf::attach(std::ostream& os_) {
+  os = &os_;
+  os_buf = os->rdbuf(this);
+}
+
+// Routines to write data; these just append to our buffer
+int slug_mpiio_buf::overflow(int c) {
+  if (c != std::char_traits<char>::eof())
+    data.push_back(static_cast<char>(c));
+  return c;
+}
+
+std::streamsize slug_mpiio_buf::xsputn(const char *s, std::streamsize n) {
+  data.insert(data.end(), s, s+n);
+  return n;
+}
+
+// Mark the end of a record
+void slug_mpiio_buf::end_record(const unsigned long trial) {
+  rec_trial.push_back(trial);
+  rec_size.push_back(data.size() - rec_start);
+  rec_start = data.size();
+}
+
+// Throw away the current record
+void slug_mpiio_buf::discard_record() {
+  data.resize(rec_start);
+}
+
+// Write out the records we can place in the file
+void slug_mpiio_buf::flush(const bool final) {
+
+  // Safety check
+  if (!open_flag) return;
+
+  // Throw away anything written after the last record if this is the
+  // last flush
+  if (final) data.resize(rec_start);
+
+  // Group the records completed since the last flush into runs of
+  // consecutive trial numbers; since records are added in order of
+  // increasing trial number, the data for each run is contiguous in
+  // our buffer, and follows the data for runs from earlier flushes
+  // that have not yet been written
+  std::deque<run>::size_type nrun_old = runs_loc.size();
+  for (std::vector<unsigned long>::size_type i=0; i<rec_trial.size(); i++) {
+    if (runs_loc.size() > nrun_old &&
+	(rec_trial[i] == runs_loc.back().last ||
+	 rec_trial[i] == runs_loc.back().last+1)) {
+      runs_loc.back().last = rec_trial[i];
+      runs_loc.back().size += rec_size[i];
+    } else {
+      run r = { rec_trial[i], rec_trial[i], rec_size[i] };
+      runs_loc.push_back(r);
+    }
+  }
+  rec_trial.clear();
+  rec_size.clear();
+
+  // Gather the new run descriptions from all processes; the amount
+  // of data exchanged scales with the number of blocks of trials
+  // handed out, not with the number of trials
+  int nproc;
+  MPI_Comm_size(comm, &nproc);
+  std::vector<unsigned long long> runs;
+  for (std::deque<run>::size_type i=nrun_old; i<runs_loc.size(); i++) {
+    runs.push_back(runs_loc[i].first);
+    runs.push_back(runs_loc[i].last);
+    runs.push_back(runs_loc[i].size);
+  }
+  int nrun_loc = runs.size();
+  std::vector<int> nrun(nproc), rundisp(nproc+1, 0);
+  MPI_Allgather(&nrun_loc, 1, MPI_INT, nrun.data(), 1, MPI_INT, comm);
+  for (int i=0; i<nproc; i++) rundisp[i+1] = rundisp[i] + nrun[i];
+  std::vector<unsigned long long> allruns(rundisp[nproc]);
+  MPI_Allgatherv(runs.data(), nrun_loc, MPI_UNSIGNED_LONG_LONG,
+		 allruns.data(), nrun.data(), rundisp.data(),
+		 MPI_UNSIGNED_LONG_LONG, comm);
+  for (std::vector<unsigned long long>::size_type i=0; i<allruns.size();
+       i+=3) {
+    run r = { allruns[i], allruns[i+1], allruns[i+2] };
+    runs_all[r.first] = r;
+  }
+
+  // Place runs in the file in order of trial number, starting from
+  // the first trial not yet placed and stopping at the first gap,
+  // since the trials in the gap are still being run; on the final
+  // flush there are no more trials to come, so place everything. All
+  // processes hold the same list of runs, so they all reach the same
+  // result. Record the offsets of the runs placed.
+  std::map<unsigned long long, unsigned long long> run_off;
+  while (runs_all.size() > 0 &&
+	 (final || runs_all.begin()->first <= next_trial)) {
+    const run& r = runs_all.begin()->second;
+    run_off[r.first] = file_off;
+    file_off += r.size;
+    next_trial = r.last + 1;
+    runs_all.erase(runs_all.begin());
+  }
+
+  // If nothing was placed, we're done; every process knows this, so
+  // they all return together
+  if (run_off.size() == 0) return;
+
+  // Build a file view describing where our placed runs go; these are
+  // the runs at the front of our list, in order of increasing trial
+  // number, as required for a file view, and runs larger than the
+  // chunk size are split so that block lengths fit in an int
+  std::vector<int> blocklen;
+  std::vector<MPI_Aint> disp;
+  std::vector<char>::size_type nbyte_loc = 0;
+  while (runs_loc.size() > 0 && run_off.count(runs_loc.front().first)) {
+    unsigned long long off = run_off[runs_loc.front().first];
+    unsigned long long left = runs_loc.front().size;
+    nbyte_loc += left;
+    while (left > 0) {
+      unsigned long long nbyte = left < SLUG_MPIIO_CHUNK_SIZE ?
+	left : SLUG_MPIIO_CHUNK_SIZE;
+      blocklen.push_back(static_cast<int>(nbyte));
+      disp.push_back(static_cast<MPI_Aint>(off));
+      off += nbyte;
+      left -= nbyte;
+    }
+    runs_loc.pop_front();
+  }
+  MPI_Datatype filetype = MPI_BYTE;
+  if (blocklen.size() > 0) {
+    MPI_Type_create_hindexed(blocklen.size(), blocklen.data(), disp.data(),
+			     MPI_BYTE, &filetype);
+    MPI_Type_commit(&filetype);
+  }
+  MPI_File_set_view(fh, 0, MPI_BYTE, filetype,
+		    const_cast<char *>("native"), MPI_INFO_NULL);
+
+  // Write the data; we do this in chunks if the amount of data is
+  // very large, which requires that all processes agree on how many
+  // chunks there will be
+  unsigned long long nchunk_loc =
+    (nbyte_loc + SLUG_MPIIO_CHUNK_SIZE - 1) / SLUG_MPIIO_CHUNK_SIZE;
+  unsigned long long nchunk;
+  MPI_Allreduce(&nchunk_loc, &nchunk, 1, MPI_UNSIGNED_LONG_LONG,
+		MPI_MAX, comm);
+  std::vector<char>::size_type ptr = 0;
+  for (unsigned long long i=0; i<nchunk; i++) {
+    std::vector<char>::size_type nbyte = nbyte_loc - ptr;
+    if (nbyte > SLUG_MPIIO_CHUNK_SIZE) nbyte = SLUG_MPIIO_CHUNK_SIZE;
+    MPI_Status stat;
+    MPI_File_write_all(fh, data.data()+ptr, static_cast<int>(nbyte),
+		       MPI_BYTE, &stat);
+    ptr += nbyte;
+  }
+  if (filetype != MPI_BYTE) MPI_Type_free(&filetype);
+
+  // Drop the data we have written from our buffer
+  data.erase(data.begin(), data.begin()+nbyte_loc);
+  rec_start -= nbyte_loc;
+}
+
+// Write remaining data and close file
+void slug_mpiio_buf::close() {
+
+  // Safety check
+  if (!open_flag) return;
+
+  // Write everything that is left, then close and free memory
+  flush(true);
+  MPI_File_close(&fh);
+  open_flag = false;
+  std::vector<char>().swap(data);
+  runs_loc.clear();
+  runs_all.clear();
+  rec_start = 0;
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////
+// slug_ascii_record class
+////////////////////////////////////////////////////////////////////////
+
+// Values whose magnitudes lie outside this range, along with zero,
+// infinities, and NaNs, are formatted with snprintf rather than by the
+// fast method
+#define SLUG_ASCII_FAST_MIN 1.0e-290
+#define SLUG_ASCII_FAST_MAX 1.0e290
+
+// Table of correctly rounded powers of 10, from 10^-SLUG_ASCII_POW10_OFF
+// to 10^SLUG_ASCII_POW10_OFF; this covers every scaling factor the fast
+// method needs for values in the range above
+#define SLUG_ASCII_POW10_OFF 300
+static const std::vector<double>& slug_ascii_pow10() {
+  static const std::vector<double> tab = [] {
+    std::vector<double> t(2*SLUG_ASCII_POW10_OFF+1);
+    for (int i=0; i<(int) t.size(); i++) {
+      char s[16];
+      snprintf(s, sizeof s, "1e%d", i-SLUG_ASCII_POW10_OFF);
+      t[i] = strtod(s, nullptr);
+    }
+    return t;
+  }();
+  return tab;
+}
+
+// Format a value as %.5e; returns the number of characters written
+// to out, which must have room for at least 32
+static int slug_ascii_format_e5(char *out, const double x) {
+
+  // Handle values outside the range of the fast method
+  double ax = fabs(x);
+  if (!(ax >= SLUG_ASCII_FAST_MIN && ax <= SLUG_ASCII_FAST_MAX))
+    return snprintf(out, 32, "%.5e", x);
+
+  // Scale the value so that its mantissa lies in [10^5, 10^6); our
+  // estimate of the exponent from log10 can be off by one near
+  // powers of 10, so correct it if needed
+  const std::vector<double>& pow10 = slug_ascii_pow10();
+  const int off = SLUG_ASCII_POW10_OFF;
+  int e = (int) floor(log10(ax));
+  double m = ax * pow10[off+5-e];
+  if (m < 1.0e5) {
+    e--;
+    m = ax * pow10[off+5-e];
+  } else if (m >= 1.0e6) {
+    e++;
+    m = ax * pow10[off+5-e];
+  }
+
+  // Round to an integer mantissa. The scaled value carries an error
+  // of at most a few parts in 10^16, so if it lies very close to
+  // half an integer we cannot be sure which way snprintf would round
+  // the exact value, and we let snprintf do it.
+  double mi = floor(m);
+  double frac = m - mi;
+  if (fabs(frac - 0.5) < 1.0e-6) return snprintf(out, 32, "%.5e", x);
+  unsigned long r = (unsigned long) mi;
+  if (frac > 0.5) r++;
+  if (r >= 1000000) {
+    r /= 10;
+    e++;
+  }
+
+  // Write sign, mantissa, and exponent
+  char *p = out;
+  if (x < 0) *(p++) = '-';
+  p[6] = '0' + r % 10; r /= 10;
+  p[5] = '0' + r % 10; r /= 10;
+  p[4] = '0' + r % 10; r /= 10;
+  p[3] = '0' + r % 10; r /= 10;
+  p[2] = '0' + r % 10; r /= 10;
+  p[1] = '.';
+  p[0] = '0' + r;
+  p += 7;
+  *(p++) = 'e';
+  if (e < 0) {
+    *(p++) = '-';
+    e = -e;
+  } else {
+    *(p++) = '+';
+  }
+  if (e >= 100) {
+    *(p++) = '0' + e / 100;
+    e %= 100;
+  }
+  *(p++) = '0' + e / 10;
+  *(p++) = '0' + e % 10;
+  return p - out;
+}
+
+// Append a floating point value
+slug_ascii_record& slug_ascii_record::sci(const double x, const int width) {
+  char tmp[32];
+  int len = slug_ascii_format_e5(tmp, x);
+  pad(len, width);
+  buf.append(tmp, len);
+  return *this;
+}
+
+// Append an integer
+slug_ascii_record& slug_ascii_record::num(const unsigned long x,
+					  const int width) {
+  char tmp[24];
+  char *p = tmp + sizeof tmp;
+  unsigned long y = x;
+  do {
+    *(--p) = '0' + y % 10;
+    y /= 10;
+  } while (y > 0);
+  std::string::size_type len = tmp + sizeof tmp - p;
+  pad(len, width);
+  buf.append(p, len);
+  return *this;
+}
+
+// Append a string
+slug_ascii_record& slug_ascii_record::str(const std::string& s,
+					  const int width) {
+  pad(s.size(), width);
+  buf.append(s);
+  return *this;
+}
+
+
+#ifdef ENABLE_FITS
+////////////////////////////////////////////////////////////////////////
+// slug_fits_table class
+////////////////////////////////////////////////////////////////////////
+
+// Target amount of memory, in bytes, used to buffer rows for a single
+// table before they are written out
+#define SLUG_FITS_TABLE_BUF_SIZE 16777216
+
+// Constructor
+slug_fits_table::slug_fits_table(fitsfile *fptr_)
+  : fptr(fptr_), nrow_file(0), nrow_buf(0), nrow_max(1) {
+
+  // Get number of rows already in the table, and the number of
+  // columns
+  int fits_status = 0;
+  int ncol = 0;
+  fits_get_num_rows(fptr, &nrow_file, &fits_status);
+  fits_get_num_cols(fptr, &ncol, &fits_status);
+
+  // Get the type and repeat count of every column; integer columns
+  // are held as unsigned long, everything else as double
+  datatype.resize(ncol);
+  repeat.resize(ncol);
+  dbl_data.resize(ncol);
+  ulong_data.resize(ncol);
+  long rowsize = 0;
+  for (int i=0; i<ncol; i++) {
+    int typecode;
+    long width;
+    fits_get_coltype(fptr, i+1, &typecode, &(repeat[i]), &width,
+		     &fits_status);
+    if (typecode == TLONGLONG || typecode == TLONG ||
+	typecode == TINT || typecode == TSHORT || typecode == TBYTE) {
+      datatype[i] = TULONG;
+      rowsize += repeat[i] * sizeof(unsigned long);
+    } else {
+      datatype[i] = TDOUBLE;
+      rowsize += repeat[i] * sizeof(double);
+    }
+  }
+
+  // Set the number of rows to buffer: as many as fit in our target
+  // buffer size, but no fewer than cfitsio's own optimal number of
+  // rows per write
+  long nrow_opt = 1;
+  fits_get_rowsize(fptr, &nrow_opt, &fits_status);
+  if (rowsize > 0) nrow_max = SLUG_FITS_TABLE_BUF_SIZE / rowsize;
+  if (nrow_max < nrow_opt) nrow_max = nrow_opt;
+  if (nrow_max < 1) nrow_max = 1;
+}
+
+// Routines to set data in the current row
+void slug_fits_table::set(const int colnum, const double x) {
+  std::vector<double>& d = dbl_data[colnum-1];
+  d.resize((nrow_buf+1)*repeat[colnum-1]);
+  d[nrow_buf*repeat[colnum-1]] = x;
+}
+
+void slug_fits_table::set(const int colnum, const unsigned long x) {
+  std::vector<unsigned long>& d = ulong_data[colnum-1];
+  d.resize((nrow_buf+1)*repeat[colnum-1]);
+  d[nrow_buf*repeat[colnum-1]] = x;
+}
+
+void slug_fits_table::set(const int colnum, const std::vector<double>& x) {
+  std::vector<double>& d = dbl_data[colnum-1];
+  std::vector<double>::size_type n = repeat[colnum-1];
+  if (x.size() < n) n = x.size();
+  d.resize((nrow_buf+1)*repeat[colnum-1]);
+  std::copy(x.begin(), x.begin()+n, d.begin()+nrow_buf*repeat[colnum-1]);
+}
+
+// Finish the current row
+void slug_fits_table::end_row() {
+  nrow_buf++;
+  for (std::vector<int>::size_type i=0; i<datatype.size(); i++) {
+    if (datatype[i] == TULONG)
+      ulong_data[i].resize(nrow_buf*repeat[i]);
+    else
+      dbl_data[i].resize(nrow_buf*repeat[i]);
+  }
+  if (nrow_buf >= nrow_max) flush();
+}
+
+// Write all buffered rows; we clear the buffers but keep their
+// memory, since they will be filled again
+void slug_fits_table::flush() {
+  if (nrow_buf == 0) return;
+  int fits_status = 0;
+  for (std::vector<int>::size_type i=0; i<datatype.size(); i++) {
+    if (datatype[i] == TULONG) {
+      fits_write_col(fptr, TULONG, i+1, nrow_file+1, 1,
+		     nrow_buf*repeat[i], ulong_data[i].data(),
+		     &fits_status);
+      ulong_data[i].clear();
+    } else {
+      fits_write_col(fptr, TDOUBLE, i+1, nrow_file+1, 1,
+		     nrow_buf*repeat[i], dbl_data[i].data(),
+		     &fits_status);
+      dbl_data[i].clear();
+    }
+  }
+  nrow_file += nrow_buf;
+  nrow_buf = 0;
+}
+#endif
@@ -8,7 +8,12 @@ using namespace std;
 ////////////////////////////////////////////////////////////////////////
 // An abort routine
 ////////////////////////////////////////////////////////////////////////
+static thread_local bool bailout_throw = false;
+
+void bailout_throws(bool val) { bailout_throw = val; }
+
 [[noreturn]] void bailout(int exit_val) {
+  if (bailout_throw) throw slug_bailout_error(exit_val);
 #ifdef ENABLE_MPI
   MPI_Abort(MPI_COMM_WORLD, exit_val);
 #endif
@@ -28,30 +33,55 @@ using namespace std;
 // big chunk sizes can be memory expensive.
 #define SLUG_MPI_CHUNK_SIZE 4194304
 
-// Utility routine for creating a send buffer from a vector of
-// clusters
-static inline slug_cluster_buffer *
-pack_slug_clusters(const vector<slug_cluster *> &clusters,
-		   vector<size_t> &sizes, size_t &bufsize) {
-  
-  // Record size of each cluster and total buffer size
-  sizes.resize(clusters.size());
+// Routine to build an MPI datatype describing a vector of
+// serialized clusters laid out back to back; see slug_MPI.H
+MPI_Datatype
+MPI_slug_cluster_datatype(const slug_cluster *const *clusters,
+			  const size_t ncluster,
+			  vector<slug_cluster_buf_prefix> &prefixes,
+			  vector<size_t> &sizes, size_t &bufsize) {
+
+  // Get the segments making up each cluster's buffer; note that we
+  // size the prefix array first, since the segments point into it
+  prefixes.resize(ncluster);
+  sizes.resize(ncluster);
+  vector<struct iovec> iov;
+  for (vector<size_t>::size_type i=0; i<ncluster; i++) {
+    clusters[i]->buffer_segments(prefixes[i], iov);
+    sizes[i] = prefixes[i].hdr.size;
+  }
+
+  // Convert segments to a list of absolute addresses and lengths
+  vector<int> blocklens(iov.size());
+  vector<MPI_Aint> displs(iov.size());
   bufsize = 0;
-  for (vector<size_t>::size_type i=0; i<clusters.size(); i++) {
-    sizes[i] = clusters[i]->buffer_size();
-    bufsize += sizes[i];
+  for (vector<struct iovec>::size_type i=0; i<iov.size(); i++) {
+    blocklens[i] = iov[i].iov_len;
+    MPI_Get_address(iov[i].iov_base, &(displs[i]));
+    bufsize += iov[i].iov_len;
   }
 
-  // Allocate and pack the buffer
-  slug_cluster_buffer *buf = malloc(bufsize);
+  // Build and commit the datatype
+  MPI_Datatype dtype;
+  MPI_Type_create_hindexed(iov.size(), blocklens.data(), displs.data(),
+			   MPI_BYTE, &dtype);
+  MPI_Type_commit(&dtype);
+  return dtype;
+}
+
+// Utility routine to get views of a vector of clusters stored back
+// to back in a buffer
+static inline vector<slug_cluster_view>
+view_slug_clusters(const vector<size_t>::size_type ncluster,
+		   const size_t *sizes,
+		   const slug_cluster_buffer *buf) {
+  vector<slug_cluster_view> views(ncluster);
   size_t ptr = 0;
-  for (vector<size_t>::size_type i=0; i<clusters.size(); i++) {
-    clusters[i]->pack_buffer((char *) buf+ptr);
+  for (vector<size_t>::size_type i=0; i<ncluster; i++) {
+    views[i] = slug_cluster_view((const char *) buf + ptr);
     ptr += sizes[i];
   }
-
-  // Return the buffer
-  return buf;
+  return views;
 }
 
 // Utility routine to unpack a vector of clusters
@@ -70,22 +100,19 @@ unpack_slug_clusters(const vector<size_t>::size_type ncluster,
 		     slug_ostreams &ostreams_,
 		     const slug_PDF *clf_) {
   vector<slug_cluster *> clusters(ncluster);
-  size_t ptr = 0;
-  for (vector<size_t>::size_type i=0; i<ncluster; i++) {
-    slug_cluster_buffer *bufptr = (slug_cluster_buffer *)
-      ((char *) buf + ptr);
-    clusters[i] = new slug_cluster(bufptr, imf_, tracks_, specsyn_,
-				   filters_, extinct_, nebular_,
+  vector<slug_cluster_view> views = view_slug_clusters(ncluster, sizes, buf);
+  for (vector<size_t>::size_type i=0; i<ncluster; i++)
+    clusters[i] = new slug_cluster(views[i].buffer(), imf_, tracks_,
+				   specsyn_, filters_, extinct_, nebular_,
 				   yields_, lines_, ostreams_, clf_);
-    ptr += sizes[i];
-  }
   return clusters;
 }
 
 // Utility routine to pack a vector of clusters for chunked
-// communication; this differs from pack_slug_clusters in that the
-// buffer also contains information on the number of clusters and
-// their sizes, packed into a single message. The buffer is broken up
+// communication; this differs from the layout described by
+// MPI_slug_cluster_datatype in that the buffer also contains
+// information on the number of clusters and their sizes, packed into
+// a single message. The buffer is broken up
 // into chunks of a specified maximum size, and the routine returns
 // the size of each chunk. The first chunk starts with
 //
@@ -220,8 +247,13 @@ pack_slug_clusters_chunk(const vector<slug_cluster *> &clusters,
 void MPI_send_slug_cluster(const slug_cluster &cluster, int dest, int tag,
 			   MPI_Comm comm) {
   
-  // Get size of buffer
-  size_t bufsize = cluster.buffer_size();
+  // Build a datatype describing the serialized cluster in place
+  const slug_cluster *cl = &cluster;
+  vector<slug_cluster_buf_prefix> prefixes;
+  vector<size_t> sizes;
+  size_t bufsize;
+  MPI_Datatype dtype =
+    MPI_slug_cluster_datatype(&cl, 1, prefixes, sizes, bufsize);
 
   // Send size of buffer; note that this is a bit tricky, because
   // there isn't a single MPI integer type that we can guarantee will
@@ -229,14 +261,12 @@ void MPI_send_slug_cluster(const slug_cluster &cluster, int dest, int tag,
   // interpret on the other end
   MPI_Send(&bufsize, sizeof(bufsize), MPI_BYTE, dest, tag, comm);
 
-  // Get the serialized version of the input object
-  slug_cluster_buffer *buf = cluster.make_buffer();
+  // Do send directly from the cluster's memory and wait for
+  // completion
+  MPI_Send(MPI_BOTTOM, 1, dtype, dest, tag, comm);
 
-  // Do send and wait for completion
-  MPI_Send(buf, bufsize, MPI_BYTE, dest, tag, comm);
-
-  // Free buffer
-  cluster.free_buffer(buf);
+  // Free datatype
+  MPI_Type_free(&dtype);
 }
 
 // Blocking receive of a single cluster
@@ -281,11 +311,13 @@ MPI_recv_slug_cluster(int source, int tag, MPI_Comm comm,
 void MPI_send_slug_cluster_vec(const vector<slug_cluster *> &clusters,
 			       int dest, int tag, MPI_Comm comm) {
 
-  // Create send buffer and metadata
+  // Create datatype describing the data to send, and metadata
+  vector<slug_cluster_buf_prefix> prefixes;
   vector<size_t> sizes;
   size_t bufsize;
-  slug_cluster_buffer *buf =
-    pack_slug_clusters(clusters, sizes, bufsize);
+  MPI_Datatype dtype =
+    MPI_slug_cluster_datatype(clusters.data(), clusters.size(),
+			      prefixes, sizes, bufsize);
 
   // First send number of objects to be sent
   vector<int>::size_type ncluster = sizes.size();
@@ -296,25 +328,17 @@ void MPI_send_slug_cluster_vec(const vector<slug_cluster *> &clusters,
 	   dest, tag, comm);
 
   // Finally send the data
-  MPI_Send(buf, bufsize, MPI_BYTE, dest, tag, comm);
+  MPI_Send(MPI_BOTTOM, 1, dtype, dest, tag, comm);
 
-  // Free buffer
-  free(buf);
+  // Free datatype
+  MPI_Type_free(&dtype);
 }
 
-// Blocking receive of a vector of clusters
-std::vector<slug_cluster *>
-MPI_recv_slug_cluster_vec(int source, int tag, MPI_Comm comm,
-			  const slug_PDF *imf_, 
-			  const slug_tracks *tracks_, 
-			  const slug_specsyn *specsyn_,
-			  const slug_filter_set *filters_,
-			  const slug_extinction *extinct_,
-			  const slug_nebular *nebular_,
-			  const slug_yields *yields_,
-			  const slug_line_list *lines_,
-			  slug_ostreams &ostreams_,
-			  const slug_PDF *clf_) {
+// Blocking receive of a vector of clusters, returning views into
+// the receive buffer
+std::vector<slug_cluster_view>
+MPI_recv_slug_cluster_vec_view(int source, int tag, MPI_Comm comm,
+			       slug_cluster_buffer *&buf) {
 
   // First receive the number of objects to be received
   vector<size_t>::size_type ncluster;
@@ -322,28 +346,51 @@ MPI_recv_slug_cluster_vec(int source, int tag, MPI_Comm comm,
 	   MPI_STATUS_IGNORE);
 
   // Now receive the sizes of each object
-  size_t *sizes = (size_t *) calloc(ncluster, sizeof(size_t));
-  MPI_Recv(sizes, sizeof(size_t)*ncluster, MPI_BYTE, source, tag,
+  vector<size_t> sizes(ncluster);
+  MPI_Recv(sizes.data(), sizeof(size_t)*ncluster, MPI_BYTE, source, tag,
 	   comm, MPI_STATUS_IGNORE);
 
   // Allocate memory to receive the cluster data
   size_t bufsize = 0;
   for (vector<int>::size_type i=0; i<ncluster; i++) bufsize += sizes[i];
-  slug_cluster_buffer *buf = (slug_cluster_buffer *) malloc(bufsize);
+  buf = (slug_cluster_buffer *) malloc(bufsize);
 
   // Receive data
   MPI_Recv(buf, bufsize, MPI_BYTE, source, tag, comm,
 	   MPI_STATUS_IGNORE);
 
+  // Return views of the data
+  return view_slug_clusters(ncluster, sizes.data(), buf);
+}
+
+// Blocking receive of a vector of clusters
+std::vector<slug_cluster *>
+MPI_recv_slug_cluster_vec(int source, int tag, MPI_Comm comm,
+			  const slug_PDF *imf_, 
+			  const slug_tracks *tracks_, 
+			  const slug_specsyn *specsyn_,
+			  const slug_filter_set *filters_,
+			  const slug_extinction *extinct_,
+			  const slug_nebular *nebular_,
+			  const slug_yields *yields_,
+			  const slug_line_list *lines_,
+			  slug_ostreams &ostreams_,
+			  const slug_PDF *clf_) {
+
+  // Receive the data
+  slug_cluster_buffer *buf;
+  vector<slug_cluster_view> views =
+    MPI_recv_slug_cluster_vec_view(source, tag, comm, buf);
+
   // Unpack data
-  vector<slug_cluster *> clusters =
-    unpack_slug_clusters(ncluster, sizes, buf, imf_, tracks_, specsyn_,
-			 filters_, extinct_, nebular_, yields_,lines_,
-			 ostreams_, clf_);
+  vector<slug_cluster *> clusters(views.size());
+  for (vector<size_t>::size_type i=0; i<views.size(); i++)
+    clusters[i] = new slug_cluster(views[i].buffer(), imf_, tracks_,
+				   specsyn_, filters_, extinct_, nebular_,
+				   yields_, lines_, ostreams_, clf_);
 
-  // Free buffers
+  // Free buffer
   free(buf);
-  free(sizes);
 
   // Return
   return clusters;
@@ -369,19 +416,23 @@ MPI_bcast_slug_cluster(slug_cluster *cluster, int root,
   MPI_Comm_rank(comm, &myrank);
   if (myrank == root) {
 
-    // I am the transmitting processor, so get the size of the buffer
-    // and build the buffer
-    size_t bufsize = cluster->buffer_size();
-    slug_cluster_buffer *buf = cluster->make_buffer();
+    // I am the transmitting processor, so build a datatype
+    // describing the serialized cluster in place
+    const slug_cluster *cl = cluster;
+    vector<slug_cluster_buf_prefix> prefixes;
+    vector<size_t> sizes;
+    size_t bufsize;
+    MPI_Datatype dtype =
+      MPI_slug_cluster_datatype(&cl, 1, prefixes, sizes, bufsize);
 
     // Send the size of the buffer
     MPI_Bcast(&bufsize, sizeof(bufsize), MPI_BYTE, root, comm);
 
     // Send the contents of the buffer
-    MPI_Bcast(buf, bufsize, MPI_BYTE, root, comm);
+    MPI_Bcast(MPI_BOTTOM, 1, dtype, root, comm);
 
-    // Free buffer
-    free(buf);
+    // Free datatype
+    MPI_Type_free(&dtype);
 
     // Return the input pointer as output
     return cluster;
@@ -431,12 +482,14 @@ MPI_bcast_slug_cluster_vec(std::vector<slug_cluster *> &clusters,
   MPI_Comm_rank(comm, &myrank);
   if (myrank == root) {
 
-    // I am the sending processor, so build the send buffer and its
-    // metadata
+    // I am the sending processor, so build a datatype describing
+    // the data to send, and its metadata
+    vector<slug_cluster_buf_prefix> prefixes;
     vector<size_t> sizes;
     size_t bufsize;
-    slug_cluster_buffer *buf =
-      pack_slug_clusters(clusters, sizes, bufsize);
+    MPI_Datatype dtype =
+      MPI_slug_cluster_datatype(clusters.data(), clusters.size(),
+			      prefixes, sizes, bufsize);
     vector<size_t>::size_type ncluster = sizes.size();
 
     // Broadcast how many clusters we'll be sending
@@ -446,10 +499,10 @@ MPI_bcast_slug_cluster_vec(std::vector<slug_cluster *> &clusters,
     MPI_Bcast(sizes.data(), ncluster*sizeof(size_t), MPI_BYTE, root, comm);
 
     // Now broadcast the data
-    MPI_Bcast(buf, bufsize, MPI_BYTE, root, comm);
+    MPI_Bcast(MPI_BOTTOM, 1, dtype, root, comm);
 
-    // Free buffer
-    free(buf);
+    // Free datatype
+    MPI_Type_free(&dtype);
 
     // Return the array of pointers we were originally passed
     return clusters;
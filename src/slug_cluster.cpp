@@ -23,10 +23,10 @@ namespace std
 #endif
 #include "constants.H"
 #include "slug_cluster.H"
-#include "utils/int_tabulated.H"
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <boost/bind.hpp>
 
@@ -128,6 +128,7 @@ slug_cluster::slug_cluster(const unsigned long id_,
 
   // Initialize status flags for what data has been stored
   spec_set = Lbol_set = data_set = phot_set = yield_set = ew_set = false;
+  Lbol_ext_set = spec_ext_set = spec_neb_set = false;
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -146,7 +147,7 @@ slug_cluster::slug_cluster(const slug_cluster_buffer *buf,
 			   const slug_PDF *clf_,
 			   const bool stoch_contrib_only_) :
   ostreams(ostreams_),
-  targetMass(((double *) buf)[0]),
+  targetMass(slug_cluster_view(buf).get_target_mass()),
   imf(imf_),
   clf(clf_),
   tracks(tracks_), 
@@ -159,105 +160,63 @@ slug_cluster::slug_cluster(const slug_cluster_buffer *buf,
   integ(tracks_, imf_, nullptr, ostreams_),
   stoch_contrib_only(stoch_contrib_only_)
 {
-  // Pull out the basic data first
-  // Doubles
-  const double *buf_dbl = (const double *) buf;
-  birthMass = buf_dbl[1];
-  aliveMass = buf_dbl[2];
-  stochBirthMass = buf_dbl[3];
-  stochAliveMass = buf_dbl[4];
-  nonStochBirthMass = buf_dbl[5];
-  nonStochAliveMass = buf_dbl[6];
-  stochRemnantMass = buf_dbl[7];
-  nonStochRemnantMass = buf_dbl[8];
-  stellarMass = buf_dbl[9];
-  stochStellarMass = buf_dbl[10];
-  nonStochStellarMass = buf_dbl[11];
-  formationTime = buf_dbl[12];
-  curTime = buf_dbl[13];
-  clusterAge = buf_dbl[14];
-  lifetime = buf_dbl[15];
-  stellarDeathMass = buf_dbl[16];
-  A_V = buf_dbl[17];
-  A_Vneb = buf_dbl[18];
-  Lbol = buf_dbl[19];
-  Lbol_ext = buf_dbl[20];
-  tot_sn = buf_dbl[21];
-  last_yield_time = buf_dbl[22];
-
-  // Unsigned longs
-  const unsigned long *buf_ul = (const unsigned long *) (buf_dbl+23);
-  id = buf_ul[0];
-  stoch_sn = buf_ul[1];
-
-  // Bools; could pack these into an integer, but this is easier to
-  // read, the the storage space and communication cost isn't going to
-  // be affected significantly one way or the other
-  const bool *buf_bool = (const bool *) (buf_ul+2);
-  is_disrupted = buf_bool[0];
-  data_set = buf_bool[1];
-  Lbol_set = buf_bool[2];
-  spec_set = buf_bool[3];
-  phot_set = buf_bool[4];
-  yield_set = buf_bool[5];
-  ew_set = buf_bool[6];
-
-  // Sizes of various vectors
-  const vector<double>::size_type *buf_sz =
-    (const vector<double>::size_type *) (buf_bool+7);
-  stars.resize(buf_sz[0]);
-  dead_stars.resize(buf_sz[1]);
-  L_lambda.resize(buf_sz[2]);
-  phot.resize(buf_sz[3]);
-  L_lambda_ext.resize(buf_sz[4]);
-  phot_ext.resize(buf_sz[5]);
-  L_lambda_neb.resize(buf_sz[6]);
-  phot_neb.resize(buf_sz[7]);
-  L_lambda_neb_ext.resize(buf_sz[8]);
-  phot_neb_ext.resize(buf_sz[9]);
-  all_yields.resize(buf_sz[10]);
-  stoch_yields.resize(buf_sz[11]);
-  non_stoch_yields.resize(buf_sz[12]);
-  stardata.resize(buf_sz[13]);
-  ew.resize(buf_sz[14]);
-
-  // Contents of the vectors
-  const double *buf_vec = (const double *) (buf_sz+15);
-  vector<double>::size_type offset, offset0;
-  for (offset = 0; offset < stars.size(); offset++)
-    stars[offset] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < dead_stars.size(); offset++)
-    dead_stars[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < L_lambda.size(); offset++)
-    L_lambda[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < phot.size(); offset++)
-    phot[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < L_lambda_ext.size(); offset++)
-    L_lambda_ext[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < phot_ext.size(); offset++)
-    phot_ext[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < L_lambda_neb.size(); offset++)
-    L_lambda_neb[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < phot_neb.size(); offset++)
-    phot_neb[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < L_lambda_neb_ext.size(); offset++)
-    L_lambda_neb_ext[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < phot_neb_ext.size(); offset++)
-    phot_neb_ext[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < all_yields.size(); offset++)
-    all_yields[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < stoch_yields.size(); offset++)
-    stoch_yields[offset-offset0] = buf_vec[offset];
-  for (offset0 = offset; offset-offset0 < non_stoch_yields.size(); offset++)
-    non_stoch_yields[offset-offset0] = buf_vec[offset];
-  const slug_stardata *buf_stardata =
-    (const slug_stardata *) (buf_vec+offset);
-  for (offset = 0; offset < stardata.size(); offset++)
-    stardata[offset] = buf_stardata[offset];
-  for (offset =0; offset < ew.size(); offset++)
-  {
-    ew[offset] = buf_vec[offset];
+  // Check that the buffer is one we know how to read
+  slug_cluster_view view(buf);
+  if (!view.valid()) {
+    ostreams.slug_err_one << "slug_cluster: serialized cluster buffer "
+			  << "has bad magic number or unknown version"
+			  << endl;
+    exit(1);
+  }
+
+  // Scalar doubles
+  const double *buf_dbl = (const double *) view.section(CLBUF_DBL);
+  birthMass = buf_dbl[CLBUF_BIRTH_MASS];
+  aliveMass = buf_dbl[CLBUF_ALIVE_MASS];
+  stochBirthMass = buf_dbl[CLBUF_STOCH_BIRTH_MASS];
+  stochAliveMass = buf_dbl[CLBUF_STOCH_ALIVE_MASS];
+  nonStochBirthMass = buf_dbl[CLBUF_NON_STOCH_BIRTH_MASS];
+  nonStochAliveMass = buf_dbl[CLBUF_NON_STOCH_ALIVE_MASS];
+  stochRemnantMass = buf_dbl[CLBUF_STOCH_REMNANT_MASS];
+  nonStochRemnantMass = buf_dbl[CLBUF_NON_STOCH_REMNANT_MASS];
+  stellarMass = buf_dbl[CLBUF_STELLAR_MASS];
+  stochStellarMass = buf_dbl[CLBUF_STOCH_STELLAR_MASS];
+  nonStochStellarMass = buf_dbl[CLBUF_NON_STOCH_STELLAR_MASS];
+  formationTime = buf_dbl[CLBUF_FORMATION_TIME];
+  curTime = buf_dbl[CLBUF_CUR_TIME];
+  clusterAge = buf_dbl[CLBUF_CLUSTER_AGE];
+  lifetime = buf_dbl[CLBUF_LIFETIME];
+  stellarDeathMass = buf_dbl[CLBUF_STELLAR_DEATH_MASS];
+  A_V = buf_dbl[CLBUF_A_V];
+  A_Vneb = buf_dbl[CLBUF_A_VNEB];
+  Lbol = buf_dbl[CLBUF_LBOL];
+  Lbol_ext = buf_dbl[CLBUF_LBOL_EXT];
+  tot_sn = buf_dbl[CLBUF_TOT_SN];
+  last_yield_time = buf_dbl[CLBUF_LAST_YIELD_TIME];
+
+  // Scalar integers and flags
+  id = view.get_int(CLBUF_ID);
+  stoch_sn = view.get_int(CLBUF_STOCH_SN);
+  is_disrupted = view.get_flag(CLBUF_FLAG_DISRUPTED);
+  data_set = view.get_flag(CLBUF_FLAG_DATA_SET);
+  Lbol_set = view.get_flag(CLBUF_FLAG_LBOL_SET);
+  spec_set = view.get_flag(CLBUF_FLAG_SPEC_SET);
+  phot_set = view.get_flag(CLBUF_FLAG_PHOT_SET);
+  yield_set = view.get_flag(CLBUF_FLAG_YIELD_SET);
+  ew_set = view.get_flag(CLBUF_FLAG_EW_SET);
+  Lbol_ext_set = view.get_flag(CLBUF_FLAG_LBOL_EXT_SET);
+  spec_ext_set = view.get_flag(CLBUF_FLAG_SPEC_EXT_SET);
+  spec_neb_set = view.get_flag(CLBUF_FLAG_SPEC_NEB_SET);
+
+  // Vectors; each is a single block copy out of the buffer
+  vector<double> *vecs[CLBUF_NSEC];
+  buffer_vectors(vecs);
+  for (int i=CLBUF_STARS; i<CLBUF_STARDATA; i++) {
+    slug_cluster_buf_section sec = (slug_cluster_buf_section) i;
+    vecs[i]->assign(view.vec(sec), view.vec(sec) + view.count(sec));
   }
+  stardata.assign(view.get_stardata(),
+		  view.get_stardata() + view.count(CLBUF_STARDATA));
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -311,6 +270,9 @@ slug_cluster::slug_cluster(const slug_cluster &obj,
   phot_set = obj.phot_set;
   yield_set = obj.yield_set;
   ew_set = obj.ew_set;
+  Lbol_ext_set = obj.Lbol_ext_set;
+  spec_ext_set = obj.spec_ext_set;
+  spec_neb_set = obj.spec_neb_set;
 
   // Copy vectors
   stars = obj.stars;
@@ -333,20 +295,55 @@ slug_cluster::slug_cluster(const slug_cluster &obj,
 ////////////////////////////////////////////////////////////////////////
 // Routines to build and manipulate serialized buffers
 ////////////////////////////////////////////////////////////////////////
+void
+slug_cluster::buffer_vectors(const vector<double> *vecs[CLBUF_NSEC]) const {
+  const vector<double> *v[] = {
+    nullptr, nullptr,
+    &stars, &dead_stars,
+    &L_lambda, &phot,
+    &L_lambda_ext, &phot_ext,
+    &L_lambda_neb, &phot_neb,
+    &L_lambda_neb_ext, &phot_neb_ext,
+    &all_yields, &stoch_yields, &non_stoch_yields,
+    &ew, nullptr
+  };
+  for (int i=0; i<CLBUF_NSEC; i++) vecs[i] = v[i];
+}
+
+void
+slug_cluster::buffer_vectors(vector<double> *vecs[CLBUF_NSEC]) {
+  vector<double> *v[] = {
+    nullptr, nullptr,
+    &stars, &dead_stars,
+    &L_lambda, &phot,
+    &L_lambda_ext, &phot_ext,
+    &L_lambda_neb, &phot_neb,
+    &L_lambda_neb_ext, &phot_neb_ext,
+    &all_yields, &stoch_yields, &non_stoch_yields,
+    &ew, nullptr
+  };
+  for (int i=0; i<CLBUF_NSEC; i++) vecs[i] = v[i];
+}
+
+void
+slug_cluster::buffer_header(slug_cluster_buf_header &hdr) const {
+  hdr.magic = SLUG_CLUSTER_BUF_MAGIC;
+  hdr.version = SLUG_CLUSTER_BUF_VERSION;
+  const vector<double> *vecs[CLBUF_NSEC];
+  buffer_vectors(vecs);
+  hdr.count[CLBUF_DBL] = CLBUF_NDBL;
+  hdr.count[CLBUF_INT] = CLBUF_NINT;
+  for (int i=CLBUF_STARS; i<CLBUF_STARDATA; i++)
+    hdr.count[i] = vecs[i]->size();
+  hdr.count[CLBUF_STARDATA] = stardata.size();
+  slug_cluster_buf_layout(hdr);
+}
+
 size_t
 slug_cluster::buffer_size() const {
-  // Add up the storage needed for the buffer
-  size_t bufsize = 23*sizeof(double) + 2*sizeof(unsigned long) +
-    7*sizeof(bool) + 15*sizeof(vector<double>::size_type) +
-    sizeof(double) * (stars.size() + dead_stars.size() +
-		      L_lambda.size() + phot.size() +
-		      L_lambda_ext.size() + phot_ext.size() +
-		      L_lambda_neb.size() + phot_neb.size() +
-		      L_lambda_neb_ext.size() + phot_neb_ext.size() +
-		      all_yields.size() + stoch_yields.size() +
-		      non_stoch_yields.size()) +
-    sizeof(slug_stardata) * stardata.size();
-  return bufsize;
+  slug_cluster_buf_header hdr;
+  buffer_header(hdr);
+  return hdr.size;
 }
 
 slug_cluster_buffer *
@@ -362,109 +359,78 @@ slug_cluster::make_buffer() const {
   return(buf);
 }
 
+void
+slug_cluster::buffer_segments(slug_cluster_buf_prefix &prefix,
+			      vector<struct iovec> &iov) const {
+
+  // Header
+  buffer_header(prefix.hdr);
+
+  // Scalar doubles
+  double *buf_dbl = prefix.dbl;
+  buf_dbl[CLBUF_TARGET_MASS] = targetMass;
+  buf_dbl[CLBUF_BIRTH_MASS] = birthMass;
+  buf_dbl[CLBUF_ALIVE_MASS] = aliveMass;
+  buf_dbl[CLBUF_STOCH_BIRTH_MASS] = stochBirthMass;
+  buf_dbl[CLBUF_STOCH_ALIVE_MASS] = stochAliveMass;
+  buf_dbl[CLBUF_NON_STOCH_BIRTH_MASS] = nonStochBirthMass;
+  buf_dbl[CLBUF_NON_STOCH_ALIVE_MASS] = nonStochAliveMass;
+  buf_dbl[CLBUF_STOCH_REMNANT_MASS] = stochRemnantMass;
+  buf_dbl[CLBUF_NON_STOCH_REMNANT_MASS] = nonStochRemnantMass;
+  buf_dbl[CLBUF_STELLAR_MASS] = stellarMass;
+  buf_dbl[CLBUF_STOCH_STELLAR_MASS] = stochStellarMass;
+  buf_dbl[CLBUF_NON_STOCH_STELLAR_MASS] = nonStochStellarMass;
+  buf_dbl[CLBUF_FORMATION_TIME] = formationTime;
+  buf_dbl[CLBUF_CUR_TIME] = curTime;
+  buf_dbl[CLBUF_CLUSTER_AGE] = clusterAge;
+  buf_dbl[CLBUF_LIFETIME] = lifetime;
+  buf_dbl[CLBUF_STELLAR_DEATH_MASS] = stellarDeathMass;
+  buf_dbl[CLBUF_A_V] = A_V;
+  buf_dbl[CLBUF_A_VNEB] = A_Vneb;
+  buf_dbl[CLBUF_LBOL] = Lbol;
+  buf_dbl[CLBUF_LBOL_EXT] = Lbol_ext;
+  buf_dbl[CLBUF_TOT_SN] = tot_sn;
+  buf_dbl[CLBUF_LAST_YIELD_TIME] = last_yield_time;
+
+  // Scalar integers and flags
+  prefix.ints[CLBUF_ID] = id;
+  prefix.ints[CLBUF_STOCH_SN] = stoch_sn;
+  uint64_t flags = 0;
+  if (is_disrupted) flags |= CLBUF_FLAG_DISRUPTED;
+  if (data_set) flags |= CLBUF_FLAG_DATA_SET;
+  if (Lbol_set) flags |= CLBUF_FLAG_LBOL_SET;
+  if (spec_set) flags |= CLBUF_FLAG_SPEC_SET;
+  if (phot_set) flags |= CLBUF_FLAG_PHOT_SET;
+  if (yield_set) flags |= CLBUF_FLAG_YIELD_SET;
+  if (ew_set) flags |= CLBUF_FLAG_EW_SET;
+  if (Lbol_ext_set) flags |= CLBUF_FLAG_LBOL_EXT_SET;
+  if (spec_ext_set) flags |= CLBUF_FLAG_SPEC_EXT_SET;
+  if (spec_neb_set) flags |= CLBUF_FLAG_SPEC_NEB_SET;
+  prefix.ints[CLBUF_FLAGS] = flags;
+
+  // Pointers to the vector data
+  const vector<double> *vecs[CLBUF_NSEC];
+  buffer_vectors(vecs);
+  const void *data[CLBUF_NSEC];
+  data[CLBUF_DBL] = data[CLBUF_INT] = nullptr;
+  for (int i=CLBUF_STARS; i<CLBUF_STARDATA; i++) data[i] = vecs[i]->data();
+  data[CLBUF_STARDATA] = stardata.data();
+
+  // Build the segment list
+  slug_cluster_buf_segments(prefix, data, iov);
+}
+
 void
 slug_cluster::pack_buffer(slug_cluster_buffer *buf) const {
 
-  // Doubles
-  double *buf_dbl = (double *) buf;
-  buf_dbl[0] = targetMass;
-  buf_dbl[1] = birthMass;
-  buf_dbl[2] = aliveMass;
-  buf_dbl[3] = stochBirthMass;
-  buf_dbl[4] = stochAliveMass;
-  buf_dbl[5] = nonStochBirthMass;
-  buf_dbl[6] = nonStochAliveMass;
-  buf_dbl[7] = stochRemnantMass;
-  buf_dbl[8] = nonStochRemnantMass;
-  buf_dbl[9] = stellarMass;
-  buf_dbl[10] = stochStellarMass;
-  buf_dbl[11] = nonStochStellarMass;
-  buf_dbl[12] = formationTime;
-  buf_dbl[13] = curTime;
-  buf_dbl[14] = clusterAge;
-  buf_dbl[15] = lifetime;
-  buf_dbl[16] = stellarDeathMass;
-  buf_dbl[17] = A_V;
-  buf_dbl[18] = A_Vneb;
-  buf_dbl[19] = Lbol;
-  buf_dbl[20] = Lbol_ext;
-  buf_dbl[21] = tot_sn;
-  buf_dbl[22] = last_yield_time;
-
-  // Unsigned longs
-  unsigned long *buf_ul = (unsigned long *) (buf_dbl+23);
-  buf_ul[0] = id;
-  buf_ul[1] = stoch_sn;
-
-  // Bools; could pack these into an integer, but this is much easier
-  // to read, and the overall storage space and cost isn't going to be
-  // affected in any significant way
-  bool *buf_bool = (bool *) (buf_ul+2);
-  buf_bool[0] = is_disrupted;
-  buf_bool[1] = data_set;
-  buf_bool[2] = Lbol_set;
-  buf_bool[3] = spec_set;
-  buf_bool[4] = phot_set;
-  buf_bool[5] = yield_set;
-  buf_bool[6] = ew_set;
-
-  // Sizes of the various vectors
-  vector<double>::size_type *buf_sz =
-    (vector<double>::size_type *) (buf_bool+7);
-  buf_sz[0] = stars.size();
-  buf_sz[1] = dead_stars.size();
-  buf_sz[2] = L_lambda.size();
-  buf_sz[3] = phot.size();
-  buf_sz[4] = L_lambda_ext.size();
-  buf_sz[5] = phot_ext.size();
-  buf_sz[6] = L_lambda_neb.size();
-  buf_sz[7] = phot_neb.size();
-  buf_sz[8] = L_lambda_neb_ext.size();
-  buf_sz[9] = phot_neb_ext.size();
-  buf_sz[10] = all_yields.size();
-  buf_sz[11] = stoch_yields.size();
-  buf_sz[12] = non_stoch_yields.size();
-  buf_sz[13] = stardata.size();
-  buf_sz[14] = ew.size();
-
-  // Data in the vectors
-  buf_dbl = (double *) (buf_sz+15);
-  vector<double>::size_type offset, offset0;
-  for (offset = 0; offset < stars.size(); offset++)
-    buf_dbl[offset] = stars[offset];
-  for (offset0 = offset; offset-offset0 < dead_stars.size(); offset++)
-    buf_dbl[offset] = dead_stars[offset-offset0];
-  for (offset0 = offset; offset-offset0 < L_lambda.size(); offset++)
-    buf_dbl[offset] = L_lambda[offset-offset0];
-  for (offset0 = offset; offset-offset0 < phot.size(); offset++)
-    buf_dbl[offset] = phot[offset-offset0];
-  for (offset0 = offset; offset-offset0 < L_lambda_ext.size(); offset++)
-    buf_dbl[offset] = L_lambda_ext[offset-offset0];
-  for (offset0 = offset; offset-offset0 < phot_ext.size(); offset++)
-    buf_dbl[offset] = phot_ext[offset-offset0];
-  for (offset0 = offset; offset-offset0 < L_lambda_neb.size(); offset++)
-    buf_dbl[offset] = L_lambda_neb[offset-offset0];
-  for (offset0 = offset; offset-offset0 < phot_neb.size(); offset++)
-    buf_dbl[offset] = phot_neb[offset-offset0];
-  for (offset0 = offset; offset-offset0 < L_lambda_neb_ext.size(); offset++)
-    buf_dbl[offset] = L_lambda_neb_ext[offset-offset0];
-  for (offset0 = offset; offset-offset0 < phot_neb_ext.size(); offset++)
-    buf_dbl[offset] = phot_neb_ext[offset-offset0];
-  for (offset0 = offset; offset-offset0 < all_yields.size(); offset++)
-    buf_dbl[offset] = all_yields[offset-offset0];
-  for (offset0 = offset; offset-offset0 < stoch_yields.size(); offset++)
-    buf_dbl[offset] = stoch_yields[offset-offset0];
-  for (offset0 = offset; offset-offset0 < non_stoch_yields.size(); offset++)
-    buf_dbl[offset] = non_stoch_yields[offset-offset0];
-  slug_stardata *buf_stardata =
-    (slug_stardata *) (buf_dbl+offset);
-  for (offset = 0; offset < stardata.size(); offset++) {
-    buf_stardata[offset] = stardata[offset];
-  }
-  
-  for (offset = 0; offset < ew.size(); offset++)
-  {
-    buf_dbl[offset] = ew[offset-offset0]; //Check
+  // Gather the segments that make up the buffer into it
+  slug_cluster_buf_prefix prefix;
+  vector<struct iovec> iov;
+  buffer_segments(prefix, iov);
+  char *ptr = (char *) buf;
+  for (vector<struct iovec>::size_type i=0; i<iov.size(); i++) {
+    memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+    ptr += iov[i].iov_len;
   }
 }
 
@@ -487,6 +453,7 @@ slug_cluster::reset(bool keep_id) {
   curTime = last_yield_time = 0.0;
   is_disrupted = false;
   data_set = Lbol_set = spec_set = phot_set = yield_set = ew_set =  false;
+  Lbol_ext_set = spec_ext_set = spec_neb_set = false;
 
   // Delete current stellar masses and data
   stars.resize(0);
@@ -688,6 +655,7 @@ slug_cluster::advance(double time) {
 
   // Mark that data are not current
   data_set = spec_set = Lbol_set = phot_set = yield_set = ew_set = false;
+  Lbol_ext_set = spec_ext_set = spec_neb_set = false;
 
   // Update all the stellar data to the new isochrone
   set_isochrone();
@@ -963,23 +931,40 @@ void slug_cluster::set_Lbol() {
   if (imf->has_stoch_lim() && !stoch_contrib_only)
     Lbol += specsyn->get_Lbol_cts(birthMass, curTime-formationTime);
 
-  // If using extinction, to compute Lbol we need to first compute the
-  // spectrum, then integrate it
-  if (extinct != NULL) {
-    set_spectrum();
-    Lbol_ext = int_tabulated::
-      integrate(extinct->lambda(), L_lambda_ext) / constants::Lsun;
-  }
-
   // Flag that things are set
   Lbol_set = true;
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Routine to get bolometric luminosity after extinction. This
+// requires the stellar spectrum, but not the extincted spectrum; we
+// get the integral over the extincted spectrum directly from the
+// extinction object.
+////////////////////////////////////////////////////////////////////////
+void slug_cluster::set_Lbol_ext() {
+
+  // Do nothing if already set, or if there is no extinction
+  if (Lbol_ext_set || extinct == NULL) return;
+
+  // Get the stellar spectrum, then integrate it with extinction
+  set_spectrum();
+  Lbol_ext = extinct->Lbol_extinct(A_V, L_lambda);
+
+  // Flag that things are set
+  Lbol_ext_set = true;
+}
+
+
 
 ////////////////////////////////////////////////////////////////////////
-// Spectral synthesis routine. Note that this routine also sets Lbol
-// in the process because the extra cost of computing it is negligible.
+// Spectral synthesis routines. The stellar spectrum, the extincted
+// spectrum, and the nebular spectra (with and without extinction)
+// are computed separately, each only when something needs it, so
+// that runs that do not request a particular spectrum or quantities
+// derived from it do not pay for computing it. The stellar spectrum
+// routine also sets Lbol in the process because the extra cost of
+// computing it is negligible.
 ////////////////////////////////////////////////////////////////////////
 void
 slug_cluster::set_spectrum() {
@@ -1032,48 +1017,74 @@ slug_cluster::set_spectrum() {
     Lbol += Lbol_tmp;
   }
 
-  // If using nebular emission, compute the stellar+nebular spectrum
-  vector<double> L_lambda_neb_only;
-  if (nebular != NULL) {
-    L_lambda_neb_only = nebular->get_neb_spec(L_lambda, this->get_age());
-    L_lambda_neb = nebular->add_stellar_nebular_spec(L_lambda,
-						     L_lambda_neb_only);
-  }
-  
-  // If using extinction, compute the extincted spectrum and the
-  // bolometric luminosity after extinction is applied
+  // Flag that things are set
+  spec_set = Lbol_set = true;
+}
+
+void
+slug_cluster::set_spectrum_ext() {
+
+  // Do nothing if already set, or if there is no extinction
+  if (spec_ext_set || extinct == NULL) return;
+
+  // Compute the extincted spectrum from the stellar one
+  set_spectrum();
+  L_lambda_ext = extinct->spec_extinct(A_V, L_lambda);
+
+  // Flag that things are set
+  spec_ext_set = true;
+}
+
+void
+slug_cluster::set_spectrum_neb() {
+
+  // Do nothing if already set, or if there is no nebular emission
+  if (spec_neb_set || nebular == NULL) return;
+
+  // Compute the stellar+nebular spectrum
+  set_spectrum();
+  vector<double> L_lambda_neb_only =
+    nebular->get_neb_spec(L_lambda, this->get_age());
+  L_lambda_neb = nebular->add_stellar_nebular_spec(L_lambda,
+						   L_lambda_neb_only);
+
+  // If using extinction, compute the extincted stellar+nebular
+  // spectrum here as well, since it needs the nebular-only spectrum
   if (extinct != NULL) {
-    L_lambda_ext = extinct->spec_extinct(A_V, L_lambda);
-    Lbol_ext = int_tabulated::
-      integrate(extinct->lambda(), L_lambda_ext) 
-      / constants::Lsun;
-    if (nebular != NULL) {
-      // Procedure depends on if nebular and stellar extinctions
-      // differ
-      if (extinct->excess_neb_extinct()) {
-	// Apply nebular extinction to nebular portion
-	vector<double> L_lambda_neb_only_ext =
-	  extinct->spec_extinct_neb(A_Vneb, L_lambda_neb_only);
-	// Add extincted nebular and stellar spectra; note that we
-	// must provide the offsets, because the the extincted
-	// spectrum may be truncated relative to the full stellar and
-	// nebular grids
-	L_lambda_neb_ext =
-	  nebular->add_stellar_nebular_spec(L_lambda_ext,
-					    L_lambda_neb_only_ext,
-					    extinct->off(),
-					    extinct->off_neb());
-      } else {
-	// We are using the same extinction for nebular stellar
-	// emission; just apply that extinction to both
-	L_lambda_neb_ext = 
-	  extinct->spec_extinct_neb(A_V, L_lambda_neb);
-      }
+    // Procedure depends on if nebular and stellar extinctions
+    // differ
+    if (extinct->excess_neb_extinct()) {
+      // Apply nebular extinction to nebular portion
+      set_spectrum_ext();
+      vector<double> L_lambda_neb_only_ext =
+	extinct->spec_extinct_neb(A_Vneb, L_lambda_neb_only);
+      // Add extincted nebular and stellar spectra; note that we
+      // must provide the offsets, because the the extincted
+      // spectrum may be truncated relative to the full stellar and
+      // nebular grids
+      L_lambda_neb_ext =
+	nebular->add_stellar_nebular_spec(L_lambda_ext,
+					  L_lambda_neb_only_ext,
+					  extinct->off(),
+					  extinct->off_neb());
+    } else {
+      // We are using the same extinction for nebular stellar
+      // emission; just apply that extinction to both
+      L_lambda_neb_ext = 
+	extinct->spec_extinct_neb(A_V, L_lambda_neb);
     }
   }
 
   // Flag that things are set
-  spec_set = Lbol_set = true;
+  spec_neb_set = true;
+}
+
+void
+slug_cluster::set_spectrum_all() {
+  set_spectrum();
+  set_spectrum_ext();
+  set_spectrum_neb();
+  set_Lbol_ext();
 }
 
 
@@ -1086,8 +1097,8 @@ slug_cluster::set_photometry() {
   // Do nothing if already set
   if (phot_set) return;
 
-  // Compute the spectrum
-  set_spectrum();
+  // Compute the spectra
+  set_spectrum_all();
 
   // Compute photometry
   phot = filters->compute_phot(specsyn->lambda(), L_lambda);
@@ -1347,17 +1358,17 @@ const vector<double> &slug_cluster::get_spectrum() {
 }
 
 const vector<double> &slug_cluster::get_spectrum_neb() {
-  set_spectrum();
+  set_spectrum_neb();
   return L_lambda_neb;
 }
 
 const vector<double> &slug_cluster::get_spectrum_extinct() {
-  set_spectrum();
+  set_spectrum_ext();
   return L_lambda_ext;
 }
 
 const vector<double> &slug_cluster::get_spectrum_neb_extinct() { 
-  set_spectrum(); 
+  set_spectrum_neb();
   return L_lambda_neb_ext;
 }
 
@@ -1372,7 +1383,7 @@ void slug_cluster::get_spectrum(vector<double> &lambda_out,
 void slug_cluster::get_spectrum_neb(vector<double> &lambda_out, 
 				    vector<double> &L_lambda_out,
 				    bool rest) {
-  set_spectrum(); 
+  set_spectrum_neb();
   lambda_out = nebular->lambda(rest); 
   L_lambda_out = L_lambda_neb;
 }
@@ -1380,7 +1391,7 @@ void slug_cluster::get_spectrum_neb(vector<double> &lambda_out,
 void slug_cluster::get_spectrum_extinct(vector<double> &lambda_out, 
 					vector<double> &L_lambda_out,
 					bool rest) { 
-  set_spectrum(); 
+  set_spectrum_ext();
   lambda_out = extinct->lambda(rest); 
   L_lambda_out = L_lambda_ext;
 }
@@ -1388,7 +1399,7 @@ void slug_cluster::get_spectrum_extinct(vector<double> &lambda_out,
 void slug_cluster::get_spectrum_neb_extinct(vector<double> &lambda_out, 
 					    vector<double> &L_lambda_out,
 					    bool rest) { 
-  set_spectrum(); 
+  set_spectrum_neb();
   lambda_out = extinct->lambda_neb(rest); 
   L_lambda_out = L_lambda_neb_ext;
 }
@@ -1476,7 +1487,7 @@ void slug_cluster::clear_spectrum() {
   phot_neb.resize(0);
   phot_ext.resize(0);
   phot_neb_ext.resize(0);
-  spec_set = false;
+  spec_set = spec_ext_set = spec_neb_set = false;
   phot_set = false;
   ew_set = false;
   ew.resize(0); 
@@ -1493,38 +1504,32 @@ slug_cluster::write_prop(ofstream& outfile, const outputMode out_mode,
 			 bool cluster_only, const std::vector<double>& imfvp) const {
 
   if (out_mode == ASCII) {
-    outfile << setprecision(5) << scientific
-	    << setw(11) << right << id << "   "
-	    << setw(11) << right << curTime << "   "
-	    << setw(11) << right << formationTime << "   "
-	    << setw(11) << right << lifetime << "   "
-	    << setw(11) << right << targetMass << "   "
-	    << setw(11) << right << birthMass << "   "
-	    << setw(11) << right << aliveMass << "   "
-	    << setw(11) << right << stellarMass << "   "
-	    << setw(11) << right << stars.size() << "   ";
+    slug_ascii_record rec;
+    rec.num(id).sep()
+      .sci(curTime).sep()
+      .sci(formationTime).sep()
+      .sci(lifetime).sep()
+      .sci(targetMass).sep()
+      .sci(birthMass).sep()
+      .sci(aliveMass).sep()
+      .sci(stellarMass).sep()
+      .num(stars.size()).sep();
     if (stars.size() > 0)
-      outfile << setw(11) << right << stars[stars.size()-1];
+      rec.sci(stars[stars.size()-1]);
     else
-      outfile << setw(11) << right << 0.0;
+      rec.sci(0.0);
     if (extinct != NULL) {
-      outfile << "   " << setw(11) << right << A_V;
+      rec.sep().sci(A_V);
       if (extinct->excess_neb_extinct()) {
-	outfile << "   " << setw(11) << right << A_Vneb;
+	rec.sep().sci(A_Vneb);
       }
     }
 
     // Variable parameter block
-    if (imfvp.size()>0) {
-      // Loop over the variable parameters
-      for (vector<double>::size_type p = 0; p<imfvp.size();p++)
-      {
-        outfile << "   " << setw(11) << right << imfvp[p];
-      }
-    
-    }
+    for (vector<double>::size_type p = 0; p<imfvp.size(); p++)
+      rec.sep().sci(imfvp[p]);
     
-    outfile << endl;
+    rec.endl().write(outfile);
   
   } else if (out_mode == BINARY) {
     if (cluster_only) {
@@ -1574,63 +1579,42 @@ slug_cluster::write_prop(ofstream& outfile, const outputMode out_mode,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_cluster::write_prop(fitsfile *out_fits, unsigned long trial,
+slug_cluster::write_prop(slug_fits_table& out_tab, unsigned long trial,
                           const std::vector<double>& imfvp) {
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(out_fits, &nrows, &fits_status);
-
-  // Write a new entry
-  fits_write_col(out_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(out_fits, TULONG, 2, nrows+1, 1, 1, &id,
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 3, nrows+1, 1, 1, &curTime,
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 4, nrows+1, 1, 1, &formationTime,
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 5, nrows+1, 1, 1, &lifetime,
-		 &fits_status);
-  double tmass = targetMass; // Needed to avoid compiler complaint
-  fits_write_col(out_fits, TDOUBLE, 6, nrows+1, 1, 1, &tmass,
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 7, nrows+1, 1, 1, &birthMass,
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 8, nrows+1, 1, 1, &aliveMass,
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 9, nrows+1, 1, 1, &stellarMass,
-		 &fits_status);
+  // Add a new row
+  out_tab.set(1, trial);
+  out_tab.set(2, id);
+  out_tab.set(3, curTime);
+  out_tab.set(4, formationTime);
+  out_tab.set(5, lifetime);
+  out_tab.set(6, targetMass);
+  out_tab.set(7, birthMass);
+  out_tab.set(8, aliveMass);
+  out_tab.set(9, stellarMass);
   vector<double>::size_type n = stars.size();
-  fits_write_col(out_fits, TULONG, 10, nrows+1, 1, 1, &n,
-		 &fits_status);
+  out_tab.set(10, (unsigned long) n);
   double mstar;
   if (n>0) mstar = stars.back();
   else mstar = 0.0;
-  fits_write_col(out_fits, TDOUBLE, 11, nrows+1, 1, 1, &mstar,
-		 &fits_status);
+  out_tab.set(11, mstar);
 		 
   int colnum = 11;			 
   if (extinct != NULL) {
-    fits_write_col(out_fits, TDOUBLE, 12, nrows+1, 1, 1, &A_V, &fits_status);
+    out_tab.set(12, A_V);
     colnum++;
     if (extinct->excess_neb_extinct()) {
-      fits_write_col(out_fits, TDOUBLE, 13, nrows+1, 1, 1, &A_Vneb,
-		     &fits_status);
+      out_tab.set(13, A_Vneb);
       colnum++;
     }
   }
    
-  if (imfvp.size()>0) {
-    // Loop over the variable parameters
-    for (vector<double>::size_type p = 0; p<imfvp.size(); p++) {
-      colnum++;
-      double vp_p=imfvp[p];
-      fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 1, &vp_p,
-		  &fits_status);
-    }
+  // Loop over the variable parameters
+  for (vector<double>::size_type p = 0; p<imfvp.size(); p++) {
+    colnum++;
+    out_tab.set(colnum, imfvp[p]);
   }
+  out_tab.end_row();
 }
 #endif
 
@@ -1645,7 +1629,7 @@ write_spectrum(ofstream& outfile, const outputMode out_mode,
 	       bool cluster_only) {
 
   // Make sure information is current
-  if (!spec_set) set_spectrum();
+  set_spectrum_all();
 
   if (out_mode == ASCII) {
     vector<double> lambda, L_lambda_star, L_lambda_star_ext;
@@ -1663,29 +1647,27 @@ write_spectrum(ofstream& outfile, const outputMode out_mode,
 	L_lambda_star_ext = nebular->interp_stellar(L_lambda_ext, 
 						    extinct->off());
     }
+    slug_ascii_record rec;
     for (unsigned int i=0; i<lambda.size(); i++) {
-      outfile << setprecision(5) << scientific 
-	      << setw(11) << right << id << "   "
-	      << setw(11) << right << curTime << "   "
-	      << setw(11) << right << lambda[i] << "   "
-	      << setw(11) << right << L_lambda_star[i];
+      rec.num(id).sep()
+	.sci(curTime).sep()
+	.sci(lambda[i]).sep()
+	.sci(L_lambda_star[i]);
       if (nebular != NULL)
-	outfile << "   "
-		<< setw(11) << right << L_lambda_neb[i];
+	rec.sep().sci(L_lambda_neb[i]);
       if (extinct != NULL) {
 	int j;
 	if (nebular == NULL) j = i - extinct->off();
 	else j = i - extinct->off_neb();
 	if ((j >= 0) && ((unsigned int) j < L_lambda_star_ext.size())) {
-	  outfile << "   "
-		  << setw(11) << right << L_lambda_star_ext[j];
+	  rec.sep().sci(L_lambda_star_ext[j]);
 	  if (nebular != NULL)
-	    outfile << "   "
-		    << setw(11) << right << L_lambda_neb_ext[j];
+	    rec.sep().sci(L_lambda_neb_ext[j]);
 	}
       }
-      outfile << endl;
+      rec.endl();
     }
+    rec.write(outfile);
   } else {
     if (cluster_only) {
       outfile.write((char *) &trial, sizeof trial);
@@ -1715,52 +1697,36 @@ write_spectrum(ofstream& outfile, const outputMode out_mode,
 #ifdef ENABLE_FITS
 void
 slug_cluster::
-write_spectrum(fitsfile *out_fits, unsigned long trial) {
+write_spectrum(slug_fits_table& out_tab, unsigned long trial) {
 
   // Make sure information is current
-  if (!spec_set) set_spectrum();
-
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(out_fits, &nrows, &fits_status);
-
-  // Write data
-  fits_write_col(out_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(out_fits, TULONG, 2, nrows+1, 1, 1, &id, 
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 3, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 4, nrows+1, 1, L_lambda.size(), 
-		 L_lambda.data(), &fits_status);
+  set_spectrum_all();
+
+  // Add a new row
+  out_tab.set(1, trial);
+  out_tab.set(2, id);
+  out_tab.set(3, curTime);
+  out_tab.set(4, L_lambda);
   unsigned int colnum = 5;
   if (nebular != NULL) {
-    fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 
-		   L_lambda_neb.size(), L_lambda_neb.data(), 
-		   &fits_status);
+    out_tab.set(colnum, L_lambda_neb);
     colnum++;
   }
   if (extinct != NULL) {
-    fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 
-		   L_lambda_ext.size(), L_lambda_ext.data(), 
-		   &fits_status);
+    out_tab.set(colnum, L_lambda_ext);
     colnum++;
     if (nebular != NULL) {
-      fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 
-		     L_lambda_neb_ext.size(), L_lambda_neb_ext.data(), 
-		     &fits_status);
+      out_tab.set(colnum, L_lambda_neb_ext);
       colnum++;
     }
   }
   //Output rectified spectrum if it is present
   if (specsyn->get_rectify())
   {
-    fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 
-		     recspec.size(), recspec.data(), 
-		     &fits_status);
+    out_tab.set(colnum, recspec);
     colnum++;
   }
+  out_tab.end_row();
 }
 #endif
 
@@ -1770,36 +1736,23 @@ write_spectrum(fitsfile *out_fits, unsigned long trial) {
 #ifdef ENABLE_FITS
 void
 slug_cluster::
-write_ew(fitsfile *out_fits, unsigned long trial) 
+write_ew(slug_fits_table& out_tab, unsigned long trial) 
 {
 
   // Make sure information is current
   if (!ew_set) set_ew();
   
-  
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(out_fits, &nrows, &fits_status);
-
-
-  // Write data
-  fits_write_col(out_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		             &fits_status);
-  fits_write_col(out_fits, TULONG, 2, nrows+1, 1, 1, &id, 
-		             &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 3, nrows+1, 1, 1, &curTime, 
-		             &fits_status);
+  // Add a new row
+  out_tab.set(1, trial);
+  out_tab.set(2, id);
+  out_tab.set(3, curTime);
   unsigned int colnum = 4;
-  
-  
   for (unsigned int i=0; i<ew.size(); i++) 
   {
-    fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		               &(ew[i]), &fits_status);
+    out_tab.set(colnum, ew[i]);
     colnum++;
   }
- 
+  out_tab.end_row();
 }
 #endif
 
@@ -1816,31 +1769,31 @@ write_photometry(ofstream& outfile, const outputMode out_mode,
   if (!phot_set) set_photometry();
 
   if (out_mode == ASCII) {
-    outfile << setprecision(5) << scientific 
-	    << setw(18) << right << id << "   "
-	    << setw(18) << right << curTime;
+    slug_ascii_record rec;
+    rec.num(id, 18).sep()
+      .sci(curTime, 18);
     for (vector<double>::size_type i=0; i<phot.size(); i++)
-      outfile << "   " << setw(18) << right << phot[i];
+      rec.sep().sci(phot[i], 18);
     if (nebular != NULL)
       for (vector<double>::size_type i=0; i<phot_neb.size(); i++)
-	outfile << "   " << setw(18) << right << phot_neb[i];
+	rec.sep().sci(phot_neb[i], 18);
     if (extinct != NULL) {
       for (vector<double>::size_type i=0; i<phot_ext.size(); i++) {
 	if (!std::isnan(phot_ext[i]))
-	  outfile << "   " << setw(18) << right << phot_ext[i];
+	  rec.sep().sci(phot_ext[i], 18);
 	else
-	  outfile << "   " << setw(18) << right << " ";
+	  rec.sep().str(" ", 18);
       }
       if (nebular != NULL) {
 	for (vector<double>::size_type i=0; i<phot_neb_ext.size(); i++) {
 	  if (!std::isnan(phot_neb_ext[i]))
-	    outfile << "   " << setw(18) << right << phot_neb_ext[i];
+	    rec.sep().sci(phot_neb_ext[i], 18);
 	  else
-	    outfile << "   " << setw(18) << right << " ";
+	    rec.sep().str(" ", 18);
 	}
       }
     }
-    outfile << endl;
+    rec.endl().write(outfile);
   } else {
     if (cluster_only) {
       outfile.write((char *) &trial, sizeof trial);
@@ -1871,50 +1824,39 @@ write_photometry(ofstream& outfile, const outputMode out_mode,
 #ifdef ENABLE_FITS
 void
 slug_cluster::
-write_photometry(fitsfile *out_fits, unsigned long trial) {
+write_photometry(slug_fits_table& out_tab, unsigned long trial) {
 
   // Make sure information is current
   if (!phot_set) set_photometry();
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(out_fits, &nrows, &fits_status);
-
-  // Write data
-  fits_write_col(out_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(out_fits, TULONG, 2, nrows+1, 1, 1, &id, 
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 3, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
+  // Add a new row
+  out_tab.set(1, trial);
+  out_tab.set(2, id);
+  out_tab.set(3, curTime);
   unsigned int colnum = 4;
   for (unsigned int i=0; i<phot.size(); i++) {
-    fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		   &(phot[i]), &fits_status);
+    out_tab.set(colnum, phot[i]);
     colnum++;
   }
   if (nebular != NULL) {
     for (unsigned int i=0; i<phot_neb.size(); i++) {
-      fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		     &(phot_neb[i]), &fits_status);
+      out_tab.set(colnum, phot_neb[i]);
       colnum++;
     }
   }
   if (extinct != NULL) {
     for (unsigned int i=0; i<phot_ext.size(); i++) {
-      fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		     &(phot_ext[i]), &fits_status);
+      out_tab.set(colnum, phot_ext[i]);
       colnum++;
     }
     if (nebular != NULL) {
       for (unsigned int i=0; i<phot_neb_ext.size(); i++) {
-	fits_write_col(out_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		       &(phot_neb_ext[i]), &fits_status);
+	out_tab.set(colnum, phot_neb_ext[i]);
 	colnum++;
       }
     }
   }
+  out_tab.end_row();
 }
 #endif
 
@@ -1928,11 +1870,12 @@ write_sn(ofstream& outfile, const outputMode out_mode,
 	 bool cluster_only) {
 
   if (out_mode == ASCII) {
-    outfile << setprecision(5) << scientific 
-	    << setw(11) << right << id << "   "
-	    << setw(11) << right << curTime << "   "
-	    << setw(11) << right << tot_sn << "   "
-	    << setw(11) << right << stoch_sn << endl;
+    slug_ascii_record rec;
+    rec.num(id).sep()
+      .sci(curTime).sep()
+      .sci(tot_sn).sep()
+      .num(stoch_sn).endl()
+      .write(outfile);
   } else {
     if (cluster_only) {
       outfile.write((char *) &trial, sizeof trial);
@@ -1953,25 +1896,15 @@ write_sn(ofstream& outfile, const outputMode out_mode,
 #ifdef ENABLE_FITS
 void
 slug_cluster::
-write_sn(fitsfile *out_fits, unsigned long trial) {
-
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(out_fits, &nrows, &fits_status);
-
-  // Write data
-  fits_write_col(out_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(out_fits, TULONG, 2, nrows+1, 1, 1, &id, 
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 3, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 4, nrows+1, 1, 1, &tot_sn, 
-		 &fits_status);
-  unsigned long tmp = stoch_sn;
-  fits_write_col(out_fits, TULONG, 5, nrows+1, 1, 1, &tmp, 
-		 &fits_status);
+write_sn(slug_fits_table& out_tab, unsigned long trial) {
+
+  // Add a new row
+  out_tab.set(1, trial);
+  out_tab.set(2, id);
+  out_tab.set(3, curTime);
+  out_tab.set(4, tot_sn);
+  out_tab.set(5, stoch_sn);
+  out_tab.end_row();
 }
 #endif
 
@@ -1990,15 +1923,16 @@ write_yield(ofstream& outfile, const outputMode out_mode,
   // Write
   if (out_mode == ASCII) {
     const vector<const isotope_data *>& isodata = yields->get_isotopes();
+    slug_ascii_record rec;
     for (vector<double>::size_type i=0; i<all_yields.size(); i++) {
-      outfile << setprecision(5) << scientific
-	      << setw(11) << right << id << "   "
-	      << setw(11) << right << curTime << "   "
-	      << setw(11) << right << isodata[i]->symbol() << "   "
-	      << setw(11) << right << isodata[i]->num() << "   "
-	      << setw(11) << right << isodata[i]->wgt() << "   "
-	      << setw(11) << right << all_yields[i] << endl;
+      rec.num(id).sep()
+	.sci(curTime).sep()
+	.str(isodata[i]->symbol()).sep()
+	.num(isodata[i]->num()).sep()
+	.num(isodata[i]->wgt()).sep()
+	.sci(all_yields[i]).endl();
     }
+    rec.write(outfile);
   } else if (out_mode == BINARY) {
     if (cluster_only) {
       outfile.write((char *) &trial, sizeof trial);
@@ -2017,24 +1951,16 @@ write_yield(ofstream& outfile, const outputMode out_mode,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void 
-slug_cluster::write_yield(fitsfile *out_fits, unsigned long trial){
+slug_cluster::write_yield(slug_fits_table& out_tab, unsigned long trial){
 
   // Make sure information is current
   if (!yield_set) set_yield();
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(out_fits, &nrows, &fits_status);
-
-  // Write a new set of entries
-  fits_write_col(out_fits, TULONG, 1, nrows+1, 1, 1, &trial,
-     &fits_status);
-  fits_write_col(out_fits, TULONG, 2, nrows+1, 1, 1, &id, 
-		 &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 3, nrows+1, 1, 1, &curTime,
-     &fits_status);
-  fits_write_col(out_fits, TDOUBLE, 4, nrows+1, 1, all_yields.size(), 
-    all_yields.data(), &fits_status);
+  // Add a new row
+  out_tab.set(1, trial);
+  out_tab.set(2, id);
+  out_tab.set(3, curTime);
+  out_tab.set(4, all_yields);
+  out_tab.end_row();
 }
 #endif
@@ -0,0 +1,94 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "slug_cluster_buffer.H"
+
+using namespace std;
+
+// Block of zeros used to pad between sections
+static const char slug_cluster_buf_zeros[SLUG_CLUSTER_BUF_ALIGN] = { 0 };
+
+////////////////////////////////////////////////////////////////////////
+// Element sizes of the sections
+////////////////////////////////////////////////////////////////////////
+size_t slug_cluster_buf_elem_size(const slug_cluster_buf_section sec) {
+  if (sec == CLBUF_INT) return sizeof(uint64_t);
+  else if (sec == CLBUF_STARDATA) return sizeof(slug_stardata);
+  else return sizeof(double);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Compute the section offsets and total size
+////////////////////////////////////////////////////////////////////////
+void slug_cluster_buf_layout(slug_cluster_buf_header &hdr) {
+  size_t ptr = slug_cluster_buf_pad(sizeof(slug_cluster_buf_header));
+  for (int i=0; i<CLBUF_NSEC; i++) {
+    slug_cluster_buf_section sec = (slug_cluster_buf_section) i;
+    hdr.offset[i] = ptr;
+    ptr = slug_cluster_buf_pad(ptr + hdr.count[i] *
+			       slug_cluster_buf_elem_size(sec));
+  }
+  hdr.size = ptr;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Build the scatter/gather segments for a buffer
+////////////////////////////////////////////////////////////////////////
+void slug_cluster_buf_segments(const slug_cluster_buf_prefix &prefix,
+			       const void *const data[CLBUF_NSEC],
+			       vector<struct iovec> &iov) {
+
+  // Byte offset in the buffer of the end of the last segment
+  const slug_cluster_buf_header &hdr = prefix.hdr;
+  size_t ptr = 0;
+  struct iovec seg;
+
+  // Header
+  seg.iov_base = (void *) &hdr;
+  seg.iov_len = sizeof(hdr);
+  iov.push_back(seg);
+  ptr += seg.iov_len;
+
+  // Sections
+  for (int i=0; i<CLBUF_NSEC; i++) {
+
+    // Pad to the start of this section
+    if (hdr.offset[i] > ptr) {
+      seg.iov_base = (void *) slug_cluster_buf_zeros;
+      seg.iov_len = hdr.offset[i] - ptr;
+      iov.push_back(seg);
+      ptr += seg.iov_len;
+    }
+
+    // Data for this section
+    size_t len = hdr.count[i] *
+      slug_cluster_buf_elem_size((slug_cluster_buf_section) i);
+    if (len == 0) continue;
+    if (i == CLBUF_DBL) seg.iov_base = (void *) prefix.dbl;
+    else if (i == CLBUF_INT) seg.iov_base = (void *) prefix.ints;
+    else seg.iov_base = (void *) data[i];
+    seg.iov_len = len;
+    iov.push_back(seg);
+    ptr += len;
+  }
+
+  // Final padding
+  if (hdr.size > ptr) {
+    seg.iov_base = (void *) slug_cluster_buf_zeros;
+    seg.iov_len = hdr.size - ptr;
+    iov.push_back(seg);
+  }
+}
@@ -239,6 +239,10 @@ void slug_extinction::init(const slug_parmParser& pp,
   lambda_obs = lambda_grd;
   for (vector<double>::size_type i=0; i<lambda_grd.size(); i++)
     lambda_obs[i] *= 1.0+pp.get_z();
+
+  // Precompute the weights for integrating over the extincted
+  // spectrum to get the extincted bolometric luminosity
+  Lbol_wgt = int_tabulated::weights(lambda_obs);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -267,6 +271,23 @@ slug_extinction::spec_extinct(const double A_V,
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Routine to compute the bolometric luminosity of a spectrum after
+// extinction is applied; this is the same as integrating the output
+// of spec_extinct over lambda(), but doesn't construct the extincted
+// spectrum
+////////////////////////////////////////////////////////////////////////
+double
+slug_extinction::Lbol_extinct(const double A_V,
+			      const vector<double>& spec_in) const {
+  assert(spec_in.size() >= offset+lambda_grd.size());
+  double Lbol_ext = 0.0;
+  for (vector<double>::size_type i = 0; i < lambda_grd.size(); i++)
+    Lbol_ext += Lbol_wgt[i] * spec_in[i+offset] * exp(-A_V*kappa_grd[i]);
+  return Lbol_ext / constants::Lsun;
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Routine to apply extinction to a spectrum on the nebular grid
 ////////////////////////////////////////////////////////////////////////
@@ -30,7 +30,9 @@ namespace std
 #include "tracks/slug_tracks.H"
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
+#include <sstream>
 #include <boost/bind.hpp>
 
 using namespace std;
@@ -40,6 +42,10 @@ using namespace std;
 ////////////////////////////////////////////////////////////////////////
 namespace galaxy {
 
+  // Maximum number of entries in the cache of non-stochastic field
+  // star contributions
+  static const unsigned int nonstoch_cache_size = 1024;
+
   // Sorts stars by death time
   bool sort_death_time_decreasing(const slug_star star1, 
 				  const slug_star star2) {
@@ -74,6 +80,96 @@ namespace galaxy {
       return 0.0;
     }
   }
+
+  // Header for galaxy snapshots; the length of the random number
+  // generator state and the counts of field stars, field star
+  // extinctions, yields, clusters, and disrupted clusters give the
+  // sizes of the arrays that follow it
+#define SLUG_GALAXY_SNAP_MAGIC   0x534c5547u  // "SLUG"
+#define SLUG_GALAXY_SNAP_VERSION 2u
+  enum snap_dbl {
+    SNAP_CUR_TIME = 0, SNAP_MASS, SNAP_TARGET_MASS, SNAP_ALIVE_MASS,
+    SNAP_STELLAR_MASS, SNAP_NON_STOCH_ALIVE_MASS,
+    SNAP_NON_STOCH_REMNANT_MASS, SNAP_CLUSTER_ALIVE_MASS,
+    SNAP_CLUSTER_STELLAR_MASS, SNAP_FIELD_ALIVE_MASS,
+    SNAP_FIELD_REMNANT_MASS, SNAP_CLUSTER_MASS,
+    SNAP_NON_STOCH_FIELD_MASS, SNAP_LAST_YIELD_TIME, SNAP_FIELD_TOT_SN,
+    SNAP_SF_FRAC,
+    SNAP_NDBL
+  };
+  enum snap_int {
+    SNAP_CLUSTER_ID = 0, SNAP_CLUSTER_ID_START, SNAP_CLUSTER_ID_STRIDE,
+    SNAP_FIELD_STOCH_SN, SNAP_RNG_LEN, SNAP_NFIELD, SNAP_NAV,
+    SNAP_NYIELD, SNAP_NCLUSTER, SNAP_NDISRUPTED,
+    SNAP_NINT
+  };
+  typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    double dbl[SNAP_NDBL];
+    uint64_t ints[SNAP_NINT];
+  } snapshot_header;
+
+  // This function writes a list of clusters to a snapshot, directly
+  // from the clusters' memory
+  void write_snapshot_clusters(ostream &out,
+			       const list<slug_cluster *> &clusters) {
+    list<slug_cluster *>::const_iterator it;
+    for (it = clusters.begin(); it != clusters.end(); it++) {
+      slug_cluster_buf_prefix prefix;
+      vector<struct iovec> iov;
+      (*it)->buffer_segments(prefix, iov);
+      for (vector<struct iovec>::size_type i=0; i<iov.size(); i++)
+	out.write((const char *) iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+
+#ifdef ENABLE_MPI
+  // This function sums a vector over all processes in a
+  // communicator, leaving the result in place on the root process
+  void reduce_sum(vector<double> &v, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0)
+      MPI_Reduce(MPI_IN_PLACE, v.data(), v.size(), MPI_DOUBLE, MPI_SUM,
+		 0, comm);
+    else
+      MPI_Reduce(v.data(), nullptr, v.size(), MPI_DOUBLE, MPI_SUM,
+		 0, comm);
+  }
+
+  // This function deals out the elements of a set of vectors of
+  // equal length, held on the root process, among the processes in a
+  // communicator in round-robin order, so that element i goes to
+  // process i mod nproc; on return each process holds its own
+  // elements, in their original order
+  void deal_out(const vector<vector<double> *> &v, MPI_Comm comm) {
+    int rank, nproc;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nproc);
+    int nv = v.size();
+    vector<double> sendbuf;
+    vector<int> counts(nproc, 0), displs(nproc, 0);
+    if (rank == 0) {
+      vector<double>::size_type n = v[0]->size();
+      for (int p=0; p<nproc; p++) {
+	displs[p] = sendbuf.size();
+	for (vector<double>::size_type i=p; i<n; i+=nproc)
+	  for (int j=0; j<nv; j++) sendbuf.push_back((*v[j])[i]);
+	counts[p] = sendbuf.size() - displs[p];
+      }
+    }
+    int count;
+    MPI_Scatter(counts.data(), 1, MPI_INT, &count, 1, MPI_INT, 0, comm);
+    vector<double> recvbuf(count);
+    MPI_Scatterv(sendbuf.data(), counts.data(), displs.data(), MPI_DOUBLE,
+		 recvbuf.data(), count, MPI_DOUBLE, 0, comm);
+    for (int j=0; j<nv; j++) {
+      v[j]->resize(count/nv);
+      for (int i=0; i<count/nv; i++) (*v[j])[i] = recvbuf[i*nv+j];
+    }
+  }
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -127,11 +223,18 @@ slug_galaxy::slug_galaxy(const slug_parmParser& pp,
   // Get fc
   fc = pp.get_fClust();
 
-  // Initialize the cluster ID pointer
-  cluster_id = 0;
+  // Initialize the cluster ID pointer; by default this object
+  // represents the entire galaxy
+  cluster_id = cluster_id_start = 0;
+  cluster_id_stride = 1;
+  sf_frac = 1.0;
+#ifdef ENABLE_MPI
+  comm = MPI_COMM_NULL;
+#endif
 
   // Initialize status flags
-  Lbol_set = spec_set = field_data_set = phot_set = yield_set = false;
+  Lbol_set = spec_set = field_data_set = phot_set = yield_set
+    = reduced = false;
 }
 
 
@@ -166,7 +269,8 @@ slug_galaxy::reset(bool reset_cluster_id) {
     = fieldAliveMass = clusterMass = clusterAliveMass 
     = nonStochFieldMass = stellarMass = clusterStellarMass 
     = fieldRemnantMass = 0.0;
-  Lbol_set = spec_set = field_data_set = phot_set = yield_set = false;
+  Lbol_set = spec_set = field_data_set = phot_set = yield_set
+    = reduced = false;
   field_stars.resize(0);
   field_tot_sn = 0.0;
   field_stoch_sn = 0;
@@ -185,9 +289,36 @@ slug_galaxy::reset(bool reset_cluster_id) {
     stoch_field_yields.assign(yields->get_niso(), 0.0);
     all_yields.assign(yields->get_niso(), 0.0);
   }
-  if (reset_cluster_id) cluster_id = 0;
+  if (reset_cluster_id) cluster_id = cluster_id_start;
 }
 
+
+#ifdef ENABLE_MPI
+////////////////////////////////////////////////////////////////////////
+// Set up this galaxy to be one process's share of a galaxy that is
+// distributed over the processes in a communicator
+////////////////////////////////////////////////////////////////////////
+void
+slug_galaxy::set_partition(MPI_Comm comm_) {
+  comm = comm_;
+  int rank, nproc;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+
+  // Each process holds an equal share of the non-stochastic stars,
+  // which are smooth functions of the star formation history. The
+  // stochastic clusters and field stars are not split this way: in
+  // advance, the root process draws them for the galaxy as a whole
+  // and deals them out among the processes, so that with any sampling
+  // method the union of the processes' stars is a realization of the
+  // full galaxy.
+  sf_frac = 1.0 / nproc;
+
+  // Interleave cluster IDs so that they are unique across processes
+  set_cluster_ids(rank, nproc);
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////
 // Advance routine
 ////////////////////////////////////////////////////////////////////////
@@ -203,10 +334,28 @@ slug_galaxy::advance(double time) {
   // second part is added to ensure that, if we're doing stop nearest
   // or something like that, we get as close as possible at each
   // time.
-  double new_mass = sfh->integral(curTime, time);
+  double new_mass = sf_frac * sfh->integral(curTime, time);
   double mass_to_draw = new_mass + targetMass - mass;
   targetMass += new_mass;
 
+  // If this galaxy is distributed over several processes, the
+  // stochastic clusters and field stars are drawn for the whole
+  // galaxy on the root process and then dealt out, since drawing each
+  // process's share separately would not give a realization of the
+  // full galaxy for sampling methods such as stop_nearest. The mass
+  // to draw is then the sum of the processes' shares.
+  bool draw_here = true;
+  double stoch_mass_to_draw = mass_to_draw;
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    draw_here = rank == 0;
+    MPI_Reduce(&mass_to_draw, &stoch_mass_to_draw, 1, MPI_DOUBLE,
+	       MPI_SUM, 0, comm);
+  }
+#endif
+
   // Skip star/cluster creation if new_mass == 0, even if mass_to_draw
   // != 0, to avoid problems with trying to draw from a region of SFH
   // where no clusters should form
@@ -215,22 +364,26 @@ slug_galaxy::advance(double time) {
     // Create new clusters
     if (fc != 0) {
 
-      // Get masses of new clusters
-      vector<double> new_cluster_masses;
-      cmf->drawPopulation(fc*mass_to_draw, new_cluster_masses);
-
-      // Get birth times of new clusters
-      vector<double> birth_times = sfh->draw(curTime, time,
-					     new_cluster_masses.size());
+      // Get masses and birth times of new clusters
+      vector<double> new_cluster_masses, birth_times;
+      if (draw_here) {
+	cmf->drawPopulation(fc*stoch_mass_to_draw, new_cluster_masses);
+	birth_times = sfh->draw(curTime, time, new_cluster_masses.size());
+      }
+#ifdef ENABLE_MPI
+      if (comm != MPI_COMM_NULL)
+	galaxy::deal_out({ &new_cluster_masses, &birth_times }, comm);
+#endif
 
       // Create clusters of chosen masses and birth times, and push them
       // onto the master cluster list
       for (unsigned int i=0; i<new_cluster_masses.size(); i++) {
 	slug_cluster *new_cluster = 
-	  new slug_cluster(cluster_id++, new_cluster_masses[i],
+	  new slug_cluster(cluster_id, new_cluster_masses[i],
 			   birth_times[i], imf, tracks, specsyn, filters,
 			   extinct, nebular, yields, lines, ostreams, clf);
 	clusters.push_back(new_cluster);
+	cluster_id += cluster_id_stride;
 	mass += new_cluster->get_birth_mass();
 	clusterMass += new_cluster->get_birth_mass();
 	clusterAliveMass += new_cluster->get_alive_mass();
@@ -241,29 +394,39 @@ slug_galaxy::advance(double time) {
     // Create new field stars
     if (fc != 1) {
 
-      // Get masses of new field stars
-      vector<double> new_star_masses;
-      imf->drawPopulation((1.0-fc)*mass_to_draw, new_star_masses);
+      // Get masses of new field stars, their extinctions, and their
+      // birth times
+      vector<double> new_star_masses, AV, AVneb, birth_times;
+      if (draw_here) {
+	imf->drawPopulation((1.0-fc)*stoch_mass_to_draw, new_star_masses);
+	if (extinct != NULL) {
+	  AV = extinct->draw_AV(new_star_masses.size());
+	  AVneb.resize(new_star_masses.size());
+	  for (vector<double>::size_type i = 0; i<AV.size(); i++)
+	    AVneb[i] = AV[i] * extinct->draw_neb_extinct_fac();
+	}
+	birth_times = sfh->draw(curTime, time, new_star_masses.size());
+      }
+#ifdef ENABLE_MPI
+      if (comm != MPI_COMM_NULL) {
+	if (extinct != NULL)
+	  galaxy::deal_out({ &new_star_masses, &birth_times, &AV, &AVneb },
+			   comm);
+	else
+	  galaxy::deal_out({ &new_star_masses, &birth_times }, comm);
+      }
+#endif
       int count=0;
       double mtot=0.0;
       for (vector<double>::size_type i=0; i<new_star_masses.size(); i++)
 	if (new_star_masses[i] > 5.0) { count++; mtot += new_star_masses[i]; }
 
-      // Get extinctions to field stars
-      vector<double> AV, AVneb;
-      if (extinct != NULL) {
-	AV = extinct->draw_AV(new_star_masses.size());
-	AVneb.resize(new_star_masses.size());
-	for (vector<double>::size_type i = 0; i<AV.size(); i++)
-	  AVneb[i] = AV[i] * extinct->draw_neb_extinct_fac();
-      }
-
       // Push stars onto field star list; in the process, set the birth
       // time and death time for each of them
       for (unsigned int i=0; i<new_star_masses.size(); i++) {
 	slug_star new_star;
 	new_star.mass = new_star_masses[i];
-	new_star.birth_time = sfh->draw(curTime, time);
+	new_star.birth_time = birth_times[i];
 	new_star.death_time = new_star.birth_time 
 	  + tracks->star_lifetime(new_star.mass);
 	field_stars.push_back(new_star);
@@ -341,7 +504,8 @@ slug_galaxy::advance(double time) {
   }
 
   // Flag that computed quantities are now out of date
-  Lbol_set = spec_set = field_data_set = phot_set = yield_set = false;
+  Lbol_set = spec_set = field_data_set = phot_set = yield_set
+    = reduced = false;
 
   // Store new time
   curTime = time;
@@ -362,6 +526,14 @@ slug_galaxy::advance(double time) {
   // Compute the alive mass for non-stochastic field stars; be sure to
   // include the contribution from the part of the IMF that's below
   // the minimum track mass
+  //
+  // The integrals over the non-stochastic field stars below, for the
+  // alive mass, remnant mass, and supernova count, are taken from the
+  // cache if we have already computed them for this IMF and time
+  nonstoch_entry *ns = nullptr;
+  if (imf->get_xStochMin() > imf->get_xMin()) ns = get_nonstoch_entry(time);
+  bool ns_cached = (ns != nullptr) && ns->mass_set;
+  double sfh_int = sfh->integral();
   nonStochAliveMass = 0.0;
   if (imf->get_xStochMin() > imf->get_xMin()) {
     if (imf->get_xMin() < tracks->min_mass()) {
@@ -369,7 +541,11 @@ slug_galaxy::advance(double time) {
 	imf->mass_frac(imf->get_xMin(), 
 		       min(tracks->min_mass(), imf->get_xStochMin()));
     }
-    nonStochAliveMass += integ.integrate_sfh(time, galaxy::curMass);
+    double ns_alive;
+    if (ns_cached) ns_alive = sfh_int * ns->aliveMass;
+    else ns_alive = integ.integrate_sfh(time, galaxy::curMass);
+    nonStochAliveMass += sf_frac * ns_alive;
+    if (ns && !ns_cached) ns->aliveMass = ns_alive / sfh_int;
   }
 
   // Recompute the remnant mass for non-stochastic field stars; note a
@@ -377,8 +553,10 @@ slug_galaxy::advance(double time) {
   // function is overloaded, so we need to static_cast to the version
   // of it we want before passing to boost::bind
   nonStochRemnantMass = 0.0;
-  if (imf->get_xStochMin() > imf->get_xMin())
-    nonStochRemnantMass = 
+  if (imf->get_xStochMin() > imf->get_xMin()) {
+    double ns_remnant;
+    if (ns_cached) ns_remnant = sfh_int * ns->remnantMass;
+    else ns_remnant =
       integ.integrate_sfh_nt(time, 
 			     boost::bind(static_cast<double (slug_tracks::*)
 					 (const double, const double,
@@ -386,6 +564,9 @@ slug_galaxy::advance(double time) {
 					 (&slug_tracks::remnant_mass), 
 					 tracks, _1, _2,
 					 tracks::null_metallicity));
+    nonStochRemnantMass = sf_frac * ns_remnant;
+    if (ns && !ns_cached) ns->remnantMass = ns_remnant / sfh_int;
+  }
 
   // Recompute the alive mass and stellar mass
   aliveMass = nonStochAliveMass + clusterAliveMass + fieldAliveMass;
@@ -409,18 +590,70 @@ slug_galaxy::advance(double time) {
   // history.
   field_tot_sn = field_stoch_sn;
   if (imf->get_xStochMin() > imf->get_xMin()) {
-    vector<double> sn_mass_range = yields->sn_mass_range();
-    for (vector<double>::size_type i=0; i<=sn_mass_range.size(); i+=2) {
-      double mlo = min(sn_mass_range[i], imf->get_xStochMin());
-      double mhi = min(sn_mass_range[i+1], imf->get_xMax());
-      if (mhi > mlo) {
-	field_tot_sn +=
-	  integ.integrate_nt_lim(1.0, time, mlo, mhi,
-				 boost::bind(galaxy::dnSN_dm, _1, _2,
-					     sfh, tracks));
+    double ns_sn = 0.0;
+    if (ns_cached) {
+      ns_sn = sfh_int * ns->sn;
+    } else {
+      vector<double> sn_mass_range = yields->sn_mass_range();
+      for (vector<double>::size_type i=0; i<=sn_mass_range.size(); i+=2) {
+	double mlo = min(sn_mass_range[i], imf->get_xStochMin());
+	double mhi = min(sn_mass_range[i+1], imf->get_xMax());
+	if (mhi > mlo) {
+	  ns_sn +=
+	    integ.integrate_nt_lim(1.0, time, mlo, mhi,
+				   boost::bind(galaxy::dnSN_dm, _1, _2,
+					       sfh, tracks));
+	}
+      }
+      if (ns) {
+	ns->sn = ns_sn / sfh_int;
+	ns->mass_set = true;
       }
     }
+    field_tot_sn += sf_frac * ns_sn;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Get the cache entry for the non-stochastic field star contributions
+// at the current IMF and the specified time
+////////////////////////////////////////////////////////////////////////
+slug_galaxy::nonstoch_entry *
+slug_galaxy::get_nonstoch_entry(const double t) {
+
+  // Values are stored per unit SFH integral, so we can't cache if
+  // that is zero
+  if (sfh->integral() <= 0.0) return nullptr;
+
+  // Build the key
+  vector<double> key = imf->vseg_params();
+  key.push_back(imf->get_xStochMin());
+  key.push_back(t);
+
+  // Return existing entry if we have one, marking it as the most
+  // recently used
+  map<vector<double>, nonstoch_entry>::iterator it =
+    nonstoch_cache.find(key);
+  if (it != nonstoch_cache.end()) {
+    nonstoch_lru.splice(nonstoch_lru.begin(), nonstoch_lru,
+			it->second.lru);
+    return &(it->second);
+  }
+
+  // If the cache is full, evict the least recently used entry
+  if (nonstoch_cache.size() >= galaxy::nonstoch_cache_size) {
+    nonstoch_cache.erase(nonstoch_lru.back());
+    nonstoch_lru.pop_back();
   }
+
+  // Create new entry
+  nonstoch_lru.push_front(key);
+  nonstoch_entry &entry = nonstoch_cache[key];
+  entry.mass_set = entry.Lbol_set = entry.spec_set = entry.yield_set
+    = false;
+  entry.lru = nonstoch_lru.begin();
+  return &entry;
 }
 
 
@@ -460,6 +693,341 @@ slug_galaxy::get_non_stoch_sn() const {
   return get_sn() - get_stoch_sn();
 }
 
+
+////////////////////////////////////////////////////////////////////////
+// Return the integrated properties to be written out
+////////////////////////////////////////////////////////////////////////
+slug_galaxy::int_prop_data
+slug_galaxy::get_int_prop() const {
+  if (reduced) return int_prop_tot;
+  int_prop_data p;
+  p.targetMass = targetMass;
+  p.mass = mass;
+  p.aliveMass = aliveMass;
+  p.stellarMass = stellarMass;
+  p.clusterMass = clusterMass;
+  p.sn = get_sn();
+  p.nclusters = clusters.size();
+  p.ndisrupted = disrupted_clusters.size();
+  p.nfield = field_stars.size();
+  p.stoch_sn = get_stoch_sn();
+  return p;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Return the names and values of quantities for summary statistics;
+// the names follow the column names in the integrated output files
+////////////////////////////////////////////////////////////////////////
+vector<string>
+slug_galaxy::stats_names(const bool with_prop, const bool with_phot,
+			 const bool with_sn, const bool with_yield) const {
+  vector<string> names(1, "Time");
+  if (with_prop) {
+    const char *prop_names[] = { "TargetMass", "ActualMass", "LiveMass",
+				 "StellarMass", "ClusterMass",
+				 "NumClusters", "NumDisClust",
+				 "NumFldStar" };
+    names.insert(names.end(), prop_names, prop_names+8);
+  }
+  if (with_phot) {
+    const vector<string>& filter_names = filters->get_filter_names();
+    names.insert(names.end(), filter_names.begin(), filter_names.end());
+    if (nebular != NULL)
+      for (vector<string>::size_type i=0; i<filter_names.size(); i++)
+	names.push_back(filter_names[i]+"_n");
+    if (extinct != NULL) {
+      for (vector<string>::size_type i=0; i<filter_names.size(); i++)
+	names.push_back(filter_names[i]+"_ex");
+      if (nebular != NULL)
+	for (vector<string>::size_type i=0; i<filter_names.size(); i++)
+	  names.push_back(filter_names[i]+"_nex");
+    }
+  }
+  if (with_sn) {
+    names.push_back("TotSN");
+    names.push_back("StochSN");
+  }
+  if (with_yield) {
+    const vector<const isotope_data *>& isodata = yields->get_isotopes();
+    for (vector<double>::size_type i=0; i<isodata.size(); i++)
+      names.push_back(isodata[i]->symbol() + to_string(isodata[i]->wgt()));
+  }
+  return names;
+}
+
+void
+slug_galaxy::stats_values(vector<double>& vals, const bool with_prop,
+			  const bool with_phot, const bool with_sn,
+			  const bool with_yield,
+			  const bool del_cluster) {
+
+  // Get the integrated properties and yields before the photometry,
+  // since computing the spectrum may delete the clusters
+  const int_prop_data p = get_int_prop();
+  if (with_yield && !yield_set) set_yield(del_cluster);
+  if (with_phot && !phot_set) set_photometry(del_cluster);
+
+  // Pack the values in the same order as the names
+  vals.assign(1, curTime);
+  if (with_prop) {
+    double prop_vals[] = { p.targetMass, p.mass, p.aliveMass,
+			   p.stellarMass, p.clusterMass,
+			   (double) p.nclusters, (double) p.ndisrupted,
+			   (double) p.nfield };
+    vals.insert(vals.end(), prop_vals, prop_vals+8);
+  }
+  if (with_phot) {
+    vals.insert(vals.end(), phot.begin(), phot.end());
+    if (nebular != NULL)
+      vals.insert(vals.end(), phot_neb.begin(), phot_neb.end());
+    if (extinct != NULL) {
+      vals.insert(vals.end(), phot_ext.begin(), phot_ext.end());
+      if (nebular != NULL)
+	vals.insert(vals.end(), phot_neb_ext.begin(), phot_neb_ext.end());
+    }
+  }
+  if (with_sn) {
+    vals.push_back(p.sn);
+    vals.push_back((double) p.stoch_sn);
+  }
+  if (with_yield)
+    vals.insert(vals.end(), all_yields.begin(), all_yields.end());
+}
+
+
+#ifdef ENABLE_MPI
+////////////////////////////////////////////////////////////////////////
+// Sum integrated quantities over all processes for a distributed
+// galaxy
+////////////////////////////////////////////////////////////////////////
+void
+slug_galaxy::reduce(const bool reduce_spec, const bool reduce_yield,
+		    const bool del_cluster) {
+
+  // Nothing to do if the galaxy is not distributed
+  if (comm == MPI_COMM_NULL) return;
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  // Sum the integrated properties and supernova counts; do this
+  // first, because computing the spectrum may delete the clusters
+  int_prop_data p = get_int_prop();
+  double dbuf[6] = { p.targetMass, p.mass, p.aliveMass,
+		     p.stellarMass, p.clusterMass, p.sn };
+  unsigned long ubuf[4] = { p.nclusters, p.ndisrupted, p.nfield,
+			    p.stoch_sn };
+  double dtot[6];
+  unsigned long utot[4];
+  MPI_Reduce(dbuf, dtot, 6, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(ubuf, utot, 4, MPI_UNSIGNED_LONG, MPI_SUM, 0, comm);
+  if (rank == 0) {
+    int_prop_tot.targetMass = dtot[0];
+    int_prop_tot.mass = dtot[1];
+    int_prop_tot.aliveMass = dtot[2];
+    int_prop_tot.stellarMass = dtot[3];
+    int_prop_tot.clusterMass = dtot[4];
+    int_prop_tot.sn = dtot[5];
+    int_prop_tot.nclusters = utot[0];
+    int_prop_tot.ndisrupted = utot[1];
+    int_prop_tot.nfield = utot[2];
+    int_prop_tot.stoch_sn = utot[3];
+  }
+
+  // Sum the yields; these are additive, so the sum on the root is the
+  // yield of the entire galaxy
+  if (reduce_yield) {
+    set_yield(del_cluster);
+    galaxy::reduce_sum(all_yields, comm);
+  }
+
+  // Sum the spectra and bolometric luminosities. Photometry is not
+  // additive in general (e.g., for magnitudes), so rather than
+  // summing it we flag it as out of date, so that on the root process
+  // it will be recomputed from the summed spectra.
+  if (reduce_spec) {
+    set_spectrum(del_cluster);
+    galaxy::reduce_sum(L_lambda, comm);
+    if (nebular != NULL) galaxy::reduce_sum(L_lambda_neb, comm);
+    if (extinct != NULL) {
+      galaxy::reduce_sum(L_lambda_ext, comm);
+      if (nebular != NULL) galaxy::reduce_sum(L_lambda_neb_ext, comm);
+    }
+    vector<double> Lbol_buf(1, Lbol);
+    if (extinct != NULL) Lbol_buf.push_back(Lbol_ext);
+    galaxy::reduce_sum(Lbol_buf, comm);
+    Lbol = Lbol_buf[0];
+    if (extinct != NULL) Lbol_ext = Lbol_buf[1];
+    phot_set = false;
+  }
+
+  // Flag that the root process now holds the totals
+  reduced = rank == 0;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Write a snapshot of the galaxy state
+////////////////////////////////////////////////////////////////////////
+void
+slug_galaxy::write_snapshot(ostream &out, const rng_type &rng) const {
+
+  // Get the state of the random number generator in text form
+  ostringstream rng_ss;
+  rng_ss << rng;
+  string rng_state = rng_ss.str();
+
+  // Build and write the header
+  galaxy::snapshot_header hdr;
+  hdr.magic = SLUG_GALAXY_SNAP_MAGIC;
+  hdr.version = SLUG_GALAXY_SNAP_VERSION;
+  hdr.dbl[galaxy::SNAP_CUR_TIME] = curTime;
+  hdr.dbl[galaxy::SNAP_MASS] = mass;
+  hdr.dbl[galaxy::SNAP_TARGET_MASS] = targetMass;
+  hdr.dbl[galaxy::SNAP_ALIVE_MASS] = aliveMass;
+  hdr.dbl[galaxy::SNAP_STELLAR_MASS] = stellarMass;
+  hdr.dbl[galaxy::SNAP_NON_STOCH_ALIVE_MASS] = nonStochAliveMass;
+  hdr.dbl[galaxy::SNAP_NON_STOCH_REMNANT_MASS] = nonStochRemnantMass;
+  hdr.dbl[galaxy::SNAP_CLUSTER_ALIVE_MASS] = clusterAliveMass;
+  hdr.dbl[galaxy::SNAP_CLUSTER_STELLAR_MASS] = clusterStellarMass;
+  hdr.dbl[galaxy::SNAP_FIELD_ALIVE_MASS] = fieldAliveMass;
+  hdr.dbl[galaxy::SNAP_FIELD_REMNANT_MASS] = fieldRemnantMass;
+  hdr.dbl[galaxy::SNAP_CLUSTER_MASS] = clusterMass;
+  hdr.dbl[galaxy::SNAP_NON_STOCH_FIELD_MASS] = nonStochFieldMass;
+  hdr.dbl[galaxy::SNAP_LAST_YIELD_TIME] = last_yield_time;
+  hdr.dbl[galaxy::SNAP_FIELD_TOT_SN] = field_tot_sn;
+  hdr.dbl[galaxy::SNAP_SF_FRAC] = sf_frac;
+  hdr.ints[galaxy::SNAP_CLUSTER_ID] = cluster_id;
+  hdr.ints[galaxy::SNAP_CLUSTER_ID_START] = cluster_id_start;
+  hdr.ints[galaxy::SNAP_CLUSTER_ID_STRIDE] = cluster_id_stride;
+  hdr.ints[galaxy::SNAP_FIELD_STOCH_SN] = field_stoch_sn;
+  hdr.ints[galaxy::SNAP_RNG_LEN] = rng_state.size();
+  hdr.ints[galaxy::SNAP_NFIELD] = field_stars.size();
+  hdr.ints[galaxy::SNAP_NAV] = field_star_AV.size();
+  hdr.ints[galaxy::SNAP_NYIELD] = stoch_field_yields.size();
+  hdr.ints[galaxy::SNAP_NCLUSTER] = clusters.size();
+  hdr.ints[galaxy::SNAP_NDISRUPTED] = disrupted_clusters.size();
+  out.write((const char *) &hdr, sizeof hdr);
+
+  // Write random number generator state
+  out.write(rng_state.data(), rng_state.size());
+
+  // Write field star data
+  out.write((const char *) field_stars.data(),
+	    field_stars.size() * sizeof(slug_star));
+  out.write((const char *) field_star_AV.data(),
+	    field_star_AV.size() * sizeof(double));
+  out.write((const char *) field_star_AV_neb.data(),
+	    field_star_AV_neb.size() * sizeof(double));
+  out.write((const char *) stoch_field_yields.data(),
+	    stoch_field_yields.size() * sizeof(double));
+
+  // Write the clusters
+  galaxy::write_snapshot_clusters(out, clusters);
+  galaxy::write_snapshot_clusters(out, disrupted_clusters);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Restore the galaxy state from a snapshot
+////////////////////////////////////////////////////////////////////////
+void
+slug_galaxy::read_snapshot(istream &in, rng_type &rng) {
+
+  // Read and check the header
+  galaxy::snapshot_header hdr;
+  in.read((char *) &hdr, sizeof hdr);
+  if (!in || hdr.magic != SLUG_GALAXY_SNAP_MAGIC ||
+      hdr.version != SLUG_GALAXY_SNAP_VERSION) {
+    ostreams.slug_err_one << "slug_galaxy: invalid galaxy snapshot"
+			  << endl;
+    exit(1);
+  }
+
+  // Clear current state, keeping the cluster ID counter
+  reset();
+
+  // Restore scalar data
+  curTime = hdr.dbl[galaxy::SNAP_CUR_TIME];
+  mass = hdr.dbl[galaxy::SNAP_MASS];
+  targetMass = hdr.dbl[galaxy::SNAP_TARGET_MASS];
+  aliveMass = hdr.dbl[galaxy::SNAP_ALIVE_MASS];
+  stellarMass = hdr.dbl[galaxy::SNAP_STELLAR_MASS];
+  nonStochAliveMass = hdr.dbl[galaxy::SNAP_NON_STOCH_ALIVE_MASS];
+  nonStochRemnantMass = hdr.dbl[galaxy::SNAP_NON_STOCH_REMNANT_MASS];
+  clusterAliveMass = hdr.dbl[galaxy::SNAP_CLUSTER_ALIVE_MASS];
+  clusterStellarMass = hdr.dbl[galaxy::SNAP_CLUSTER_STELLAR_MASS];
+  fieldAliveMass = hdr.dbl[galaxy::SNAP_FIELD_ALIVE_MASS];
+  fieldRemnantMass = hdr.dbl[galaxy::SNAP_FIELD_REMNANT_MASS];
+  clusterMass = hdr.dbl[galaxy::SNAP_CLUSTER_MASS];
+  nonStochFieldMass = hdr.dbl[galaxy::SNAP_NON_STOCH_FIELD_MASS];
+  last_yield_time = hdr.dbl[galaxy::SNAP_LAST_YIELD_TIME];
+  field_tot_sn = hdr.dbl[galaxy::SNAP_FIELD_TOT_SN];
+  sf_frac = hdr.dbl[galaxy::SNAP_SF_FRAC];
+  cluster_id = hdr.ints[galaxy::SNAP_CLUSTER_ID];
+  cluster_id_start = hdr.ints[galaxy::SNAP_CLUSTER_ID_START];
+  cluster_id_stride = hdr.ints[galaxy::SNAP_CLUSTER_ID_STRIDE];
+  field_stoch_sn = hdr.ints[galaxy::SNAP_FIELD_STOCH_SN];
+
+  // Restore random number generator state
+  string rng_state(hdr.ints[galaxy::SNAP_RNG_LEN], '\0');
+  in.read(&rng_state[0], rng_state.size());
+  istringstream rng_ss(rng_state);
+  rng_ss >> rng;
+  if (!in || !rng_ss) {
+    ostreams.slug_err_one << "slug_galaxy: invalid random number "
+			  << "generator state in galaxy snapshot" << endl;
+    exit(1);
+  }
+
+  // Restore field star data
+  field_stars.resize(hdr.ints[galaxy::SNAP_NFIELD]);
+  in.read((char *) field_stars.data(),
+	  field_stars.size() * sizeof(slug_star));
+  field_star_AV.resize(hdr.ints[galaxy::SNAP_NAV]);
+  in.read((char *) field_star_AV.data(),
+	  field_star_AV.size() * sizeof(double));
+  field_star_AV_neb.resize(hdr.ints[galaxy::SNAP_NAV]);
+  in.read((char *) field_star_AV_neb.data(),
+	  field_star_AV_neb.size() * sizeof(double));
+  stoch_field_yields.resize(hdr.ints[galaxy::SNAP_NYIELD]);
+  in.read((char *) stoch_field_yields.data(),
+	  stoch_field_yields.size() * sizeof(double));
+  dead_field_stars.resize(0);
+
+  // Restore the clusters; for each one, read the header to get the
+  // size, then read the rest of the buffer behind it
+  uint64_t ncl = hdr.ints[galaxy::SNAP_NCLUSTER] +
+    hdr.ints[galaxy::SNAP_NDISRUPTED];
+  for (uint64_t i=0; i<ncl; i++) {
+    slug_cluster_buf_header clhdr;
+    in.read((char *) &clhdr, sizeof clhdr);
+    slug_cluster_view view(&clhdr);
+    if (!in || !view.valid()) {
+      ostreams.slug_err_one << "slug_galaxy: invalid cluster in "
+			    << "galaxy snapshot" << endl;
+      exit(1);
+    }
+    slug_cluster_buffer *buf = malloc(clhdr.size);
+    memcpy(buf, &clhdr, sizeof clhdr);
+    in.read((char *) buf + sizeof clhdr, clhdr.size - sizeof clhdr);
+    slug_cluster *cluster =
+      new slug_cluster(buf, imf, tracks, specsyn, filters, extinct,
+		       nebular, yields, lines, ostreams, clf);
+    free(buf);
+    if (i < hdr.ints[galaxy::SNAP_NCLUSTER])
+      clusters.push_back(cluster);
+    else
+      disrupted_clusters.push_back(cluster);
+  }
+  if (!in) {
+    ostreams.slug_err_one << "slug_galaxy: truncated galaxy snapshot"
+			  << endl;
+    exit(1);
+  }
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Get stellar data on all field stars
 ////////////////////////////////////////////////////////////////////////
@@ -529,8 +1097,20 @@ slug_galaxy::set_Lbol() {
   }
 
   // Now do non-stochastic field stars
-  if (imf->has_stoch_lim())
-    Lbol += specsyn->get_Lbol_cts_sfh(curTime);
+  if (imf->has_stoch_lim()) {
+    nonstoch_entry *ns = get_nonstoch_entry(curTime);
+    double sfh_int = sfh->integral();
+    if (ns && ns->Lbol_set) {
+      Lbol += sf_frac * sfh_int * ns->Lbol;
+    } else {
+      double Lbol_ns = specsyn->get_Lbol_cts_sfh(curTime);
+      Lbol += sf_frac * Lbol_ns;
+      if (ns) {
+	ns->Lbol = Lbol_ns / sfh_int;
+	ns->Lbol_set = true;
+      }
+    }
+  }
 
   // Set flag
   Lbol_set = true;
@@ -643,8 +1223,7 @@ slug_galaxy::set_spectrum(const bool del_cluster) {
 	extinct->spec_extinct(field_star_AV[i], spec);
       for (vector<double>::size_type j=0; j<nl_ext; j++) 
 	L_lambda_ext[j] += spec_ext[j];
-      Lbol_ext += int_tabulated::
-	integrate(extinct->lambda(), spec_ext) / constants::Lsun;
+      Lbol_ext += extinct->Lbol_extinct(field_star_AV[i], spec);
       if (nebular != NULL) {
 	// Procedure depends on if nebular and stellar extinctions
 	// differ
@@ -680,7 +1259,27 @@ slug_galaxy::set_spectrum(const bool del_cluster) {
   if (imf->has_stoch_lim()) {
     double Lbol_tmp;
     vector<double> spec;
-    specsyn->get_spectrum_cts_sfh(curTime, spec, Lbol_tmp);
+    nonstoch_entry *ns = get_nonstoch_entry(curTime);
+    double sfh_int = sfh->integral();
+    if (ns && ns->spec_set) {
+      spec = ns->spec;
+      for (vector<double>::size_type i=0; i<spec.size(); i++)
+	spec[i] *= sfh_int;
+      Lbol_tmp = sfh_int * ns->spec_Lbol;
+    } else {
+      specsyn->get_spectrum_cts_sfh(curTime, spec, Lbol_tmp);
+      if (ns) {
+	ns->spec = spec;
+	for (vector<double>::size_type i=0; i<spec.size(); i++)
+	  ns->spec[i] /= sfh_int;
+	ns->spec_Lbol = Lbol_tmp / sfh_int;
+	ns->spec_set = true;
+      }
+    }
+    if (sf_frac != 1.0) {
+      for (vector<double>::size_type i=0; i<nl; i++) spec[i] *= sf_frac;
+      Lbol_tmp *= sf_frac;
+    }
     for (vector<double>::size_type i=0; i<nl; i++) 
       L_lambda[i] += spec[i];
     Lbol += Lbol_tmp;
@@ -696,8 +1295,7 @@ slug_galaxy::set_spectrum(const bool del_cluster) {
 	extinct->spec_extinct(extinct->AV_expect(), spec);
       for (vector<double>::size_type i=0; i<nl_ext; i++) 
 	L_lambda_ext[i] += spec_ext[i];
-      Lbol_ext += int_tabulated::
-	integrate(extinct->lambda(), spec_ext) / constants::Lsun;
+      Lbol_ext += extinct->Lbol_extinct(extinct->AV_expect(), spec);
       if (nebular != NULL) {
 	vector<double> spec_neb_ext;
 	// Procedure depends on whether we have differential extinction
@@ -898,15 +1496,31 @@ slug_galaxy::set_yield(const bool del_cluster) {
   // using the radioactive isotopes in non-stochastic mode, or by
   // setting the time step to something much smaller than the lifetime
   // of the isotopes in question.
-  vector<double> non_stoch_field_yields =
-    v_integ.integrate_sfh_nt(curTime,
-			     boost::bind(galaxy::yield, _1, _2,
-					 tracks, yields));
+  vector<double> non_stoch_field_yields;
+  nonstoch_entry *ns = get_nonstoch_entry(curTime);
+  double sfh_int = sfh->integral();
+  if (ns && ns->yield_set) {
+    non_stoch_field_yields = ns->yields;
+    for (vector<double>::size_type i=0; i<non_stoch_field_yields.size();
+	 i++)
+      non_stoch_field_yields[i] *= sfh_int;
+  } else {
+    non_stoch_field_yields =
+      v_integ.integrate_sfh_nt(curTime,
+			       boost::bind(galaxy::yield, _1, _2,
+					   tracks, yields));
+    if (ns) {
+      ns->yields = non_stoch_field_yields;
+      for (vector<double>::size_type i=0; i<ns->yields.size(); i++)
+	ns->yields[i] /= sfh_int;
+      ns->yield_set = true;
+    }
+  }
   
   // Sum all yields
   for (vector<double>::size_type i=0; i<all_yields.size(); i++)
       all_yields[i] = cluster_yields[i] + stoch_field_yields[i]
-	+ non_stoch_field_yields[i];
+	+ sf_frac * non_stoch_field_yields[i];
   yield_set = true;  
 }
 
@@ -920,46 +1534,45 @@ slug_galaxy::write_integrated_prop(ofstream& int_prop_file,
 				   const unsigned long trial,
 				   const std::vector<double>& imfvp) {
 
+  // Get data to write
+  const int_prop_data p = get_int_prop();
+
   if (out_mode == ASCII) {
   
     //ASCII Output
-    int_prop_file << setprecision(5) << scientific 
-		  << setw(11) << right << curTime << "   "
-		  << setw(11) << right << targetMass << "   "
-		  << setw(11) << right << mass << "   "
-		  << setw(11) << right << aliveMass << "   "
-		  << setw(11) << right << stellarMass << "   "
-		  << setw(11) << right << clusterMass << "   "
-		  << setw(11) << right << clusters.size() << "   "
-		  << setw(11) << right << disrupted_clusters.size() << "   "
-		  << setw(11) << right << field_stars.size();
+    slug_ascii_record rec;
+    rec.sci(curTime).sep()
+      .sci(p.targetMass).sep()
+      .sci(p.mass).sep()
+      .sci(p.aliveMass).sep()
+      .sci(p.stellarMass).sep()
+      .sci(p.clusterMass).sep()
+      .num(p.nclusters).sep()
+      .num(p.ndisrupted).sep()
+      .num(p.nfield);
 	  
     // Output any variable parameters  
-    if (imfvp.size()>0) {
-      // Loop over the variable parameters and output
-      for (vector<double>::size_type p = 0; p<imfvp.size();p++) {
-        int_prop_file << "   " << setw(11) << right << imfvp[p];
-      }
-    }
+    for (vector<double>::size_type i = 0; i<imfvp.size(); i++)
+      rec.sep().sci(imfvp[i]);
 
     // Close
-    int_prop_file << endl;
+    rec.endl().write(int_prop_file);
 
   } else {
   
     // Binary Output
     int_prop_file.write((char *) &trial, sizeof trial);
     int_prop_file.write((char *) &curTime, sizeof curTime);
-    int_prop_file.write((char *) &targetMass, sizeof targetMass);
-    int_prop_file.write((char *) &mass, sizeof mass);
-    int_prop_file.write((char *) &aliveMass, sizeof aliveMass);
-    int_prop_file.write((char *) &stellarMass, sizeof stellarMass);
-    int_prop_file.write((char *) &clusterMass, sizeof clusterMass);
-    vector<slug_cluster *>::size_type n = clusters.size();
+    int_prop_file.write((char *) &p.targetMass, sizeof p.targetMass);
+    int_prop_file.write((char *) &p.mass, sizeof p.mass);
+    int_prop_file.write((char *) &p.aliveMass, sizeof p.aliveMass);
+    int_prop_file.write((char *) &p.stellarMass, sizeof p.stellarMass);
+    int_prop_file.write((char *) &p.clusterMass, sizeof p.clusterMass);
+    vector<slug_cluster *>::size_type n = p.nclusters;
     int_prop_file.write((char *) &n, sizeof n);
-    n = disrupted_clusters.size();
+    n = p.ndisrupted;
     int_prop_file.write((char *) &n, sizeof n);
-    n = field_stars.size();
+    n = p.nfield;
     int_prop_file.write((char *) &n, sizeof n);
     
     // Write out variable parameter values
@@ -978,50 +1591,32 @@ slug_galaxy::write_integrated_prop(ofstream& int_prop_file,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_integrated_prop(fitsfile* int_prop_fits, 
+slug_galaxy::write_integrated_prop(slug_fits_table& int_prop_tab, 
 				   unsigned long trial,
 				   const std::vector<double>& imfvp) {
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(int_prop_fits, &nrows, &fits_status);
-
-  // Write a new entry
-  fits_write_col(int_prop_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(int_prop_fits, TDOUBLE, 2, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
-  fits_write_col(int_prop_fits, TDOUBLE, 3, nrows+1, 1, 1, &targetMass, 
-		 &fits_status);
-  fits_write_col(int_prop_fits, TDOUBLE, 4, nrows+1, 1, 1, &mass, 
-		 &fits_status);
-  fits_write_col(int_prop_fits, TDOUBLE, 5, nrows+1, 1, 1, &aliveMass, 
-		 &fits_status);
-  fits_write_col(int_prop_fits, TDOUBLE, 6, nrows+1, 1, 1, &stellarMass, 
-		 &fits_status);
-  fits_write_col(int_prop_fits, TDOUBLE, 7, nrows+1, 1, 1, 
-		 &clusterMass, &fits_status);
-  vector<slug_cluster *>::size_type n = clusters.size();
-  fits_write_col(int_prop_fits, TULONG, 8, nrows+1, 1, 1, &n,	 
-		 &fits_status);
-  n = disrupted_clusters.size();
-  fits_write_col(int_prop_fits, TULONG, 9, nrows+1, 1, 1, &n,	 
-		 &fits_status);
-  n = field_stars.size();
-  fits_write_col(int_prop_fits, TULONG, 10, nrows+1, 1, 1, &n,	 
-		 &fits_status);
+  // Get data to write
+  int_prop_data p = get_int_prop();
+
+  // Add a new row
+  int_prop_tab.set(1, trial);
+  int_prop_tab.set(2, curTime);
+  int_prop_tab.set(3, p.targetMass);
+  int_prop_tab.set(4, p.mass);
+  int_prop_tab.set(5, p.aliveMass);
+  int_prop_tab.set(6, p.stellarMass);
+  int_prop_tab.set(7, p.clusterMass);
+  int_prop_tab.set(8, p.nclusters);
+  int_prop_tab.set(9, p.ndisrupted);
+  int_prop_tab.set(10, p.nfield);
 		 
-  if (imfvp.size()>0) {
-    // Loop over the variable parameters
-    int colnum=10;  //Current column number
-    for (vector<double>::size_type p = 0; p<imfvp.size(); p++) {
-      colnum++;
-      double vp_p=imfvp[p];
-      fits_write_col(int_prop_fits, TDOUBLE, colnum, nrows+1, 1, 1, &vp_p,
-		  &fits_status);
-    }
-  }		 
+  // Loop over the variable parameters
+  int colnum=10;  //Current column number
+  for (vector<double>::size_type i = 0; i<imfvp.size(); i++) {
+    colnum++;
+    int_prop_tab.set(colnum, imfvp[i]);
+  }
+  int_prop_tab.end_row();
 }
 #endif
 
@@ -1055,12 +1650,12 @@ slug_galaxy::write_cluster_prop(ofstream& cluster_prop_file,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_cluster_prop(fitsfile* cluster_prop_fits, 
+slug_galaxy::write_cluster_prop(slug_fits_table& cluster_prop_tab, 
 				unsigned long trial,
 				const std::vector<double>& imfvp) {
   for (list<slug_cluster *>::iterator it = clusters.begin();
        it != clusters.end(); ++it)
-    (*it)->write_prop(cluster_prop_fits, trial,imfvp);
+    (*it)->write_prop(cluster_prop_tab, trial,imfvp);
 }
 #endif
 
@@ -1093,28 +1688,26 @@ slug_galaxy::write_integrated_spec(ofstream& int_spec_file,
 	L_lambda_star_ext = nebular->interp_stellar(L_lambda_ext, 
 						    extinct->off());
     }
+    slug_ascii_record rec;
     for (vector<double>::size_type i=0; i<lambda.size(); i++) {
-      int_spec_file << setprecision(5) << scientific 
-		    << setw(11) << right << curTime << "   "
-		    << setw(11) << right << lambda[i] << "   "
-		    << setw(11) << right << L_lambda_star[i];
+      rec.sci(curTime).sep()
+	.sci(lambda[i]).sep()
+	.sci(L_lambda_star[i]);
       if (nebular != NULL)
-	int_spec_file << "   "
-		      << setw(11) << right << L_lambda_neb[i];
+	rec.sep().sci(L_lambda_neb[i]);
       if (extinct != NULL) {
 	int j;
 	if (nebular == NULL) j = i - extinct->off();
 	else j = i - extinct->off_neb();
 	if ((j >= 0) && ((unsigned int) j < L_lambda_star_ext.size())) {
-	  int_spec_file << "   "
-			<< setw(11) << right << L_lambda_star_ext[j];
+	  rec.sep().sci(L_lambda_star_ext[j]);
 	  if (nebular != NULL)
-	    int_spec_file << "   "
-			  << setw(11) << right << L_lambda_neb_ext[j];
+	    rec.sep().sci(L_lambda_neb_ext[j]);
 	}
       }
-      int_spec_file << endl;
+      rec.endl();
     }
+    rec.write(int_spec_file);
   } else {
     int_spec_file.write((char *) &trial, sizeof trial);
     int_spec_file.write((char *) &curTime, sizeof curTime);
@@ -1139,44 +1732,31 @@ slug_galaxy::write_integrated_spec(ofstream& int_spec_file,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_integrated_spec(fitsfile* int_spec_fits, 
+slug_galaxy::write_integrated_spec(slug_fits_table& int_spec_tab, 
 				   unsigned long trial,
 				   const bool del_cluster) {
 
   // Make sure spectrum information is current. If not, compute it.
   if (!spec_set) set_spectrum(del_cluster);
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(int_spec_fits, &nrows, &fits_status);
-
-  // Write data
-  fits_write_col(int_spec_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(int_spec_fits, TDOUBLE, 2, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
-  fits_write_col(int_spec_fits, TDOUBLE, 3, nrows+1, 1, 
-		 L_lambda.size(), L_lambda.data(), &fits_status);
+  // Add a new row
+  int_spec_tab.set(1, trial);
+  int_spec_tab.set(2, curTime);
+  int_spec_tab.set(3, L_lambda);
   int colnum = 4;
   if (nebular != NULL) {
-    fits_write_col(int_spec_fits, TDOUBLE, colnum, nrows+1, 1, 
-		   L_lambda_neb.size(), L_lambda_neb.data(),
-		   &fits_status);
+    int_spec_tab.set(colnum, L_lambda_neb);
     colnum++;
   }
   if (extinct != NULL) {
-    fits_write_col(int_spec_fits, TDOUBLE, colnum, nrows+1, 1, 
-		   L_lambda_ext.size(), L_lambda_ext.data(),
-		   &fits_status);
+    int_spec_tab.set(colnum, L_lambda_ext);
     colnum++;
     if (nebular != NULL) {
-      fits_write_col(int_spec_fits, TDOUBLE, colnum, nrows+1, 1, 
-		     L_lambda_neb_ext.size(), L_lambda_neb_ext.data(),
-		     &fits_status);
+      int_spec_tab.set(colnum, L_lambda_neb_ext);
       colnum++;
     }
   }
+  int_spec_tab.end_row();
 }
 #endif
 
@@ -1209,11 +1789,11 @@ slug_galaxy::write_cluster_spec(ofstream& cluster_spec_file,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_cluster_spec(fitsfile* cluster_spec_fits, 
+slug_galaxy::write_cluster_spec(slug_fits_table& cluster_spec_tab, 
 				unsigned long trial) {
   for (list<slug_cluster *>::iterator it = clusters.begin();
        it != clusters.end(); ++it)
-    (*it)->write_spectrum(cluster_spec_fits, trial);
+    (*it)->write_spectrum(cluster_spec_tab, trial);
 }
 #endif
 
@@ -1230,35 +1810,35 @@ slug_galaxy::write_integrated_phot(ofstream& outfile,
   if (!phot_set) set_photometry(del_cluster);
 
   if (out_mode == ASCII) {
-    outfile << setprecision(5) << scientific 
-	    << setw(18) << right << curTime;
+    slug_ascii_record rec;
+    rec.sci(curTime, 18);
     for (vector<double>::size_type i=0; i<phot.size(); i++)
-      outfile << "   " << setw(18) << right << phot[i];
+      rec.sep().sci(phot[i], 18);
     if (nebular != NULL) {
       for (vector<double>::size_type i=0; i<phot_neb.size(); i++) {
 	if (!std::isnan(phot_neb[i]))
-	  outfile << "   " << setw(18) << right << phot_neb[i];
+	  rec.sep().sci(phot_neb[i], 18);
 	else
-	  outfile << "   " << setw(18) << right << " ";
+	  rec.sep().str(" ", 18);
       }
     }
     if (extinct != NULL) {
       for (vector<double>::size_type i=0; i<phot_ext.size(); i++) {
 	if (!std::isnan(phot_ext[i]))
-	  outfile << "   " << setw(18) << right << phot_ext[i];
+	  rec.sep().sci(phot_ext[i], 18);
 	else
-	  outfile << "   " << setw(18) << right << " ";
+	  rec.sep().str(" ", 18);
       }
       if (nebular != NULL) {
 	for (vector<double>::size_type i=0; i<phot_neb_ext.size(); i++) {
 	  if (!std::isnan(phot_neb_ext[i]))
-	    outfile << "   " << setw(18) << right << phot_neb_ext[i];
+	    rec.sep().sci(phot_neb_ext[i], 18);
 	  else
-	    outfile << "   " << setw(18) << right << " ";
+	    rec.sep().str(" ", 18);
 	}
       }
     }
-    outfile << endl;
+    rec.endl().write(outfile);
   } else {
     outfile.write((char *) &trial, sizeof trial);
     outfile.write((char *) &curTime, sizeof curTime);
@@ -1282,50 +1862,40 @@ slug_galaxy::write_integrated_phot(ofstream& outfile,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_integrated_phot(fitsfile* int_phot_fits, 
+slug_galaxy::write_integrated_phot(slug_fits_table& int_phot_tab, 
 				   unsigned long trial,
 				   const bool del_cluster) {
 
   // Make sure photometric information is current. If not, compute it.
   if (!phot_set) set_photometry(del_cluster);
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(int_phot_fits, &nrows, &fits_status);
-
-  // Write data
-  fits_write_col(int_phot_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(int_phot_fits, TDOUBLE, 2, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
+  // Add a new row
+  int_phot_tab.set(1, trial);
+  int_phot_tab.set(2, curTime);
   unsigned int colnum = 3;
   for (unsigned int i=0; i<phot.size(); i++) {
-    fits_write_col(int_phot_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		   &(phot[i]), &fits_status);
+    int_phot_tab.set(colnum, phot[i]);
     colnum++;
   }
   if (nebular != NULL) {
     for (unsigned int i=0; i<phot_neb.size(); i++) {
-      fits_write_col(int_phot_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		     &(phot_neb[i]), &fits_status);
+      int_phot_tab.set(colnum, phot_neb[i]);
       colnum++;
     }
   }
   if (extinct != NULL) {
     for (unsigned int i=0; i<phot_ext.size(); i++) {
-      fits_write_col(int_phot_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		     &(phot_ext[i]), &fits_status);
+      int_phot_tab.set(colnum, phot_ext[i]);
       colnum++;
     }
     if (nebular != NULL) {
       for (unsigned int i=0; i<phot_neb_ext.size(); i++) {
-	fits_write_col(int_phot_fits, TDOUBLE, colnum, nrows+1, 1, 1,
-		       &(phot_neb_ext[i]), &fits_status);
+	int_phot_tab.set(colnum, phot_neb_ext[i]);
 	colnum++;
       }
     }
   }
+  int_phot_tab.end_row();
 }
 #endif
 
@@ -1338,22 +1908,26 @@ slug_galaxy::write_integrated_sn(ofstream& int_sn_file,
 				 const outputMode out_mode, 
 				 const unsigned long trial) {
 
+  // Get data to write
+  const int_prop_data p = get_int_prop();
+
   if (out_mode == ASCII) {
   
     //ASCII Output
-    int_sn_file << setprecision(5) << scientific 
-		<< setw(11) << right << curTime << "   "
-		<< setw(11) << right << get_sn() << "   "
-		<< setw(11) << right << get_stoch_sn() << endl;
+    slug_ascii_record rec;
+    rec.sci(curTime).sep()
+      .sci(p.sn).sep()
+      .num(p.stoch_sn).endl()
+      .write(int_sn_file);
 
   } else {
   
     // Binary Output
     int_sn_file.write((char *) &trial, sizeof trial);
     int_sn_file.write((char *) &curTime, sizeof curTime);
-    double tot_sn = get_sn();
+    double tot_sn = p.sn;
     int_sn_file.write((char *) &tot_sn, sizeof tot_sn);
-    unsigned long stoch_sn = get_stoch_sn();
+    unsigned long stoch_sn = p.stoch_sn;
     int_sn_file.write((char *) &stoch_sn, sizeof stoch_sn);
     
   }
@@ -1364,25 +1938,16 @@ slug_galaxy::write_integrated_sn(ofstream& int_sn_file,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_integrated_sn(fitsfile* int_sn_fits, 
+slug_galaxy::write_integrated_sn(slug_fits_table& int_sn_tab, 
 				 unsigned long trial) {
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(int_sn_fits, &nrows, &fits_status);
-
-  // Write a new entry
-  fits_write_col(int_sn_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(int_sn_fits, TDOUBLE, 2, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
-  double totSN = get_sn();
-  fits_write_col(int_sn_fits, TDOUBLE, 3, nrows+1, 1, 1, &totSN, 
-		 &fits_status);
-  unsigned long stochSN = get_stoch_sn();
-  fits_write_col(int_sn_fits, TULONG, 4, nrows+1, 1, 1, &stochSN, 
-		 &fits_status);
+  // Add a new row
+  const int_prop_data p = get_int_prop();
+  int_sn_tab.set(1, trial);
+  int_sn_tab.set(2, curTime);
+  int_sn_tab.set(3, p.sn);
+  int_sn_tab.set(4, p.stoch_sn);
+  int_sn_tab.end_row();
 }
 #endif
 
@@ -1414,11 +1979,11 @@ slug_galaxy::write_cluster_sn(ofstream& cluster_sn_file,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_cluster_sn(fitsfile* cluster_sn_fits, 
+slug_galaxy::write_cluster_sn(slug_fits_table& cluster_sn_tab, 
 			      unsigned long trial) {
   for (list<slug_cluster *>::iterator it = clusters.begin();
        it != clusters.end(); ++it)
-    (*it)->write_sn(cluster_sn_fits, trial);
+    (*it)->write_sn(cluster_sn_tab, trial);
 }
 #endif
 
@@ -1438,14 +2003,15 @@ slug_galaxy::write_integrated_yield(std::ofstream& outfile,
   // Write
   if (out_mode == ASCII) {
     const vector<const isotope_data *>& isodata = yields->get_isotopes();
+    slug_ascii_record rec;
     for (vector<double>::size_type i=0; i<all_yields.size(); i++) {
-      outfile << setprecision(5) << scientific
-	      << setw(11) << right << curTime << "   "
-	      << setw(11) << right << isodata[i]->symbol() << "   "
-	      << setw(11) << right << isodata[i]->num() << "   "
-	      << setw(11) << right << isodata[i]->wgt() << "   "
-	      << setw(11) << right << all_yields[i] << endl;
+      rec.sci(curTime).sep()
+	.str(isodata[i]->symbol()).sep()
+	.num(isodata[i]->num()).sep()
+	.num(isodata[i]->wgt()).sep()
+	.sci(all_yields[i]).endl();
     }
+    rec.write(outfile);
   } else if (out_mode == BINARY) {
     outfile.write((char *) &trial, sizeof trial);
     outfile.write((char *) &curTime, sizeof curTime);
@@ -1460,25 +2026,18 @@ slug_galaxy::write_integrated_yield(std::ofstream& outfile,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_integrated_yield(fitsfile* int_yield_fits, 
+slug_galaxy::write_integrated_yield(slug_fits_table& int_yield_tab, 
 				    unsigned long trial,
 				    const bool del_cluster) {
 
-  // Make sure photometric information is current. If not, compute it.
+  // Make sure yield information is current. If not, compute it.
   if (!yield_set) set_yield(del_cluster);
 
-  // Get current number of entries
-  int fits_status = 0;
-  long nrows = 0;
-  fits_get_num_rows(int_yield_fits, &nrows, &fits_status);
-
-  // Write data
-  fits_write_col(int_yield_fits, TULONG, 1, nrows+1, 1, 1, &trial, 
-		 &fits_status);
-  fits_write_col(int_yield_fits, TDOUBLE, 2, nrows+1, 1, 1, &curTime, 
-		 &fits_status);
-  fits_write_col(int_yield_fits, TDOUBLE, 3, nrows+1, 1, all_yields.size(), 
-		 all_yields.data(), &fits_status);
+  // Add a new row
+  int_yield_tab.set(1, trial);
+  int_yield_tab.set(2, curTime);
+  int_yield_tab.set(3, all_yields);
+  int_yield_tab.end_row();
 }
 #endif
 
@@ -1510,11 +2069,11 @@ slug_galaxy::write_cluster_phot(ofstream& outfile,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_cluster_phot(fitsfile* cluster_phot_fits, 
+slug_galaxy::write_cluster_phot(slug_fits_table& cluster_phot_tab, 
 				unsigned long trial) {
   for (list<slug_cluster *>::iterator it = clusters.begin();
        it != clusters.end(); ++it)
-    (*it)->write_photometry(cluster_phot_fits, trial);
+    (*it)->write_photometry(cluster_phot_tab, trial);
 }
 #endif
 
@@ -1546,11 +2105,11 @@ slug_galaxy::write_cluster_yield(ofstream& outfile,
 ////////////////////////////////////////////////////////////////////////
 #ifdef ENABLE_FITS
 void
-slug_galaxy::write_cluster_yield(fitsfile* cluster_yield_fits, 
+slug_galaxy::write_cluster_yield(slug_fits_table& cluster_yield_tab, 
 				unsigned long trial) {
   for (list<slug_cluster *>::iterator it = clusters.begin();
        it != clusters.end(); ++it)
-    (*it)->write_yield(cluster_yield_fits, trial);
+    (*it)->write_yield(cluster_yield_tab, trial);
 }
 #endif
 
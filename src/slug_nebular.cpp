@@ -314,7 +314,7 @@ void slug_nebular::read_H2photon(const char *atomic_dir) {
     ostreams.slug_err_one
       << "unable to open H data file " 
       << Halpha2s_path.string() << endl;
-    exit(1);
+    bailout(1);
   }
 
   // Read until we find a non-comment, non-blank line
@@ -24,6 +24,7 @@ namespace std
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
@@ -59,6 +60,7 @@ slug_parmParser::slug_parmParser(int argc, char **argv,
 #ifdef ENABLE_MPI
   // Get rank if working in MPI mode
   if (comm != MPI_COMM_NULL) MPI_Comm_rank(comm, &rank);
+  else rank = 0;
 #endif
 
   // First make sure we have the right number of arguments; if not,
@@ -130,6 +132,18 @@ slug_parmParser::slug_parmParser(int argc, char **argv,
   // Check that all parameters are set to valid values
   checkParams();
 
+  // Merged output files cannot be restarted
+  if (restart && mergeOutput) {
+    ostreams.slug_err_one << "cannot restart a run with merge_output set"
+			  << std::endl;
+    bailout(1);
+  }
+  if (restart && distributeGalaxy) {
+    ostreams.slug_err_one << "cannot restart a run with distribute_galaxy set"
+			  << std::endl;
+    bailout(1);
+  }
+
   // If this is a restart, parse the restart files to figure out how
   // many completed trials they contain, and to set the checkpoint
   // counter
@@ -137,6 +151,65 @@ slug_parmParser::slug_parmParser(int argc, char **argv,
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Constructor used for a single configuration in a parameter
+// sweep. This reads the parameter file, then applies each of the
+// strings in overrides as if it were an additional line at the end of
+// the file, so that it replaces any value set in the file, and
+// appends model_suffix to the model name so that each configuration
+// writes its own output files. Restarts are not supported in this
+// mode.
+////////////////////////////////////////////////////////////////////////
+
+slug_parmParser::slug_parmParser(const string &paramFileName,
+				 const vector<string> &overrides,
+				 const string &model_suffix,
+				 slug_ostreams &ostreams_
+#ifdef ENABLE_MPI
+				 , MPI_Comm comm_
+#endif
+				 ) :
+  ostreams(ostreams_)
+#ifdef ENABLE_MPI
+  , comm(comm_)
+#endif
+{
+#ifdef ENABLE_MPI
+  // Get rank if working in MPI mode
+  if (comm != MPI_COMM_NULL) MPI_Comm_rank(comm, &rank);
+  else rank = 0;
+#endif
+
+  // Start by setting all parameters to their default values
+  setDefaults();
+
+  // Read the parameter file into memory, and exit with error message
+  // if we can't
+  std::ifstream paramFile;
+  paramFile.open(paramFileName.c_str(), ios::in);
+  if (!paramFile.is_open()) {
+    ostreams.slug_err_one << "unable to open file " 
+			  << paramFileName << endl;
+    exit(1);
+  }
+  stringstream params;
+  string line;
+  while (getline(paramFile, line)) params << line << endl;
+  paramFile.close();
+
+  // Append the overrides, then parse
+  for (vector<string>::size_type i=0; i<overrides.size(); i++)
+    params << overrides[i] << endl;
+  parseFile(params);
+
+  // Tag the model name
+  model += model_suffix;
+
+  // Check that all parameters are set to valid values
+  checkParams();
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // The destructor
 ////////////////////////////////////////////////////////////////////////
@@ -153,6 +226,8 @@ slug_parmParser::printUsage() {
   ostreams.slug_out_one << "Usage: slug slug.param" << std::endl;
   ostreams.slug_out_one << "       slug [-r or --restart] slug.param"
 			<< std::endl;
+  ostreams.slug_out_one << "       slug [-s or --sweep] sweep.list"
+			<< std::endl;
   ostreams.slug_out_one << "       slug [-h or --help]" << std::endl;
 }
 
@@ -168,6 +243,7 @@ slug_parmParser::setDefaults() {
   model = "SLUG_DEF";
   outDir = "";
   verbosity = 1;
+  parallelStartup = true;
 
   // Control flow parameters
   run_galaxy_sim = true;
@@ -230,6 +306,7 @@ slug_parmParser::setDefaults() {
   path filter_path("filters");
   filter_dir = (lib_path / filter_path).string();
   phot_mode = L_NU;
+  photLambdaSubset = true;
 
   // Line parameters
   path line_path("lines");
@@ -243,6 +320,15 @@ slug_parmParser::setDefaults() {
     writeIntegratedYield = writeIntegratedSN = writeClusterSN = true;
   writeClusterEW = false;
   out_mode = ASCII;
+  mergeOutput = false;
+  distributeGalaxy = false;
+
+  // Summary statistics parameters
+  writeStats = false;
+  statsQuantSet = false;
+  statsProp = statsPhot = statsSN = statsYield = false;
+  statsNBin = 50;
+  statsSketchK = 200;
 
   // Yield parameters
   path yield_path("yields");
@@ -256,7 +342,7 @@ slug_parmParser::setDefaults() {
 ////////////////////////////////////////////////////////////////////////
 
 void
-slug_parmParser::parseFile(std::ifstream &paramFile) {
+slug_parmParser::parseFile(std::istream &paramFile) {
   string line;
   while (!(paramFile.eof())) {
 
@@ -294,6 +380,8 @@ slug_parmParser::parseFile(std::ifstream &paramFile) {
 	outDir = tokens[1];
       } else if (!(tokens[0].compare("verbosity"))) {
 	verbosity = lexical_cast<unsigned int>(tokens[1]);
+      } else if (!(tokens[0].compare("parallel_startup"))) {
+	parallelStartup = lexical_cast<int>(tokens[1]) != 0;
       }
       
       // Simulation control parameters
@@ -453,6 +541,67 @@ slug_parmParser::parseFile(std::ifstream &paramFile) {
 	  bailout(1);
 	}	
       }
+      else if (!(tokens[0].compare("merge_output"))) {
+	mergeOutput = lexical_cast<int>(tokens[1]) != 0;
+      }
+      else if (!(tokens[0].compare("distribute_galaxy"))) {
+	distributeGalaxy = lexical_cast<int>(tokens[1]) != 0;
+      }
+
+      // Summary statistics keywords
+      else if (!(tokens[0].compare("out_stats"))) {
+	writeStats = lexical_cast<int>(tokens[1]) != 0;
+      } else if (!(tokens[0].compare("stats_quantities"))) {
+
+	// Flag that the user has chosen the quantities
+	statsQuantSet = true;
+	nTokExpected = 1;
+
+	// Parse the list of quantity groups one token at a time
+	for (unsigned int tokPtr = 1; tokPtr < tokens.size(); tokPtr++) {
+	  if ((tokens[tokPtr]).compare(0, 1, "#") == 0) break;
+	  nTokExpected++;
+	  vector<string> quantTmp;
+	  split(quantTmp, tokens[tokPtr], is_any_of(", "),
+		token_compress_on);
+	  for (unsigned int i = 0; i < quantTmp.size(); i++) {
+	    if (quantTmp[i].length() == 0) continue;
+	    to_lower(quantTmp[i]);
+	    if (quantTmp[i].compare("prop") == 0)
+	      statsProp = true;
+	    else if (quantTmp[i].compare("phot") == 0)
+	      statsPhot = true;
+	    else if (quantTmp[i].compare("sn") == 0)
+	      statsSN = true;
+	    else if (quantTmp[i].compare("yield") == 0)
+	      statsYield = true;
+	    else {
+	      ostreams.slug_err_one << "unknown stats_quantities value: "
+				    << line << std::endl;
+	      bailout(1);
+	    }
+	  }
+	}
+      } else if (!(tokens[0].compare("stats_quantiles"))) {
+
+	// Parse the list of quantiles one token at a time
+	nTokExpected = 1;
+	for (unsigned int tokPtr = 1; tokPtr < tokens.size(); tokPtr++) {
+	  if ((tokens[tokPtr]).compare(0, 1, "#") == 0) break;
+	  nTokExpected++;
+	  vector<string> quantTmp;
+	  split(quantTmp, tokens[tokPtr], is_any_of(", "),
+		token_compress_on);
+	  for (unsigned int i = 0; i < quantTmp.size(); i++) {
+	    if (quantTmp[i].length() == 0) continue;
+	    statsQuantiles.push_back(lexical_cast<double>(quantTmp[i]));
+	  }
+	}
+      } else if (!(tokens[0].compare("stats_nbin"))) {
+	statsNBin = lexical_cast<unsigned int>(tokens[1]);
+      } else if (!(tokens[0].compare("stats_sketch_k"))) {
+	statsSketchK = lexical_cast<unsigned int>(tokens[1]);
+      }
 
       // Stellar model keywords
       else if (!(tokens[0].compare("imf"))) {
@@ -606,6 +755,8 @@ slug_parmParser::parseFile(std::ifstream &paramFile) {
 				<< line << std::endl;
 	  bailout(1);
 	}
+      } else if (!(tokens[0].compare("phot_lambda_subset"))) {
+	photLambdaSubset = lexical_cast<int>(tokens[1]) != 0;
       }
 
       // Yields keywords
@@ -799,7 +950,7 @@ slug_parmParser::checkParams() {
       && !writeClusterSpec && !writeClusterYield
       && !writeIntegratedPhot && !writeIntegratedSpec
       && !writeIntegratedProp && !writeIntegratedYield
-      && !writeClusterEW) {
+      && !writeClusterEW && !writeStats) {
     valueError("no output requested");
   }
   if ((writeClusterPhot || writeIntegratedPhot) && 
@@ -819,6 +970,54 @@ slug_parmParser::checkParams() {
 			 out_mode == BINARY)) {
     valueError("equivalent widths not yet supported in ASCII or BINARY output modes");
   }
+  if (mergeOutput && out_mode != BINARY) {
+    valueError("merge_output is only supported with output_mode binary");
+  }
+  // Checkpoints are per-process sets of files, opened and closed
+  // when each process reaches a given number of its own trials, while
+  // a merged file is shared by all processes and must be opened and
+  // closed by all of them together, so the two cannot be combined
+  if (mergeOutput && checkpointInterval != 0) {
+    valueError("merge_output cannot be used with checkpointing");
+  }
+  if (distributeGalaxy && !run_galaxy_sim) {
+    valueError("distribute_galaxy requires sim_type = galaxy");
+  }
+  if (distributeGalaxy && mergeOutput) {
+    valueError("distribute_galaxy cannot be used with merge_output");
+  }
+  if (distributeGalaxy && checkpointInterval != 0) {
+    valueError("distribute_galaxy cannot be used with checkpointing");
+  }
+  if (writeStats && !run_galaxy_sim) {
+    valueError("out_stats requires sim_type = galaxy");
+  }
+  if (writeStats && checkpointInterval != 0) {
+    valueError("out_stats cannot be used with checkpointing");
+  }
+  if (writeStats && statsPhot && photBand.size() == 0) {
+    valueError("photometric statistics requested, but no photometric bands specified");
+  }
+  if (writeStats && statsNBin < 1) {
+    valueError("stats_nbin must be >= 1");
+  }
+  if (writeStats && statsSketchK < 8) {
+    valueError("stats_sketch_k must be >= 8");
+  }
+  for (vector<double>::size_type i=0; i<statsQuantiles.size(); i++) {
+    if (statsQuantiles[i] < 0.0 || statsQuantiles[i] > 1.0)
+      valueError("stats_quantiles must be in the range [0,1]");
+  }
+
+  // Default summary statistics: physical properties, plus photometry
+  // if we have photometric bands, at the standard quantiles
+  if (!statsQuantSet) {
+    statsProp = true;
+    statsPhot = photBand.size() > 0;
+  }
+  if (statsQuantiles.size() == 0)
+    statsQuantiles = { 0.01, 0.05, 0.16, 0.25, 0.5, 0.75, 0.84,
+		       0.95, 0.99 };
 
   // Make sure filter names are unique; if not, eliminate duplicates
   // and spit out a warning
@@ -1132,6 +1331,7 @@ slug_parmParser::writeParams() const {
   paramFile << "SLUG WAS RUN WITH THE FOLLOWING PARAMETERS" << endl;
   paramFile << "model_name           " << model << endl;
   paramFile << "out_dir              " << outDir << endl;
+  paramFile << "parallel_startup     " << parallelStartup << endl;
   paramFile << "sim_type             ";
   if (run_galaxy_sim)
     paramFile << "galaxy" << endl;
@@ -1226,6 +1426,7 @@ slug_parmParser::writeParams() const {
     } else if (phot_mode == VEGA) {
       paramFile << "Vega" << endl;
     }
+    paramFile << "phot_lambda_subset   " << photLambdaSubset << endl;
   }
   paramFile << "out_cluster          " << writeClusterProp << endl;
   paramFile << "out_cluster_phot     " << writeClusterPhot << endl;
@@ -1264,6 +1465,32 @@ slug_parmParser::writeParams() const {
     paramFile << "output_mode          binary" << endl;
   else if (out_mode == ASCII)
     paramFile << "output_mode          ASCII" << endl;
+  if (mergeOutput)
+    paramFile << "merge_output         " << mergeOutput << endl;
+  if (distributeGalaxy)
+    paramFile << "distribute_galaxy    " << distributeGalaxy << endl;
+  if (writeStats) {
+    paramFile << "out_stats            " << writeStats << endl;
+    paramFile << "stats_quantities     ";
+    vector<string> groups;
+    if (statsProp) groups.push_back("prop");
+    if (statsPhot) groups.push_back("phot");
+    if (statsSN) groups.push_back("sn");
+    if (statsYield) groups.push_back("yield");
+    for (unsigned int i=0; i<groups.size(); i++) {
+      paramFile << groups[i];
+      if (i < groups.size()-1) paramFile << ", ";
+    }
+    paramFile << endl;
+    paramFile << "stats_quantiles      ";
+    for (unsigned int i=0; i<statsQuantiles.size(); i++) {
+      paramFile << statsQuantiles[i];
+      if (i < statsQuantiles.size()-1) paramFile << ", ";
+    }
+    paramFile << endl;
+    paramFile << "stats_nbin           " << statsNBin << endl;
+    paramFile << "stats_sketch_k       " << statsSketchK << endl;
+  }
 
   // Close
   paramFile.close();
@@ -1274,6 +1501,8 @@ slug_parmParser::writeParams() const {
 ////////////////////////////////////////////////////////////////////////
 
 unsigned int slug_parmParser::get_verbosity() const { return verbosity; }
+bool slug_parmParser::get_parallelStartup() const
+{ return parallelStartup; }
 unsigned int slug_parmParser::get_nTrials() const { return nTrials; }
 unsigned int slug_parmParser::get_checkpoint_interval() const
 { return checkpointInterval; }
@@ -1360,9 +1589,24 @@ const { return writeIntegratedYield; }
 bool slug_parmParser::get_writeClusterEW()
 const { return writeClusterEW; }
 outputMode slug_parmParser::get_outputMode() const { return out_mode; }
+bool slug_parmParser::get_mergeOutput() const { return mergeOutput; }
+bool slug_parmParser::get_distributeGalaxy() const
+{ return distributeGalaxy; }
+bool slug_parmParser::get_writeStats() const { return writeStats; }
+bool slug_parmParser::get_statsProp() const { return statsProp; }
+bool slug_parmParser::get_statsPhot() const { return statsPhot; }
+bool slug_parmParser::get_statsSN() const { return statsSN; }
+bool slug_parmParser::get_statsYield() const { return statsYield; }
+const vector<double>& slug_parmParser::get_statsQuantiles() const
+{ return statsQuantiles; }
+unsigned int slug_parmParser::get_statsNBin() const { return statsNBin; }
+unsigned int slug_parmParser::get_statsSketchK() const
+{ return statsSketchK; }
 specsynMode slug_parmParser::get_specsynMode() const { return specsyn_mode; }
 trackSet slug_parmParser::get_trackSet() const { return track_set; }
 photMode slug_parmParser::get_photMode() const { return phot_mode; }
+bool slug_parmParser::get_photLambdaSubset() const
+{ return photLambdaSubset; }
 yieldMode slug_parmParser::get_yieldMode() const { return yield_mode; }
 bool slug_parmParser::galaxy_sim() const { return run_galaxy_sim; }
 double slug_parmParser::get_cluster_mass() const { return cluster_mass; }
@@ -0,0 +1,41 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "slug_physics_cache.H"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////
+// Destructor; nebular objects and synthesizers refer to the tracks,
+// so delete those first
+////////////////////////////////////////////////////////////////////////
+slug_physics_cache::~slug_physics_cache() {
+  for (map<string, slug_nebular *>::iterator it = nebular.begin();
+       it != nebular.end(); ++it)
+    delete it->second;
+  for (map<string, slug_specsyn *>::iterator it = specsyn.begin();
+       it != specsyn.end(); ++it)
+    delete it->second;
+  for (map<string, slug_yields *>::iterator it = yields.begin();
+       it != yields.end(); ++it)
+    delete it->second;
+  for (map<string, slug_filter_set *>::iterator it = filters.begin();
+       it != filters.end(); ++it)
+    delete it->second;
+  for (map<string, slug_tracks *>::iterator it = tracks.begin();
+       it != tracks.end(); ++it)
+    delete it->second;
+}
@@ -24,6 +24,7 @@ namespace std
 #include "slug_MPI.H"
 #include "slug_IO.H"
 #include "slug_sim.H"
+#include "slug_trial_counter.H"
 #include "pdfs/slug_PDF_powerlaw.H"
 #include "specsyn/slug_specsyn_hillier.H"
 #include "specsyn/slug_specsyn_kurucz.H"
@@ -33,7 +34,9 @@ namespace std
 #include "specsyn/slug_specsyn_sb99hruv.H"
 #include "tracks/slug_tracks_mist.H"
 #include "tracks/slug_tracks_sb99.H"
+#include "utils/slug_task_group.H"
 #include "yields/slug_yields_multiple.H"
+#include <chrono>
 #include <cmath>
 #include <ctime>
 #include <iomanip>
@@ -55,7 +58,9 @@ slug_sim::slug_sim(const slug_parmParser& pp_, slug_ostreams &ostreams_
 #ifdef ENABLE_MPI
 		   , MPI_Comm comm_
 #endif
+		   , slug_physics_cache *cache_
 		   ) : pp(pp_),
+		       cache(cache_),
 		       ostreams(ostreams_)
 #ifdef ENABLE_MPI
 		       , comm(comm_)
@@ -183,134 +188,31 @@ slug_sim::slug_sim(const slug_parmParser& pp_, slug_ostreams &ostreams_
     outTimes = pp.get_outTimes();
   }
 
-  // Set up the photometric filters
-  if (pp.get_nPhot() > 0) {
-    if (pp.get_verbosity() > 1)
-      ostreams.slug_out_one << "reading filters" << std::endl;
-    filters = new slug_filter_set(pp.get_photBand(), 
-				  pp.get_filter_dir(), 
-				  pp.get_photMode(),
-				  ostreams,
-				  pp.get_atmos_dir());
-  } else {
-    filters = nullptr;
-  }
-
-  // Read the tracks
-  if (pp.get_verbosity() > 1)
-    ostreams.slug_out_one << "reading tracks" << std::endl;
-  switch (pp.get_trackSet()) {
-  case NO_TRACK_SET: {
-    // User has manually specified the file name; decide if it is a
-    // starburst99 or MIST file based on its extension; note that
-    // MIST files are only usable if we have FITS capability
-    string fname(pp.get_trackFile());
-    size_t pos = fname.find_last_of(".");
-    bool mist_ext;
-    if (pos == string::npos) {
-      mist_ext = false;
-    } else if (fname.substr(pos).compare(".gz") == 0) {
-      mist_ext = true;
-    } else {
-      mist_ext = false;
-    }
-    if (mist_ext) {
-#ifdef ENABLE_FITS
-      tracks = (slug_tracks *)
-	new slug_tracks_mist(pp.get_trackFile(), ostreams);
-#else
-      ostreams.slug_err_one
-        << "MIST gzip'ed track files only available if "
-        << "SLUG was compiled with ENABLE_FITS option"
-        << endl;
-      exit(1);
-#endif
-    } else {
-      tracks = (slug_tracks *)
-	new slug_tracks_sb99(pp.get_trackFile(), ostreams);
-    }
-    break;
-  }
-  case GENEVA_2013_VVCRIT_00:
-  case GENEVA_2013_VVCRIT_40:
-  case GENEVA_MDOT_STD:
-  case GENEVA_MDOT_ENHANCED:
-  case PADOVA_TPAGB_YES:
-  case PADOVA_TPAGB_NO: {
-    // These are starburst99 track sets
-    tracks = (slug_tracks *)
-      new slug_tracks_sb99(pp.get_trackSet(), pp.get_metallicity(),
-			   pp.get_track_dir(), ostreams);
-    break;
-  }
-#ifdef ENABLE_FITS
-  case MIST_2016_VVCRIT_00:
-  case MIST_2016_VVCRIT_40: {
-    // These are MIST track sets
-    tracks = (slug_tracks *)
-      new slug_tracks_mist(pp.get_trackSet(), pp.get_metallicity(),
-			   pp.get_track_dir(), ostreams);
-    break;
-  }
-#endif
-  }
+  // Read the data files that describe the stellar physics. The
+  // filters, tracks, and line list are independent of one another,
+  // so they are read concurrently; the spectral synthesizer and the
+  // yield tables need the tracks, and the nebular tables need the
+  // synthesizer's wavelength grid, so these are read in later
+  // stages. The PDFs are set up on this thread between the first and
+  // second stages, since the synthesizer needs the IMF and SFH.
+  chrono::steady_clock::time_point load_start =
+    chrono::steady_clock::now();
+  slug_task_group loaders(pp.get_parallelStartup());
+  filters = nullptr;
+  lines = nullptr;
+  yields = nullptr;
+  nebular = nullptr;
+  if (pp.get_nPhot() > 0)
+    loaders.run("filters", [this]() { load_filters(); });
+  loaders.run("tracks", [this]() { load_tracks(); });
+  if (pp.get_writeClusterEW())
+    loaders.run("line list", [this]() { load_lines(); });
+  wait_loaders(loaders);
 
-  // If we're computing yields, set up yield tables
-  if (pp.get_writeClusterYield() || pp.get_writeIntegratedYield() ||
-      pp.get_writeClusterSN() || pp.get_writeIntegratedSN()) {
-    if (pp.get_verbosity() > 1)
-      ostreams.slug_out_one << "reading yield tables" << std::endl;
-    yields = (slug_yields *)
-      new slug_yields_multiple(pp.get_yield_dir(),
-			       pp.get_yieldMode(),
-			       ((slug_tracks_2d *) tracks)->get_metallicity(),
-			       ostreams,
-			       pp.no_decay_isotopes(),
-			       pp.output_all_isotopes());
-  } else {
-    yields = nullptr;
-  }
-  
   // Set up the IMF, including the limts on its stochasticity
   imf = new slug_PDF(pp.get_IMF(), rng, ostreams);
   imf->set_stoch_lim(pp.get_min_stoch_mass());
 
-  // Compare IMF and tracks, and issue warning if IMF extends outside
-  // range of tracks
-  if (imf->get_xMin() < tracks->min_mass()*(1.0-1.0e-10)) {
-    ostreams.slug_warn_one
-      << "minimum IMF mass " << imf->get_xMin() 
-      << " Msun < minimum evolution track mass " << tracks->min_mass()
-      << " Msun. Calculation will proceed, but stars with mass "
-      << imf->get_xMin() << " Msun to " << tracks->min_mass()
-      << " Msun will be treated as having zero luminosity." << std::endl;
-  }
-  if (imf->get_xMax() > tracks->max_mass()*(1.0+1.0e-10))
-    ostreams.slug_warn_one
-      << "maximum IMF mass " << imf->get_xMax() 
-      << " Msun > maximum evolution track mass " << tracks->max_mass()
-      << " Msun. Calculation will proceed, but stars with mass "
-      << tracks->max_mass() << " Msun to " << imf->get_xMax()
-      << " Msun will be treated as having zero luminosity." << std::endl;
-  
-  // Ditto for IMF and yield table
-  if (yields) {
-    if (imf->get_xMin() < yields->min_mass()*(1.0-1.0e-10))
-      ostreams.slug_warn_one
-	<< "minimum IMF mass " << imf->get_xMin() 
-	<< " Msun < minimum yield table mass " << yields->min_mass()
-	<< " Msun. Calculation will proceed, but stars with mass "
-	<< imf->get_xMin() << " Msun to " << yields->min_mass()
-	<< " Msun will be treated as having zero yield." << endl;
-    if (imf->get_xMax() > yields->max_mass()*(1.0+1.0e-10))
-      ostreams.slug_warn_one
-	<< "maximum IMF mass " << imf->get_xMax() 
-	<< " Msun > maximum yield table mass " << yields->max_mass()
-	<< " Msun. Calculation will proceed, but stars with mass "
-	<< yields->max_mass() << " Msun to " << imf->get_xMax()
-	<< " Msun will be treated as having zero yield." << endl;
-  }
-  
   // Check for variable segments & initialise them
   is_imf_var = imf->init_vsegs();	
 	
@@ -360,80 +262,69 @@ slug_sim::slug_sim(const slug_parmParser& pp_, slug_ostreams &ostreams_
     }
   }
 
-  // Initialize the spectral synthesizer
-  if (pp.get_verbosity() > 1)
-    ostreams.slug_out_one << "reading atmospheres" << std::endl;
-  if (pp.get_specsynMode() == PLANCK) {
-    specsyn = static_cast<slug_specsyn *>
-      (new slug_specsyn_planck(tracks, imf, sfh, ostreams, pp.get_z()));
-  } else if (pp.get_specsynMode() == KURUCZ) {
-    specsyn = static_cast<slug_specsyn *>
-      (new slug_specsyn_kurucz(pp.get_atmos_dir(), tracks, 
-			       imf, sfh, ostreams, pp.get_z()));
-  } else if (pp.get_specsynMode() == KURUCZ_HILLIER) {
-    specsyn = static_cast<slug_specsyn *>
-      (new slug_specsyn_hillier(pp.get_atmos_dir(), tracks, 
-				imf, sfh, ostreams, pp.get_z()));
-  } else if (pp.get_specsynMode() == KURUCZ_PAULDRACH) {
-    specsyn = static_cast<slug_specsyn *>
-      (new slug_specsyn_pauldrach(pp.get_atmos_dir(), tracks, 
-				  imf, sfh, ostreams, pp.get_z()));
-  } else if (pp.get_specsynMode() == SB99) {
-    specsyn = static_cast<slug_specsyn *> 
-      (new slug_specsyn_sb99(pp.get_atmos_dir(), tracks,
-			     imf, sfh, ostreams, pp.get_z()));
-  }
-  else if  (pp.get_specsynMode() == SB99_HRUV) {
-    specsyn = static_cast<slug_specsyn *> 
-      (new slug_specsyn_sb99hruv(pp.get_atmos_dir(), tracks,
-				 imf, sfh, ostreams, pp.get_z()));   
-  }
-
-  // Load line list for equivalent width calculations
-  if (pp.get_writeClusterEW()) {
-    if (pp.get_verbosity() > 1) {
-      ostreams.slug_out_one << "reading line list" << std::endl;
-    }    
-    lines = new slug_line_list(pp.get_linepicks(),
-			       pp.get_line_dir(),
-			       ostreams);
-  } else {
-    lines = nullptr;
-  }
-  
-  // If using nebular emission, initialize the computation of that
+  // Second and third loading stages
+  loaders.run("spectral synthesizer", [this]() { load_specsyn(); });
+  if (pp.get_writeClusterYield() || pp.get_writeIntegratedYield() ||
+      pp.get_writeClusterSN() || pp.get_writeIntegratedSN() ||
+      (pp.get_writeStats() && (pp.get_statsSN() || pp.get_statsYield())))
+    loaders.run("yield tables", [this]() { load_yields(); });
+  wait_loaders(loaders);
   if (pp.get_use_nebular()) {
-    if (pp.get_trackSet() == NO_TRACK_SET) {
-      // User has manually specified a file name
-      nebular = new slug_nebular(pp.get_atomic_dir(),
-				 specsyn->lambda(true),
-				 pp.get_trackFile(),
-				 ostreams,
-				 pp.get_nebular_den(),
-				 pp.get_nebular_temp(),
-				 pp.get_nebular_logU(),
-				 pp.get_nebular_phi(),
-				 pp.get_z(),
-				 pp.nebular_no_metals());
-    } else {
-      // User has specified a track set
-      nebular
-	= new slug_nebular(pp.get_atomic_dir(),
-			   specsyn->lambda(true),
-			   ((slug_tracks_2d *) tracks)->get_metallicity(),
-			   ((slug_tracks_2d *) tracks)->trackset_filenames(),
-			   ((slug_tracks_2d *) tracks)->trackset_metallicities(),
-			   ((slug_tracks_2d *) tracks)->trackset_Z_int_meth(),
-			   ostreams,
-			   pp.get_nebular_den(),
-			   pp.get_nebular_temp(),
-			   pp.get_nebular_logU(),
-			   pp.get_nebular_phi(),
-			   pp.get_z(),
-			   pp.nebular_no_metals());
+    loaders.run("nebular tables", [this]() { load_nebular(); });
+    wait_loaders(loaders);
+  }
+
+  // Report how long each component took to load
+  if (pp.get_verbosity() > 1) {
+    vector<double> t = loaders.times();
+    for (vector<double>::size_type i=0; i<t.size(); i++) {
+      ostringstream ss;
+      ss << fixed << setprecision(2) << t[i];
+      ostreams.slug_out_one << "loaded " << loaders.names()[i]
+			    << " in " << ss.str() << " s" << std::endl;
     }
-  } else {
-    nebular = nullptr;
+    ostringstream ss;
+    ss << fixed << setprecision(2)
+       << chrono::duration<double>
+      (chrono::steady_clock::now() - load_start).count();
+    ostreams.slug_out_one << "startup data loaded in " << ss.str()
+			  << " s" << std::endl;
+  }
+
+  // Compare IMF and tracks, and issue warning if IMF extends outside
+  // range of tracks
+  if (imf->get_xMin() < tracks->min_mass()*(1.0-1.0e-10)) {
+    ostreams.slug_warn_one
+      << "minimum IMF mass " << imf->get_xMin() 
+      << " Msun < minimum evolution track mass " << tracks->min_mass()
+      << " Msun. Calculation will proceed, but stars with mass "
+      << imf->get_xMin() << " Msun to " << tracks->min_mass()
+      << " Msun will be treated as having zero luminosity." << std::endl;
+  }
+  if (imf->get_xMax() > tracks->max_mass()*(1.0+1.0e-10))
+    ostreams.slug_warn_one
+      << "maximum IMF mass " << imf->get_xMax() 
+      << " Msun > maximum evolution track mass " << tracks->max_mass()
+      << " Msun. Calculation will proceed, but stars with mass "
+      << tracks->max_mass() << " Msun to " << imf->get_xMax()
+      << " Msun will be treated as having zero luminosity." << std::endl;
+  
+  // Ditto for IMF and yield table
+  if (yields) {
+    if (imf->get_xMin() < yields->min_mass()*(1.0-1.0e-10))
+      ostreams.slug_warn_one
+	<< "minimum IMF mass " << imf->get_xMin() 
+	<< " Msun < minimum yield table mass " << yields->min_mass()
+	<< " Msun. Calculation will proceed, but stars with mass "
+	<< imf->get_xMin() << " Msun to " << yields->min_mass()
+	<< " Msun will be treated as having zero yield." << endl;
+    if (imf->get_xMax() > yields->max_mass()*(1.0+1.0e-10))
+      ostreams.slug_warn_one
+	<< "maximum IMF mass " << imf->get_xMax() 
+	<< " Msun > maximum yield table mass " << yields->max_mass()
+	<< " Msun. Calculation will proceed, but stars with mass "
+	<< yields->max_mass() << " Msun to " << imf->get_xMax()
+	<< " Msun will be treated as having zero yield." << endl;
   }
 
   // If using extinction, initialize the extinction curve
@@ -470,10 +361,49 @@ slug_sim::slug_sim(const slug_parmParser& pp_, slug_ostreams &ostreams_
 
   // Record the output mode and set the checkpoint counter
   out_mode = pp.get_outputMode();
+#ifdef ENABLE_MPI
+  merge_output = pp.get_mergeOutput() && (comm != MPI_COMM_NULL);
+  distribute_galaxy = pp.get_distributeGalaxy() && (comm != MPI_COMM_NULL);
+#else
+  merge_output = distribute_galaxy = false;
+#endif
+  id_start = 0;
+  id_stride = 1;
+
+  // If the galaxy is distributed over processes, every process owns a
+  // share of its stars; only the root writes integrated outputs
+#ifdef ENABLE_MPI
+  if (distribute_galaxy) {
+    if (is_imf_var) {
+      ostreams.slug_err_one
+	<< "distribute_galaxy cannot be used with variable IMFs" << endl;
+      bailout(1);
+    }
+    galaxy->set_partition(comm);
+  }
+
+  // If all processes write clusters into the same files, interleave
+  // the cluster IDs so that they are unique across processes
+  if (merge_output) {
+    int nproc;
+    MPI_Comm_size(comm, &nproc);
+    id_start = rank;
+    id_stride = nproc;
+    if (galaxy) galaxy->set_cluster_ids(id_start, id_stride);
+  }
+  write_integrated = !distribute_galaxy || rank == 0;
+#else
+  write_integrated = true;
+#endif
   if (pp.get_checkpoint_interval() == 0)
     checkpoint_ctr = -1; // Indicate no checkpointing
   else
     checkpoint_ctr = pp.get_checkpoint_ctr();  
+
+  // If we are restarting a galaxy simulation from checkpoints,
+  // restore the state saved with the last of them
+  if (galaxy && checkpoint_ctr > 0)
+    read_checkpoint_state(checkpoint_ctr-1);
 }
 
 
@@ -485,23 +415,314 @@ slug_sim::~slug_sim() {
   // Clean up variable parameter storage
   imf_vpdraws.clear();
 
-  // Delete the various objects we created
+  // Delete the various objects we created; objects shared through a
+  // physics cache belong to the cache
   if (galaxy != nullptr) delete galaxy;
   if (cluster != nullptr) delete cluster;
-  if (specsyn != nullptr) delete specsyn;
   if (sfh != nullptr) delete sfh;
   if (clf != nullptr) delete clf;
   if (cmf != nullptr) delete cmf;
   if (imf != nullptr) delete imf;
-  if (tracks != nullptr) delete tracks;
-  if (yields != nullptr) delete yields;
   if (rng != nullptr) delete rng;
-  if (filters != nullptr) delete filters;
   if (out_time_pdf != nullptr) delete out_time_pdf;
   if (sfr_pdf != nullptr) delete sfr_pdf;
   if (extinct != nullptr) delete extinct;
-  if (nebular != nullptr) delete nebular;
   if (lines != nullptr) delete lines;
+  if (cache == nullptr) {
+    if (specsyn != nullptr) delete specsyn;
+    if (tracks != nullptr) delete tracks;
+    if (yields != nullptr) delete yields;
+    if (filters != nullptr) delete filters;
+    if (nebular != nullptr) delete nebular;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to wait for a stage of loading to finish. Diagnostics
+// written by the loaders are held until they finish, and any error
+// that stopped one of them is reported here, so that only this
+// thread writes output, makes MPI calls, or ends the program.
+////////////////////////////////////////////////////////////////////////
+void slug_sim::wait_loaders(slug_task_group &loaders) {
+  try {
+    loaders.wait();
+  } catch (const slug_bailout_error &e) {
+    ostreams.release_held();
+    bailout(e.exit_val);
+  } catch (const std::exception &e) {
+    ostreams.release_held();
+    ostreams.slug_err_one << "error while reading data files: "
+			  << e.what() << endl;
+    bailout(1);
+  } catch (...) {
+    ostreams.release_held();
+    ostreams.slug_err_one << "unknown error while reading data files"
+			  << endl;
+    bailout(1);
+  }
+  ostreams.release_held();
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to read the photometric filters. This and the other load_
+// methods below may run concurrently with one another, so they must
+// not use the random number generator, or modify any object other
+// than the one they create
+////////////////////////////////////////////////////////////////////////
+void slug_sim::load_filters() {
+  ostringstream key;
+  key << pp.get_filter_dir() << "|" << pp.get_atmos_dir() << "|"
+      << pp.get_photMode();
+  for (vector<string>::size_type i=0; i<pp.get_nPhot(); i++)
+    key << "|" << pp.get_photBand(i);
+  filters = cache ? cache->get_filters(key.str()) : nullptr;
+  if (!filters) {
+    if (pp.get_verbosity() > 1)
+      ostreams.slug_out_one << "reading filters" << std::endl;
+    filters = new slug_filter_set(pp.get_photBand(), 
+				  pp.get_filter_dir(), 
+				  pp.get_photMode(),
+				  ostreams,
+				  pp.get_atmos_dir());
+    if (cache) filters = cache->add(key.str(), filters);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to read the stellar tracks
+////////////////////////////////////////////////////////////////////////
+void slug_sim::load_tracks() {
+  ostringstream key;
+  key << setprecision(17) << pp.get_trackSet() << "|"
+      << pp.get_trackFile() << "|" << pp.get_track_dir() << "|"
+      << pp.get_metallicity();
+  track_key = key.str();
+  tracks = cache ? cache->get_tracks(track_key) : nullptr;
+  if (!tracks) {
+    if (pp.get_verbosity() > 1)
+      ostreams.slug_out_one << "reading tracks" << std::endl;
+    switch (pp.get_trackSet()) {
+    case NO_TRACK_SET: {
+      // User has manually specified the file name; decide if it is a
+      // starburst99 or MIST file based on its extension; note that
+      // MIST files are only usable if we have FITS capability
+      string fname(pp.get_trackFile());
+      size_t pos = fname.find_last_of(".");
+      bool mist_ext;
+      if (pos == string::npos) {
+	mist_ext = false;
+      } else if (fname.substr(pos).compare(".gz") == 0) {
+	mist_ext = true;
+      } else {
+	mist_ext = false;
+      }
+      if (mist_ext) {
+#ifdef ENABLE_FITS
+	tracks = (slug_tracks *)
+	  new slug_tracks_mist(pp.get_trackFile(), ostreams);
+#else
+	ostreams.slug_err_one
+	  << "MIST gzip'ed track files only available if "
+	  << "SLUG was compiled with ENABLE_FITS option"
+	  << endl;
+	bailout(1);
+#endif
+      } else {
+	tracks = (slug_tracks *)
+	  new slug_tracks_sb99(pp.get_trackFile(), ostreams);
+      }
+      break;
+    }
+    case GENEVA_2013_VVCRIT_00:
+    case GENEVA_2013_VVCRIT_40:
+    case GENEVA_MDOT_STD:
+    case GENEVA_MDOT_ENHANCED:
+    case PADOVA_TPAGB_YES:
+    case PADOVA_TPAGB_NO: {
+      // These are starburst99 track sets
+      tracks = (slug_tracks *)
+	new slug_tracks_sb99(pp.get_trackSet(), pp.get_metallicity(),
+			     pp.get_track_dir(), ostreams);
+      break;
+    }
+#ifdef ENABLE_FITS
+    case MIST_2016_VVCRIT_00:
+    case MIST_2016_VVCRIT_40: {
+      // These are MIST track sets
+      tracks = (slug_tracks *)
+	new slug_tracks_mist(pp.get_trackSet(), pp.get_metallicity(),
+			     pp.get_track_dir(), ostreams);
+      break;
+    }
+#endif
+    }
+    if (cache) tracks = cache->add(track_key, tracks);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to read the yield tables
+////////////////////////////////////////////////////////////////////////
+void slug_sim::load_yields() {
+  ostringstream key;
+  key << track_key << "|" << pp.get_yield_dir() << "|"
+      << pp.get_yieldMode() << "|" << pp.no_decay_isotopes() << "|"
+      << pp.output_all_isotopes();
+  yields = cache ? cache->get_yields(key.str()) : nullptr;
+  if (!yields) {
+    if (pp.get_verbosity() > 1)
+      ostreams.slug_out_one << "reading yield tables" << std::endl;
+    yields = (slug_yields *)
+      new slug_yields_multiple(pp.get_yield_dir(),
+			       pp.get_yieldMode(),
+			       ((slug_tracks_2d *) tracks)->get_metallicity(),
+			       ostreams,
+			       pp.no_decay_isotopes(),
+			       pp.output_all_isotopes());
+    if (cache) yields = cache->add(key.str(), yields);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to set up the spectral synthesizer
+////////////////////////////////////////////////////////////////////////
+void slug_sim::load_specsyn() {
+  // If we are computing photometry but not writing spectra, we will
+  // restrict the wavelength grid to the parts of the spectrum covered
+  // by the filters, so that we do not waste time synthesizing,
+  // processing, and extincting the spectrum at wavelengths we never
+  // use; if we are computing nebular emission, we also need the
+  // ionizing part of the spectrum, since this sets the nebular
+  // luminosity. This must be done before the nebular and extinction
+  // grids, which are built from the stellar grid, are set up.
+  vector<double> lambda_min, lambda_max;
+  bool restrict_lambda = filters != nullptr &&
+    pp.get_photLambdaSubset() && !pp.get_writeClusterSpec() &&
+    !pp.get_writeIntegratedSpec() && !pp.get_writeClusterEW();
+  if (restrict_lambda) {
+    for (vector<string>::size_type i=0;
+	 i<filters->get_filter_names().size(); i++) {
+      lambda_min.push_back(filters->get_filter(i)->get_wavelength_min());
+      lambda_max.push_back(filters->get_filter(i)->get_wavelength_max());
+    }
+    if (pp.get_use_nebular()) {
+      lambda_min.push_back(0.0);
+      lambda_max.push_back(constants::lambdaHI * (1.0+pp.get_z()));
+    }
+  }
+
+  // Initialize the spectral synthesizer; a synthesizer taken from the
+  // cache must be pointed at this simulation's IMF and SFH
+  ostringstream key;
+  key << setprecision(17) << track_key << "|" << pp.get_specsynMode()
+      << "|" << pp.get_atmos_dir() << "|" << pp.get_z();
+  for (vector<double>::size_type i=0; i<lambda_min.size(); i++)
+    key << "|" << lambda_min[i] << "-" << lambda_max[i];
+  specsyn_key = key.str();
+  specsyn = cache ? cache->get_specsyn(specsyn_key) : nullptr;
+  if (specsyn) {
+    specsyn->set_pdfs(imf, sfh);
+  } else {
+    if (pp.get_verbosity() > 1)
+      ostreams.slug_out_one << "reading atmospheres" << std::endl;
+    if (pp.get_specsynMode() == PLANCK) {
+      specsyn = static_cast<slug_specsyn *>
+	(new slug_specsyn_planck(tracks, imf, sfh, ostreams, pp.get_z()));
+    } else if (pp.get_specsynMode() == KURUCZ) {
+      specsyn = static_cast<slug_specsyn *>
+	(new slug_specsyn_kurucz(pp.get_atmos_dir(), tracks, 
+				 imf, sfh, ostreams, pp.get_z()));
+    } else if (pp.get_specsynMode() == KURUCZ_HILLIER) {
+      specsyn = static_cast<slug_specsyn *>
+	(new slug_specsyn_hillier(pp.get_atmos_dir(), tracks, 
+				  imf, sfh, ostreams, pp.get_z()));
+    } else if (pp.get_specsynMode() == KURUCZ_PAULDRACH) {
+      specsyn = static_cast<slug_specsyn *>
+	(new slug_specsyn_pauldrach(pp.get_atmos_dir(), tracks, 
+				    imf, sfh, ostreams, pp.get_z()));
+    } else if (pp.get_specsynMode() == SB99) {
+      specsyn = static_cast<slug_specsyn *> 
+	(new slug_specsyn_sb99(pp.get_atmos_dir(), tracks,
+			       imf, sfh, ostreams, pp.get_z()));
+    }
+    else if  (pp.get_specsynMode() == SB99_HRUV) {
+      specsyn = static_cast<slug_specsyn *> 
+	(new slug_specsyn_sb99hruv(pp.get_atmos_dir(), tracks,
+				   imf, sfh, ostreams, pp.get_z()));   
+    }
+    if (restrict_lambda) {
+      vector<double>::size_type nl = specsyn->n_lambda();
+      specsyn->set_lambda_ranges(lambda_min, lambda_max);
+      if (pp.get_verbosity() > 1 && specsyn->n_lambda() < nl)
+	ostreams.slug_out_one << "restricting wavelength grid to "
+			      << specsyn->n_lambda() << " of "
+			      << nl << " points" << std::endl;
+    }
+    if (cache) specsyn = cache->add(specsyn_key, specsyn);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to read the line list for equivalent width calculations
+////////////////////////////////////////////////////////////////////////
+void slug_sim::load_lines() {
+  if (pp.get_verbosity() > 1) {
+    ostreams.slug_out_one << "reading line list" << std::endl;
+  }    
+  lines = new slug_line_list(pp.get_linepicks(),
+			     pp.get_line_dir(),
+			     ostreams);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to set up the nebular emission calculation
+////////////////////////////////////////////////////////////////////////
+void slug_sim::load_nebular() {
+  ostringstream key;
+  key << setprecision(17) << specsyn_key << "|"
+      << pp.get_atomic_dir() << "|" << pp.get_nebular_den() << "|"
+      << pp.get_nebular_temp() << "|" << pp.get_nebular_logU() << "|"
+      << pp.get_nebular_phi() << "|" << pp.nebular_no_metals();
+  nebular = cache ? cache->get_nebular(key.str()) : nullptr;
+  if (!nebular) {
+    if (pp.get_trackSet() == NO_TRACK_SET) {
+      // User has manually specified a file name
+      nebular = new slug_nebular(pp.get_atomic_dir(),
+				 specsyn->lambda(true),
+				 pp.get_trackFile(),
+				 ostreams,
+				 pp.get_nebular_den(),
+				 pp.get_nebular_temp(),
+				 pp.get_nebular_logU(),
+				 pp.get_nebular_phi(),
+				 pp.get_z(),
+				 pp.nebular_no_metals());
+    } else {
+      // User has specified a track set
+      nebular
+	= new slug_nebular(pp.get_atomic_dir(),
+			   specsyn->lambda(true),
+			   ((slug_tracks_2d *) tracks)->get_metallicity(),
+			   ((slug_tracks_2d *) tracks)->trackset_filenames(),
+			   ((slug_tracks_2d *) tracks)->trackset_metallicities(),
+			   ((slug_tracks_2d *) tracks)->trackset_Z_int_meth(),
+			   ostreams,
+			   pp.get_nebular_den(),
+			   pp.get_nebular_temp(),
+			   pp.get_nebular_logU(),
+			   pp.get_nebular_phi(),
+			   pp.get_z(),
+			   pp.nebular_no_metals());
+    }
+    if (cache) nebular = cache->add(key.str(), nebular);
+  }
 }
 
 
@@ -509,15 +730,20 @@ slug_sim::~slug_sim() {
 // Methods to open and close output files
 ////////////////////////////////////////////////////////////////////////
 void slug_sim::open_output(slug_output_files &outfiles, int chknum) {
-  if (pp.galaxy_sim() && pp.get_writeIntegratedProp())
+  if (pp.galaxy_sim() && write_integrated &&
+      pp.get_writeIntegratedProp())
     open_integrated_prop(outfiles, chknum);
-  if (pp.galaxy_sim() && pp.get_writeIntegratedSpec()) 
+  if (pp.galaxy_sim() && write_integrated &&
+      pp.get_writeIntegratedSpec()) 
     open_integrated_spec(outfiles, chknum);
-  if (pp.galaxy_sim() && pp.get_writeIntegratedPhot()) 
+  if (pp.galaxy_sim() && write_integrated &&
+      pp.get_writeIntegratedPhot()) 
     open_integrated_phot(outfiles, chknum);
-  if (pp.galaxy_sim() && pp.get_writeIntegratedYield())
+  if (pp.galaxy_sim() && write_integrated &&
+      pp.get_writeIntegratedYield())
     open_integrated_yield(outfiles, chknum);
-  if (pp.galaxy_sim() && pp.get_writeIntegratedSN())
+  if (pp.galaxy_sim() && write_integrated &&
+      pp.get_writeIntegratedSN())
     open_integrated_sn(outfiles, chknum);
   if (pp.get_writeClusterProp()) open_cluster_prop(outfiles, chknum);
   if (pp.get_writeClusterPhot()) open_cluster_phot(outfiles, chknum);
@@ -526,10 +752,58 @@ void slug_sim::open_output(slug_output_files &outfiles, int chknum) {
   if (pp.get_writeClusterSN()) open_cluster_sn(outfiles, chknum);
   if (pp.get_writeClusterEW()) open_cluster_ew(outfiles, chknum);
   outfiles.is_open = true;
+
+#ifdef ENABLE_FITS
+  // Attach a row buffer to the data table of each FITS file; the
+  // routines above leave every file positioned at its data table
+  if (out_mode == FITS) {
+    vector<pair<fitsfile *, slug_fits_table **> > fits_tabs = {
+      { outfiles.int_prop_fits, &outfiles.int_prop_tab },
+      { outfiles.cluster_prop_fits, &outfiles.cluster_prop_tab },
+      { outfiles.int_spec_fits, &outfiles.int_spec_tab },
+      { outfiles.cluster_spec_fits, &outfiles.cluster_spec_tab },
+      { outfiles.int_phot_fits, &outfiles.int_phot_tab },
+      { outfiles.cluster_phot_fits, &outfiles.cluster_phot_tab },
+      { outfiles.int_sn_fits, &outfiles.int_sn_tab },
+      { outfiles.cluster_sn_fits, &outfiles.cluster_sn_tab },
+      { outfiles.int_yield_fits, &outfiles.int_yield_tab },
+      { outfiles.cluster_yield_fits, &outfiles.cluster_yield_tab },
+      { outfiles.cluster_ew_fits, &outfiles.cluster_ew_tab } };
+    for (vector<pair<fitsfile *, slug_fits_table **> >::size_type i=0;
+	 i<fits_tabs.size(); i++)
+      if (fits_tabs[i].first != nullptr)
+	*(fits_tabs[i].second) = new slug_fits_table(fits_tabs[i].first);
+  }
+#endif
+
+#ifdef ENABLE_MPI
+  // For merged output files, every process has written the same
+  // header; keep the copy on the root process only
+  for (vector<slug_mpiio_buf *>::size_type i=0;
+       i<outfiles.mpiio_bufs.size(); i++) {
+    if (rank == 0) outfiles.mpiio_bufs[i]->end_record(0);
+    else outfiles.mpiio_bufs[i]->discard_record();
+  }
+  outfiles.mpiio_flush_time = MPI_Wtime();
+#endif
 }
 
 void slug_sim::close_output(slug_output_files &outfiles,
 			    int checkpoint_ctr, unsigned int ntrials) {
+
+#ifdef ENABLE_MPI
+  // Write and close merged output files; this is collective. Until
+  // every process has finished its trials, keep taking part in the
+  // flushes triggered by the processes that are still running.
+  if (outfiles.mpiio_bufs.size() > 0)
+    while (!flush_mpiio(outfiles, true)) { }
+  for (vector<slug_mpiio_buf *>::size_type i=0;
+       i<outfiles.mpiio_bufs.size(); i++) {
+    outfiles.mpiio_bufs[i]->close();
+    delete outfiles.mpiio_bufs[i];
+  }
+  outfiles.mpiio_bufs.clear();
+#endif
   
   // If we are closing a checkpoint, edit the number of trials it
   // contains
@@ -595,6 +869,22 @@ void slug_sim::close_output(slug_output_files &outfiles,
     outfiles.cluster_sn_file.close();
 
 #ifdef ENABLE_FITS
+  // Write out any rows still held in the FITS row buffers and free
+  // them; this must be done before we move to other HDUs below
+  vector<slug_fits_table **> fits_tabs = {
+    &outfiles.int_prop_tab, &outfiles.cluster_prop_tab,
+    &outfiles.int_spec_tab, &outfiles.cluster_spec_tab,
+    &outfiles.int_phot_tab, &outfiles.cluster_phot_tab,
+    &outfiles.int_sn_tab, &outfiles.cluster_sn_tab,
+    &outfiles.int_yield_tab, &outfiles.cluster_yield_tab,
+    &outfiles.cluster_ew_tab };
+  for (vector<slug_fits_table **>::size_type i=0; i<fits_tabs.size(); i++) {
+    if (*(fits_tabs[i]) != nullptr) {
+      delete *(fits_tabs[i]);
+      *(fits_tabs[i]) = nullptr;
+    }
+  }
+
   // Reset number of trials for FITS files
   if (checkpoint_ctr >= 0) {
 
@@ -672,59 +962,63 @@ void slug_sim::close_output(slug_output_files &outfiles,
 ////////////////////////////////////////////////////////////////////////
 void slug_sim::galaxy_sim() {
 
-  // Prepare to count trials; in serial mode this is trivial, while in
-  // MPI mode we need to set up a remote access window so that we can
-  // synchronize trial counts across processes
+  // Prepare to count trials; the trial counter object handles
+  // distributing trials among processes in MPI mode. If the galaxy
+  // itself is distributed, every process takes part in every trial.
   unsigned long trials_to_do = pp.get_nTrials();
   unsigned long trial_ctr = pp.get_checkpoint_trials();
   unsigned long trial_ctr_loc = 0; // Counts trials on this processor
   unsigned long trial_ctr_last = 1; // Trial counter at last write
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  unsigned long trial_ctr_buf = trial_ctr; // Buffer to hold global trial counter
-  MPI_Win win;
-  if (comm != MPI_COMM_NULL) {
-    if (rank == 0) {
-      // Root process holds the accumulated number of trials
-      MPI_Win_create(&trial_ctr_buf, sizeof(trial_ctr_buf),
-		     sizeof(trial_ctr_buf), MPI_INFO_NULL, comm, &win);
-    } else {
-      // All other processes don't need a remote access window
-      MPI_Win_create(NULL, 0, sizeof(int), MPI_INFO_NULL, comm, &win);
-    }
-  }
+  slug_trial_counter trial_counter(trials_to_do, trial_ctr,
+				   pp.get_checkpoint_interval()
+#ifdef ENABLE_MPI
+				   , distribute_galaxy ? MPI_COMM_NULL : comm
 #endif
+				   );
 
-  // Initialize output file information
+  // Initialize output file information; merged output files are
+  // shared by all processes, so they must be opened by all processes
+  // together before we start handing out trials
   slug_output_files outfiles;
+  if (merge_output) open_output(outfiles);
+
+  // Set up summary statistics if requested; only the processes that
+  // write integrated outputs accumulate them. With random output
+  // times there is a single output per trial. The rank seeds the
+  // quantile sketches, so that each process makes independent
+  // choices when compacting them.
+  bool stats_prop = pp.get_statsProp(), stats_phot = pp.get_statsPhot(),
+    stats_sn = pp.get_statsSN(), stats_yield = pp.get_statsYield();
+  slug_stats *stats = nullptr;
+  vector<double> stats_vals;
+#ifdef ENABLE_MPI
+  unsigned long long stats_seed = rank;
+#else
+  unsigned long long stats_seed = 0;
+#endif
+  if (pp.get_writeStats())
+    stats = new slug_stats(galaxy->stats_names(stats_prop, stats_phot,
+					       stats_sn, stats_yield),
+			   pp.get_random_output_time() ? 1 : outTimes.size(),
+			   pp.get_statsSketchK(), stats_seed);
   
   // Main loop
   while (true) {
 
-    // Increment the trial counters; under MPI, the global counter
-    // update is done as a Fetch_and_op operation. Note that
-    // Fetch_and_op returns the value of the buffer before the
-    // addition is done, so we still need to increment the trial
-    // counter
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-    if (comm != MPI_COMM_NULL) {
-      MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
-      unsigned long i=1;
-      MPI_Fetch_and_op(&i, &trial_ctr, MPI_UNSIGNED_LONG, 0, 0,
-		       MPI_SUM, win);
-      MPI_Win_unlock(0, win);
-    }
-#endif
-    trial_ctr++;
+    // Increment the local trial counter, and get the global number
+    // of the next trial; exit the loop if there are no trials left
     trial_ctr_loc++;
+    if (!trial_counter.next_trial(trial_ctr)) break;
 
-    // If global trial counter exceeds number of trials we're supposed
-    // to do, exit the loop
-    if (trial_ctr > trials_to_do) break;
+    // Trial number to write to output files; merged output files use
+    // the global trial number
+    unsigned long trial_num = merge_output ? trial_ctr : trial_ctr_loc;
 
     // Figure out if we need to open a new output file
     bool open_new_output = false;
-    if (trial_ctr_loc == 1) {
-      // Always open new file on first trial
+    if (trial_ctr_loc == 1 && !outfiles.is_open) {
+      // Always open new file on first trial, unless files were opened
+      // before the loop for merged output
       open_new_output = true;
     } else if (pp.get_checkpoint_interval() != 0) {
       if ((trial_ctr_loc-1) % pp.get_checkpoint_interval() == 0) {
@@ -742,10 +1036,13 @@ void slug_sim::galaxy_sim() {
 	  trial_ctr_loc != 1)
 	ostreams.slug_out << "finalizing checkpoint "
 			  << checkpoint_ctr << std::endl;
-      // Close old output if it is open
-      if (outfiles.is_open)
+      // Close old output if it is open, and save the state that goes
+      // with it
+      if (outfiles.is_open) {
 	close_output(outfiles, checkpoint_ctr-1,
 		     trial_ctr_loc - trial_ctr_last);
+	if (checkpoint_ctr > 0) write_checkpoint_state(checkpoint_ctr-1);
+      }
       // Open new checkpoint files
       open_output(outfiles, checkpoint_ctr);
       // Increment checkpoint counter, and update number of trials
@@ -789,7 +1086,7 @@ void slug_sim::galaxy_sim() {
 	  break;
       }
       
-      if (pp.get_writeIntegratedProp()) { 
+      if (pp.get_writeIntegratedProp() && write_integrated) { 
         // Write separators
         int ncol = 9*14-3;      
 	if (is_imf_var==true) ncol += (imf_vpdraws.size())*14;
@@ -806,14 +1103,14 @@ void slug_sim::galaxy_sim() {
       }
       // Add on IMF fields
       if (is_imf_var==true) extrafields += (imf_vpdraws.size());
-      if (pp.get_writeIntegratedSpec()) 
+      if (pp.get_writeIntegratedSpec() && write_integrated)
 	write_separator(outfiles.int_spec_file, (2+nfield)*14-3);
-      if (pp.get_writeIntegratedPhot())
+      if (pp.get_writeIntegratedPhot() && write_integrated)
 	write_separator(outfiles.int_phot_file,
 			(1+nfield*pp.get_nPhot())*21-3);
-      if (pp.get_writeIntegratedSN())
+      if (pp.get_writeIntegratedSN() && write_integrated)
 	write_separator(outfiles.int_sn_file, 14*3-3);
-      if (pp.get_writeIntegratedYield())
+      if (pp.get_writeIntegratedYield() && write_integrated)
 	write_separator(outfiles.int_yield_file, 14*5-3);
       if (pp.get_writeClusterProp())
 	write_separator(outfiles.cluster_prop_file, (10+extrafields)*14-3);
@@ -833,11 +1130,20 @@ void slug_sim::galaxy_sim() {
     if (pp.get_random_output_time()) {
       outTimes.resize(0);
       outTimes.push_back(out_time_pdf->draw());
+#ifdef ENABLE_MPI
+      // All processes sharing a galaxy must use the same output time
+      if (distribute_galaxy)
+	MPI_Bcast(&outTimes.back(), 1, MPI_DOUBLE, 0, comm);
+#endif
     }
 
     // If the SFR is randomly changing, draw a new SFR for this trial
     if (pp.get_randomSFR()) {
       double sfr = sfr_pdf->draw();
+#ifdef ENABLE_MPI
+      // All processes sharing a galaxy must use the same SFR
+      if (distribute_galaxy) MPI_Bcast(&sfr, 1, MPI_DOUBLE, 0, comm);
+#endif
       sfh->setNorm(outTimes.back()*sfr);
     }
 
@@ -857,16 +1163,43 @@ void slug_sim::galaxy_sim() {
       // Advance to next time
       galaxy->advance(outTimes[j]);
 
+      // For a distributed galaxy, sum the integrated quantities we
+      // are going to write over all processes. Clusters can only be
+      // deleted here if we are not going to write cluster properties
+      // or supernovae below, since those come after the integrated
+      // spectra.
+#ifdef ENABLE_MPI
+      if (distribute_galaxy)
+	galaxy->reduce(pp.get_writeIntegratedSpec() ||
+		       pp.get_writeIntegratedPhot() ||
+		       (stats && stats_phot),
+		       pp.get_writeIntegratedYield() ||
+		       (stats && stats_yield),
+		       del_cluster && !pp.get_writeClusterProp() &&
+		       !pp.get_writeClusterSN());
+#endif
+
+      // Add this trial to the summary statistics; as above, clusters
+      // can only be deleted if we are not going to write their
+      // properties or supernovae
+      if (stats && write_integrated) {
+	galaxy->stats_values(stats_vals, stats_prop, stats_phot,
+			     stats_sn, stats_yield,
+			     del_cluster && !pp.get_writeClusterProp() &&
+			     !pp.get_writeClusterSN());
+	stats->add(j, stats_vals);
+      }
+
       // Write physical properties if requested
-      if (pp.get_writeIntegratedProp()) {
+      if (pp.get_writeIntegratedProp() && write_integrated) {
 #ifdef ENABLE_FITS
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_integrated_prop(outfiles.int_prop_file, out_mode,
-					trial_ctr_loc, imf_vpdraws);
+					trial_num, imf_vpdraws);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_integrated_prop(outfiles.int_prop_fits, trial_ctr_loc,
+	  galaxy->write_integrated_prop(*outfiles.int_prop_tab, trial_num,
 					imf_vpdraws);
 	}
 #endif
@@ -876,26 +1209,26 @@ void slug_sim::galaxy_sim() {
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_cluster_prop(outfiles.cluster_prop_file, out_mode,
-				     trial_ctr_loc, imf_vpdraws);
+				     trial_num, imf_vpdraws);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_cluster_prop(outfiles.cluster_prop_fits,
-				     trial_ctr_loc, imf_vpdraws);
+	  galaxy->write_cluster_prop(*outfiles.cluster_prop_tab,
+				     trial_num, imf_vpdraws);
 	}
 #endif
       }
 
       // Write yield if requested
-      if (pp.get_writeIntegratedYield()) {
+      if (pp.get_writeIntegratedYield() && write_integrated) {
 #ifdef ENABLE_FITS
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_integrated_yield(outfiles.int_yield_file, out_mode,
-					 trial_ctr_loc, del_cluster);
+					 trial_num, del_cluster);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_integrated_yield(outfiles.int_yield_fits,
-					 trial_ctr_loc, del_cluster);
+	  galaxy->write_integrated_yield(*outfiles.int_yield_tab,
+					 trial_num, del_cluster);
 	}
 #endif
       }
@@ -904,26 +1237,26 @@ void slug_sim::galaxy_sim() {
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_cluster_yield(outfiles.cluster_yield_file, out_mode,
-				      trial_ctr_loc);
+				      trial_num);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_cluster_yield(outfiles.cluster_yield_fits,
-				      trial_ctr_loc);
+	  galaxy->write_cluster_yield(*outfiles.cluster_yield_tab,
+				      trial_num);
 	}
 #endif
       }
 
       // Write supernova count if requested
-      if (pp.get_writeIntegratedSN()) {
+      if (pp.get_writeIntegratedSN() && write_integrated) {
 #ifdef ENABLE_FITS
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_integrated_sn(outfiles.int_sn_file, out_mode,
-					 trial_ctr_loc);
+					 trial_num);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_integrated_sn(outfiles.int_sn_fits,
-					 trial_ctr_loc);
+	  galaxy->write_integrated_sn(*outfiles.int_sn_tab,
+					 trial_num);
 	}
 #endif
       }
@@ -932,25 +1265,25 @@ void slug_sim::galaxy_sim() {
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_cluster_sn(outfiles.cluster_sn_file, out_mode,
-				   trial_ctr_loc);
+				   trial_num);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_cluster_sn(outfiles.cluster_sn_fits,
-				   trial_ctr_loc);
+	  galaxy->write_cluster_sn(*outfiles.cluster_sn_tab,
+				   trial_num);
 	}
 #endif
       }
 
       // Write spectra if requested
-      if (pp.get_writeIntegratedSpec()) {
+      if (pp.get_writeIntegratedSpec() && write_integrated) {
 #ifdef ENABLE_FITS
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_integrated_spec(outfiles.int_spec_file, out_mode,
-					trial_ctr_loc, del_cluster);
+					trial_num, del_cluster);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_integrated_spec(outfiles.int_spec_fits, trial_ctr_loc,
+	  galaxy->write_integrated_spec(*outfiles.int_spec_tab, trial_num,
 					del_cluster);
 	}
 #endif
@@ -960,26 +1293,26 @@ void slug_sim::galaxy_sim() {
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_cluster_spec(outfiles.cluster_spec_file, out_mode,
-				     trial_ctr_loc);
+				     trial_num);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_cluster_spec(outfiles.cluster_spec_fits,
-				     trial_ctr_loc);
+	  galaxy->write_cluster_spec(*outfiles.cluster_spec_tab,
+				     trial_num);
 	}
 #endif
       }
       
       // Write photometry if requested
-      if (pp.get_writeIntegratedPhot()) {
+      if (pp.get_writeIntegratedPhot() && write_integrated) {
 #ifdef ENABLE_FITS
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_integrated_phot(outfiles.int_phot_file, out_mode,
-					trial_ctr_loc, del_cluster);
+					trial_num, del_cluster);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_integrated_phot(outfiles.int_phot_fits,
-					trial_ctr_loc, del_cluster);
+	  galaxy->write_integrated_phot(*outfiles.int_phot_tab,
+					trial_num, del_cluster);
 	}
 #endif
       }
@@ -988,15 +1321,20 @@ void slug_sim::galaxy_sim() {
 	if (out_mode != FITS) {
 #endif
 	  galaxy->write_cluster_phot(outfiles.cluster_phot_file, out_mode,
-				     trial_ctr_loc);
+				     trial_num);
 #ifdef ENABLE_FITS
 	} else {
-	  galaxy->write_cluster_phot(outfiles.cluster_phot_fits,
-				     trial_ctr_loc);
+	  galaxy->write_cluster_phot(*outfiles.cluster_phot_tab,
+				     trial_num);
 	}
 #endif
       }
     }
+
+    // Mark the end of this trial in merged output files
+#ifdef ENABLE_MPI
+    if (merge_output) end_trial_mpiio(outfiles, trial_ctr);
+#endif
   }
   
   // Close last output file
@@ -1005,12 +1343,17 @@ void slug_sim::galaxy_sim() {
     ostreams.slug_out << "finalizing checkpoint "
 		      << checkpoint_ctr << std::endl;
   close_output(outfiles, checkpoint_ctr, trial_ctr_loc - trial_ctr_last);
-  
-  // Free MPI window
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) MPI_Win_free(&win);
+  if (checkpoint_ctr > 0) write_checkpoint_state(checkpoint_ctr-1);
+
+  // Combine and write summary statistics
+  if (stats) {
+#ifdef ENABLE_MPI
+    if (comm != MPI_COMM_NULL) stats->merge(comm);
 #endif
-  
+    write_stats(*stats);
+    delete stats;
+  }
+    
   // Clean up vector of variable pdfs
   if (is_imf_var == true) {
     imf->cleanup();
@@ -1018,32 +1361,50 @@ void slug_sim::galaxy_sim() {
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Method to write the summary statistics file
+////////////////////////////////////////////////////////////////////////
+void slug_sim::write_stats(const slug_stats &stats) {
+
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && rank != 0) return;
+#endif
+
+  // Open file
+  string fname(pp.get_modelName());
+  fname += "_stats.txt";
+  path full_path(pp.get_outDir());
+  full_path /= fname;
+  std::ofstream stats_file(full_path.c_str(), ios::out);
+  if (!stats_file.is_open()) {
+    ostreams.slug_err_one << "unable to open summary statistics file "
+			  << full_path.string() << endl;
+    bailout(1);
+  }
+
+  // Write
+  stats.write(stats_file, pp.get_statsQuantiles(), pp.get_statsNBin());
+  stats_file.close();
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Method to run a cluster simulation
 ////////////////////////////////////////////////////////////////////////
 void slug_sim::cluster_sim() {
 
-  // Prepare to count trials; in serial mode this is trivial, while in
-  // MPI mode we need to set up a remote access window so that we can
-  // synchronize trial counts across processes
+  // Prepare to count trials; the trial counter object handles
+  // distributing trials among processes in MPI mode
   unsigned long trials_to_do = pp.get_nTrials();
   unsigned long trial_ctr = pp.get_checkpoint_trials();
   unsigned long trial_ctr_loc = 0; // Counts trials on this processor
   unsigned long trial_ctr_last = 1; // Trial counter at last write
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  unsigned long trial_ctr_buf = trial_ctr; // Buffer to hold global trial counter
-  MPI_Win win;
-  if (comm != MPI_COMM_NULL) {
-    if (rank == 0) {
-      // Root process holds the accumulated number of trials
-      MPI_Win_create(&trial_ctr_buf, sizeof(trial_ctr_buf),
-		     sizeof(trial_ctr_buf), MPI_INFO_NULL, comm, &win);
-    } else {
-      // All other processes don't need a remote access window
-      MPI_Win_create(NULL, 0, sizeof(int), MPI_INFO_NULL, comm, &win);
-    }
-  }
+  slug_trial_counter trial_counter(trials_to_do, trial_ctr,
+				   pp.get_checkpoint_interval()
+#ifdef ENABLE_MPI
+				   , comm
 #endif
+				   );
 
   // Initialize output file information
   slug_output_files outfiles;
@@ -1054,35 +1415,27 @@ void slug_sim::cluster_sim() {
     = outfiles.cluster_spec_fits = outfiles.cluster_phot_fits
     = outfiles.cluster_yield_fits = outfiles.cluster_ew_fits= nullptr;
 #endif
+  if (merge_output) open_output(outfiles);
   
-  // Loop over trials
-  unsigned long id = 0;
+  // Loop over trials; id is the ID to give the next cluster we
+  // create
+  unsigned long id = id_start + id_stride;
   while (true) {
 
-    // Increment the global trial counter
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-    // Method for MPI: add 1 to the global RMA variable trial_ctr
-    if (comm != MPI_COMM_NULL) {
-      MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
-      unsigned long i=1;
-      MPI_Fetch_and_op(&i, &trial_ctr, MPI_UNSIGNED_LONG, 0, 0,
-		       MPI_SUM, win);
-      MPI_Win_unlock(0, win);
-    }
-#endif
-    trial_ctr++;
-
-    // Update local trial counter
+    // Increment the local trial counter, and get the global number
+    // of the next trial; exit the loop if there are no trials left
     trial_ctr_loc++;
+    if (!trial_counter.next_trial(trial_ctr)) break;
 
-    // If global trial counter exceeds number of trials we're supposed
-    // to do, exit the loop
-    if (trial_ctr > trials_to_do) break;
+    // Trial number to write to output files; merged output files use
+    // the global trial number
+    unsigned long trial_num = merge_output ? trial_ctr : trial_ctr_loc;
 
     // Figure out if we need to open a new output file
     bool open_new_output = false;
-    if (trial_ctr_loc == 1) {
-      // Always open new file on first trial
+    if (trial_ctr_loc == 1 && !outfiles.is_open) {
+      // Always open new file on first trial, unless files were opened
+      // before the loop for merged output
       open_new_output = true;
     } else if (pp.get_checkpoint_interval() != 0) {
       if ((trial_ctr_loc-1) % pp.get_checkpoint_interval() == 0) {
@@ -1139,7 +1492,6 @@ void slug_sim::cluster_sim() {
     // a new one if not
     if (pp.get_random_cluster_mass()) {
       if (cluster) {
-	id = cluster->get_id();
 	delete cluster;
 	cluster = nullptr;
       }
@@ -1158,9 +1510,10 @@ void slug_sim::cluster_sim() {
 	}  
 	m_cl *= pow(1.0 - fac, 1.0/lgamma);
       }
-      cluster = new slug_cluster(id+1, m_cl, 0.0, imf,
+      cluster = new slug_cluster(id, m_cl, 0.0, imf,
 				 tracks, specsyn, filters,
 				 extinct, nebular, yields, lines, ostreams, clf);
+      id += id_stride;
     } else {
       cluster->reset();
     }
@@ -1211,11 +1564,11 @@ void slug_sim::cluster_sim() {
 	if (out_mode != FITS) {
 #endif
 	  cluster->write_prop(outfiles.cluster_prop_file, out_mode,
-			      trial_ctr_loc, true,
+			      trial_num, true,
 			      imf_vpdraws);
 #ifdef ENABLE_FITS
 	} else {
-	  cluster->write_prop(outfiles.cluster_prop_fits, trial_ctr_loc,
+	  cluster->write_prop(*outfiles.cluster_prop_tab, trial_num,
 			      imf_vpdraws);
 	}
 #endif
@@ -1227,17 +1580,17 @@ void slug_sim::cluster_sim() {
 	if (out_mode != FITS) {
 #endif
 	  cluster->write_spectrum(outfiles.cluster_spec_file, out_mode,
-				  trial_ctr_loc, true);
+				  trial_num, true);
 #ifdef ENABLE_FITS
 	} else {
-	  cluster->write_spectrum(outfiles.cluster_spec_fits, trial_ctr_loc);
+	  cluster->write_spectrum(*outfiles.cluster_spec_tab, trial_num);
 	}
 #endif
       }
 #ifdef ENABLE_FITS    
     // Write equivalent width if requested
     if (pp.get_writeClusterEW()) {
-      cluster->write_ew(outfiles.cluster_ew_fits, trial_ctr_loc);
+      cluster->write_ew(*outfiles.cluster_ew_tab, trial_num);
     }
 #endif
 
@@ -1247,10 +1600,10 @@ void slug_sim::cluster_sim() {
 	if (out_mode != FITS) {
 #endif
 	  cluster->write_photometry(outfiles.cluster_phot_file, out_mode,
-				    trial_ctr_loc, true);
+				    trial_num, true);
 #ifdef ENABLE_FITS
 	} else {
-	  cluster->write_photometry(outfiles.cluster_phot_fits, trial_ctr_loc);
+	  cluster->write_photometry(*outfiles.cluster_phot_tab, trial_num);
 	}
 #endif
       }
@@ -1261,10 +1614,10 @@ void slug_sim::cluster_sim() {
 	if (out_mode != FITS) {
 #endif
 	  cluster->write_yield(outfiles.cluster_yield_file, out_mode,
-			       trial_ctr_loc, true);
+			       trial_num, true);
 #ifdef ENABLE_FITS
 	} else {
-	  cluster->write_yield(outfiles.cluster_yield_fits, trial_ctr_loc);
+	  cluster->write_yield(*outfiles.cluster_yield_tab, trial_num);
 	}
 #endif
       }
@@ -1275,14 +1628,19 @@ void slug_sim::cluster_sim() {
 	if (out_mode != FITS) {
 #endif
 	  cluster->write_sn(outfiles.cluster_sn_file, out_mode,
-			    trial_ctr_loc, true);
+			    trial_num, true);
 #ifdef ENABLE_FITS
 	} else {
-	  cluster->write_sn(outfiles.cluster_sn_fits, trial_ctr_loc);
+	  cluster->write_sn(*outfiles.cluster_sn_tab, trial_num);
 	}
 #endif
       }
     }
+
+    // Mark the end of this trial in merged output files
+#ifdef ENABLE_MPI
+    if (merge_output) end_trial_mpiio(outfiles, trial_ctr);
+#endif
   }
 
   // Close last output file
@@ -1292,11 +1650,6 @@ void slug_sim::cluster_sim() {
 		      << checkpoint_ctr << std::endl;
   close_output(outfiles, checkpoint_ctr, trial_ctr_loc - trial_ctr_last);
 
-  // Free MPI window
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) MPI_Win_free(&win);
-#endif
-
   // Clean up vector of variable pdfs
   if (is_imf_var == true) {
     imf->cleanup();
@@ -1312,8 +1665,8 @@ void slug_sim::open_integrated_prop(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output && !distribute_galaxy) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -1333,7 +1686,12 @@ void slug_sim::open_integrated_prop(slug_output_files &outfiles,
   } else if (out_mode == BINARY) {
     fname += ".bin";
     full_path /= fname;
-    outfiles.int_prop_file.open(full_path.c_str(), ios::out | ios::binary);
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.int_prop_file, full_path.string(), outfiles);
+    else
+#endif
+      outfiles.int_prop_file.open(full_path.c_str(), ios::out | ios::binary);
   } 
 #ifdef ENABLE_FITS
   else if (out_mode == FITS) {
@@ -1358,7 +1716,7 @@ void slug_sim::open_integrated_prop(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.int_prop_file.is_open()) {
+    if (!outfiles.int_prop_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open intergrated properties file " 
 			<< full_path.string() << endl;
       exit(1);
@@ -1519,8 +1877,8 @@ void slug_sim::open_cluster_prop(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -1540,7 +1898,12 @@ void slug_sim::open_cluster_prop(slug_output_files &outfiles,
   } else if (out_mode == BINARY) {
     fname += ".bin";
     full_path /= fname;
-    outfiles.cluster_prop_file.open(full_path.c_str(), ios::out | ios::binary);
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.cluster_prop_file, full_path.string(), outfiles);
+    else
+#endif
+      outfiles.cluster_prop_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
   else if (out_mode == FITS) {
@@ -1565,7 +1928,7 @@ void slug_sim::open_cluster_prop(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.cluster_prop_file.is_open()) {
+    if (!outfiles.cluster_prop_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open cluster properties file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -1787,8 +2150,8 @@ void slug_sim::open_integrated_spec(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output && !distribute_galaxy) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -1807,7 +2170,12 @@ void slug_sim::open_integrated_spec(slug_output_files &outfiles,
     outfiles.int_spec_file.open(full_path.c_str(), ios::out);
   } else if (out_mode == BINARY) {
     fname += ".bin";
-      full_path /= fname;
+    full_path /= fname;
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.int_spec_file, full_path.string(), outfiles);
+    else
+#endif
       outfiles.int_spec_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
@@ -1832,7 +2200,7 @@ void slug_sim::open_integrated_spec(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.int_spec_file.is_open()) {
+    if (!outfiles.int_spec_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open intergrated spectrum file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -2057,8 +2425,8 @@ void slug_sim::open_cluster_spec(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -2077,7 +2445,12 @@ void slug_sim::open_cluster_spec(slug_output_files &outfiles,
     outfiles.cluster_spec_file.open(full_path.c_str(), ios::out);
   } else if (out_mode == BINARY) {
     fname += ".bin";
-      full_path /= fname;
+    full_path /= fname;
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.cluster_spec_file, full_path.string(), outfiles);
+    else
+#endif
       outfiles.cluster_spec_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
@@ -2102,7 +2475,7 @@ void slug_sim::open_cluster_spec(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.cluster_spec_file.is_open()) {
+    if (!outfiles.cluster_spec_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open cluster spectrum file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -2364,8 +2737,8 @@ void slug_sim::open_integrated_phot(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output && !distribute_galaxy) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -2384,7 +2757,12 @@ void slug_sim::open_integrated_phot(slug_output_files &outfiles,
     outfiles.int_phot_file.open(full_path.c_str(), ios::out);
   } else if (out_mode == BINARY) {
     fname += ".bin";
-      full_path /= fname;
+    full_path /= fname;
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.int_phot_file, full_path.string(), outfiles);
+    else
+#endif
       outfiles.int_phot_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
@@ -2409,7 +2787,7 @@ void slug_sim::open_integrated_phot(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.int_phot_file.is_open()) {
+    if (!outfiles.int_phot_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open intergrated photometry file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -2575,8 +2953,8 @@ void slug_sim::open_cluster_phot(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -2595,7 +2973,12 @@ void slug_sim::open_cluster_phot(slug_output_files &outfiles,
     outfiles.cluster_phot_file.open(full_path.c_str(), ios::out);
   } else if (out_mode == BINARY) {
     fname += ".bin";
-      full_path /= fname;
+    full_path /= fname;
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.cluster_phot_file, full_path.string(), outfiles);
+    else
+#endif
       outfiles.cluster_phot_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
@@ -2620,7 +3003,7 @@ void slug_sim::open_cluster_phot(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.cluster_phot_file.is_open()) {
+    if (!outfiles.cluster_phot_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open cluster photometry file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -2791,7 +3174,7 @@ void slug_sim::open_cluster_ew(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
+#ifdef ENABLE_MPI
   if (comm != MPI_COMM_NULL) 
   {
     ostringstream ss;
@@ -2884,8 +3267,8 @@ void slug_sim::open_integrated_sn(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output && !distribute_galaxy) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -2905,7 +3288,12 @@ void slug_sim::open_integrated_sn(slug_output_files &outfiles,
   } else if (out_mode == BINARY) {
     fname += ".bin";
     full_path /= fname;
-    outfiles.int_sn_file.open(full_path.c_str(), ios::out | ios::binary);
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.int_sn_file, full_path.string(), outfiles);
+    else
+#endif
+      outfiles.int_sn_file.open(full_path.c_str(), ios::out | ios::binary);
   } 
 #ifdef ENABLE_FITS
   else if (out_mode == FITS) {
@@ -2930,7 +3318,7 @@ void slug_sim::open_integrated_sn(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.int_sn_file.is_open()) {
+    if (!outfiles.int_sn_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open intergrated supernovae file " 
 			<< full_path.string() << endl;
       exit(1);
@@ -3024,8 +3412,8 @@ void slug_sim::open_cluster_sn(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -3045,7 +3433,12 @@ void slug_sim::open_cluster_sn(slug_output_files &outfiles,
   } else if (out_mode == BINARY) {
     fname += ".bin";
     full_path /= fname;
-    outfiles.cluster_sn_file.open(full_path.c_str(), ios::out | ios::binary);
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.cluster_sn_file, full_path.string(), outfiles);
+    else
+#endif
+      outfiles.cluster_sn_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
   else if (out_mode == FITS) {
@@ -3070,7 +3463,7 @@ void slug_sim::open_cluster_sn(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.cluster_sn_file.is_open()) {
+    if (!outfiles.cluster_sn_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open cluster supernovae file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -3160,8 +3553,8 @@ void slug_sim::open_integrated_yield(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output && !distribute_galaxy) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -3181,7 +3574,12 @@ void slug_sim::open_integrated_yield(slug_output_files &outfiles,
   } else if (out_mode == BINARY) {
     fname += ".bin";
     full_path /= fname;
-    outfiles.int_yield_file.open(full_path.c_str(), ios::out | ios::binary);
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.int_yield_file, full_path.string(), outfiles);
+    else
+#endif
+      outfiles.int_yield_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
   else if (out_mode == FITS) {
@@ -3205,7 +3603,7 @@ void slug_sim::open_integrated_yield(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.int_yield_file.is_open()) {
+    if (!outfiles.int_yield_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open integrated yield file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -3362,8 +3760,8 @@ void slug_sim::open_cluster_yield(slug_output_files &outfiles,
 
   // Construct file name and path
   string fname(pp.get_modelName());
-#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
-  if (comm != MPI_COMM_NULL) {
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL && !merge_output) {
     ostringstream ss;
     ss << "_" << setfill('0') << setw(4) << rank;
     fname += ss.str();
@@ -3383,7 +3781,12 @@ void slug_sim::open_cluster_yield(slug_output_files &outfiles,
   } else if (out_mode == BINARY) {
     fname += ".bin";
     full_path /= fname;
-    outfiles.cluster_yield_file.open(full_path.c_str(), ios::out | ios::binary);
+#ifdef ENABLE_MPI
+    if (merge_output)
+      open_mpiio(outfiles.cluster_yield_file, full_path.string(), outfiles);
+    else
+#endif
+      outfiles.cluster_yield_file.open(full_path.c_str(), ios::out | ios::binary);
   }
 #ifdef ENABLE_FITS
   else if (out_mode == FITS) {
@@ -3407,7 +3810,7 @@ void slug_sim::open_cluster_yield(slug_output_files &outfiles,
 #ifdef ENABLE_FITS
   if (out_mode != FITS) {
 #endif
-    if (!outfiles.cluster_yield_file.is_open()) {
+    if (!outfiles.cluster_yield_file.is_open() && !merge_output) {
       ostreams.slug_err << "unable to open cluster yield file " 
 			<< full_path.string() << endl;
       bailout(1);
@@ -3559,12 +3962,122 @@ void slug_sim::open_cluster_yield(slug_output_files &outfiles,
 }
 
 
+#ifdef ENABLE_MPI
+// Interval in seconds of wall clock time between flushes of merged
+// output files; this bounds the amount of output each process holds
+// in memory
+#define SLUG_MPIIO_FLUSH_TIME 10.0
+
+////////////////////////////////////////////////////////////////////////
+// Open a merged output file; all processes must call this together
+////////////////////////////////////////////////////////////////////////
+void slug_sim::open_mpiio(std::ofstream& file, const string& fname,
+			  slug_output_files &outfiles) {
+  slug_mpiio_buf *buf = new slug_mpiio_buf(fname, comm);
+  if (!buf->is_open()) {
+    ostreams.slug_err_one << "unable to open merged output file "
+			  << fname << endl;
+    bailout(1);
+  }
+  buf->attach(file);
+  outfiles.mpiio_bufs.push_back(buf);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Mark the end of a trial in all merged output files
+////////////////////////////////////////////////////////////////////////
+void slug_sim::end_trial_mpiio(slug_output_files &outfiles,
+			       const unsigned long trial) {
+  for (vector<slug_mpiio_buf *>::size_type i=0;
+       i<outfiles.mpiio_bufs.size(); i++)
+    outfiles.mpiio_bufs[i]->end_record(trial);
+
+  // Flush at fixed intervals of wall clock time; every process
+  // measures the interval from the end of the previous flush, which
+  // all processes leave together, so they reach the next flush at
+  // about the same time, and wait at most about one trial for each
+  // other
+  if (MPI_Wtime() - outfiles.mpiio_flush_time > SLUG_MPIIO_FLUSH_TIME)
+    flush_mpiio(outfiles, false);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Flush all merged output files; this is collective, and finished
+// indicates whether this process has finished all its trials. The
+// return value is true if all processes have finished, in which case
+// all data have been written.
+////////////////////////////////////////////////////////////////////////
+bool slug_sim::flush_mpiio(slug_output_files &outfiles,
+			   const bool finished) {
+  int fin_loc = finished, fin;
+  MPI_Allreduce(&fin_loc, &fin, 1, MPI_INT, MPI_LAND, comm);
+  for (vector<slug_mpiio_buf *>::size_type i=0;
+       i<outfiles.mpiio_bufs.size(); i++)
+    outfiles.mpiio_bufs[i]->flush(fin != 0);
+  outfiles.mpiio_flush_time = MPI_Wtime();
+  return fin != 0;
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////
+// Save and restore the state of a galaxy simulation at a
+// checkpoint. The state is a galaxy snapshot, taken between trials,
+// which records the random number generator state and the cluster ID
+// counter, so that a restarted run continues the same random sequence
+// and does not reuse cluster IDs.
+////////////////////////////////////////////////////////////////////////
+string slug_sim::checkpoint_state_name(const int chknum) const {
+  ostringstream ss;
+  ss << pp.get_modelName();
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL)
+    ss << "_" << setfill('0') << setw(4) << rank;
+#endif
+  ss << "_chk" << setfill('0') << setw(4) << chknum << "_state.bin";
+  path full_path(pp.get_outDir());
+  full_path /= ss.str();
+  return full_path.string();
+}
+
+void slug_sim::write_checkpoint_state(const int chknum) {
+  // The galaxy holds the last trial of the checkpoint, which is not
+  // needed to continue, so clear it before taking the snapshot
+  galaxy->reset();
+  string fname = checkpoint_state_name(chknum);
+  std::ofstream state_file(fname.c_str(), ios::out | ios::binary);
+  if (state_file.is_open()) galaxy->write_snapshot(state_file, *rng);
+  if (!state_file.is_open() || !state_file.good()) {
+    ostreams.slug_err << "unable to write checkpoint state file "
+		      << fname << endl;
+    bailout(1);
+  }
+}
+
+void slug_sim::read_checkpoint_state(const int chknum) {
+  // Checkpoints without a state file can still be restarted from;
+  // the run then just continues with a fresh random sequence
+  string fname = checkpoint_state_name(chknum);
+  std::ifstream state_file(fname.c_str(), ios::in | ios::binary);
+  if (!state_file.is_open()) {
+    if (pp.get_verbosity() > 0)
+      ostreams.slug_out << "no state file found for checkpoint "
+			<< chknum << "; continuing with a new random "
+			<< "number sequence" << endl;
+    return;
+  }
+  galaxy->read_snapshot(state_file, *rng);
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Write out a separator
 ////////////////////////////////////////////////////////////////////////
 void slug_sim::write_separator(std::ofstream& file, 
 			       const unsigned int width) {
-  string sep;
-  for (unsigned int i=0; i<width; i++) sep += "-";
-  file << sep << endl;
+  string sep(width, '-');
+  sep += '\n';
+  file << sep;
 }
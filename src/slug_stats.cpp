@@ -0,0 +1,451 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "slug_stats.H"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+
+// Ratio of the capacities of successive compactors in a quantile
+// sketch, and the smallest capacity of any compactor
+#define SLUG_SKETCH_CAP_FAC (2.0/3.0)
+#define SLUG_SKETCH_CAP_MIN 2
+
+// Base seed for the coin flip generator used by quantile sketches
+#define SLUG_SKETCH_SEED 0x9E3779B97F4A7C15ULL
+
+////////////////////////////////////////////////////////////////////////
+// Quantile sketch constructor; the seed is scrambled with the
+// splitmix64 finalizer so that consecutive seeds give unrelated coin
+// flip sequences, and a zero state, from which xorshift never leaves,
+// is avoided
+////////////////////////////////////////////////////////////////////////
+slug_quantile_sketch::slug_quantile_sketch(const unsigned int k_,
+					   const unsigned long long seed) :
+  k(k_), n(0), size(0), max_size(0) {
+  coin = seed + SLUG_SKETCH_SEED;
+  coin = (coin ^ (coin >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  coin = (coin ^ (coin >> 27)) * 0x94D049BB133111EBULL;
+  coin ^= coin >> 31;
+  if (coin == 0) coin = SLUG_SKETCH_SEED;
+  grow();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Capacity of compactor h; this is k for the top compactor, and
+// decreases geometrically below it
+////////////////////////////////////////////////////////////////////////
+vector<double>::size_type
+slug_quantile_sketch::capacity(const unsigned int h) const {
+  double depth = compactors.size() - h - 1;
+  vector<double>::size_type cap = (vector<double>::size_type)
+    ceil(k * pow(SLUG_SKETCH_CAP_FAC, depth));
+  return max(cap, (vector<double>::size_type) SLUG_SKETCH_CAP_MIN);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Add a compactor at the top of the hierarchy
+////////////////////////////////////////////////////////////////////////
+void
+slug_quantile_sketch::grow() {
+  compactors.push_back(vector<double>());
+  max_size = 0;
+  for (unsigned int h=0; h<compactors.size(); h++)
+    max_size += capacity(h);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Coin flip; this is a 64-bit xorshift generator
+////////////////////////////////////////////////////////////////////////
+bool
+slug_quantile_sketch::flip() {
+  coin ^= coin << 13;
+  coin ^= coin >> 7;
+  coin ^= coin << 17;
+  return (coin >> 32) & 1;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Compact until the number of values stored is below the maximum
+////////////////////////////////////////////////////////////////////////
+void
+slug_quantile_sketch::compress() {
+  while (size >= max_size) {
+    for (unsigned int h=0; h<compactors.size(); h++) {
+      if (compactors[h].size() < capacity(h)) continue;
+
+      // Add a new compactor above this one if needed
+      if (h+1 == compactors.size()) grow();
+
+      // Sort this compactor, then promote every other value in its
+      // even-length prefix, starting from a random offset; if the
+      // number of values is odd, the largest stays where it is
+      vector<double> &c = compactors[h];
+      sort(c.begin(), c.end());
+      vector<double>::size_type npair = c.size() / 2;
+      vector<double>::size_type offset = flip() ? 1 : 0;
+      for (vector<double>::size_type i=0; i<npair; i++)
+	compactors[h+1].push_back(c[2*i+offset]);
+      if (c.size() % 2 == 1) {
+	double last = c.back();
+	c.resize(1);
+	c[0] = last;
+      } else {
+	c.resize(0);
+      }
+      size -= npair;
+      if (size < max_size) break;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Add a value
+////////////////////////////////////////////////////////////////////////
+void
+slug_quantile_sketch::add(const double x) {
+  compactors[0].push_back(x);
+  size++;
+  n++;
+  if (size >= max_size) compress();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Merge another sketch into this one
+////////////////////////////////////////////////////////////////////////
+void
+slug_quantile_sketch::merge(const slug_quantile_sketch &other) {
+  while (compactors.size() < other.compactors.size()) grow();
+  for (unsigned int h=0; h<other.compactors.size(); h++) {
+    compactors[h].insert(compactors[h].end(),
+			 other.compactors[h].begin(),
+			 other.compactors[h].end());
+    size += other.compactors[h].size();
+  }
+  n += other.n;
+  if (size >= max_size) compress();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Return sorted values and cumulative weights
+////////////////////////////////////////////////////////////////////////
+void
+slug_quantile_sketch::sorted(vector<double> &x,
+			     vector<double> &cum) const {
+  vector<pair<double, double> > items;
+  items.reserve(size);
+  double wgt = 1.0;
+  for (unsigned int h=0; h<compactors.size(); h++, wgt *= 2.0)
+    for (vector<double>::size_type i=0; i<compactors[h].size(); i++)
+      items.push_back(pair<double, double>(compactors[h][i], wgt));
+  sort(items.begin(), items.end());
+  x.resize(items.size());
+  cum.resize(items.size());
+  double tot = 0.0;
+  for (vector<double>::size_type i=0; i<items.size(); i++) {
+    tot += items[i].second;
+    x[i] = items[i].first;
+    cum[i] = tot;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Pack and unpack; the packed format is k, n, the number of
+// compactors, and then for each compactor its size followed by its
+// contents
+////////////////////////////////////////////////////////////////////////
+void
+slug_quantile_sketch::pack(vector<double> &buf) const {
+  buf.push_back(k);
+  buf.push_back(n);
+  buf.push_back(compactors.size());
+  for (unsigned int h=0; h<compactors.size(); h++) {
+    buf.push_back(compactors[h].size());
+    buf.insert(buf.end(), compactors[h].begin(), compactors[h].end());
+  }
+}
+
+void
+slug_quantile_sketch::unpack(const double *&buf) {
+  k = (unsigned int) buf[0];
+  n = (unsigned long) buf[1];
+  vector<double>::size_type nh = (vector<double>::size_type) buf[2];
+  buf += 3;
+  compactors.resize(0);
+  size = 0;
+  for (vector<double>::size_type h=0; h<nh; h++) {
+    vector<double>::size_type nc = (vector<double>::size_type) buf[0];
+    buf++;
+    compactors.push_back(vector<double>(buf, buf+nc));
+    buf += nc;
+    size += nc;
+  }
+  max_size = 0;
+  for (unsigned int h=0; h<compactors.size(); h++)
+    max_size += capacity(h);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// slug_stats constructor
+////////////////////////////////////////////////////////////////////////
+slug_stats::slug_stats(const vector<string> &names_,
+		       const vector<double>::size_type ntime_,
+		       const unsigned int k,
+		       const unsigned long long seed) :
+  names(names_), ntime(ntime_) {
+  moments m0;
+  m0.n = 0;
+  m0.mean = m0.m2 = 0.0;
+  m0.min = numeric_limits<double>::infinity();
+  m0.max = -numeric_limits<double>::infinity();
+  mom.assign(ntime*names.size(), m0);
+
+  // Give every sketch a distinct seed, built from the seed we were
+  // passed in the high bits and the sketch index in the low ones
+  sketch.reserve(ntime*names.size());
+  for (vector<double>::size_type i=0; i<ntime*names.size(); i++)
+    sketch.push_back(slug_quantile_sketch(k, (seed << 32) + i));
+}
+
+////////////////////////////////////////////////////////////////////////
+// Add the values for one trial at one output time
+////////////////////////////////////////////////////////////////////////
+void
+slug_stats::add(const vector<double>::size_type time_idx,
+		const vector<double> &vals) {
+  vector<double>::size_type off = time_idx * names.size();
+  for (vector<double>::size_type i=0; i<vals.size(); i++) {
+    if (!std::isfinite(vals[i])) continue;
+    moments &m = mom[off+i];
+    m.n++;
+    double delta = vals[i] - m.mean;
+    m.mean += delta / m.n;
+    m.m2 += delta * (vals[i] - m.mean);
+    if (vals[i] < m.min) m.min = vals[i];
+    if (vals[i] > m.max) m.max = vals[i];
+    sketch[off+i].add(vals[i]);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Combine statistics over MPI processes
+////////////////////////////////////////////////////////////////////////
+#ifdef ENABLE_MPI
+void
+slug_stats::merge(MPI_Comm comm) {
+
+  int rank, nproc;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  if (nproc == 1) return;
+
+  // Pack the local statistics
+  vector<double> buf;
+  for (vector<moments>::size_type i=0; i<mom.size(); i++) {
+    buf.push_back(mom[i].n);
+    buf.push_back(mom[i].mean);
+    buf.push_back(mom[i].m2);
+    buf.push_back(mom[i].min);
+    buf.push_back(mom[i].max);
+    sketch[i].pack(buf);
+  }
+
+  // Gather the packed statistics on the root
+  int count = buf.size();
+  vector<int> counts, displs;
+  if (rank == 0) {
+    counts.resize(nproc);
+    displs.resize(nproc);
+  }
+  MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+  vector<double> allbuf;
+  if (rank == 0) {
+    int tot = 0;
+    for (int i=0; i<nproc; i++) {
+      displs[i] = tot;
+      tot += counts[i];
+    }
+    allbuf.resize(tot);
+  }
+  MPI_Gatherv(buf.data(), count, MPI_DOUBLE, allbuf.data(),
+	      counts.data(), displs.data(), MPI_DOUBLE, 0, comm);
+  if (rank != 0) return;
+
+  // Merge the statistics from the other processes into ours; moments
+  // are combined using the pairwise formulae of Chan, Golub, &
+  // LeVeque (1979)
+  for (int p=1; p<nproc; p++) {
+    const double *ptr = allbuf.data() + displs[p];
+    for (vector<moments>::size_type i=0; i<mom.size(); i++) {
+      moments mp;
+      mp.n = (unsigned long) ptr[0];
+      mp.mean = ptr[1];
+      mp.m2 = ptr[2];
+      mp.min = ptr[3];
+      mp.max = ptr[4];
+      ptr += 5;
+      slug_quantile_sketch sp;
+      sp.unpack(ptr);
+      if (mp.n == 0) continue;
+      moments &m = mom[i];
+      double ntot = (double) m.n + (double) mp.n;
+      double delta = mp.mean - m.mean;
+      m.mean += delta * mp.n / ntot;
+      m.m2 += mp.m2 + delta * delta * ((double) m.n) * mp.n / ntot;
+      m.n += mp.n;
+      m.min = min(m.min, mp.min);
+      m.max = max(m.max, mp.max);
+      sketch[i].merge(sp);
+    }
+  }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Write statistics
+////////////////////////////////////////////////////////////////////////
+void
+slug_stats::write(ofstream &outfile, const vector<double> &quantiles,
+		  const unsigned int nbin) const {
+
+  const double nan = numeric_limits<double>::quiet_NaN();
+  vector<double>::size_type nq = names.size();
+
+  // Header for moments and quantiles
+  outfile << setw(21) << left << "Quantity"
+	  << setw(14) << left << "OutIdx"
+	  << setw(14) << left << "N"
+	  << setw(14) << left << "Mean"
+	  << setw(14) << left << "StdDev"
+	  << setw(14) << left << "Min"
+	  << setw(14) << left << "Max";
+  for (vector<double>::size_type j=0; j<quantiles.size(); j++) {
+    ostringstream ss;
+    ss << "Q" << quantiles[j];
+    outfile << setw(14) << left << ss.str();
+  }
+  outfile << endl;
+  outfile << setw(21) << left << "------------------";
+  for (vector<double>::size_type j=0; j<6+quantiles.size(); j++)
+    outfile << setw(14) << left << "-----------";
+  outfile << endl;
+
+  // Quantiles and histograms are both computed from the sorted
+  // contents of the sketches, so compute these once and save the
+  // histograms to write after the moments
+  vector<vector<unsigned long> > hist(mom.size());
+  vector<bool> hist_log(mom.size(), false);
+  outfile << setprecision(5) << scientific;
+  for (vector<double>::size_type t=0; t<ntime; t++) {
+    for (vector<double>::size_type q=0; q<nq; q++) {
+      vector<double>::size_type i = t*nq + q;
+      const moments &m = mom[i];
+      vector<double> x, cum;
+      sketch[i].sorted(x, cum);
+      double wtot = cum.size() > 0 ? cum.back() : 0.0;
+
+      // Moments
+      outfile << setw(21) << left << names[q]
+	      << setw(14) << left << t
+	      << setw(14) << left << m.n;
+      if (m.n > 0) {
+	double sd = m.n > 1 ? sqrt(m.m2 / (m.n - 1)) : 0.0;
+	outfile << setw(14) << left << m.mean
+		<< setw(14) << left << sd
+		<< setw(14) << left << m.min
+		<< setw(14) << left << m.max;
+      } else {
+	for (int j=0; j<4; j++) outfile << setw(14) << left << nan;
+      }
+
+      // Quantiles; the quantile p is the smallest value such that the
+      // fraction of the weight at or below it is >= p
+      for (vector<double>::size_type j=0; j<quantiles.size(); j++) {
+	if (m.n == 0) {
+	  outfile << setw(14) << left << nan;
+	  continue;
+	}
+	vector<double>::size_type idx =
+	  lower_bound(cum.begin(), cum.end(), quantiles[j]*wtot) -
+	  cum.begin();
+	if (idx >= x.size()) idx = x.size()-1;
+	outfile << setw(14) << left << x[idx];
+      }
+      outfile << endl;
+
+      // Histogram; bin b covers [edge_b, edge_b+1), except that the
+      // last bin also includes its upper edge. The cumulative weights
+      // are sums of powers of 2, and so are whole numbers, but we
+      // round them before differencing so that the counts are exact
+      // integers that sum to the number of values.
+      hist[i].assign(nbin, 0);
+      if (m.n == 0) continue;
+      hist_log[i] = m.min > 0.0;
+      double lo = hist_log[i] ? log(m.min) : m.min;
+      double hi = hist_log[i] ? log(m.max) : m.max;
+      unsigned long below_last = 0;
+      for (unsigned int b=1; b<=nbin; b++) {
+	unsigned long below;
+	if (b < nbin) {
+	  double edge = lo + b*(hi-lo)/nbin;
+	  if (hist_log[i]) edge = exp(edge);
+	  vector<double>::size_type idx =
+	    lower_bound(x.begin(), x.end(), edge) - x.begin();
+	  below = idx > 0 ? (unsigned long) llround(cum[idx-1]) : 0;
+	} else {
+	  below = m.n;
+	}
+	hist[i][b-1] = below - below_last;
+	below_last = below;
+      }
+    }
+  }
+
+  // Write histograms
+  outfile << endl;
+  outfile << setw(21) << left << "Quantity"
+	  << setw(14) << left << "OutIdx"
+	  << setw(14) << left << "Scale"
+	  << setw(14) << left << "Lo"
+	  << setw(14) << left << "Hi"
+	  << setw(14) << left << "Counts" << endl;
+  outfile << setw(21) << left << "------------------";
+  for (int j=0; j<5; j++)
+    outfile << setw(14) << left << "-----------";
+  outfile << endl;
+  for (vector<double>::size_type t=0; t<ntime; t++) {
+    for (vector<double>::size_type q=0; q<nq; q++) {
+      vector<double>::size_type i = t*nq + q;
+      outfile << setw(21) << left << names[q]
+	      << setw(14) << left << t
+	      << setw(14) << left << (hist_log[i] ? "log" : "lin");
+      if (mom[i].n > 0)
+	outfile << setw(14) << left << mom[i].min
+		<< setw(14) << left << mom[i].max;
+      else
+	outfile << setw(14) << left << nan
+		<< setw(14) << left << nan;
+      for (unsigned int b=0; b<nbin; b++)
+	outfile << setw(14) << left << hist[i][b];
+      outfile << endl;
+    }
+  }
+}
@@ -0,0 +1,258 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "slug_MPI.H"
+#include "slug_sim.H"
+#include "slug_sweep.H"
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+using namespace boost::algorithm;
+
+////////////////////////////////////////////////////////////////////////
+// Keywords that take lists of values, and so cannot be varied in a
+// grid, since the values would be appended to those in the base file
+// rather than replacing them
+////////////////////////////////////////////////////////////////////////
+namespace sweep {
+  static const char *list_keywords[] = {
+    "output_times", "phot_bands", "spectral_lines",
+    "stats_quantities", "stats_quantiles"
+  };
+  static const unsigned int n_list_keywords =
+    sizeof(list_keywords) / sizeof(list_keywords[0]);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Constructor
+////////////////////////////////////////////////////////////////////////
+slug_sweep::slug_sweep(const string &sweepFileName,
+		       slug_ostreams &ostreams_
+#ifdef ENABLE_MPI
+		       , MPI_Comm comm_
+#endif
+		       ) : ostreams(ostreams_)
+#ifdef ENABLE_MPI
+			 , comm(comm_)
+#endif
+{
+  // Get MPI information, and set up I/O handlers for the
+  // simulations; these do not pass through the root process, since
+  // every process runs its own simulations
+#ifdef ENABLE_MPI
+  if (comm != MPI_COMM_NULL) {
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nproc);
+  } else {
+    rank = 0;
+    nproc = 1;
+  }
+  sim_ostreams = new slug_ostreams(MPI_COMM_NULL);
+#else
+  sim_ostreams = &ostreams;
+#endif
+
+  // Read the sweep file; every process does this, so all processes
+  // agree on the list of configurations
+  readSweepFile(sweepFileName);
+
+  // Parse the parameters for the configurations this process will
+  // run; we do this for all of them before running any, so that an
+  // error in any configuration is caught before we do any work
+  for (vector<string>::size_type i=0; i<paramFiles.size(); i++) {
+#ifdef ENABLE_MPI
+    if (i % nproc != (vector<string>::size_type) rank) continue;
+#endif
+    configs.push_back(new slug_parmParser(paramFiles[i], overrides[i],
+					  suffixes[i], *sim_ostreams
+#ifdef ENABLE_MPI
+					  , MPI_COMM_NULL
+#endif
+					  ));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Destructor
+////////////////////////////////////////////////////////////////////////
+slug_sweep::~slug_sweep() {
+  for (vector<slug_parmParser *>::size_type i=0; i<configs.size(); i++)
+    delete configs[i];
+#ifdef ENABLE_MPI
+  delete sim_ostreams;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////
+// Method to read the sweep file
+////////////////////////////////////////////////////////////////////////
+void slug_sweep::readSweepFile(const string &sweepFileName) {
+
+  // Open file
+  std::ifstream sweepFile;
+  sweepFile.open(sweepFileName.c_str(), ios::in);
+  if (!sweepFile.is_open()) {
+    ostreams.slug_err_one << "unable to open sweep file "
+			  << sweepFileName << endl;
+    bailout(1);
+  }
+
+  // Read the file, storing its lines as lists of tokens
+  vector<vector<string> > lines;
+  bool grid = false;
+  string line;
+  while (getline(sweepFile, line)) {
+    trim(line);
+    if (line.length() == 0) continue;
+    if (line.compare(0, 1, "#") == 0) continue;
+    vector<string> tokens;
+    split(tokens, line, is_any_of("\t "), token_compress_on);
+    for (vector<string>::size_type i=1; i<tokens.size(); i++) {
+      if (tokens[i].compare(0, 1, "#") == 0) {
+	tokens.resize(i);
+	break;
+      }
+    }
+    if (iequals(tokens[0], "base") || iequals(tokens[0], "vary"))
+      grid = true;
+    lines.push_back(tokens);
+  }
+  sweepFile.close();
+
+  // Handle list of parameter files
+  if (!grid) {
+    for (vector<vector<string> >::size_type i=0; i<lines.size(); i++) {
+      if (lines[i].size() != 1) {
+	ostreams.slug_err_one << "sweep file " << sweepFileName
+			      << ": expected a single parameter file "
+			      << "name per line" << endl;
+	bailout(1);
+      }
+      paramFiles.push_back(lines[i][0]);
+    }
+    overrides.resize(paramFiles.size());
+    suffixes.resize(paramFiles.size());
+  }
+
+  // Handle grid
+  else {
+
+    // Get the base file and the keywords and values to vary
+    string base;
+    vector<string> keys;
+    vector<vector<string> > vals;
+    for (vector<vector<string> >::size_type i=0; i<lines.size(); i++) {
+      if (iequals(lines[i][0], "base") && lines[i].size() == 2 &&
+	  base.length() == 0) {
+	base = lines[i][1];
+      } else if (iequals(lines[i][0], "vary") && lines[i].size() > 2) {
+	string key = lines[i][1];
+	to_lower(key);
+	for (unsigned int j=0; j<sweep::n_list_keywords; j++) {
+	  if (!key.compare(sweep::list_keywords[j])) {
+	    ostreams.slug_err_one << "sweep file " << sweepFileName
+				  << ": keyword " << key
+				  << " takes a list of values, and "
+				  << "cannot be varied" << endl;
+	    bailout(1);
+	  }
+	}
+	keys.push_back(key);
+	vals.push_back(vector<string>(lines[i].begin()+2,
+				      lines[i].end()));
+      } else {
+	ostreams.slug_err_one << "sweep file " << sweepFileName
+			      << ": bad line: " << lines[i][0];
+	for (vector<string>::size_type j=1; j<lines[i].size(); j++)
+	  ostreams.slug_err_one << " " << lines[i][j];
+	ostreams.slug_err_one << endl;
+	bailout(1);
+      }
+    }
+    if (base.length() == 0) {
+      ostreams.slug_err_one << "sweep file " << sweepFileName
+			    << ": no base parameter file specified"
+			    << endl;
+      bailout(1);
+    }
+
+    // Count configurations
+    vector<string>::size_type nconfig = 1;
+    for (vector<string>::size_type i=0; i<keys.size(); i++)
+      nconfig *= vals[i].size();
+
+    // Build the configurations; for each one, decompose its index
+    // into an index for each keyword, with the last keyword varying
+    // fastest
+    for (vector<string>::size_type n=0; n<nconfig; n++) {
+      vector<string> ov(keys.size());
+      vector<string>::size_type idx = n;
+      for (vector<string>::size_type i=keys.size(); i>0; i--) {
+	ov[i-1] = keys[i-1] + " " + vals[i-1][idx % vals[i-1].size()];
+	idx /= vals[i-1].size();
+      }
+      ostringstream ss;
+      ss << "_" << setfill('0') << setw(4) << n;
+      paramFiles.push_back(base);
+      overrides.push_back(ov);
+      suffixes.push_back(ss.str());
+    }
+  }
+
+  // Make sure we got something
+  if (paramFiles.size() == 0) {
+    ostreams.slug_err_one << "sweep file " << sweepFileName
+			  << " contains no configurations" << endl;
+    bailout(1);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Method to run the sweep
+////////////////////////////////////////////////////////////////////////
+void slug_sweep::run() {
+
+  for (vector<slug_parmParser *>::size_type i=0; i<configs.size(); i++) {
+
+    // Print status
+    const slug_parmParser &pp = *(configs[i]);
+    if (pp.get_verbosity() > 0)
+      sim_ostreams->slug_out << "starting configuration "
+			     << pp.get_modelName() << endl;
+
+    // Set up the simulation, taking physics from the cache
+    slug_sim sim(pp, *sim_ostreams
+#ifdef ENABLE_MPI
+		 , MPI_COMM_NULL
+#endif
+		 , &cache);
+
+    // Write the parameter summary, then run
+    pp.writeParams();
+    if (pp.galaxy_sim())
+      sim.galaxy_sim();
+    else
+      sim.cluster_sim();
+  }
+
+#ifdef ENABLE_MPI
+  // Wait for all processes to finish
+  if (comm != MPI_COMM_NULL) MPI_Barrier(comm);
+#endif
+}
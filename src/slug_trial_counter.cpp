@@ -0,0 +1,195 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "slug_trial_counter.H"
+
+using namespace std;
+
+// Parameters controlling the size of trial leases in MPI mode: a
+// lease contains at most 1 / SLUG_LEASE_FAC of the remaining trials
+// per process, and should take no more than SLUG_LEASE_TIME seconds
+// to complete
+#define SLUG_LEASE_FAC 2
+#define SLUG_LEASE_TIME 1.0
+
+////////////////////////////////////////////////////////////////////////
+// Constructor
+////////////////////////////////////////////////////////////////////////
+slug_trial_counter::
+slug_trial_counter(const unsigned long trials_to_do_,
+		   const unsigned long trials_done_,
+		   const unsigned long checkpoint_interval_
+#ifdef ENABLE_MPI
+		   , MPI_Comm comm_
+#endif
+		   ) :
+  trials_to_do(trials_to_do_),
+  checkpoint_interval(checkpoint_interval_),
+  lease_cur(trials_done_),
+  lease_end(trials_done_),
+  trials_loc(0),
+  exhausted(false)
+#ifdef ENABLE_MPI
+  , comm(comm_)
+#endif
+{
+
+  // Serial case: this process gets all remaining trials
+#ifdef ENABLE_MPI
+  if (comm == MPI_COMM_NULL) {
+#endif
+    lease_end = trials_to_do;
+#ifdef ENABLE_MPI
+    return;
+  }
+#endif
+
+#ifdef ENABLE_MPI
+#  if (MPI_VERSION == 1 || MPI_VERSION == 2)
+
+  // MPI without RMA: divide the remaining trials into contiguous
+  // blocks, one per process, with the first few processes taking one
+  // extra trial if the division is not even
+  int rank, nproc;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  unsigned long remaining = trials_to_do > trials_done_ ?
+    trials_to_do - trials_done_ : 0;
+  unsigned long nper = remaining / nproc;
+  unsigned long nextra = remaining % nproc;
+  unsigned long r = rank;
+  lease_cur = trials_done_ + r*nper + (r < nextra ? r : nextra);
+  lease_end = lease_cur + nper + (r < nextra ? 1 : 0);
+
+#  else
+
+  // MPI with RMA: set up the window holding the global trial counter
+  // on the root process
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  trial_ctr_buf = trials_done_;
+  if (rank == 0) {
+    // Root process holds the accumulated number of trials
+    MPI_Win_create(&trial_ctr_buf, sizeof(trial_ctr_buf),
+		   sizeof(trial_ctr_buf), MPI_INFO_NULL, comm, &win);
+  } else {
+    // All other processes don't need a remote access window
+    MPI_Win_create(NULL, 0, sizeof(int), MPI_INFO_NULL, comm, &win);
+  }
+
+  // Record starting time
+  t_start = MPI_Wtime();
+
+#  endif
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Destructor
+////////////////////////////////////////////////////////////////////////
+slug_trial_counter::~slug_trial_counter() {
+#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
+  if (comm != MPI_COMM_NULL) MPI_Win_free(&win);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Method to get the next trial
+////////////////////////////////////////////////////////////////////////
+bool slug_trial_counter::next_trial(unsigned long &trial) {
+
+  // If we have already run out of trials, stop here
+  if (exhausted) return false;
+
+  // If our current lease is used up, get a new one if we can
+  if (lease_cur >= lease_end) {
+#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
+    if (comm != MPI_COMM_NULL) get_lease();
+#endif
+    if (lease_cur >= lease_end) {
+      exhausted = true;
+      return false;
+    }
+  }
+
+  // Hand out the next trial in the lease
+  lease_cur++;
+  trials_loc++;
+  trial = lease_cur;
+  return true;
+}
+
+
+#if defined(ENABLE_MPI) && !(MPI_VERSION == 1 || MPI_VERSION == 2)
+////////////////////////////////////////////////////////////////////////
+// Method to get a new lease from the global counter
+////////////////////////////////////////////////////////////////////////
+void slug_trial_counter::get_lease() {
+
+  // Guided self-scheduling: take a fraction of the remaining trials
+  // per process, using the last known value of the global counter
+  // to estimate how many remain
+  unsigned long remaining = trials_to_do > lease_end ?
+    trials_to_do - lease_end : 0;
+  unsigned long nlease = remaining / (SLUG_LEASE_FAC * nproc);
+
+  // Limit the lease so that it should complete within the target
+  // time, based on the mean time per trial so far; on the first
+  // lease we have no timing information, so just take one trial
+  if (trials_loc == 0) {
+    nlease = 1;
+  } else {
+    double t_trial = (MPI_Wtime() - t_start) / trials_loc;
+    if (t_trial > 0.0) {
+      double nlease_time = SLUG_LEASE_TIME / t_trial;
+      if (nlease_time < nlease) nlease = (unsigned long) nlease_time;
+    }
+  }
+
+  // Do not let the lease extend past the next checkpoint, so that
+  // each checkpoint file contains whole leases
+  if (checkpoint_interval > 0) {
+    unsigned long nchk = checkpoint_interval -
+      trials_loc % checkpoint_interval;
+    if (nlease > nchk) nlease = nchk;
+  }
+
+  // Always take at least one trial
+  if (nlease < 1) nlease = 1;
+
+  // Add the lease size to the global counter; Fetch_and_op returns
+  // the value of the counter before the addition, which is the last
+  // trial leased to any other process. Because Fetch_and_op is
+  // atomic, a shared lock suffices here.
+  unsigned long ctr;
+  MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+  MPI_Fetch_and_op(&nlease, &ctr, MPI_UNSIGNED_LONG, 0, 0,
+		   MPI_SUM, win);
+  MPI_Win_unlock(0, win);
+
+  // Record the new lease, truncating it at the total number of
+  // trials
+  if (ctr >= trials_to_do) {
+    lease_cur = lease_end = trials_to_do;
+  } else {
+    lease_cur = ctr;
+    lease_end = ctr + nlease < trials_to_do ? ctr + nlease : trials_to_do;
+  }
+}
+#endif
@@ -74,6 +74,71 @@ slug_specsyn::slug_specsyn(const slug_tracks *my_tracks,
 slug_specsyn::~slug_specsyn() { }
 
 
+////////////////////////////////////////////////////////////////////////
+// Routines to restrict the wavelength grid
+////////////////////////////////////////////////////////////////////////
+bool
+slug_specsyn::set_lambda_ranges(const vector<double>& lambda_min,
+				const vector<double>& lambda_max,
+				const unsigned int npad) {
+
+  // Flag the grid points that fall inside each interval, plus the
+  // padding points on either side
+  vector<bool> keep(lambda_obs.size(), false);
+  for (vector<double>::size_type i=0; i<lambda_min.size(); i++) {
+    vector<double>::size_type lo =
+      lower_bound(lambda_obs.begin(), lambda_obs.end(), lambda_min[i])
+      - lambda_obs.begin();
+    vector<double>::size_type hi =
+      upper_bound(lambda_obs.begin(), lambda_obs.end(), lambda_max[i])
+      - lambda_obs.begin();
+    lo = lo > npad ? lo - npad : 0;
+    hi = hi + npad < lambda_obs.size() ? hi + npad : lambda_obs.size();
+    for (vector<double>::size_type j=lo; j<hi; j++) keep[j] = true;
+  }
+
+  // Build the index list; if we are keeping everything, there is
+  // nothing to do
+  vector<vector<double>::size_type> idx;
+  for (vector<double>::size_type j=0; j<keep.size(); j++)
+    if (keep[j]) idx.push_back(j);
+  if (idx.size() == lambda_obs.size()) return true;
+  return select_lambda(idx);
+}
+
+bool
+slug_specsyn::select_lambda(const vector<vector<double>::size_type>
+			    &idx) {
+
+  // Check that the derived class supports restriction, so that we
+  // change nothing if it does not, then let it restrict its data
+  if (!can_restrict_lambda()) return false;
+  restrict_lambda(idx);
+
+  // Restrict the wavelength grids
+  vector<double> lambda_rest_sel(idx.size()), lambda_obs_sel(idx.size());
+  for (vector<double>::size_type i=0; i<idx.size(); i++) {
+    lambda_rest_sel[i] = lambda_rest[idx[i]];
+    lambda_obs_sel[i] = lambda_obs[idx[i]];
+  }
+  lambda_rest = lambda_rest_sel;
+  lambda_obs = lambda_obs_sel;
+
+  // Record which points of the original grid are in use
+  if (lambda_sel.size() == 0) {
+    lambda_sel = idx;
+  } else {
+    for (vector<double>::size_type i=0; i<idx.size(); i++)
+      lambda_sel[i] = lambda_sel[idx[i]];
+    lambda_sel.resize(idx.size());
+  }
+
+  // Resize the integrator
+  v_integ.set_nvec(lambda_rest.size()+1);
+  return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Trivial function to pack Lbol and spectrum together
 ////////////////////////////////////////////////////////////////////////
@@ -214,6 +214,18 @@ slug_specsyn_hillier::~slug_specsyn_hillier() {
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Function to change the IMF and SFH
+////////////////////////////////////////////////////////////////////////
+void
+slug_specsyn_hillier::set_pdfs(const slug_PDF *my_imf,
+			       const slug_PDF *my_sfh) {
+  slug_specsyn::set_pdfs(my_imf, my_sfh);
+  if (kurucz != NULL) kurucz->set_pdfs(my_imf, my_sfh);
+  if (planck != NULL) planck->set_pdfs(my_imf, my_sfh);
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Function to turn data checking on or off
 ////////////////////////////////////////////////////////////////////////
@@ -228,10 +240,39 @@ slug_specsyn_hillier::set_check_data(bool val) {
     kurucz = new slug_specsyn_kurucz(dirname.string().c_str(), 
 				     tracks, imf, sfh, ostreams,
 				     z, false);
+    if (lambda_sel.size() > 0) kurucz->select_lambda(lambda_sel);
   }
   check_data = val;
 }
 
+////////////////////////////////////////////////////////////////////////
+// Restrict the wavelength grid
+////////////////////////////////////////////////////////////////////////
+void
+slug_specsyn_hillier::
+restrict_lambda(const vector<vector<double>::size_type> &idx) {
+
+  // Copy the model fluxes at the retained wavelengths
+  array2d::extent_gen extent;
+  array2d F_lam_wn_sel(extent[F_lam_wn.shape()[0]][idx.size()]);
+  array2d F_lam_wc_sel(extent[F_lam_wc.shape()[0]][idx.size()]);
+  for (array2d::size_type i=0; i<F_lam_wn.shape()[0]; i++)
+    for (vector<double>::size_type j=0; j<idx.size(); j++)
+      F_lam_wn_sel[i][j] = F_lam_wn[i][idx[j]];
+  for (array2d::size_type i=0; i<F_lam_wc.shape()[0]; i++)
+    for (vector<double>::size_type j=0; j<idx.size(); j++)
+      F_lam_wc_sel[i][j] = F_lam_wc[i][idx[j]];
+  F_lam_wn.resize(extent[F_lam_wn.shape()[0]][idx.size()]);
+  F_lam_wc.resize(extent[F_lam_wc.shape()[0]][idx.size()]);
+  F_lam_wn = F_lam_wn_sel;
+  F_lam_wc = F_lam_wc_sel;
+
+  // Restrict the backup synthesizers
+  if (kurucz != NULL) kurucz->select_lambda(idx);
+  if (planck != NULL) planck->select_lambda(idx);
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Wrapper function to get stellar spectra that first sorts stars by
 // whether they should use the Hillier WN/WC model atmospheres, Kurucz
@@ -214,6 +214,17 @@ slug_specsyn_kurucz::~slug_specsyn_kurucz() {
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Function to change the IMF and SFH
+////////////////////////////////////////////////////////////////////////
+void
+slug_specsyn_kurucz::set_pdfs(const slug_PDF *my_imf,
+			      const slug_PDF *my_sfh) {
+  slug_specsyn::set_pdfs(my_imf, my_sfh);
+  if (planck != NULL) planck->set_pdfs(my_imf, my_sfh);
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Function to turn data checking on or off
 ////////////////////////////////////////////////////////////////////////
@@ -226,6 +237,30 @@ slug_specsyn_kurucz::set_check_data(bool val) {
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Restrict the wavelength grid
+////////////////////////////////////////////////////////////////////////
+void
+slug_specsyn_kurucz::
+restrict_lambda(const vector<vector<double>::size_type> &idx) {
+
+  // Copy the model fluxes at the retained wavelengths
+  array3d::extent_gen extent3;
+  array3d F_lambda_sel(extent3[F_lambda.shape()[0]]
+		       [F_lambda.shape()[1]][idx.size()]);
+  for (array3d::size_type i=0; i<F_lambda.shape()[0]; i++)
+    for (array3d::size_type j=0; j<F_lambda.shape()[1]; j++)
+      for (vector<double>::size_type k=0; k<idx.size(); k++)
+	F_lambda_sel[i][j][k] = F_lambda[i][j][idx[k]];
+  F_lambda.resize(extent3[F_lambda.shape()[0]]
+		  [F_lambda.shape()[1]][idx.size()]);
+  F_lambda = F_lambda_sel;
+
+  // Restrict the backup Planck synthesizer
+  if (planck != NULL) planck->select_lambda(idx);
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Wrapper function to get stellar spectra including cases where not
 // all the input Teff values are within our model grid
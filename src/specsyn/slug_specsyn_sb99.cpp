@@ -25,6 +25,39 @@ namespace std
 
 using namespace std;
 
+////////////////////////////////////////////////////////////////////////
+// Restrict the wavelength grid
+////////////////////////////////////////////////////////////////////////
+bool
+slug_specsyn_sb99::can_restrict_lambda() const {
+  return hillier.can_restrict_lambda() && kurucz.can_restrict_lambda() &&
+    pauldrach.can_restrict_lambda() && planck.can_restrict_lambda();
+}
+
+void
+slug_specsyn_sb99::
+restrict_lambda(const vector<vector<double>::size_type> &idx) {
+  hillier.select_lambda(idx);
+  kurucz.select_lambda(idx);
+  pauldrach.select_lambda(idx);
+  planck.select_lambda(idx);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Change the IMF and SFH
+////////////////////////////////////////////////////////////////////////
+void
+slug_specsyn_sb99::set_pdfs(const slug_PDF *my_imf,
+			    const slug_PDF *my_sfh) {
+  slug_specsyn::set_pdfs(my_imf, my_sfh);
+  hillier.set_pdfs(my_imf, my_sfh);
+  kurucz.set_pdfs(my_imf, my_sfh);
+  pauldrach.set_pdfs(my_imf, my_sfh);
+  planck.set_pdfs(my_imf, my_sfh);
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Wrapper function that just decides which of type of atmosphere
 // model to use for each star, calls the appropriate one for each, and
@@ -23,6 +23,7 @@ namespace std
 #endif
 #include "slug_specsyn_sb99hruv.H"
 #include "../constants.H"
+#include "../slug_MPI.H"
 #include <boost/filesystem.hpp>
 #include <cstdlib>
 #include <cmath>
@@ -98,7 +99,7 @@ slug_specsyn_sb99hruv(const char *dirname, const slug_tracks *my_tracks,
     // Couldn't open file, so bail out
     ostreams.slug_err_one << "unable to open ifa line atmosphere file " 
                           << atmos_path_l.string() << endl;
-    exit(1);
+    bailout(1);
   }
 
   // Save file name
@@ -115,7 +116,7 @@ slug_specsyn_sb99hruv(const char *dirname, const slug_tracks *my_tracks,
     // Couldn't open file, so bail out
     ostreams.slug_err_one << "unable to open ifa continuum atmosphere file " 
                           << atmos_path_c.string() << endl;
-    exit(1);
+    bailout(1);
   }
 
   // Save file name
@@ -133,7 +134,7 @@ slug_specsyn_sb99hruv(const char *dirname, const slug_tracks *my_tracks,
     // Couldn't open file, so bail out
     ostreams.slug_err_one << "unable to open ifa wavelength file " 
                           << wave_path.string() << endl;
-    exit(1);
+    bailout(1);
   }
 
   // Save file name
@@ -299,6 +300,21 @@ slug_specsyn_sb99hruv(const char *dirname, const slug_tracks *my_tracks,
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Change the IMF and SFH
+////////////////////////////////////////////////////////////////////////
+void
+slug_specsyn_sb99hruv::set_pdfs(const slug_PDF *my_imf,
+				const slug_PDF *my_sfh) {
+  slug_specsyn::set_pdfs(my_imf, my_sfh);
+  powr.set_pdfs(my_imf, my_sfh);
+  hillier.set_pdfs(my_imf, my_sfh);
+  kurucz.set_pdfs(my_imf, my_sfh);
+  pauldrach.set_pdfs(my_imf, my_sfh);
+  planck.set_pdfs(my_imf, my_sfh);
+}
+
+
 
 ////////////////////////////////////////////////////////////////////////
 // Wrapper function that just decides which of type of atmosphere
@@ -150,6 +150,94 @@ int_tabulated::integrate(const std::vector<double>& x1,
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Quadrature weights for integrate on a fixed grid. The integral is
+// a linear function of the data: the Newton-Cotes sum is linear in
+// the interpolated values, and each interpolated value on interval
+// [x_i, x_{i+1}] is
+//
+// s(x) = A f_i + B f_{i+1} + [(A^3-A) M_i + (B^3-B) M_{i+1}] h_i^2/6,
+//
+// where A = (x_{i+1}-x)/h_i, B = 1-A, h_i = x_{i+1}-x_i, and the
+// second derivatives M satisfy the natural spline system T M = R f,
+// with T symmetric and tridiagonal. The integral is therefore a.f +
+// b.M = (a + R^T T^-1 b).f, so the weights cost one pass over the
+// interpolation grid plus one tridiagonal solve.
+////////////////////////////////////////////////////////////////////////
+vector<double>
+int_tabulated::weights(const std::vector<double>& x) {
+
+  // Safety check
+  assert(x.size() > 1);
+#ifndef NDEBUG
+  for (vector<double>::size_type i = 0; i<x.size()-1; i++)
+    assert(x[i] < x[i+1]);
+#endif
+
+  // Set up the interpolation grid exactly as in integrate
+  vector<double>::size_type n = x.size();
+  unsigned long nseg = n - 1;
+  while (nseg % 4) nseg++;
+  double stepsize = (x.back() - x.front()) / nseg;
+
+  // Accumulate the coefficients a of f and b of M
+  vector<double> a(n, 0.0), b(n, 0.0);
+  vector<double>::size_type j = 0;
+  for (unsigned long k=0; k<nseg+1; k++) {
+    double xk = x.front() + k*stepsize;
+    if ((xk < x.front()) || (xk > x.back())) continue;
+    double c;
+    if ((k == 0) || (k == nseg)) c = 7.0;
+    else if (k % 4 == 0) c = 14.0;
+    else if (k % 2 == 1) c = 32.0;
+    else c = 12.0;
+    while ((j < n-2) && (xk > x[j+1])) j++;
+    double h = x[j+1] - x[j];
+    double A = (x[j+1] - xk) / h;
+    double B = 1.0 - A;
+    a[j] += c*A;
+    a[j+1] += c*B;
+    b[j] += c*(A*A*A - A)*h*h/6.0;
+    b[j+1] += c*(B*B*B - B)*h*h/6.0;
+  }
+
+  // Solve T y = b for the interior points; the natural boundary
+  // conditions give M_0 = M_{n-1} = 0, so b at the end points
+  // contributes nothing
+  vector<double> w = a;
+  if (n > 2) {
+    vector<double>::size_type m = n - 2;
+    vector<double> diag(m), rhs(m);
+    for (vector<double>::size_type i=0; i<m; i++) {
+      diag[i] = 2.0*(x[i+2] - x[i]);
+      rhs[i] = b[i+1];
+    }
+    for (vector<double>::size_type i=1; i<m; i++) {
+      double off = x[i+1] - x[i];
+      double fac = off / diag[i-1];
+      diag[i] -= fac*off;
+      rhs[i] -= fac*rhs[i-1];
+    }
+    vector<double> y(m);
+    y[m-1] = rhs[m-1] / diag[m-1];
+    for (vector<double>::size_type i=m-1; i>0; i--)
+      y[i-1] = (rhs[i-1] - (x[i+1] - x[i])*y[i]) / diag[i-1];
+
+    // Add R^T y
+    for (vector<double>::size_type i=1; i<n-1; i++) {
+      double hl = x[i] - x[i-1], hr = x[i+1] - x[i];
+      w[i-1] += 6.0*y[i-1]/hl;
+      w[i] -= 6.0*y[i-1]*(1.0/hl + 1.0/hr);
+      w[i+1] += 6.0*y[i-1]/hr;
+    }
+  }
+
+  // Apply the Newton-Cotes prefactor
+  for (vector<double>::size_type i=0; i<n; i++) w[i] *= 2.0*stepsize/45.0;
+  return w;
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Cubic spline interpolation helper routine
 ////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,98 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "slug_task_group.H"
+#include "../slug_MPI.H"
+#include <chrono>
+
+using namespace std;
+
+// Threads are allowed unless we are told otherwise
+bool slug_task_group::threads_allowed = true;
+
+////////////////////////////////////////////////////////////////////////
+// Destructor
+////////////////////////////////////////////////////////////////////////
+slug_task_group::~slug_task_group() {
+  join();
+  for (vector<task *>::size_type i=0; i<tasks.size(); i++)
+    delete tasks[i];
+}
+
+////////////////////////////////////////////////////////////////////////
+// Start a task
+////////////////////////////////////////////////////////////////////////
+void slug_task_group::run(const string &name,
+			  function<void()> func) {
+  task *t = new task;
+  t->func = func;
+  t->time = 0.0;
+  tasks.push_back(t);
+  task_names.push_back(name);
+  if (parallel)
+    threads.push_back(thread(execute, t));
+  else
+    execute(t);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Wait for all running threads to finish
+////////////////////////////////////////////////////////////////////////
+void slug_task_group::join() {
+  for (vector<thread>::size_type i=0; i<threads.size(); i++)
+    threads[i].join();
+  threads.clear();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Wait for all running tasks to finish, then rethrow the first
+// exception from the tasks started since the last wait
+////////////////////////////////////////////////////////////////////////
+void slug_task_group::wait() {
+  join();
+  vector<task *>::size_type first = nchecked;
+  nchecked = tasks.size();
+  for (vector<task *>::size_type i=first; i<tasks.size(); i++)
+    if (tasks[i]->err) rethrow_exception(tasks[i]->err);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Return the task times
+////////////////////////////////////////////////////////////////////////
+vector<double> slug_task_group::times() const {
+  vector<double> t(tasks.size());
+  for (vector<task *>::size_type i=0; i<tasks.size(); i++)
+    t[i] = tasks[i]->time;
+  return t;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Execute a task and record its time and any exception it throws;
+// bailout is made to throw for the duration, so that the task cannot
+// end the program from this thread
+////////////////////////////////////////////////////////////////////////
+void slug_task_group::execute(task *t) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  bailout_throws(true);
+  try {
+    t->func();
+  } catch (...) {
+    t->err = current_exception();
+  }
+  bailout_throws(false);
+  t->time = chrono::duration<double>
+    (chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,144 @@
+/*********************************************************************
+Copyright (C) 2014 Robert da Silva, Michele Fumagalli, Mark Krumholz
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+/*********************************************************************/
+/* Timing harness for the bayesphot KD tree neighbor searches. It     */
+/* builds a tree from uniformly distributed points in the unit cube   */
+/* and times neighbors(), neighbors_point() and, optionally,          */
+/* neighbors_all(). The sum of the squared distances returned is      */
+/* printed along with each timing, so that runs against different     */
+/* versions of kdtree.c can be checked for identical results.         */
+/*                                                                   */
+/* Usage: bench_neighbors npt ndim nneighbor nquery [all]             */
+/*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "kdtree.h"
+
+#define LEAFSIZE 16
+
+/* Simple xorshift generator, so that every build sees the same data */
+static unsigned long long rng_state = 88172645463325252ULL;
+static double urand(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (rng_state >> 11) * (1.0/9007199254740992.0);
+}
+
+static double wtime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long npt, ndim, nneighbor, nquery, i, j;
+  unsigned long *sortmap, *idx;
+  double *x, *xq, *pos, *d2, t0, t1, sum;
+  KDtree *tree;
+  int do_all;
+
+  /* Read arguments */
+  if (argc < 5) {
+    fprintf(stderr, "usage: bench_neighbors npt ndim nneighbor nquery [all]\n");
+    return 1;
+  }
+  npt = strtoul(argv[1], NULL, 10);
+  ndim = strtoul(argv[2], NULL, 10);
+  nneighbor = strtoul(argv[3], NULL, 10);
+  nquery = strtoul(argv[4], NULL, 10);
+  do_all = argc > 5 && !strcmp(argv[5], "all");
+
+  /* Generate data and query points */
+  x = (double *) malloc(npt*ndim*sizeof(double));
+  xq = (double *) malloc(nquery*ndim*sizeof(double));
+  sortmap = (unsigned long *) malloc(npt*sizeof(unsigned long));
+  pos = (double *) malloc(nneighbor*ndim*sizeof(double));
+  idx = (unsigned long *) malloc(nneighbor*sizeof(unsigned long));
+  d2 = (double *) malloc(nneighbor*sizeof(double));
+  if (!x || !xq || !sortmap || !pos || !idx || !d2) {
+    fprintf(stderr, "bench_neighbors: unable to allocate memory\n");
+    return 1;
+  }
+  for (i=0; i<npt*ndim; i++) x[i] = urand();
+  for (i=0; i<nquery*ndim; i++) xq[i] = urand();
+
+  /* Build the tree */
+  t0 = wtime();
+  tree = build_tree(x, ndim, npt, LEAFSIZE, NULL, 0, 0, sortmap);
+  t1 = wtime();
+  printf("build_tree      npt %lu ndim %lu          time %9.4f s\n",
+	 npt, ndim, t1-t0);
+
+  /* Searches around arbitrary points, then around points in the
+     tree */
+  if (nquery > 0) {
+    sum = 0.0;
+    t0 = wtime();
+    for (i=0; i<nquery; i++) {
+      neighbors(tree, xq+ndim*i, NULL, ndim, nneighbor, NULL, pos,
+		NULL, d2);
+      for (j=0; j<nneighbor; j++) sum += d2[j];
+    }
+    t1 = wtime();
+    printf("neighbors       npt %lu ndim %lu k %3lu    time %9.4f s"
+	   "  sum %.15e\n", npt, ndim, nneighbor, t1-t0, sum);
+
+    sum = 0.0;
+    t0 = wtime();
+    for (i=0; i<nquery; i++) {
+      neighbors_point(tree, (unsigned long) (urand()*npt), nneighbor,
+		      NULL, idx, d2);
+      for (j=0; j<nneighbor; j++) sum += d2[j];
+    }
+    t1 = wtime();
+    printf("neighbors_point npt %lu ndim %lu k %3lu    time %9.4f s"
+	   "  sum %.15e\n", npt, ndim, nneighbor, t1-t0, sum);
+  }
+
+  /* Searches around every point in the tree */
+  if (do_all) {
+    free(idx);
+    free(d2);
+    idx = (unsigned long *) malloc(npt*nneighbor*sizeof(unsigned long));
+    d2 = (double *) malloc(npt*nneighbor*sizeof(double));
+    if (!idx || !d2) {
+      fprintf(stderr, "bench_neighbors: unable to allocate memory\n");
+      return 1;
+    }
+    t0 = wtime();
+    neighbors_all(tree, nneighbor, NULL, idx, d2);
+    t1 = wtime();
+    sum = 0.0;
+    for (i=0; i<npt*nneighbor; i++) sum += d2[i];
+    printf("neighbors_all   npt %lu ndim %lu k %3lu    time %9.4f s"
+	   "  sum %.15e\n", npt, ndim, nneighbor, t1-t0, sum);
+  }
+
+  /* Clean up */
+  free_tree(tree);
+  free(x);
+  free(xq);
+  free(sortmap);
+  free(pos);
+  free(idx);
+  free(d2);
+  return 0;
+}
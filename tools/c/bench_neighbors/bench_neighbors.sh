@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# Times the bayesphot KD tree neighbor searches for the kdtree.c in
+# the working tree and, optionally, for the one at a given git
+# revision, and prints the ratio of the two timings.
+#
+# Usage: bench_neighbors.sh [revision]
+#
+# The environment variables NPT, NQUERY, NDIMS, KS and ALL_NPT set the
+# number of points in the tree (default 1e6), the number of query
+# points (default 2e4), the dimensions and neighbor counts to run
+# (default 5-8 and 1, 10, 100), and the number of points for the
+# neighbors_all() runs (default 1e5; set to 0 to skip them). CC,
+# CFLAGS and LIBS set the compiler, its flags, and the libraries
+# needed by geometry.c.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+TOP=$(cd "$HERE/../../.." && pwd)
+SRC=slugpy/bayesphot/bayesphot_c
+REV=$1
+
+NPT=${NPT:-1000000}
+NQUERY=${NQUERY:-20000}
+NDIMS=${NDIMS:-"5 6 7 8"}
+KS=${KS:-"1 10 100"}
+ALL_NPT=${ALL_NPT:-100000}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-O3 -std=c99 -DNDEBUG -DHAVE_INLINE"}
+LIBS=${LIBS:-"-lgsl -lgslcblas -lm"}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Build the harness against a copy of the library sources
+build() {
+    $CC $CFLAGS -D_POSIX_C_SOURCE=199309L -I"$2" -o "$1" \
+	"$HERE/bench_neighbors.c" "$2/kdtree.c" "$2/geometry.c" $LIBS
+}
+mkdir -p "$WORK/new"
+cp "$TOP/$SRC"/*.c "$TOP/$SRC"/*.h "$WORK/new"
+build "$WORK/bench_new" "$WORK/new"
+if [ -n "$REV" ]; then
+    mkdir -p "$WORK/old"
+    (cd "$TOP" && git archive "$REV" "$SRC") | tar -x -C "$WORK/old"
+    build "$WORK/bench_old" "$WORK/old/$SRC"
+fi
+
+# Print the timing in one run's output for the named routine
+timing() {
+    awk -v r="$1" '$1 == r { for (i=1; i<NF; i++) if ($i == "time") print $(i+1) }'
+}
+
+# Run one case; the first argument lists the routines to compare
+run() {
+    routines=$1
+    shift
+    echo "== $*"
+    "$WORK/bench_new" "$@" > "$WORK/new.out"
+    sed 's/^/new  /' "$WORK/new.out"
+    if [ -n "$REV" ]; then
+	"$WORK/bench_old" "$@" > "$WORK/old.out"
+	sed 's/^/old  /' "$WORK/old.out"
+	for r in $routines; do
+	    tn=$(timing $r < "$WORK/new.out")
+	    to=$(timing $r < "$WORK/old.out")
+	    awk -v r=$r -v a="$to" -v b="$tn" \
+		'BEGIN { printf "     %-15s speedup x%.2f\n", r, a/b }'
+	done
+    fi
+}
+
+for ndim in $NDIMS; do
+    for k in $KS; do
+	run "neighbors neighbors_point" $NPT $ndim $k $NQUERY
+	if [ "$ALL_NPT" -gt 0 ]; then
+	    run neighbors_all $ALL_NPT $ndim $k 0 all
+	fi
+    done
+done